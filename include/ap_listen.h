@@ -78,6 +78,14 @@ struct ap_listen_rec {
  */
 AP_DECLARE_DATA extern ap_listen_rec *ap_listeners;
 
+/**
+ * Whether ap_setup_listeners() sets SO_REUSEPORT on the sockets it opens.
+ * MPMs which want to use ap_duplicate_listeners() set this after
+ * ap_listen_pre_config() has reset it, and before ap_setup_listeners().
+ * It is cleared again if the option cannot be set.
+ */
+AP_DECLARE_DATA extern int ap_listen_reuseport;
+
 /**
  * Setup all of the defaults for the listener list
  */
@@ -91,6 +99,28 @@ AP_DECLARE(void) ap_listen_pre_config(void);
  */
 AP_DECLARE(int) ap_setup_listeners(server_rec *s);
 
+/**
+ * Open num_buckets - 1 more sets of listening sockets, bound to the same
+ * addresses as ap_listeners with SO_REUSEPORT (SO_REUSEPORT_LB on FreeBSD),
+ * so that the kernel spreads new connections over all sets.  MPMs use this
+ * to let several threads or processes accept without contending on the
+ * same sockets.  Like ap_listeners, the sockets are kept open across
+ * restarts and reused by the next call, the ones no longer needed are
+ * closed.  Only Linux and FreeBSD balance the connections, elsewhere
+ * APR_ENOTIMPL is returned.
+ * @param p The pool for the returned array
+ * @param s The global server_rec
+ * @param buckets Set to an array of num_buckets listener lists, the first
+ *        of which is ap_listeners
+ * @param num_buckets The number of listener lists wanted
+ * @return APR_SUCCESS, APR_ENOTIMPL if SO_REUSEPORT is not available or
+ *         ap_listen_reuseport was not set, or the error from opening a
+ *         socket
+ */
+AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
+                                                ap_listen_rec ***buckets,
+                                                int num_buckets);
+
 /**
  * Loop through the global ap_listen_rec list and close each of the sockets.
  */
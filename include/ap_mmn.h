@@ -395,6 +395,29 @@
  * 20120211.0 (2.5.0-dev)  Change re_nsub in ap_regex_t from apr_size_t to int.
  * 20120211.1 (2.5.0-dev)  Add ap_palloc_debug, ap_pcalloc_debug
  * 20120211.2 (2.5.0-dev)  Add ap_runtime_dir_relative
+ * 20120211.3 (2.5.0-dev)  Add ap_listen_reuseport, ap_duplicate_listeners()
+ * 20120211.4 (2.5.0-dev)  Add CONN_STATE_READ_REQUEST_BODY,
+ *                         AP_MPMQ_CAN_WAIT_FOR_BODY
+ * 20120211.5 (2.5.0-dev)  Add CONN_STATE_READ_REQUEST_HEAD,
+ *                         AP_MPMQ_CAN_WAIT_FOR_HEAD
+ * 20120211.6 (2.5.0-dev)  Add ap_scan_http_line(), ap_http_headers_end(),
+ *                         ap_parse_http_headers()
+ * 20120211.7 (2.5.0-dev)  Add ap_header_id_e, ap_header_id(), ap_header_name(),
+ *                         ap_get_header_in(), headers_in_index to
+ *                         core_request_config
+ * 20120211.8 (2.5.0-dev)  Add flush_min_threshold, flush_max_threshold,
+ *                         flush_max_pipelined to core_server_config
+ * 20120211.9 (2.5.0-dev)  Add write_count, write_iovecs, write_bytes to
+ *                         worker_score, ap_increment_write_counts()
+ * 20120211.10 (2.5.0-dev) Add ap_acquire_brigade(), ap_release_brigade(),
+ *                         filter_conn_ctx to conn_rec
+ * 20120211.11 (2.5.0-dev) Add ap_filter_chain_t, ap_filter_chain_make(),
+ *                         ap_add_filter_chain(), output_filter_chain and
+ *                         input_filter_chain to core_dir_config
+ * 20120211.12 (2.5.0-dev) Add log_levels to server_rec, buffered_error_logs
+ *                         to core_server_config
+ * 20120211.13 (2.5.0-dev) Add ap_read_request_timed_out()
+ * 20120211.14 (2.5.0-dev) Add ap_read_request_from()
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -402,7 +425,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20120211
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 2                   /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 14                  /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
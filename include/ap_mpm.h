@@ -145,6 +145,8 @@ AP_DECLARE(apr_status_t) ap_os_create_privileged_process(
 #define AP_MPMQ_IS_ASYNC             14  /* MPM can process async connections  */
 #define AP_MPMQ_GENERATION           15  /* MPM generation */
 #define AP_MPMQ_HAS_SERF             16  /* MPM can drive serf internally  */
+#define AP_MPMQ_CAN_WAIT_FOR_BODY    17  /* MPM supports CONN_STATE_READ_REQUEST_BODY */
+#define AP_MPMQ_CAN_WAIT_FOR_HEAD    18  /* MPM supports CONN_STATE_READ_REQUEST_HEAD */
 
 /**
  * Query a property of the current MPM.
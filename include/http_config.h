@@ -579,17 +579,22 @@ AP_DECLARE(void) ap_set_module_loglevel(apr_pool_t *p, struct ap_logconf *l,
      (l)->level :                                                         \
      (l)->module_levels[i])
 
+/* The log config of a server takes a single lookup once resolved */
+#define ap_get_logconf_module_loglevel(l,s,i)                   \
+    (((l) == &(s)->log && (s)->log_levels) ? (s)->log_levels[i] : \
+     ap_get_module_loglevel(l,i))
+
 #define ap_get_server_module_loglevel(s,i)  \
-    (ap_get_module_loglevel(&(s)->log,i))
+    (ap_get_logconf_module_loglevel(&(s)->log,s,i))
 
 #define ap_get_conn_module_loglevel(c,i)  \
-    (ap_get_module_loglevel(ap_get_conn_logconf(c),i))
+    (ap_get_logconf_module_loglevel(ap_get_conn_logconf(c),(c)->base_server,i))
 
 #define ap_get_conn_server_module_loglevel(c,s,i)  \
-    (ap_get_module_loglevel(ap_get_conn_server_logconf(c,s),i))
+    (ap_get_logconf_module_loglevel(ap_get_conn_server_logconf(c,s),s,i))
 
 #define ap_get_request_module_loglevel(r,i)  \
-    (ap_get_module_loglevel(ap_get_request_logconf(r),i))
+    (ap_get_logconf_module_loglevel(ap_get_request_logconf(r),(r)->server,i))
 
 #endif /* AP_DEBUG */
 
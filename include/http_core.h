@@ -407,6 +407,11 @@ typedef struct {
     /** Should addition of charset= be suppressed for this request?
      */
     int suppress_charset;
+
+    /** Where the well known fields are in r->headers_in, built by
+     *  ap_get_header_in() on first use
+     */
+    struct ap_header_index *headers_in_index;
 } core_request_config;
 
 /* Standard entries that are guaranteed to be accessible via
@@ -617,6 +622,10 @@ typedef struct {
     /** Max number of Range reversals (eg: 200-300, 100-125) allowed **/
     int max_reversals;
 
+    /** output_filters and input_filters, looked up */
+    ap_filter_chain_t *output_filter_chain;
+    ap_filter_chain_t *input_filter_chain;
+
 } core_dir_config;
 
 /* macro to implement off by default behaviour */
@@ -664,6 +673,14 @@ typedef struct {
 #define AP_TRACE_EXTENDED  2
     int trace_enable;
 
+    /* Bounds of the core output filter's buffering, 0 if unset */
+    apr_size_t flush_min_threshold;
+    apr_size_t flush_max_threshold;
+    int flush_max_pipelined;
+
+    /* BufferedErrorLogs, main server only */
+    int buffered_error_logs;
+
 } core_server_config;
 
 /* for AddOutputFiltersByType in core.c */
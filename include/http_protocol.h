@@ -60,6 +60,30 @@ AP_DECLARE_DATA extern ap_filter_rec_t *ap_old_write_func;
  */
 request_rec *ap_read_request(conn_rec *c);
 
+/**
+ * Read a request as ap_read_request() does, parsing the request line and
+ * the header fields from what the caller has already peeked at of the
+ * input (AP_MODE_SPECULATIVE), and consuming them, instead of peeking or
+ * reading them line by line again.  If the head is not all there, it is
+ * read from the input as usual.
+ * @param c The current connection
+ * @param head What was peeked at, or NULL
+ * @param len Its length
+ * @return The new request_rec
+ */
+AP_DECLARE(request_rec *) ap_read_request_from(conn_rec *c, const char *head,
+                                               apr_size_t len);
+
+/**
+ * Answer a request whose head did not arrive in time with 408 Request
+ * Time-out, and log it, as ap_read_request() would have.  For the protocol
+ * modules which let an async MPM wait for the head instead of reading it
+ * blocking.
+ * @param c The current connection
+ * @return The new request_rec, with status HTTP_REQUEST_TIME_OUT
+ */
+AP_DECLARE(request_rec *) ap_read_request_timed_out(conn_rec *c);
+
 /**
  * Read the mime-encoded headers.
  * @param r The current request
@@ -75,6 +99,102 @@ AP_DECLARE(void) ap_get_mime_headers(request_rec *r);
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r,
                                           apr_bucket_brigade *bb);
 
+/**
+ * Find the first LF, NUL or @a c in a buffer.  This is the scanner used by
+ * ap_parse_http_headers(), it looks at 16 bytes at a time where SSE2 is
+ * available.
+ * @param s The start of the buffer
+ * @param end The end of the buffer
+ * @param c Another character to stop at
+ * @return The position found, or @a end
+ */
+AP_DECLARE(const char *) ap_scan_http_line(const char *s, const char *end,
+                                           int c);
+
+/**
+ * Find the end of a block of header fields, i.e. the empty line.
+ * @param buf The header fields as received, starting with a line
+ * @param len The length of @a buf
+ * @return The length of the block including the empty line, or 0 if
+ *         it is not complete
+ */
+AP_DECLARE(apr_size_t) ap_http_headers_end(const char *buf, apr_size_t len);
+
+/**
+ * Split a complete block of header fields, as received, into a table.
+ * The field names and values are NUL terminated in place, not copied:
+ * @a buf must live as long as @a headers.
+ * @param buf The block, as measured by ap_http_headers_end()
+ * @param len The length of @a buf
+ * @param headers The table to add the fields to
+ * @param limit_fieldsize The maximum length of a field, folded or not
+ * @param limit_fields The maximum number of fields, or 0 for no limit
+ * @return APR_SUCCESS, APR_ENOSPC if a limit was exceeded, APR_EINVAL if
+ *         the block is malformed.  On error some fields may have been
+ *         added to @a headers already.
+ * @note Unlike ap_get_mime_headers_core(), nothing is logged and fields
+ *       with the same name are not merged.
+ */
+AP_DECLARE(apr_status_t) ap_parse_http_headers(char *buf, apr_size_t len,
+                                               apr_table_t *headers,
+                                               apr_size_t limit_fieldsize,
+                                               int limit_fields);
+
+/**
+ * Well known request header fields, which ap_get_header_in() can look up
+ * without comparing field names.
+ */
+typedef enum {
+    AP_HEADER_ACCEPT,
+    AP_HEADER_ACCEPT_ENCODING,
+    AP_HEADER_ACCEPT_LANGUAGE,
+    AP_HEADER_AUTHORIZATION,
+    AP_HEADER_CACHE_CONTROL,
+    AP_HEADER_CONNECTION,
+    AP_HEADER_CONTENT_LENGTH,
+    AP_HEADER_CONTENT_TYPE,
+    AP_HEADER_COOKIE,
+    AP_HEADER_EXPECT,
+    AP_HEADER_HOST,
+    AP_HEADER_IF_MATCH,
+    AP_HEADER_IF_MODIFIED_SINCE,
+    AP_HEADER_IF_NONE_MATCH,
+    AP_HEADER_IF_RANGE,
+    AP_HEADER_IF_UNMODIFIED_SINCE,
+    AP_HEADER_PRAGMA,
+    AP_HEADER_RANGE,
+    AP_HEADER_REFERER,
+    AP_HEADER_TRANSFER_ENCODING,
+    AP_HEADER_USER_AGENT,
+    AP_HEADER_KNOWN     /**< the number of well known fields */
+} ap_header_id_e;
+
+/**
+ * Get the ID of a well known header field.
+ * @param name The field name, case does not matter
+ * @param len The length of @a name
+ * @return The ID, or -1 if the field is not well known
+ */
+AP_DECLARE(int) ap_header_id(const char *name, apr_size_t len);
+
+/**
+ * Get the name of a well known header field.
+ * @param id The ID of the field
+ * @return The name, as in "Content-Length"
+ */
+AP_DECLARE(const char *) ap_header_name(ap_header_id_e id);
+
+/**
+ * Look up a well known field in r->headers_in, by ID.  This is the same
+ * as apr_table_get(r->headers_in, ap_header_name(id)), but after the first
+ * lookup in a request it does not search the table again as long as
+ * r->headers_in is not modified.
+ * @param r The current request
+ * @param id The ID of the field
+ * @return The first value of the field, or NULL
+ */
+AP_DECLARE(const char *) ap_get_header_in(request_rec *r, ap_header_id_e id);
+
 /* Finish up stuff after a request */
 
 /**
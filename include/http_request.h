@@ -328,6 +328,23 @@ AP_DECLARE(void) ap_process_request_after_handler(request_rec *r);
  */
 void ap_process_async_request(request_rec *r);
 
+/**
+ * The first part of ap_process_async_request(): the quick handler, the
+ * walks and the access checks.  The MPM may wait for the request body
+ * between this and ap_process_async_request_handler().
+ * @param r The current request
+ * @return OK if ap_process_async_request_handler() is to be called next,
+ *         DONE if the request has been answered already
+ */
+int ap_process_async_request_access(request_rec *r);
+
+/**
+ * The second part of ap_process_async_request(): run the handler and
+ * finish the request.
+ * @param r The current request
+ */
+void ap_process_async_request_handler(request_rec *r);
+
 /**
  * Kill the current request
  * @param type Why the request is dieing
@@ -1143,6 +1143,9 @@ struct conn_rec {
 #if APR_HAS_THREADS
     apr_thread_t *current_thread;
 #endif
+
+    /** Brigades kept for reuse, see ap_acquire_brigade() */
+    struct ap_filter_conn_ctx *filter_conn_ctx;
 };
 
 /**
@@ -1158,7 +1161,11 @@ typedef enum  {
     CONN_STATE_SUSPENDED,
     CONN_STATE_LINGER,          /* connection may be closed with lingering */
     CONN_STATE_LINGER_NORMAL,   /* MPM has started lingering close with normal timeout */
-    CONN_STATE_LINGER_SHORT     /* MPM has started lingering close with short timeout */
+    CONN_STATE_LINGER_SHORT,    /* MPM has started lingering close with short timeout */
+    CONN_STATE_READ_REQUEST_BODY, /* waiting for the request body, see
+                                   * AP_MPMQ_CAN_WAIT_FOR_BODY */
+    CONN_STATE_READ_REQUEST_HEAD  /* waiting for the rest of the request
+                                   * head, see AP_MPMQ_CAN_WAIT_FOR_HEAD */
 } conn_state_e;
 
 /**
@@ -1282,6 +1289,11 @@ struct server_rec {
 
     /** Opaque storage location */
     void *context;
+
+    /** The log level of each module in log, indexed by module_index from
+     *  APLOG_NO_MODULE (the level of log) on, filled in once the
+     *  configuration is merged, or NULL before */
+    signed char *log_levels;
 };
 
 /**
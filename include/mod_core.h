@@ -44,6 +44,7 @@ extern AP_DECLARE_DATA ap_filter_rec_t *ap_http_header_filter_handle;
 extern AP_DECLARE_DATA ap_filter_rec_t *ap_chunk_filter_handle;
 extern AP_DECLARE_DATA ap_filter_rec_t *ap_http_outerror_filter_handle;
 extern AP_DECLARE_DATA ap_filter_rec_t *ap_byterange_filter_handle;
+extern AP_DECLARE_DATA ap_filter_rec_t *ap_body_prefetch_filter_handle;
 
 /*
  * These (input) filters are internal to the mod_core operation.
@@ -52,6 +53,23 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
                             ap_input_mode_t mode, apr_read_type_e block,
                             apr_off_t readbytes);
 
+/* Hands the request body read by ap_http_prefetch_body() to the handler */
+apr_status_t ap_body_prefetch_filter(ap_filter_t *f, apr_bucket_brigade *b,
+                                     ap_input_mode_t mode,
+                                     apr_read_type_e block,
+                                     apr_off_t readbytes);
+
+/**
+ * Read the request body ahead without blocking, up to limit bytes.
+ * @param r The current request
+ * @param limit How much of the body to buffer at most
+ * @return APR_EAGAIN if more of the body is to be waited for, otherwise
+ *         APR_SUCCESS: the body, the first limit bytes of it, or the
+ *         error reading it will be passed to the handler.
+ * @note Nothing is read for requests expecting a 100-continue.
+ */
+apr_status_t ap_http_prefetch_body(request_rec *r, apr_off_t limit);
+
 /* HTTP/1.1 chunked transfer encoding filter. */
 apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b);
 
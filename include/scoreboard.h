@@ -115,6 +115,10 @@ struct worker_score {
     char client[32];            /* Keep 'em small... */
     char request[64];           /* We just want an idea... */
     char vhost[32];             /* What virtual host is being accessed? */
+    /* the core output filter's syscalls, see ap_increment_write_counts() */
+    unsigned long write_count;
+    unsigned long write_iovecs;
+    apr_off_t     write_bytes;
 };
 
 typedef struct {
@@ -167,6 +171,16 @@ apr_status_t ap_cleanup_scoreboard(void *d);
  */
 AP_DECLARE(int) ap_exists_scoreboard_image(void);
 AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sbh, request_rec *r);
+/**
+ * Count a writev() or sendfile() of the core output filter which wrote
+ * some bytes, if ExtendedStatus is on
+ * @param sbh The scoreboard handle of the connection
+ * @param iovecs The number of iovecs written, 1 for sendfile()
+ * @param bytes The number of bytes written
+ */
+AP_DECLARE(void) ap_increment_write_counts(ap_sb_handle_t *sbh,
+                                           apr_size_t iovecs,
+                                           apr_size_t bytes);
 
 AP_DECLARE(apr_status_t) ap_reopen_scoreboard(apr_pool_t *p, apr_shm_t **shm, int detached);
 AP_DECLARE(void) ap_init_scoreboard(void *shared_score);
@@ -470,6 +470,34 @@ AP_DECLARE(ap_filter_t *) ap_add_output_filter_handle(ap_filter_rec_t *f,
  */
 AP_DECLARE(ap_filter_rec_t *) ap_get_output_filter_handle(const char *name);
 
+/**
+ * A list of filters looked up once, to be added to many requests with
+ * ap_add_filter_chain().
+ */
+typedef struct ap_filter_chain_t ap_filter_chain_t;
+
+/**
+ * Look up a ; delimited list of filters, as given to SetOutputFilter.
+ * Filters not registered yet are looked up again by ap_add_filter_chain().
+ * @param p The pool to allocate the chain from, e.g. the configuration pool
+ * @param names The filter names
+ * @param input Nonzero for input filters, zero for output filters
+ * @return The filter chain
+ */
+AP_DECLARE(ap_filter_chain_t *) ap_filter_chain_make(apr_pool_t *p,
+                                                     const char *names,
+                                                     int input);
+
+/**
+ * Add the filters of a chain to a request, in order, as if each one was
+ * added with ap_add_input_filter() or ap_add_output_filter() with a NULL
+ * context, but without looking up their names or allocating them one by one.
+ * @param chain The chain from ap_filter_chain_make()
+ * @param r The request to add the filters for
+ */
+AP_DECLARE(void) ap_add_filter_chain(const ap_filter_chain_t *chain,
+                                     request_rec *r);
+
 /**
  * Remove an input filter from either the request or connection stack
  * it is associated with.
@@ -499,6 +527,27 @@ AP_DECLARE(void) ap_remove_output_filter(ap_filter_t *f);
  * it will append the current brigade onto the one that you are retrieving.
  */
 
+/**
+ * Get an empty brigade for the connection, reusing one given back with
+ * ap_release_brigade() if possible.  Unlike apr_brigade_create(r->pool, ...)
+ * for each request, this doesn't grow any pool once the connection has
+ * as many brigades as it uses at a time.
+ * @param c The connection
+ * @return An empty brigade, allocated from c->pool
+ * @remark The brigade must be given back with ap_release_brigade(), not
+ *         destroyed, and must not be used after that.  Buckets still in it
+ *         must not outlive what they refer to, e.g. the request pool.
+ */
+AP_DECLARE(apr_bucket_brigade *) ap_acquire_brigade(conn_rec *c);
+
+/**
+ * Give back a brigade from ap_acquire_brigade(), for reuse on the same
+ * connection.  The brigade is emptied first.
+ * @param c The connection
+ * @param bb The brigade
+ */
+AP_DECLARE(void) ap_release_brigade(conn_rec *c, apr_bucket_brigade *bb);
+
 /**
  * prepare a bucket brigade to be setaside.  If a different brigade was
  * set-aside earlier, then the two brigades are concatenated together.
@@ -603,6 +603,10 @@ SOURCE=.\server\util_script.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\server\util_scan.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\include\util_script.h
 # End Source File
 # Begin Source File
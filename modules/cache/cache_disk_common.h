@@ -27,7 +27,9 @@
 #define CACHE_DIST_COMMON_H
 
 #define VARY_FORMAT_VERSION 5
-#define DISK_FORMAT_VERSION 6
+#define DISK_FORMAT_VERSION 7
+/* The previous format, with the body in a separate .data file */
+#define DISK_FORMAT_VERSION_6 6
 
 #define CACHE_HEADER_SUFFIX ".header"
 #define CACHE_DATA_SUFFIX   ".data"
@@ -64,5 +66,65 @@ typedef struct {
     cache_control_t control;
 } disk_cache_info_t;
 
+/*
+ * In DISK_FORMAT_VERSION, a header file holds the whole entity:
+ *   disk_cache_info_t
+ *   disk_cache_index_t
+ *   entity name [length is in disk_cache_info_t->name_len]
+ *   header block [length is in disk_cache_index_t->hdrs_len]
+ *   padding up to disk_cache_index_t->body_offset
+ *   body [length is in disk_cache_index_t->body_len]
+ *
+ * The header block holds the nhdrs_out response headers, then the nhdrs_in
+ * request headers, each as its name and its value, NUL terminated, so that
+ * it can be turned into tables where it is loaded, or mapped.  The body
+ * starts on a CACHE_DISK_BODY_ALIGN boundary, so that it can be mapped as
+ * well as sent with sendfile; the device and inode fields of
+ * disk_cache_info_t are not used.
+ *
+ * With CACHE_DISK_BODY_IN_DATA, the header file ends with the header block
+ * and the body is at body_offset in the .data file instead, whose device
+ * and inode are in disk_cache_info_t as in DISK_FORMAT_VERSION_6.  This is
+ * how an entity is revalidated without copying its body: the .data file is
+ * the file which held the body before, a hard link to the previous header
+ * file if need be.
+ */
+#define CACHE_DISK_BODY_ALIGN 4096
+
+#define CACHE_DISK_BODY_IN_DATA 1
+
+typedef struct {
+    /* The size of the header block which follows the entity name. */
+    apr_size_t hdrs_len;
+    /* The number of response and request headers in the header block. */
+    apr_uint32_t nhdrs_out;
+    apr_uint32_t nhdrs_in;
+    /* CACHE_DISK_BODY_IN_DATA */
+    apr_uint32_t flags;
+    /* The offset of the body from the start of the file, and its size. */
+    apr_off_t body_offset;
+    apr_off_t body_len;
+} disk_cache_index_t;
+
+/*
+ * The journal of the changes made to a cache root, appended to by
+ * mod_cache_disk (CacheJournal) and read by htcacheclean (-J), so that
+ * the size of the cache is known without walking it.  Each record gives
+ * the sizes of the files written, and of the files replaced or removed,
+ * -1 for none.
+ */
+#define CACHE_JOURNAL_VERSION 1
+#define CACHE_JOURNAL_STORE   1
+#define CACHE_JOURNAL_REMOVE  2
+#define CACHE_JOURNAL_FILES   3
+
+typedef struct {
+    apr_uint32_t format;
+    apr_uint32_t type;
+    apr_time_t time;
+    apr_off_t added[CACHE_JOURNAL_FILES];
+    apr_off_t removed[CACHE_JOURNAL_FILES];
+} disk_cache_journal_t;
+
 #endif /* CACHE_DIST_COMMON_H */
 /** @} */
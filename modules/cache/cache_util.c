@@ -435,8 +435,8 @@ CACHE_DECLARE(int) ap_cache_check_allowed(cache_request_rec *cache, request_rec
      */
 
     /* This value comes from the client's initial request. */
-    cc_req = apr_table_get(r->headers_in, "Cache-Control");
-    pragma = apr_table_get(r->headers_in, "Pragma");
+    cc_req = ap_get_header_in(r, AP_HEADER_CACHE_CONTROL);
+    pragma = ap_get_header_in(r, AP_HEADER_PRAGMA);
 
     ap_cache_control(r, &cache->control_in, cc_req, pragma, r->headers_in);
 
@@ -522,8 +522,8 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
      */
 
     /* This value comes from the client's initial request. */
-    cc_req = apr_table_get(r->headers_in, "Cache-Control");
-    pragma = apr_table_get(r->headers_in, "Pragma");
+    cc_req = ap_get_header_in(r, AP_HEADER_CACHE_CONTROL);
+    pragma = ap_get_header_in(r, AP_HEADER_PRAGMA);
 
     ap_cache_control(r, &cache->control_in, cc_req, pragma, r->headers_in);
 
@@ -103,7 +103,7 @@ static int cache_quick_handler(request_rec *r, int lookup)
      */
 
     /* find certain cache controlling headers */
-    auth = apr_table_get(r->headers_in, "Authorization");
+    auth = ap_get_header_in(r, AP_HEADER_AUTHORIZATION);
 
     /* First things first - does the request allow us to return
      * cached information at all? If not, just decline the request.
@@ -1002,7 +1002,7 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
          */
         reason = "Cache-Control: private present";
     }
-    else if (apr_table_get(r->headers_in, "Authorization")
+    else if (ap_get_header_in(r, AP_HEADER_AUTHORIZATION)
             && !(control.s_maxage || control.must_revalidate
                     || control.proxy_revalidate || control.public)) {
         /* RFC2616 14.8 Authorisation:
@@ -15,7 +15,10 @@
  */
 
 #include "apr_lib.h"
+#include "apr_atomic.h"
 #include "apr_file_io.h"
+#include "apr_hash.h"
+#include "apr_shm.h"
 #include "apr_strings.h"
 #include "mod_cache.h"
 #include "mod_cache_disk.h"
@@ -27,32 +30,62 @@
 #include "util_script.h"
 #include "util_charset.h"
 
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if AP_NEED_SET_MUTEX_PERMS
+#include "unixd.h"
+#endif
+
 /*
  * mod_cache_disk: Disk Based HTTP 1.1 Cache.
  *
- * Flow to Find the .data file:
+ * Flow to Find the entity:
  *   Incoming client requests URI /foo/bar/baz
  *   Generate <hash> off of /foo/bar/baz
  *   Open <hash>.header
- *   Read in <hash>.header file (may contain Format #1 or Format #2)
+ *   Read in <hash>.header file (may contain Format #1, #2 or #3)
  *   If format #1 (Contains a list of Vary Headers):
  *      Use each header name (from .header) with our request values (headers_in) to
  *      regenerate <hash> using HeaderName+HeaderValue+.../foo/bar/baz
- *      re-read in <hash>.header (must be format #2)
- *   read in <hash>.data
+ *      re-read in <hash>.header (must be format #2 or #3)
+ *   If format #3, the body follows in the same file
+ *   If format #2, read in <hash>.data
  *
  * Format #1:
  *   apr_uint32_t format;
  *   apr_time_t expire;
  *   apr_array_t vary_headers (delimited by CRLF)
  *
- * Format #2:
+ * Format #2 (DISK_FORMAT_VERSION_6, read only):
  *   disk_cache_info_t (first sizeof(apr_uint32_t) bytes is the format)
  *   entity name (dobj->name) [length is in disk_cache_info_t->name_len]
  *   r->headers_out (delimited by CRLF)
  *   CRLF
  *   r->headers_in (delimited by CRLF)
  *   CRLF
+ *
+ * Format #3 (DISK_FORMAT_VERSION):
+ *   disk_cache_info_t
+ *   disk_cache_index_t
+ *   entity name, header block, body, see cache_disk_common.h
+ *
+ * Entries in format #2 are served until they are replaced, in format #3,
+ * when they are stored again or revalidated.  Their .data file is removed
+ * when they are stored again; a revalidated entity keeps its body where it
+ * is, in the .data file (CACHE_DISK_BODY_IN_DATA), so that revalidating
+ * costs the same whatever the size of the body.
+ *
+ * With CacheLookupIndex, the <hash> of each URL stored is also kept in
+ * shared memory, so that a URL which is not cached is declined without
+ * trying to open its .header file.  The index is filled from the cache
+ * root at startup and kept across restarts, entries removed behind our
+ * back (by htcacheclean) are dropped from it when their .header file is
+ * found missing.
+ *
+ * With CacheJournal, the sizes of the files written and removed are
+ * appended to a journal, for htcacheclean -J.
  */
 
 module AP_MODULE_DECLARE_DATA cache_disk_module;
@@ -66,6 +99,7 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r);
 static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_brigade *bb);
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
                                apr_file_t *file);
+static apr_status_t write_headers(cache_handle_t *h, request_rec *r);
 
 /*
  * Local static functions
@@ -210,6 +244,284 @@ static apr_status_t file_cache_create(disk_cache_conf *conf, disk_cache_file_t *
     return APR_SUCCESS;
 }
 
+/*
+ * The lookup index
+ */
+static void lookup_hash(const char *hashfile, apr_uint32_t *h1,
+                        apr_uint32_t *h2)
+{
+    const unsigned char *p;
+
+    /* FNV-1a for the bucket, times 33 for the fingerprint, over the
+     * characters of the hash without the directory separators.
+     */
+    *h1 = 2166136261U;
+    *h2 = 5381;
+    for (p = (const unsigned char *)hashfile; *p; p++) {
+        if (*p != '/') {
+            *h1 = (*h1 ^ *p) * 16777619U;
+            *h2 = *h2 * 33 + *p;
+        }
+    }
+    if (!*h2) {
+        *h2 = 1;
+    }
+}
+
+static int lookup_find(disk_cache_lookup_t *l, const char *hashfile)
+{
+    apr_uint32_t h1, fp, *slot;
+    int i;
+
+    lookup_hash(hashfile, &h1, &fp);
+    h1 %= l->nbuckets;
+
+    if (apr_atomic_read32(&l->overflow[h1 / 32]) & (1U << (h1 % 32))) {
+        return 1;
+    }
+    slot = l->slots + h1 * LOOKUP_BUCKET_SLOTS;
+    for (i = 0; i < LOOKUP_BUCKET_SLOTS; i++) {
+        if (apr_atomic_read32(&slot[i]) == fp) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void lookup_add(disk_cache_lookup_t *l, const char *hashfile)
+{
+    apr_uint32_t h1, fp, *slot, *word, old;
+    int i;
+
+    if (lookup_find(l, hashfile)) {
+        return;
+    }
+    lookup_hash(hashfile, &h1, &fp);
+    h1 %= l->nbuckets;
+
+    slot = l->slots + h1 * LOOKUP_BUCKET_SLOTS;
+    for (i = 0; i < LOOKUP_BUCKET_SLOTS; i++) {
+        if (!apr_atomic_read32(&slot[i])
+            && !apr_atomic_cas32(&slot[i], fp, 0)) {
+            return;
+        }
+    }
+
+    /* the bucket is full, its keys can't be told apart any more */
+    word = &l->overflow[h1 / 32];
+    do {
+        old = apr_atomic_read32(word);
+    } while (apr_atomic_cas32(word, old | (1U << (h1 % 32)), old) != old);
+}
+
+static void lookup_remove(disk_cache_lookup_t *l, const char *hashfile)
+{
+    apr_uint32_t h1, fp, *slot;
+    int i;
+
+    lookup_hash(hashfile, &h1, &fp);
+    h1 %= l->nbuckets;
+
+    slot = l->slots + h1 * LOOKUP_BUCKET_SLOTS;
+    for (i = 0; i < LOOKUP_BUCKET_SLOTS; i++) {
+        if (apr_atomic_cas32(&slot[i], 0, fp) == fp) {
+            return;
+        }
+    }
+}
+
+/*
+ * Adds the .header files found under the directory to the index, the
+ * entities of a .vary directory are found through the .header file of
+ * their URL.
+ */
+static apr_status_t lookup_load(disk_cache_lookup_t *l, const char *dir,
+                                const char *hash, apr_uint32_t *count,
+                                apr_pool_t *pool)
+{
+    apr_dir_t *d;
+    apr_finfo_t finfo;
+    apr_pool_t *p;
+    apr_size_t len;
+    apr_status_t rv;
+
+    apr_pool_create(&p, pool);
+
+    rv = apr_dir_open(&d, dir, p);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(p);
+        return rv;
+    }
+
+    while (apr_dir_read(&finfo, APR_FINFO_TYPE | APR_FINFO_NAME, d)
+           == APR_SUCCESS) {
+        len = strlen(finfo.name);
+
+        if (finfo.filetype == APR_DIR) {
+            if (!strcmp(finfo.name, ".") || !strcmp(finfo.name, "..")
+                || (len > sizeof(CACHE_VDIR_SUFFIX) - 1
+                    && !strcmp(finfo.name + len - sizeof(CACHE_VDIR_SUFFIX) + 1,
+                               CACHE_VDIR_SUFFIX))) {
+                continue;
+            }
+            lookup_load(l, apr_pstrcat(p, dir, "/", finfo.name, NULL),
+                        apr_pstrcat(p, hash, finfo.name, NULL), count, p);
+        }
+        else if (finfo.filetype == APR_REG
+                 && len > sizeof(CACHE_HEADER_SUFFIX) - 1
+                 && !strcmp(finfo.name + len - sizeof(CACHE_HEADER_SUFFIX) + 1,
+                            CACHE_HEADER_SUFFIX)) {
+            lookup_add(l, apr_pstrcat(p, hash,
+                                      apr_pstrmemdup(p, finfo.name,
+                                          len - sizeof(CACHE_HEADER_SUFFIX) + 1),
+                                      NULL));
+            ++*count;
+        }
+    }
+
+    apr_dir_close(d);
+    apr_pool_destroy(p);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * The index of a cache root is kept across restarts, the entities stored
+ * and removed meanwhile having been added to and removed from it.
+ */
+typedef struct {
+    apr_shm_t *shm;
+    apr_uint32_t nbuckets;
+} lookup_retained_t;
+
+static apr_status_t lookup_create(disk_cache_lookup_t **lookup,
+                                  disk_cache_conf *conf,
+                                  apr_pool_t *pconf, server_rec *s)
+{
+    disk_cache_lookup_t *l;
+    lookup_retained_t *retained;
+    apr_pool_t *pglobal = s->process->pool;
+    apr_shm_t *shm;
+    apr_size_t size, nslots;
+    apr_uint32_t count = 0, h1, h2;
+    apr_status_t rv;
+    const char *key, *fname;
+
+    /* about half of the slots in use when the index holds its entries */
+    l = apr_pcalloc(pconf, sizeof(disk_cache_lookup_t));
+    l->nbuckets = (apr_uint32_t)(((apr_uint64_t)conf->lookup_entries * 2
+                                  + LOOKUP_BUCKET_SLOTS - 1)
+                                 / LOOKUP_BUCKET_SLOTS);
+    nslots = (apr_size_t)l->nbuckets * LOOKUP_BUCKET_SLOTS;
+    size = (nslots + (l->nbuckets + 31) / 32) * sizeof(apr_uint32_t);
+
+    key = apr_pstrcat(pconf, "mod_cache_disk-lookup-", conf->cache_root, NULL);
+    retained = ap_retained_data_get(key);
+    if (!retained) {
+        retained = ap_retained_data_create(key, sizeof(*retained));
+    }
+    if (retained->shm && retained->nbuckets == l->nbuckets) {
+        l->slots = apr_shm_baseaddr_get(retained->shm);
+        l->overflow = l->slots + nslots;
+        *lookup = l;
+        return APR_SUCCESS;
+    }
+    /* resized, the cache root is read again */
+    if (retained->shm) {
+        apr_shm_destroy(retained->shm);
+        retained->shm = NULL;
+    }
+
+    /* Use anonymous shm by default, fall back on name-based. */
+    rv = apr_shm_create(&shm, size, NULL, pglobal);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        lookup_hash(conf->cache_root, &h1, &h2);
+        fname = ap_runtime_dir_relative(pconf,
+                    apr_psprintf(pconf, "cache_lookup.%08x", h1));
+        if (!fname) {
+            return APR_EINVAL;
+        }
+        apr_shm_remove(fname, pconf);
+        rv = apr_shm_create(&shm, size, fname, pglobal);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02345)
+                     "Could not allocate shared memory for the lookup index "
+                     "of %s", conf->cache_root);
+        return rv;
+    }
+
+    l->slots = apr_shm_baseaddr_get(shm);
+    l->overflow = l->slots + nslots;
+    memset(l->slots, 0, size);
+
+    rv = lookup_load(l, conf->cache_root, "", &count, pconf);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_ENOENT(rv)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02346)
+                     "Could not read the cache root %s for the lookup index",
+                     conf->cache_root);
+        apr_shm_destroy(shm);
+        return rv;
+    }
+    retained->shm = shm;
+    retained->nbuckets = l->nbuckets;
+
+    if (count > conf->lookup_entries) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(02347)
+                     "CacheLookupIndex %u is too small for the %u URLs "
+                     "cached in %s", conf->lookup_entries, count,
+                     conf->cache_root);
+    }
+    else {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(02348)
+                     "Lookup index of %s created, %u URLs cached",
+                     conf->cache_root, count);
+    }
+
+    *lookup = l;
+    return APR_SUCCESS;
+}
+
+/*
+ * The journal
+ */
+static apr_off_t journal_file_size(const char *file, apr_pool_t *p)
+{
+    apr_finfo_t finfo;
+
+    if (file && apr_stat(&finfo, file, APR_FINFO_SIZE, p) == APR_SUCCESS) {
+        return finfo.size;
+    }
+    return -1;
+}
+
+/*
+ * Appends a record to the journal, in a single write so that the records
+ * of the children don't mix.
+ */
+static void journal_write(disk_cache_conf *conf, apr_uint32_t type,
+                          const apr_off_t *added, const apr_off_t *removed,
+                          request_rec *r)
+{
+    disk_cache_journal_t rec;
+    apr_size_t len = sizeof(rec);
+    apr_status_t rv;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.format = CACHE_JOURNAL_VERSION;
+    rec.type = type;
+    rec.time = apr_time_now();
+    memcpy(rec.added, added, sizeof(rec.added));
+    memcpy(rec.removed, removed, sizeof(rec.removed));
+
+    rv = apr_file_write(conf->journal, &rec, &len);
+    if (rv != APR_SUCCESS || len != sizeof(rec)) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(02349)
+                      "could not write to cache journal %s",
+                      conf->journal_name);
+    }
+}
+
 /* These two functions get and put state information into the data
  * file for an ap_cache_el, this state information will be read
  * and written transparent to clients of this module
@@ -228,6 +540,23 @@ static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
         return rv;
     }
 
+    if (dobj->disk_info.format == DISK_FORMAT_VERSION) {
+        len = sizeof(disk_cache_index_t);
+        rv = apr_file_read_full(fd, &dobj->disk_index, len, &len);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (dobj->disk_index.hdrs_len > dobj->disk_index.body_offset) {
+            return APR_EGENERAL;
+        }
+    }
+    else if (dobj->disk_info.format == DISK_FORMAT_VERSION_6) {
+        dobj->disk_index.hdrs_len = 0;
+    }
+    else {
+        return APR_EGENERAL;
+    }
+
     /* Store it away so we can get it later. */
     info->status = dobj->disk_info.status;
     info->date = dobj->disk_info.date;
@@ -237,22 +566,25 @@ static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
 
     memcpy(&info->control, &dobj->disk_info.control, sizeof(cache_control_t));
 
-    /* Note that we could optimize this by conditionally doing the palloc
-     * depending upon the size. */
-    urlbuff = apr_palloc(r->pool, dobj->disk_info.name_len + 1);
-    len = dobj->disk_info.name_len;
+    /* The name and the header block are read at once, the block is
+     * turned into tables in place by recall_headers(). */
+    len = dobj->disk_info.name_len + dobj->disk_index.hdrs_len;
+    urlbuff = apr_palloc(r->pool, len);
     rv = apr_file_read_full(fd, urlbuff, len, &len);
     if (rv != APR_SUCCESS) {
         return rv;
     }
-    urlbuff[dobj->disk_info.name_len] = '\0';
 
     /* check that we have the same URL */
-    /* Would strncmp be correct? */
-    if (strcmp(urlbuff, dobj->name) != 0) {
+    if (dobj->disk_info.name_len != strlen(dobj->name)
+        || memcmp(urlbuff, dobj->name, dobj->disk_info.name_len)) {
         return APR_EGENERAL;
     }
 
+    if (dobj->disk_info.format == DISK_FORMAT_VERSION) {
+        dobj->hdrs_block = urlbuff + dobj->disk_info.name_len;
+    }
+
     return APR_SUCCESS;
 }
 
@@ -443,10 +775,30 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     dobj->root = apr_pstrndup(r->pool, conf->cache_root, conf->cache_root_len);
     dobj->root_len = conf->cache_root_len;
 
-    dobj->vary.file = header_file(r->pool, conf, dobj, key);
+    /* The header file may hold the body as well, and be sent from */
     flags = APR_READ|APR_BINARY|APR_BUFFERED;
+#ifdef APR_SENDFILE_ENABLED
+    /* When we are in the quick handler we don't have the per-directory
+     * configuration, so this check only takes the global setting of
+     * the EnableSendFile directive into account.
+     */
+    flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
+#endif
+
+    dobj->vary.file = header_file(r->pool, conf, dobj, key);
+
+    /* A URL missing from the index is not cached, don't look for it */
+    if (conf->lookup && !lookup_find(conf->lookup, dobj->hashfile)) {
+        return DECLINED;
+    }
+
     rc = apr_file_open(&dobj->vary.fd, dobj->vary.file, flags, 0, r->pool);
     if (rc != APR_SUCCESS) {
+        /* removed by htcacheclean, or by a racing remove_url() in which
+         * case the URL is added back when it is stored again */
+        if (conf->lookup && APR_STATUS_IS_ENOENT(rc)) {
+            lookup_remove(conf->lookup, dobj->hashfile);
+        }
         return DECLINED;
     }
 
@@ -478,13 +830,12 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         dobj->prefix = dobj->vary.file;
         dobj->hdrs.file = header_file(r->pool, conf, dobj, nkey);
 
-        flags = APR_READ|APR_BINARY|APR_BUFFERED;
         rc = apr_file_open(&dobj->hdrs.fd, dobj->hdrs.file, flags, 0, r->pool);
         if (rc != APR_SUCCESS) {
             return DECLINED;
         }
     }
-    else if (format != DISK_FORMAT_VERSION) {
+    else if (format != DISK_FORMAT_VERSION && format != DISK_FORMAT_VERSION_6) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00705)
                 "File '%s' has a version mismatch. File had version: %d.",
                 dobj->vary.file, format);
@@ -527,24 +878,38 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         return DECLINED;
     }
 
-    apr_file_close(dobj->hdrs.fd);
-
     /* Is this a cached HEAD request? */
     if (dobj->disk_info.header_only && !r->header_only) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r, APLOGNO(00707)
                 "HEAD request cached, non-HEAD requested, ignoring: %s",
                 dobj->hdrs.file);
+        apr_file_close(dobj->hdrs.fd);
         return DECLINED;
     }
 
+    /* The body follows the headers, in the file already open */
+    if (dobj->disk_info.format == DISK_FORMAT_VERSION
+        && !(dobj->disk_index.flags & CACHE_DISK_BODY_IN_DATA)) {
+        if (dobj->disk_index.body_len) {
+            dobj->data.fd = dobj->hdrs.fd;
+            dobj->data_offset = dobj->disk_index.body_offset;
+            dobj->file_size = dobj->disk_index.body_len;
+        }
+
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02340)
+                "Recalled cached URL info header %s", dobj->name);
+
+        /* make the configuration stick */
+        h->cache_obj = obj;
+        obj->vobj = dobj;
+
+        return OK;
+    }
+
     /* Open the data file */
     if (dobj->disk_info.has_body) {
         flags = APR_READ | APR_BINARY;
 #ifdef APR_SENDFILE_ENABLED
-        /* When we are in the quick handler we don't have the per-directory
-         * configuration, so this check only takes the global setting of
-         * the EnableSendFile directive into account.
-         */
         flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
 #endif
         rc = apr_file_open(&dobj->data.fd, dobj->data.file, flags, 0, r->pool);
@@ -561,8 +926,19 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
             dobj->file_size = finfo.size;
         }
 
+        /* A revalidated entity, with the body where it was stored */
+        if (rc == APR_SUCCESS
+            && dobj->disk_info.format == DISK_FORMAT_VERSION) {
+            dobj->data_offset = dobj->disk_index.body_offset;
+            dobj->file_size = dobj->disk_index.body_len;
+            if (dobj->data_offset + dobj->file_size > finfo.size) {
+                finfo.inode = 0;
+                finfo.device = 0;
+            }
+        }
+
         /* Atomic check - does the body file belong to the header file? */
-        if (dobj->disk_info.inode == finfo.inode &&
+        if (rc == APR_SUCCESS && dobj->disk_info.inode == finfo.inode &&
                 dobj->disk_info.device == finfo.device) {
 
             /* Initialize the cache_handle callback functions */
@@ -603,6 +979,8 @@ static int remove_entity(cache_handle_t *h)
 
 static int remove_url(cache_handle_t *h, request_rec *r)
 {
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
     apr_status_t rc;
     disk_cache_object_t *dobj;
 
@@ -612,6 +990,24 @@ static int remove_url(cache_handle_t *h, request_rec *r)
         return DECLINED;
     }
 
+    /* The .header file of the URL goes, unless it lists Vary headers */
+    if (conf->lookup && !dobj->prefix) {
+        lookup_remove(conf->lookup,
+                      ap_cache_generate_name(r->pool, conf->dirlevels,
+                                             conf->dirlength, dobj->name));
+    }
+
+    if (conf->journal) {
+        apr_off_t added[CACHE_JOURNAL_FILES] = { -1, -1, -1 };
+        apr_off_t removed[CACHE_JOURNAL_FILES] = { -1, -1, -1 };
+
+        removed[0] = journal_file_size(dobj->hdrs.file, r->pool);
+        removed[1] = journal_file_size(dobj->data.file, r->pool);
+        if (removed[0] >= 0 || removed[1] >= 0) {
+            journal_write(conf, CACHE_JOURNAL_REMOVE, added, removed, r);
+        }
+    }
+
     /* Delete headers file */
     if (dobj->hdrs.file) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00711)
@@ -835,6 +1231,35 @@ static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
     return APR_SUCCESS;
 }
 
+/*
+ * Adds the next n headers of the header block to the table, the strings
+ * stay where they are.
+ */
+static apr_status_t read_table_block(apr_table_t *table, apr_uint32_t n,
+                                     char **block, char *end)
+{
+    char *key, *val, *p = *block;
+
+    while (n--) {
+        key = p;
+        p = memchr(p, '\0', end - p);
+        if (!p) {
+            return APR_EGENERAL;
+        }
+        val = ++p;
+        p = memchr(p, '\0', end - p);
+        if (!p) {
+            return APR_EGENERAL;
+        }
+        ++p;
+
+        apr_table_addn(table, key, val);
+    }
+
+    *block = p;
+    return APR_SUCCESS;
+}
+
 /*
  * Reads headers from a buffer and returns an array of headers.
  * Returns NULL on file error
@@ -846,6 +1271,31 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
 {
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
 
+    if (dobj->hdrs_block) {
+        char *block = dobj->hdrs_block;
+        char *end = block + dobj->disk_index.hdrs_len;
+
+        h->resp_hdrs = apr_table_make(r->pool, dobj->disk_index.nhdrs_out);
+        h->req_hdrs = apr_table_make(r->pool, dobj->disk_index.nhdrs_in);
+
+        if (read_table_block(h->resp_hdrs, dobj->disk_index.nhdrs_out,
+                             &block, end) != APR_SUCCESS
+            || read_table_block(h->req_hdrs, dobj->disk_index.nhdrs_in,
+                                &block, end) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02341)
+                          "Premature end of cache headers.");
+        }
+
+        /* the file stays open when the body is sent from it */
+        if (!dobj->data.fd) {
+            apr_file_close(dobj->hdrs.fd);
+        }
+
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02342)
+                "Recalled headers for URL %s", dobj->name);
+        return APR_SUCCESS;
+    }
+
     /* This case should not happen... */
     if (!dobj->hdrs.fd) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00719)
@@ -872,44 +1322,59 @@ static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_bri
     disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
 
     if (dobj->data.fd) {
-        apr_brigade_insert_file(bb, dobj->data.fd, 0, dobj->file_size, p);
+        apr_brigade_insert_file(bb, dobj->data.fd,
+                                dobj->data_offset, dobj->file_size, p);
     }
 
     return APR_SUCCESS;
 }
 
-static apr_status_t store_table(apr_file_t *fd, apr_table_t *table)
+/*
+ * The size of the table in the header block, and its number of headers
+ */
+static apr_size_t table_block_size(apr_table_t *table, apr_uint32_t *n)
 {
+    const apr_array_header_t *arr;
+    apr_table_entry_t *elts;
+    apr_size_t len = 0;
     int i;
-    apr_status_t rv;
-    struct iovec iov[4];
-    apr_size_t amt;
+
+    *n = 0;
+    if (table) {
+        arr = apr_table_elts(table);
+        elts = (apr_table_entry_t *) arr->elts;
+        for (i = 0; i < arr->nelts; ++i) {
+            if (elts[i].key != NULL) {
+                len += strlen(elts[i].key) + strlen(elts[i].val) + 2;
+                ++*n;
+            }
+        }
+    }
+    return len;
+}
+
+static char *store_table_block(char *p, apr_table_t *table)
+{
+    const apr_array_header_t *arr;
     apr_table_entry_t *elts;
+    apr_size_t len;
+    int i;
 
-    elts = (apr_table_entry_t *) apr_table_elts(table)->elts;
-    for (i = 0; i < apr_table_elts(table)->nelts; ++i) {
-        if (elts[i].key != NULL) {
-            iov[0].iov_base = elts[i].key;
-            iov[0].iov_len = strlen(elts[i].key);
-            iov[1].iov_base = ": ";
-            iov[1].iov_len = sizeof(": ") - 1;
-            iov[2].iov_base = elts[i].val;
-            iov[2].iov_len = strlen(elts[i].val);
-            iov[3].iov_base = CRLF;
-            iov[3].iov_len = sizeof(CRLF) - 1;
-
-            rv = apr_file_writev(fd, (const struct iovec *) &iov, 4,
-                                 &amt);
-            if (rv != APR_SUCCESS) {
-                return rv;
+    if (table) {
+        arr = apr_table_elts(table);
+        elts = (apr_table_entry_t *) arr->elts;
+        for (i = 0; i < arr->nelts; ++i) {
+            if (elts[i].key != NULL) {
+                len = strlen(elts[i].key) + 1;
+                memcpy(p, elts[i].key, len);
+                p += len;
+                len = strlen(elts[i].val) + 1;
+                memcpy(p, elts[i].val, len);
+                p += len;
             }
         }
     }
-    iov[0].iov_base = CRLF;
-    iov[0].iov_len = sizeof(CRLF) - 1;
-    rv = apr_file_writev(fd, (const struct iovec *) &iov, 1,
-                         &amt);
-    return rv;
+    return p;
 }
 
 static apr_status_t store_headers(cache_handle_t *h, request_rec *r, cache_info *info)
@@ -938,7 +1403,9 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
     disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
 
     disk_cache_info_t disk_info;
-    struct iovec iov[2];
+    disk_cache_index_t *index;
+    struct iovec iov[4];
+    char *block;
 
     memset(&disk_info, 0, sizeof(disk_cache_info_t));
 
@@ -1037,21 +1504,42 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
     disk_info.request_time = h->cache_obj->info.request_time;
     disk_info.response_time = h->cache_obj->info.response_time;
     disk_info.status = h->cache_obj->info.status;
-    disk_info.inode = dobj->disk_info.inode;
-    disk_info.device = dobj->disk_info.device;
-    disk_info.has_body = dobj->disk_info.has_body;
     disk_info.header_only = dobj->disk_info.header_only;
 
     disk_info.name_len = strlen(dobj->name);
 
     memcpy(&disk_info.control, &h->cache_obj->info.control, sizeof(cache_control_t));
 
+    /* Parse the vary header and dump those fields from the headers_in. */
+    /* FIXME: Make call to the same thing cache_select calls to crack Vary. */
+    index = &dobj->disk_index;
+    index->hdrs_len = table_block_size(dobj->headers_out, &index->nhdrs_out)
+                      + table_block_size(dobj->headers_in, &index->nhdrs_in);
+    block = apr_palloc(r->pool, index->hdrs_len);
+    store_table_block(store_table_block(block, dobj->headers_out),
+                      dobj->headers_in);
+
+    /* the body is written after the headers, see write_body_offset() */
+    index->body_offset = APR_ALIGN(sizeof(disk_cache_info_t)
+                                   + sizeof(disk_cache_index_t)
+                                   + disk_info.name_len + index->hdrs_len,
+                                   CACHE_DISK_BODY_ALIGN);
+    index->body_len = 0;
+    index->flags = 0;
+
+    memcpy(&dobj->disk_info, &disk_info, sizeof(disk_cache_info_t));
+
     iov[0].iov_base = (void*)&disk_info;
     iov[0].iov_len = sizeof(disk_cache_info_t);
-    iov[1].iov_base = (void*)dobj->name;
-    iov[1].iov_len = disk_info.name_len;
-
-    rv = apr_file_writev(dobj->hdrs.tempfd, (const struct iovec *) &iov, 2, &amt);
+    iov[1].iov_base = (void*)index;
+    iov[1].iov_len = sizeof(disk_cache_index_t);
+    iov[2].iov_base = (void*)dobj->name;
+    iov[2].iov_len = disk_info.name_len;
+    iov[3].iov_base = block;
+    iov[3].iov_len = index->hdrs_len;
+
+    rv = apr_file_writev_full(dobj->hdrs.tempfd, (const struct iovec *) &iov,
+                              4, &amt);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00726)
                 "could not write info to header file %s",
@@ -1061,30 +1549,57 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
         return rv;
     }
 
-    if (dobj->headers_out) {
-        rv = store_table(dobj->hdrs.tempfd, dobj->headers_out);
-        if (rv != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00727)
-                    "could not write out-headers to header file %s",
-                    dobj->hdrs.tempfile);
-            apr_file_close(dobj->hdrs.tempfd);
-            apr_pool_destroy(dobj->hdrs.pool);
-            return rv;
-        }
-    }
+    return APR_SUCCESS;
+}
 
-    /* Parse the vary header and dump those fields from the headers_in. */
-    /* FIXME: Make call to the same thing cache_select calls to crack Vary. */
-    if (dobj->headers_in) {
-        rv = store_table(dobj->hdrs.tempfd, dobj->headers_in);
-        if (rv != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00728)
-                    "could not write in-headers to header file %s",
-                    dobj->hdrs.tempfile);
-            apr_file_close(dobj->hdrs.tempfd);
-            apr_pool_destroy(dobj->hdrs.pool);
-            return rv;
-        }
+/*
+ * Pads the header file up to the offset of the body.
+ */
+static apr_status_t write_body_offset(disk_cache_object_t *dobj)
+{
+    static const char zeros[CACHE_DISK_BODY_ALIGN];
+    apr_size_t len;
+
+    len = (apr_size_t)(dobj->disk_index.body_offset
+                       - sizeof(disk_cache_info_t)
+                       - sizeof(disk_cache_index_t)
+                       - dobj->disk_info.name_len
+                       - dobj->disk_index.hdrs_len);
+
+    return apr_file_write_full(dobj->hdrs.tempfd, zeros, len, NULL);
+}
+
+/*
+ * Rewrites the fixed part of the header file once the body is known,
+ * and closes it.
+ */
+static apr_status_t write_index(cache_handle_t *h, request_rec *r)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
+    apr_off_t offset = 0;
+    struct iovec iov[2];
+    apr_size_t amt;
+    apr_status_t rv;
+
+    dobj->disk_info.has_body = dobj->file_size > 0;
+    dobj->disk_index.body_len = dobj->file_size;
+
+    iov[0].iov_base = (void*)&dobj->disk_info;
+    iov[0].iov_len = sizeof(disk_cache_info_t);
+    iov[1].iov_base = (void*)&dobj->disk_index;
+    iov[1].iov_len = sizeof(disk_cache_index_t);
+
+    rv = apr_file_seek(dobj->hdrs.tempfd, APR_SET, &offset);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_writev_full(dobj->hdrs.tempfd,
+                                  (const struct iovec *) &iov, 2, &amt);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(02343)
+                "could not write info to header file %s",
+                dobj->hdrs.tempfile);
+        apr_file_close(dobj->hdrs.tempfd);
+        return rv;
     }
 
     rv = apr_file_close(dobj->hdrs.tempfd); /* flush and close */
@@ -1092,13 +1607,104 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
         ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00729)
                 "could not close header file %s",
                 dobj->hdrs.tempfile);
-        apr_pool_destroy(dobj->hdrs.pool);
         return rv;
     }
 
     return APR_SUCCESS;
 }
 
+/*
+ * Copies the body of the entity which is revalidated into the new header
+ * file, where it cannot be linked, see keep_body().
+ */
+static apr_status_t copy_body(cache_handle_t *h, request_rec *r)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
+    char buf[AP_IOBUFSIZE];
+    apr_off_t offset = dobj->data_offset;
+    apr_off_t remaining = dobj->file_size;
+    apr_size_t len;
+    apr_status_t rv;
+
+    rv = apr_file_seek(dobj->data.fd, APR_SET, &offset);
+    while (rv == APR_SUCCESS && remaining > 0) {
+        len = remaining > (apr_off_t)sizeof(buf) ? sizeof(buf)
+                                                  : (apr_size_t)remaining;
+        rv = apr_file_read_full(dobj->data.fd, buf, len, &len);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_write_full(dobj->hdrs.tempfd, buf, len, NULL);
+        }
+        remaining -= len;
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(02344)
+                "could not copy the body of %s to header file %s",
+                dobj->name, dobj->hdrs.tempfile);
+    }
+
+    return rv;
+}
+
+/*
+ * Leaves the body of the entity which is revalidated in file, where it is,
+ * for the new header file to refer to: file is the .data file already, or
+ * else the .data file is made a hard link to the old header file.  Where
+ * hard links are not supported, a body of up to MAX_REVALIDATE_COPY bytes
+ * is copied instead, and larger ones are not kept.
+ * *linked is set if the .data file was created.
+ */
+static apr_status_t keep_body(cache_handle_t *h, request_rec *r,
+                              const char *file, int *linked)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
+    apr_finfo_t finfo, linfo;
+    apr_status_t rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_IDENT, dobj->data.fd);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* is the body where the new header file looks for it already? */
+    if (apr_stat(&linfo, dobj->data.file, APR_FINFO_IDENT, r->pool)
+            != APR_SUCCESS
+        || linfo.inode != finfo.inode || linfo.device != finfo.device) {
+        apr_file_remove(dobj->data.file, r->pool);
+        rv = apr_file_link(file, dobj->data.file);
+        if (rv == APR_SUCCESS) {
+            *linked = 1;
+            rv = apr_stat(&linfo, dobj->data.file, APR_FINFO_IDENT, r->pool);
+            /* replaced since we opened it? */
+            if (rv == APR_SUCCESS && (linfo.inode != finfo.inode
+                                      || linfo.device != finfo.device)) {
+                apr_file_remove(dobj->data.file, r->pool);
+                *linked = 0;
+                rv = APR_EGENERAL;
+            }
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02357)
+                    "could not link the body of %s to data file %s",
+                    dobj->name, dobj->data.file);
+            if (dobj->file_size > MAX_REVALIDATE_COPY) {
+                return rv;
+            }
+            rv = write_body_offset(dobj);
+            if (APR_SUCCESS == rv) {
+                rv = copy_body(h, r);
+            }
+            return rv;
+        }
+    }
+
+    dobj->disk_info.inode = finfo.inode;
+    dobj->disk_info.device = finfo.device;
+    dobj->disk_index.flags |= CACHE_DISK_BODY_IN_DATA;
+    dobj->disk_index.body_offset = dobj->data_offset;
+
+    return APR_SUCCESS;
+}
+
 static apr_status_t store_body(cache_handle_t *h, request_rec *r,
                                apr_bucket_brigade *in, apr_bucket_brigade *out)
 {
@@ -1173,32 +1779,27 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
             continue;
         }
 
-        /* Attempt to create the data file at the last possible moment, if
-         * the body is empty, we don't write a file at all, and save an inode.
+        /* Attempt to create the entity file at the first byte of the body,
+         * the headers are written first and the body follows them.  If the
+         * body is empty, the headers are written by commit_entity().
          */
-        if (!dobj->data.tempfd) {
-            apr_finfo_t finfo;
-            rv = apr_file_mktemp(&dobj->data.tempfd, dobj->data.tempfile,
-                                 APR_CREATE | APR_WRITE | APR_BINARY |
-                                 APR_BUFFERED | APR_EXCL, dobj->data.pool);
-            if (rv != APR_SUCCESS) {
-                apr_pool_destroy(dobj->data.pool);
-                return rv;
+        if (!dobj->hdrs.tempfd) {
+            rv = write_headers(h, r);
+            if (rv == APR_SUCCESS) {
+                rv = write_body_offset(dobj);
             }
-            dobj->file_size = 0;
-            rv = apr_file_info_get(&finfo, APR_FINFO_IDENT,
-                    dobj->data.tempfd);
             if (rv != APR_SUCCESS) {
-                apr_pool_destroy(dobj->data.pool);
+                /* write_headers() may have destroyed the pool already */
+                if (dobj->data.pool) {
+                    apr_pool_destroy(dobj->data.pool);
+                }
                 return rv;
             }
-            dobj->disk_info.device = finfo.device;
-            dobj->disk_info.inode = finfo.inode;
-            dobj->disk_info.has_body = 1;
+            dobj->file_size = 0;
         }
 
         /* write to the cache, leave if we fail */
-        rv = apr_file_write_full(dobj->data.tempfd, str, length, &written);
+        rv = apr_file_write_full(dobj->hdrs.tempfd, str, length, &written);
         if (rv != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00731)
                     "Error when writing cache file for URL %s",
@@ -1241,15 +1842,6 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
     if (seen_eos) {
         const char *cl_header = apr_table_get(r->headers_out, "Content-Length");
 
-        if (dobj->data.tempfd) {
-            rv = apr_file_close(dobj->data.tempfd);
-            if (rv != APR_SUCCESS) {
-                /* Buffered write failed, abandon attempt to write */
-                apr_pool_destroy(dobj->data.pool);
-                return rv;
-            }
-        }
-
         if (r->connection->aborted || r->no_cache) {
             ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(00733)
                     "Discarding body for URL %s "
@@ -1291,20 +1883,65 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
     disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
                                                  &cache_disk_module);
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
-    apr_status_t rv;
+    apr_off_t added[CACHE_JOURNAL_FILES] = { -1, -1, -1 };
+    apr_off_t removed[CACHE_JOURNAL_FILES] = { -1, -1, -1 };
+    apr_status_t rv = APR_SUCCESS;
+    int keep = 0, linked = 0;
+
+    /* write the headers to disk at the last possible moment, unless the
+     * body has been stored already, and keep the body of the entity being
+     * revalidated.
+     */
+    if (!dobj->hdrs.tempfd) {
+        /* the body is in the header file, or in the data file, which
+         * write_headers() may move elsewhere along with a new Vary */
+        const char *file = dobj->data.fd == dobj->hdrs.fd ? dobj->hdrs.file
+                                                           : dobj->data.file;
+
+        keep = dobj->data.fd && dobj->file_size;
+        rv = write_headers(h, r);
+        if (APR_SUCCESS == rv && keep) {
+            rv = keep_body(h, r, file, &linked);
+        }
+    }
+    if (APR_SUCCESS == rv) {
+        rv = write_index(h, r);
+    }
+    keep = keep && (dobj->disk_index.flags & CACHE_DISK_BODY_IN_DATA);
 
-    /* write the headers to disk at the last possible moment */
-    rv = write_headers(h, r);
+    /* the files about to be written and replaced, for the journal */
+    if (APR_SUCCESS == rv && conf->journal) {
+        if (dobj->file_size && !keep) {
+            added[0] = dobj->disk_index.body_offset + dobj->file_size;
+        }
+        else {
+            added[0] = sizeof(disk_cache_info_t) + sizeof(disk_cache_index_t)
+                       + dobj->disk_info.name_len + dobj->disk_index.hdrs_len;
+        }
+        removed[0] = journal_file_size(dobj->hdrs.file, r->pool);
+        if (linked) {
+            added[1] = journal_file_size(dobj->data.file, r->pool);
+        }
+        else if (!keep) {
+            removed[1] = journal_file_size(dobj->data.file, r->pool);
+        }
+        if (dobj->vary.tempfd) {
+            added[2] = journal_file_size(dobj->vary.tempfile, r->pool);
+            removed[2] = journal_file_size(dobj->vary.file, r->pool);
+        }
+    }
 
-    /* move header and data tempfiles to the final destination */
+    /* move header and vary tempfiles to the final destination */
     if (APR_SUCCESS == rv) {
         rv = file_cache_el_final(conf, &dobj->hdrs, r);
     }
     if (APR_SUCCESS == rv) {
         rv = file_cache_el_final(conf, &dobj->vary, r);
     }
-    if (APR_SUCCESS == rv) {
-        rv = file_cache_el_final(conf, &dobj->data, r);
+
+    /* the body is in the header file now, remove any older data file */
+    if (APR_SUCCESS == rv && !keep) {
+        apr_file_remove(dobj->data.file, r->pool);
     }
 
     /* remove the cached items completely on any failure */
@@ -1315,6 +1952,14 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
                 dobj->name);
     }
     else {
+        if (conf->lookup) {
+            lookup_add(conf->lookup,
+                       ap_cache_generate_name(r->pool, conf->dirlevels,
+                                              conf->dirlength, dobj->name));
+        }
+        if (conf->journal) {
+            journal_write(conf, CACHE_JOURNAL_STORE, added, removed, r);
+        }
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00737)
                 "commit_entity: Headers and body for URL %s cached.",
                 dobj->name);
@@ -1478,6 +2123,35 @@ static const char
     return NULL;
 }
 
+static const char
+*set_cache_lookup(cmd_parms *parms, void *in_struct_ptr, const char *arg)
+{
+    disk_cache_conf *conf = ap_get_module_config(parms->server->module_config,
+                                                 &cache_disk_module);
+    apr_int64_t val = apr_atoi64(arg);
+
+    if (val < 0 || val > 0x7fffffff) {
+        return "CacheLookupIndex argument must be a non-negative integer "
+               "representing the number of URLs expected in the cache";
+    }
+    conf->lookup_entries = (apr_uint32_t)val;
+    return NULL;
+}
+
+static const char
+*set_cache_journal(cmd_parms *parms, void *in_struct_ptr, const char *arg)
+{
+    disk_cache_conf *conf = ap_get_module_config(parms->server->module_config,
+                                                 &cache_disk_module);
+
+    conf->journal_name = ap_server_root_relative(parms->pool, arg);
+    if (!conf->journal_name) {
+        return apr_pstrcat(parms->pool, "Invalid CacheJournal path ",
+                           arg, NULL);
+    }
+    return NULL;
+}
+
 static const command_rec disk_cache_cmds[] =
 {
     AP_INIT_TAKE1("CacheRoot", set_cache_root, NULL, RSRC_CONF,
@@ -1494,6 +2168,12 @@ static const command_rec disk_cache_cmds[] =
                   "The maximum quantity of data to attempt to read and cache in one go"),
     AP_INIT_TAKE1("CacheReadTime", set_cache_readtime, NULL, RSRC_CONF | ACCESS_CONF,
                   "The maximum time taken to attempt to read and cache in go"),
+    AP_INIT_TAKE1("CacheLookupIndex", set_cache_lookup, NULL, RSRC_CONF,
+                  "The number of URLs expected in the cache, to keep an index "
+                  "of them in shared memory"),
+    AP_INIT_TAKE1("CacheJournal", set_cache_journal, NULL, RSRC_CONF,
+                  "The file to append the changes made to the cache to, "
+                  "for htcacheclean"),
     {NULL}
 };
 
@@ -1511,11 +2191,88 @@ static const cache_provider cache_disk_provider =
     &invalidate_entity
 };
 
+static int disk_cache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                  apr_pool_t *ptemp, server_rec *s)
+{
+    disk_cache_conf *conf;
+    disk_cache_lookup_t *lookup;
+    apr_hash_t *lookups, *journals;
+    apr_file_t *journal;
+    apr_status_t rv;
+    server_rec *sv;
+
+    /* don't read the cache root twice at startup */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    /* one index per cache root, used by all the servers storing there */
+    lookups = apr_hash_make(ptemp);
+    for (sv = s; sv; sv = sv->next) {
+        conf = ap_get_module_config(sv->module_config, &cache_disk_module);
+        if (conf->cache_root && conf->lookup_entries
+            && !apr_hash_get(lookups, conf->cache_root, APR_HASH_KEY_STRING)) {
+            if (lookup_create(&lookup, conf, pconf, s) != APR_SUCCESS) {
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            apr_hash_set(lookups, conf->cache_root, APR_HASH_KEY_STRING,
+                         lookup);
+        }
+    }
+    for (sv = s; sv; sv = sv->next) {
+        conf = ap_get_module_config(sv->module_config, &cache_disk_module);
+        if (conf->cache_root) {
+            conf->lookup = apr_hash_get(lookups, conf->cache_root,
+                                        APR_HASH_KEY_STRING);
+        }
+    }
+
+    /* the journals are opened once, and inherited by the children */
+    journals = apr_hash_make(ptemp);
+    for (sv = s; sv; sv = sv->next) {
+        conf = ap_get_module_config(sv->module_config, &cache_disk_module);
+        if (!conf->journal_name || conf->journal) {
+            continue;
+        }
+        journal = apr_hash_get(journals, conf->journal_name,
+                               APR_HASH_KEY_STRING);
+        if (!journal) {
+            rv = apr_file_open(&journal, conf->journal_name,
+                               APR_WRITE | APR_CREATE | APR_APPEND
+                               | APR_BINARY, APR_OS_DEFAULT, pconf);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02350)
+                             "Could not open cache journal %s",
+                             conf->journal_name);
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+#if AP_NEED_SET_MUTEX_PERMS
+            /* htcacheclean truncates the journal, running as the user
+             * the children run as, like the files of the cache */
+            if (!geteuid() && chown(conf->journal_name,
+                                    ap_unixd_config.user_id,
+                                    ap_unixd_config.group_id) == -1) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING,
+                             APR_FROM_OS_ERROR(errno), s, APLOGNO(02358)
+                             "Could not change the owner of cache journal %s",
+                             conf->journal_name);
+            }
+#endif
+            apr_hash_set(journals, conf->journal_name, APR_HASH_KEY_STRING,
+                         journal);
+        }
+        conf->journal = journal;
+    }
+
+    return OK;
+}
+
 static void disk_cache_register_hook(apr_pool_t *p)
 {
     /* cache initializer */
     ap_register_provider(p, CACHE_PROVIDER_GROUP, "disk", "0",
                          &cache_disk_provider);
+    ap_hook_post_config(disk_cache_post_config, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(cache_disk) = {
@@ -47,8 +47,11 @@ typedef struct disk_cache_object {
     const char *hashfile;        /* Computed hash key for this URI */
     const char *name;            /* Requested URI without vary bits - suitable for mortals. */
     const char *key;             /* On-disk prefix; URI with Vary bits (if present) */
-    apr_off_t file_size;         /*  File size of the cached data file  */
+    apr_off_t file_size;         /*  Size of the cached body  */
     disk_cache_info_t disk_info; /* Header information. */
+    disk_cache_index_t disk_index; /* Layout of the entity file. */
+    char *hdrs_block;            /* Header block of a recalled entity */
+    apr_off_t data_offset;       /* Offset of the body in data.fd */
     apr_table_t *headers_in;     /* Input headers to save */
     apr_table_t *headers_out;    /* Output headers to save */
     apr_off_t offset;            /* Max size to set aside */
@@ -68,12 +71,32 @@ typedef struct disk_cache_object {
 #define DEFAULT_MAX_FILE_SIZE 1000000
 #define DEFAULT_READSIZE 0
 #define DEFAULT_READTIME 0
+/* The most a revalidation copies of a body, where it cannot be linked */
+#define MAX_REVALIDATE_COPY (256 * 1024)
+
+/*
+ * The lookup index of the entities present in a cache root, kept in shared
+ * memory.  Each key hashes to a bucket of LOOKUP_BUCKET_SLOTS fingerprints,
+ * 0 when the slot is free.  Once a bucket has been full, every key hashing
+ * to it may be present.
+ */
+#define LOOKUP_BUCKET_SLOTS 8
+
+typedef struct {
+    apr_uint32_t nbuckets;
+    apr_uint32_t *slots;         /* nbuckets * LOOKUP_BUCKET_SLOTS */
+    apr_uint32_t *overflow;      /* one bit per bucket */
+} disk_cache_lookup_t;
 
 typedef struct {
     const char* cache_root;
     apr_size_t cache_root_len;
     int dirlevels;               /* Number of levels of subdirectories */
     int dirlength;               /* Length of subdirectory names */
+    apr_uint32_t lookup_entries; /* Size of the lookup index, 0 if none */
+    disk_cache_lookup_t *lookup; /* Lookup index of the cache root */
+    const char *journal_name;    /* CacheJournal file */
+    apr_file_t *journal;         /* CacheJournal, opened for appending */
 } disk_cache_conf;
 
 typedef struct {
@@ -0,0 +1,1199 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_lib.h"
+#include "apr_strings.h"
+
+#include "mod_cache.h"
+
+#include "ap_socache.h"
+#include "ap_provider.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "http_core.h"
+#include "util_mutex.h"
+
+/*
+ * mod_cache_socache: Shared Object Cache Based HTTP 1.1 Cache.
+ *
+ * Small entities are kept whole, headers and body, as a single object of
+ * an ap_socache_provider_t (shmcb typically), so that serving a hit takes
+ * one lookup and no file system access at all.
+ *
+ * Flow to find the entity:
+ *   Incoming client requests URI /foo/bar/baz
+ *   Look up the object keyed by /foo/bar/baz
+ *   If format #1 (Contains a list of Vary Headers):
+ *      Use each header name with our request values (headers_in) to
+ *      regenerate the key using HeaderName+HeaderValue+.../foo/bar/baz
+ *      look up the object keyed by it (must be format #2)
+ *
+ * Format #1:
+ *   apr_uint32_t format;
+ *   apr_time_t expire;
+ *   apr_array_t vary_headers (delimited by CRLF)
+ *   CRLF
+ *
+ * Format #2:
+ *   cache_socache_info_t (first sizeof(apr_uint32_t) bytes is the format)
+ *   entity name (sobj->name) [length is in cache_socache_info_t->name_len]
+ *   r->headers_out (delimited by CRLF)
+ *   CRLF
+ *   r->headers_in (delimited by CRLF)
+ *   CRLF
+ *   body [length is in cache_socache_info_t->body_len]
+ *
+ * The socache expires the objects by itself, and drops the oldest ones
+ * first when it is full (shmcb does).  Objects larger than
+ * CacheSocacheMaxSize are not cached.
+ */
+
+module AP_MODULE_DECLARE_DATA cache_socache_module;
+
+#define CACHE_SOCACHE_VARY_FORMAT_VERSION 1
+#define CACHE_SOCACHE_FORMAT_VERSION 2
+
+/* Maximum size of an object, headers and body (CacheSocacheMaxSize) */
+#define DEFAULT_MAX_SIZE 102400
+/* Bounds of the lifetime of an object in the socache */
+#define DEFAULT_MAXTIME apr_time_from_sec(86400)
+#define DEFAULT_MINTIME apr_time_from_sec(600)
+
+typedef struct {
+    /* Indicates the format of the object */
+    apr_uint32_t format;
+    /* The HTTP status code returned for this response.  */
+    int status;
+    /* The size of the entity name that follows. */
+    apr_size_t name_len;
+    /* The size of the body, at the end of the object */
+    apr_size_t body_len;
+    /* Miscellaneous time values. */
+    apr_time_t date;
+    apr_time_t expire;
+    apr_time_t request_time;
+    apr_time_t response_time;
+    unsigned int header_only:1;
+    /* The parsed cache control header */
+    cache_control_t control;
+} cache_socache_info_t;
+
+typedef struct {
+    const char *name;           /* Requested URI without vary bits */
+    const char *key;            /* Key of the entity, with vary bits */
+    cache_socache_info_t socache_info;
+    apr_table_t *headers_in;    /* Input headers to save */
+    apr_table_t *headers_out;   /* Output headers to save */
+    char *hdrs;                 /* The headers of a recalled object */
+    apr_size_t hdrs_len;
+    char *body;                 /* The body, recalled or to store */
+    apr_size_t body_len;
+    apr_size_t body_size;       /* Room allocated for the body */
+    apr_pool_t *pool;           /* Pool of the body */
+    unsigned int done:1;        /* Is the body complete? */
+    unsigned int failed:1;      /* Is the body not to be cached? */
+} cache_socache_object_t;
+
+typedef struct {
+    apr_size_t max;             /* Maximum size of an object */
+    apr_time_t maxtime;         /* Maximum time an object is kept */
+    apr_time_t mintime;         /* Minimum time an object is kept */
+    unsigned int max_set:1;
+    unsigned int maxtime_set:1;
+    unsigned int mintime_set:1;
+} cache_socache_conf;
+
+/* The buffer objects are retrieved into, one per connection */
+typedef struct {
+    unsigned char *buf;
+    apr_size_t size;
+} cache_socache_lookup_t;
+
+static apr_global_mutex_t *socache_mutex = NULL;
+static ap_socache_provider_t *socache_provider = NULL;
+static ap_socache_instance_t *socache_instance = NULL;
+static const char *const cache_socache_id = "cache-socache";
+
+static apr_status_t remove_lock(void *data)
+{
+    if (socache_mutex) {
+        apr_global_mutex_destroy(socache_mutex);
+        socache_mutex = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t destroy_cache(void *data)
+{
+    if (socache_instance) {
+        socache_provider->destroy(socache_instance, (server_rec*)data);
+        socache_instance = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Local static functions
+ */
+
+static apr_status_t socache_lock(request_rec *r)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (socache_mutex) {
+        rv = apr_global_mutex_lock(socache_mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02315)
+                          "could not acquire the %s mutex", cache_socache_id);
+        }
+    }
+    return rv;
+}
+
+static void socache_unlock(request_rec *r)
+{
+    if (socache_mutex) {
+        apr_status_t rv = apr_global_mutex_unlock(socache_mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02316)
+                          "could not release the %s mutex", cache_socache_id);
+        }
+    }
+}
+
+/*
+ * Get the buffer of the connection to retrieve an object of up to size
+ * bytes into.  Lookups, misses in particular, don't have to allocate the
+ * largest object size from every request pool this way.  The buffer is
+ * reused by the next lookup, a hit is to be copied out of it.
+ */
+static unsigned char *lookup_buffer(conn_rec *c, apr_size_t size)
+{
+    cache_socache_lookup_t *lookup = ap_get_module_config(c->conn_config,
+                                                        &cache_socache_module);
+
+    if (!lookup) {
+        lookup = apr_pcalloc(c->pool, sizeof(*lookup));
+        ap_set_module_config(c->conn_config, &cache_socache_module, lookup);
+    }
+    /* only grows if a virtual host allows larger objects */
+    if (lookup->size < size) {
+        lookup->buf = apr_palloc(c->pool, size);
+        lookup->size = size;
+    }
+    return lookup->buf;
+}
+
+static apr_status_t socache_retrieve(request_rec *r, const char *key,
+                                     unsigned char *buf, apr_size_t *len)
+{
+    apr_status_t rv;
+
+    rv = socache_lock(r);
+    if (rv == APR_SUCCESS) {
+        rv = socache_provider->retrieve(socache_instance, r->server,
+                                        (const unsigned char *)key,
+                                        strlen(key), buf, len, r->pool);
+        socache_unlock(r);
+    }
+    return rv;
+}
+
+static apr_status_t socache_store(request_rec *r, const char *key,
+                                  apr_time_t expire, unsigned char *buf,
+                                  apr_size_t len)
+{
+    apr_status_t rv;
+
+    rv = socache_lock(r);
+    if (rv == APR_SUCCESS) {
+        rv = socache_provider->store(socache_instance, r->server,
+                                     (const unsigned char *)key, strlen(key),
+                                     expire, buf, len, r->pool);
+        socache_unlock(r);
+    }
+    return rv;
+}
+
+static void socache_remove(request_rec *r, const char *key)
+{
+    if (socache_lock(r) == APR_SUCCESS) {
+        socache_provider->remove(socache_instance, r->server,
+                                 (const unsigned char *)key, strlen(key),
+                                 r->pool);
+        socache_unlock(r);
+    }
+}
+
+/* The time the socache keeps an object which expires at expire */
+static apr_time_t socache_expiry(cache_socache_conf *conf, apr_time_t expire)
+{
+    apr_time_t now = apr_time_now();
+
+    /* stale entries are kept a while, they may be revalidated */
+    if (expire < now + conf->mintime) {
+        return now + conf->mintime;
+    }
+    if (expire > now + conf->maxtime) {
+        return now + conf->maxtime;
+    }
+    return expire;
+}
+
+static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
+                             apr_array_header_t *varray, const char *oldkey)
+{
+    struct iovec *iov;
+    int i, k;
+    int nvec;
+    const char *header;
+    const char **elts;
+
+    nvec = (varray->nelts * 2) + 1;
+    iov = apr_palloc(p, sizeof(struct iovec) * nvec);
+    elts = (const char **) varray->elts;
+
+    /* See regen_key() in mod_cache_disk.c about the header values */
+    for(i=0, k=0; i < varray->nelts; i++) {
+        header = apr_table_get(headers, elts[i]);
+        if (!header) {
+            header = "";
+        }
+        iov[k].iov_base = (char*) elts[i];
+        iov[k].iov_len = strlen(elts[i]);
+        k++;
+        iov[k].iov_base = (char*) header;
+        iov[k].iov_len = strlen(header);
+        k++;
+    }
+    iov[k].iov_base = (char*) oldkey;
+    iov[k].iov_len = strlen(oldkey);
+    k++;
+
+    return apr_pstrcatv(p, iov, k, NULL);
+}
+
+static int array_alphasort(const void *fn1, const void *fn2)
+{
+    return strcmp(*(char**)fn1, *(char**)fn2);
+}
+
+static void tokens_to_array(apr_pool_t *p, const char *data,
+                            apr_array_header_t *arr)
+{
+    char *token;
+
+    while ((token = ap_get_list_item(p, &data)) != NULL) {
+        *((const char **) apr_array_push(arr)) = token;
+    }
+
+    /* Sort it so that "Vary: A, B" and "Vary: B, A" are stored the same. */
+    qsort((void *) arr->elts, arr->nelts,
+         sizeof(char *), array_alphasort);
+}
+
+/* The next CRLF terminated line in [*p, end), NUL terminated in place,
+ * NULL if there is none.
+ */
+static char *next_line(char **p, char *end)
+{
+    char *line = *p, *s;
+
+    for (s = line; s + 1 < end; s++) {
+        if (s[0] == CR && s[1] == LF) {
+            *s = '\0';
+            *p = s + 2;
+            return line;
+        }
+    }
+    return NULL;
+}
+
+static apr_status_t read_array(char **p, char *end, apr_array_header_t *arr)
+{
+    char *line;
+
+    while ((line = next_line(p, end)) != NULL) {
+        if (!*line) {
+            return APR_SUCCESS;
+        }
+        APR_ARRAY_PUSH(arr, const char *) = line;
+    }
+    return APR_EGENERAL;
+}
+
+static apr_status_t read_table(char **p, char *end, apr_table_t *table)
+{
+    char *line, *l;
+
+    while ((line = next_line(p, end)) != NULL) {
+        if (!*line) {
+            return APR_SUCCESS;
+        }
+
+        /* if we see a bogus header don't ignore it. Shout and scream */
+        if (!(l = strchr(line, ':'))) {
+            return APR_EGENERAL;
+        }
+
+        *l++ = '\0';
+        while (*l && apr_isspace(*l)) {
+            ++l;
+        }
+
+        apr_table_addn(table, line, l);
+    }
+    return APR_EGENERAL;
+}
+
+static apr_size_t table_size(apr_table_t *table)
+{
+    const apr_array_header_t *arr;
+    apr_table_entry_t *elts;
+    apr_size_t len = sizeof(CRLF) - 1;
+    int i;
+
+    if (table) {
+        arr = apr_table_elts(table);
+        elts = (apr_table_entry_t *) arr->elts;
+        for (i = 0; i < arr->nelts; ++i) {
+            if (elts[i].key != NULL) {
+                len += strlen(elts[i].key) + sizeof(": ") - 1
+                       + strlen(elts[i].val) + sizeof(CRLF) - 1;
+            }
+        }
+    }
+    return len;
+}
+
+static char *store_table(char *p, apr_table_t *table)
+{
+    const apr_array_header_t *arr;
+    apr_table_entry_t *elts;
+    apr_size_t len;
+    int i;
+
+    if (table) {
+        arr = apr_table_elts(table);
+        elts = (apr_table_entry_t *) arr->elts;
+        for (i = 0; i < arr->nelts; ++i) {
+            if (elts[i].key != NULL) {
+                len = strlen(elts[i].key);
+                memcpy(p, elts[i].key, len);
+                p += len;
+                *p++ = ':';
+                *p++ = ' ';
+                len = strlen(elts[i].val);
+                memcpy(p, elts[i].val, len);
+                p += len;
+                *p++ = CR;
+                *p++ = LF;
+            }
+        }
+    }
+    *p++ = CR;
+    *p++ = LF;
+    return p;
+}
+
+/*
+ * Hook and mod_cache callback functions
+ */
+static int create_entity(cache_handle_t *h, request_rec *r, const char *key,
+                         apr_off_t len, apr_bucket_brigade *bb)
+{
+    cache_socache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                    &cache_socache_module);
+    cache_object_t *obj;
+    cache_socache_object_t *sobj;
+
+    if (!socache_instance) {
+        return DECLINED;
+    }
+
+    /* we don't support caching of range requests (yet) */
+    if (r->status == HTTP_PARTIAL_CONTENT) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02317)
+                "URL %s partial content response not cached",
+                key);
+        return DECLINED;
+    }
+
+    /* Note, len is -1 if unknown so don't trust it too hard */
+    if (len > (apr_off_t)conf->max) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02318)
+                "URL %s failed the size check "
+                "(%" APR_OFF_T_FMT " > %" APR_SIZE_T_FMT ")",
+                key, len, conf->max);
+        return DECLINED;
+    }
+
+    /* Allocate and initialize cache_object_t and cache_socache_object_t */
+    h->cache_obj = obj = apr_pcalloc(r->pool, sizeof(*obj));
+    obj->vobj = sobj = apr_pcalloc(r->pool, sizeof(*sobj));
+
+    obj->key = apr_pstrdup(r->pool, key);
+
+    sobj->name = obj->key;
+    sobj->key = obj->key;
+    sobj->pool = r->pool;
+
+    /* the body is kept in memory until the commit, in one piece */
+    if (len > 0) {
+        sobj->body_size = (apr_size_t)len;
+        sobj->body = apr_palloc(sobj->pool, sobj->body_size);
+    }
+
+    sobj->socache_info.header_only = r->header_only;
+
+    return OK;
+}
+
+static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
+{
+    cache_socache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                    &cache_socache_module);
+    apr_uint32_t format;
+    apr_size_t len;
+    const char *nkey;
+    unsigned char *buf;
+    char *p, *end;
+    apr_status_t rc;
+    cache_object_t *obj;
+    cache_info *info;
+    cache_socache_object_t *sobj;
+
+    h->cache_obj = NULL;
+
+    if (!socache_instance) {
+        return DECLINED;
+    }
+
+    /* an object never is larger than this, see commit_entity() */
+    buf = lookup_buffer(r->connection, conf->max);
+
+    len = conf->max;
+    rc = socache_retrieve(r, key, buf, &len);
+    if (rc != APR_SUCCESS) {
+        return DECLINED;
+    }
+    if (len < sizeof(format)) {
+        return DECLINED;
+    }
+
+    /* read the format from the object */
+    memcpy(&format, buf, sizeof(format));
+
+    if (format == CACHE_SOCACHE_VARY_FORMAT_VERSION) {
+        apr_array_header_t* varray;
+
+        if (len < sizeof(format) + sizeof(apr_time_t)) {
+            return DECLINED;
+        }
+
+        /* the names are moved out of buf, which is reused below */
+        p = apr_pmemdup(r->pool, buf + sizeof(format) + sizeof(apr_time_t),
+                        len - sizeof(format) - sizeof(apr_time_t));
+        end = p + len - sizeof(format) - sizeof(apr_time_t);
+
+        varray = apr_array_make(r->pool, 5, sizeof(char*));
+        rc = read_array(&p, end, varray);
+        if (rc != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(02319)
+                    "Cannot parse vary entry for URL %s", key);
+            return DECLINED;
+        }
+
+        nkey = regen_key(r->pool, r->headers_in, varray, key);
+
+        len = conf->max;
+        rc = socache_retrieve(r, nkey, buf, &len);
+        if (rc != APR_SUCCESS) {
+            return DECLINED;
+        }
+        if (len < sizeof(format)) {
+            return DECLINED;
+        }
+        memcpy(&format, buf, sizeof(format));
+    }
+    else {
+        nkey = key;
+    }
+
+    /* a hit, which outlives the lookup buffer */
+    buf = apr_pmemdup(r->pool, buf, len);
+
+    if (format != CACHE_SOCACHE_FORMAT_VERSION) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02320)
+                "Cache entry for URL %s has a version mismatch. "
+                "Entry had version: %d.", nkey, format);
+        return DECLINED;
+    }
+
+    /* Create and init the cache object */
+    obj = apr_pcalloc(r->pool, sizeof(cache_object_t));
+    sobj = apr_pcalloc(r->pool, sizeof(cache_socache_object_t));
+
+    info = &(obj->info);
+
+    obj->key = nkey;
+    sobj->key = nkey;
+    sobj->name = key;
+    sobj->pool = r->pool;
+
+    if (len < sizeof(cache_socache_info_t)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02321)
+                "Cache entry for URL %s is truncated", nkey);
+        return DECLINED;
+    }
+    memcpy(&sobj->socache_info, buf, sizeof(cache_socache_info_t));
+    p = (char *)buf + sizeof(cache_socache_info_t);
+    end = (char *)buf + len;
+
+    if (sobj->socache_info.name_len > (apr_size_t)(end - p)
+        || sobj->socache_info.body_len > (apr_size_t)(end - p)
+                                         - sobj->socache_info.name_len) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02322)
+                "Cache entry for URL %s is truncated", nkey);
+        return DECLINED;
+    }
+
+    /* check that we have the same URL */
+    if (sobj->socache_info.name_len != strlen(key)
+        || memcmp(p, key, sobj->socache_info.name_len)) {
+        return DECLINED;
+    }
+    p += sobj->socache_info.name_len;
+
+    /* Is this a cached HEAD request? */
+    if (sobj->socache_info.header_only && !r->header_only) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02323)
+                "HEAD request cached, non-HEAD requested, ignoring: %s",
+                nkey);
+        return DECLINED;
+    }
+
+    sobj->hdrs = p;
+    sobj->hdrs_len = (end - p) - sobj->socache_info.body_len;
+    sobj->body = end - sobj->socache_info.body_len;
+    sobj->body_len = sobj->socache_info.body_len;
+    sobj->done = 1;
+
+    /* Store it away so we can get it later. */
+    info->status = sobj->socache_info.status;
+    info->date = sobj->socache_info.date;
+    info->expire = sobj->socache_info.expire;
+    info->request_time = sobj->socache_info.request_time;
+    info->response_time = sobj->socache_info.response_time;
+
+    memcpy(&info->control, &sobj->socache_info.control,
+           sizeof(cache_control_t));
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02324)
+            "Recalled cached URL info header %s", sobj->name);
+
+    /* make the configuration stick */
+    h->cache_obj = obj;
+    obj->vobj = sobj;
+
+    return OK;
+}
+
+static int remove_entity(cache_handle_t *h)
+{
+    /* Null out the cache object pointer so next time we start from scratch  */
+    h->cache_obj = NULL;
+    return OK;
+}
+
+static int remove_url(cache_handle_t *h, request_rec *r)
+{
+    cache_socache_object_t *sobj;
+
+    sobj = (cache_socache_object_t *) h->cache_obj->vobj;
+    if (!sobj) {
+        return DECLINED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02325)
+            "Deleting %s from cache.", sobj->key);
+
+    socache_remove(r, sobj->key);
+
+    return OK;
+}
+
+static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
+{
+    cache_socache_object_t *sobj = (cache_socache_object_t *) h->cache_obj->vobj;
+    char *p, *end;
+
+    /* This case should not happen... */
+    if (!sobj->hdrs) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02326)
+                "recalling headers; but no headers for %s", sobj->name);
+        return APR_NOTFOUND;
+    }
+
+    h->req_hdrs = apr_table_make(r->pool, 20);
+    h->resp_hdrs = apr_table_make(r->pool, 20);
+
+    /* the header lines are terminated in place, the body is behind them */
+    p = sobj->hdrs;
+    end = p + sobj->hdrs_len;
+    if (read_table(&p, end, h->resp_hdrs) != APR_SUCCESS
+        || read_table(&p, end, h->req_hdrs) != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02327)
+                "Premature end of cache headers for %s", sobj->name);
+    }
+    sobj->hdrs = NULL;
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02328)
+            "Recalled headers for URL %s", sobj->name);
+    return APR_SUCCESS;
+}
+
+static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_brigade *bb)
+{
+    cache_socache_object_t *sobj = (cache_socache_object_t*) h->cache_obj->vobj;
+    apr_bucket *e;
+
+    if (sobj->body_len) {
+        e = apr_bucket_pool_create(sobj->body, sobj->body_len, sobj->pool,
+                                   bb->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, e);
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_headers(cache_handle_t *h, request_rec *r, cache_info *info)
+{
+    cache_socache_object_t *sobj = (cache_socache_object_t*) h->cache_obj->vobj;
+
+    memcpy(&h->cache_obj->info, info, sizeof(cache_info));
+
+    if (r->headers_out) {
+        sobj->headers_out = ap_cache_cacheable_headers_out(r);
+    }
+
+    if (r->headers_in) {
+        sobj->headers_in = ap_cache_cacheable_headers_in(r);
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_body(cache_handle_t *h, request_rec *r,
+                               apr_bucket_brigade *in, apr_bucket_brigade *out)
+{
+    cache_socache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                    &cache_socache_module);
+    cache_socache_object_t *sobj = (cache_socache_object_t *) h->cache_obj->vobj;
+    apr_bucket *e;
+    apr_status_t rv = APR_SUCCESS;
+    int seen_eos = 0;
+
+    while (!APR_BRIGADE_EMPTY(in)) {
+        const char *str;
+        apr_size_t length;
+
+        e = APR_BRIGADE_FIRST(in);
+
+        /* are we done completely? if so, pass any trailing buckets right through */
+        if (sobj->done || sobj->failed) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* have we seen eos yet? */
+        if (APR_BUCKET_IS_EOS(e)) {
+            seen_eos = 1;
+            sobj->done = 1;
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* honour flush buckets, we'll get called again */
+        if (APR_BUCKET_IS_FLUSH(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* metadata buckets are preserved as is */
+        if (APR_BUCKET_IS_METADATA(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* read the bucket, copy it to the body */
+        rv = apr_bucket_read(e, &str, &length, APR_BLOCK_READ);
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(out, e);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02329)
+                    "Error when reading bucket for URL %s",
+                    h->cache_obj->key);
+            sobj->failed = 1;
+            return rv;
+        }
+
+        /* don't copy empty buckets */
+        if (!length) {
+            continue;
+        }
+
+        if (length > conf->max - sobj->body_len) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02330)
+                    "URL %s failed the size check "
+                    "(%" APR_SIZE_T_FMT ">%" APR_SIZE_T_FMT ")",
+                    h->cache_obj->key, sobj->body_len + length, conf->max);
+            sobj->failed = 1;
+            return APR_EGENERAL;
+        }
+
+        /* grow the body by doubling, up to the maximum size */
+        if (sobj->body_len + length > sobj->body_size) {
+            apr_size_t size = sobj->body_size ? sobj->body_size : 8192;
+            char *body;
+
+            while (size < sobj->body_len + length) {
+                size *= 2;
+            }
+            if (size > conf->max) {
+                size = conf->max;
+            }
+            body = apr_palloc(sobj->pool, size);
+            if (sobj->body_len) {
+                memcpy(body, sobj->body, sobj->body_len);
+            }
+            sobj->body = body;
+            sobj->body_size = size;
+        }
+        memcpy(sobj->body + sobj->body_len, str, length);
+        sobj->body_len += length;
+    }
+
+    /* Was this the final bucket? If yes, perform sanity checks.
+     */
+    if (seen_eos) {
+        const char *cl_header = apr_table_get(r->headers_out, "Content-Length");
+
+        if (r->connection->aborted || r->no_cache) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(02331)
+                    "Discarding body for URL %s "
+                    "because connection has been aborted.",
+                    h->cache_obj->key);
+            sobj->failed = 1;
+            return APR_EGENERAL;
+        }
+        if (cl_header) {
+            apr_int64_t cl = apr_atoi64(cl_header);
+            if ((errno == 0) && ((apr_int64_t)sobj->body_len != cl)) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02332)
+                        "URL %s didn't receive complete response, not caching",
+                        h->cache_obj->key);
+                sobj->failed = 1;
+                return APR_EGENERAL;
+            }
+        }
+
+        /* All checks were fine, we're good to go when the commit comes */
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_vary(cache_handle_t *h, request_rec *r,
+                               apr_time_t expire)
+{
+    cache_socache_object_t *sobj = (cache_socache_object_t*) h->cache_obj->vobj;
+    apr_array_header_t* varray;
+    apr_uint32_t format = CACHE_SOCACHE_VARY_FORMAT_VERSION;
+    const char **elts;
+    apr_size_t len;
+    char *buf, *p;
+    int i;
+
+    varray = apr_array_make(r->pool, 6, sizeof(char*));
+    tokens_to_array(r->pool, apr_table_get(sobj->headers_out, "Vary"),
+                    varray);
+
+    elts = (const char **) varray->elts;
+    len = sizeof(format) + sizeof(h->cache_obj->info.expire)
+          + sizeof(CRLF) - 1;
+    for (i = 0; i < varray->nelts; i++) {
+        len += strlen(elts[i]) + sizeof(CRLF) - 1;
+    }
+
+    p = buf = apr_palloc(r->pool, len);
+    memcpy(p, &format, sizeof(format));
+    p += sizeof(format);
+    memcpy(p, &h->cache_obj->info.expire, sizeof(h->cache_obj->info.expire));
+    p += sizeof(h->cache_obj->info.expire);
+    for (i = 0; i < varray->nelts; i++) {
+        apr_size_t n = strlen(elts[i]);
+        memcpy(p, elts[i], n);
+        p += n;
+        *p++ = CR;
+        *p++ = LF;
+    }
+    *p++ = CR;
+    *p++ = LF;
+
+    sobj->key = regen_key(r->pool, sobj->headers_in, varray, sobj->name);
+
+    return socache_store(r, sobj->name, expire, (unsigned char *)buf, len);
+}
+
+static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
+{
+    cache_socache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                    &cache_socache_module);
+    cache_socache_object_t *sobj = (cache_socache_object_t *) h->cache_obj->vobj;
+    cache_socache_info_t socache_info;
+    apr_time_t expire;
+    apr_size_t len;
+    char *buf, *p;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (sobj->failed) {
+        return APR_SUCCESS;
+    }
+
+    memset(&socache_info, 0, sizeof(cache_socache_info_t));
+
+    socache_info.format = CACHE_SOCACHE_FORMAT_VERSION;
+    socache_info.date = h->cache_obj->info.date;
+    socache_info.expire = h->cache_obj->info.expire;
+    socache_info.request_time = h->cache_obj->info.request_time;
+    socache_info.response_time = h->cache_obj->info.response_time;
+    socache_info.status = h->cache_obj->info.status;
+    socache_info.header_only = sobj->socache_info.header_only;
+    socache_info.name_len = strlen(sobj->name);
+    socache_info.body_len = sobj->body_len;
+
+    memcpy(&socache_info.control, &h->cache_obj->info.control,
+           sizeof(cache_control_t));
+
+    len = sizeof(cache_socache_info_t) + socache_info.name_len
+          + table_size(sobj->headers_out) + table_size(sobj->headers_in)
+          + socache_info.body_len;
+    if (len > conf->max) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02333)
+                "URL %s failed the size check "
+                "(%" APR_SIZE_T_FMT ">%" APR_SIZE_T_FMT ")",
+                sobj->name, len, conf->max);
+        /* the entry would not be refreshed, stale as it may be */
+        remove_url(h, r);
+        return APR_SUCCESS;
+    }
+
+    expire = socache_expiry(conf, socache_info.expire);
+
+    if (sobj->headers_out && apr_table_get(sobj->headers_out, "Vary")) {
+        rv = store_vary(h, r, expire);
+    }
+    else {
+        sobj->key = sobj->name;
+    }
+
+    if (APR_SUCCESS == rv) {
+        p = buf = apr_palloc(r->pool, len);
+        memcpy(p, &socache_info, sizeof(cache_socache_info_t));
+        p += sizeof(cache_socache_info_t);
+        memcpy(p, sobj->name, socache_info.name_len);
+        p += socache_info.name_len;
+        p = store_table(p, sobj->headers_out);
+        p = store_table(p, sobj->headers_in);
+        if (socache_info.body_len) {
+            memcpy(p, sobj->body, socache_info.body_len);
+        }
+
+        rv = socache_store(r, sobj->key, expire, (unsigned char *)buf, len);
+    }
+
+    /* remove the cached items completely on any failure */
+    if (APR_SUCCESS != rv) {
+        remove_url(h, r);
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02334)
+                "commit_entity: URL '%s' not cached due to earlier socache "
+                "error.", sobj->name);
+    }
+    else {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02335)
+                "commit_entity: Headers and body for URL %s cached.",
+                sobj->name);
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t invalidate_entity(cache_handle_t *h, request_rec *r)
+{
+    return APR_ENOTIMPL;
+}
+
+static void *create_config(apr_pool_t *p, server_rec *s)
+{
+    cache_socache_conf *conf = apr_pcalloc(p, sizeof(cache_socache_conf));
+
+    conf->max = DEFAULT_MAX_SIZE;
+    conf->maxtime = DEFAULT_MAXTIME;
+    conf->mintime = DEFAULT_MINTIME;
+
+    return conf;
+}
+
+static void *merge_config(apr_pool_t *p, void *basev, void *addv)
+{
+    cache_socache_conf *new = (cache_socache_conf *)apr_pcalloc(p, sizeof(cache_socache_conf));
+    cache_socache_conf *add = (cache_socache_conf *) addv;
+    cache_socache_conf *base = (cache_socache_conf *) basev;
+
+    new->max = (add->max_set == 0) ? base->max : add->max;
+    new->max_set = add->max_set || base->max_set;
+    new->maxtime = (add->maxtime_set == 0) ? base->maxtime : add->maxtime;
+    new->maxtime_set = add->maxtime_set || base->maxtime_set;
+    new->mintime = (add->mintime_set == 0) ? base->mintime : add->mintime;
+    new->mintime_set = add->mintime_set || base->mintime_set;
+
+    return new;
+}
+
+static const char *set_cache_socache(cmd_parms *cmd, void *in_struct_ptr,
+                                     const char *arg)
+{
+    const char *errmsg = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    const char *sep, *name;
+
+    if (errmsg) {
+        return errmsg;
+    }
+
+    /* Argument is of form 'name:args' or just 'name'. */
+    sep = ap_strchr_c(arg, ':');
+    if (sep) {
+        name = apr_pstrmemdup(cmd->pool, arg, sep - arg);
+        sep++;
+    }
+    else {
+        name = arg;
+    }
+
+    socache_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                          AP_SOCACHE_PROVIDER_VERSION);
+    if (socache_provider == NULL) {
+        return apr_psprintf(cmd->pool,
+                            "Unknown socache provider '%s'. Maybe you need "
+                            "to load the appropriate socache module "
+                            "(mod_socache_%s?)", name, name);
+    }
+
+    errmsg = socache_provider->create(&socache_instance, sep,
+                                      cmd->temp_pool, cmd->pool);
+    if (errmsg) {
+        return apr_psprintf(cmd->pool, "CacheSocache: %s", errmsg);
+    }
+    return NULL;
+}
+
+static const char *set_cache_max_size(cmd_parms *cmd, void *in_struct_ptr,
+                                      const char *arg)
+{
+    cache_socache_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                    &cache_socache_module);
+    apr_off_t max;
+
+    if (apr_strtoff(&max, arg, NULL, 10) != APR_SUCCESS
+        || max < 1024 || max > APR_SIZE_MAX) {
+        return "CacheSocacheMaxSize argument must be a number of bytes, "
+               "1024 at least";
+    }
+    conf->max = (apr_size_t)max;
+    conf->max_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_maxtime(cmd_parms *cmd, void *in_struct_ptr,
+                                     const char *arg)
+{
+    cache_socache_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                    &cache_socache_module);
+    apr_off_t seconds;
+
+    if (apr_strtoff(&seconds, arg, NULL, 10) != APR_SUCCESS || seconds < 0) {
+        return "CacheSocacheMaxTime argument must be a positive number of "
+               "seconds";
+    }
+    conf->maxtime = apr_time_from_sec(seconds);
+    conf->maxtime_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_mintime(cmd_parms *cmd, void *in_struct_ptr,
+                                     const char *arg)
+{
+    cache_socache_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                    &cache_socache_module);
+    apr_off_t seconds;
+
+    if (apr_strtoff(&seconds, arg, NULL, 10) != APR_SUCCESS || seconds < 0) {
+        return "CacheSocacheMinTime argument must be a positive number of "
+               "seconds";
+    }
+    conf->mintime = apr_time_from_sec(seconds);
+    conf->mintime_set = 1;
+    return NULL;
+}
+
+static const command_rec cache_socache_cmds[] =
+{
+    AP_INIT_TAKE1("CacheSocache", set_cache_socache, NULL, RSRC_CONF,
+                  "The shared object cache to store cache entities in, as "
+                  "type[:args]"),
+    AP_INIT_TAKE1("CacheSocacheMaxSize", set_cache_max_size, NULL, RSRC_CONF,
+                  "The maximum size of a cache entity, headers and body "
+                  "included, in bytes"),
+    AP_INIT_TAKE1("CacheSocacheMaxTime", set_cache_maxtime, NULL, RSRC_CONF,
+                  "The maximum time a cache entity is kept, in seconds"),
+    AP_INIT_TAKE1("CacheSocacheMinTime", set_cache_mintime, NULL, RSRC_CONF,
+                  "The minimum time a cache entity is kept, in seconds, even "
+                  "once stale"),
+    {NULL}
+};
+
+static const cache_provider cache_socache_provider =
+{
+    &remove_entity,
+    &store_headers,
+    &store_body,
+    &recall_headers,
+    &recall_body,
+    &create_entity,
+    &open_entity,
+    &remove_url,
+    &commit_entity,
+    &invalidate_entity
+};
+
+static int socache_precfg(apr_pool_t *pconf, apr_pool_t *plog,
+                          apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, cache_socache_id, NULL,
+                                        APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02336)
+                      "failed to register %s mutex", cache_socache_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    socache_provider = NULL;
+    socache_instance = NULL;
+    socache_mutex = NULL;
+    return OK;
+}
+
+static int socache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                               apr_pool_t *ptmp, server_rec *base_server)
+{
+    struct ap_socache_hints socache_hints;
+    apr_size_t max = 0;
+    server_rec *s;
+    apr_status_t rv;
+
+    if (!socache_instance) {
+        return OK;    /* don't waste the overhead of creating mutex & cache */
+    }
+
+    if (socache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&socache_mutex, NULL, cache_socache_id,
+                                    NULL, base_server, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02337)
+                          "failed to create %s mutex", cache_socache_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        apr_pool_cleanup_register(pconf, NULL, remove_lock,
+                                  apr_pool_cleanup_null);
+    }
+
+    /* the instance is shared by all virtual hosts, size it for the one
+     * allowing the largest objects
+     */
+    for (s = base_server; s; s = s->next) {
+        cache_socache_conf *conf = ap_get_module_config(s->module_config,
+                                                        &cache_socache_module);
+        if (conf->max > max) {
+            max = conf->max;
+        }
+    }
+
+    socache_hints.avg_id_len = 64;
+    socache_hints.avg_obj_size = max / 4;
+    socache_hints.expiry_interval = apr_time_from_sec(60);
+
+    rv = socache_provider->init(socache_instance, "mod_cache_socache",
+                                &socache_hints, base_server, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02338)
+                      "failed to initialise %s cache", cache_socache_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    apr_pool_cleanup_register(pconf, (void*)base_server, destroy_cache,
+                              apr_pool_cleanup_null);
+
+    return OK;
+}
+
+static void socache_child_init(apr_pool_t *p, server_rec *s)
+{
+    const char *lock;
+    apr_status_t rv;
+
+    if (!socache_mutex) {
+        return;       /* don't waste the overhead of creating mutex & cache */
+    }
+    lock = apr_global_mutex_lockfile(socache_mutex);
+    rv = apr_global_mutex_child_init(&socache_mutex, lock, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02339)
+                     "failed to initialise mutex in child_init");
+    }
+}
+
+static void cache_socache_register_hook(apr_pool_t *p)
+{
+    /* cache initializer */
+    ap_register_provider(p, CACHE_PROVIDER_GROUP, "socache", "0",
+                         &cache_socache_provider);
+    ap_hook_pre_config(socache_precfg, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(socache_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(socache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(cache_socache) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,                       /* create per-directory config structure */
+    NULL,                       /* merge per-directory config structures */
+    create_config,              /* create per-server config structure */
+    merge_config,               /* merge per-server config structures */
+    cache_socache_cmds,         /* command apr_table_t */
+    cache_socache_register_hook /* register hooks */
+};
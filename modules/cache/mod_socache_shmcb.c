@@ -24,10 +24,21 @@
 #include "apr_strings.h"
 #include "apr_time.h"
 #include "apr_shm.h"
+#include "apr_atomic.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_general.h"
 
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>         /* for getpid() */
+#endif
+#if APR_HAVE_SIGNAL_H
+#include <signal.h>         /* for kill() */
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
 #include "ap_socache.h"
 
 #define SHMCB_MAX_SIZE (64 * 1024 * 1024)
@@ -36,6 +47,38 @@
 
 #define DEFAULT_SHMCB_SUFFIX ".cache"
 
+/* Attempts at taking a subcache lock, or at reading a subcache without
+ * a writer getting in the way, before sleeping between attempts, and
+ * before giving up */
+#define SHMCB_SPINS     100
+#define SHMCB_TRIES     10100
+#define SHMCB_DELAY     100     /* usecs */
+
+/* The readers of a subcache never write to the shared memory: they load
+ * 'seq' with acquire semantics, copy the entry out, and load 'seq' again
+ * after a read barrier.  Without the compiler builtins the barrier is a
+ * compare-and-swap of a variable on the reader's stack, which does not
+ * bounce any shared cache line either. */
+#if defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define SHMCB_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SHMCB_READ_BARRIER() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+static APR_INLINE void shmcb_read_barrier(void)
+{
+    apr_uint32_t local = 0;
+    apr_atomic_cas32(&local, 0, 0);
+}
+static APR_INLINE apr_uint32_t shmcb_load_acquire(apr_uint32_t *p)
+{
+    apr_uint32_t v = *(volatile apr_uint32_t *)p;
+    shmcb_read_barrier();
+    return v;
+}
+#define SHMCB_LOAD_ACQUIRE(p) shmcb_load_acquire(p)
+#define SHMCB_READ_BARRIER() shmcb_read_barrier()
+#endif
+
 /*
  * Header structure - the start of the shared-mem segment
  */
@@ -70,6 +113,10 @@ typedef struct {
     unsigned int idx_pos, idx_used;
     /* Same for the data area */
     unsigned int data_pos, data_used;
+    /* Taken by the writers of the subcache, holding the pid of the owner,
+     * which make 'seq' odd while they change it so that the readers know
+     * to try again */
+    apr_uint32_t lock, seq;
 } SHMCBSubcache;
 
 /*
@@ -135,6 +182,20 @@ struct ap_socache_instance_t {
  * idx1 = { data_pos = 0, data_used = 3, id_len = 1, ...}
  * idx2 = { data_pos = 3, data_used = 3, id_len = 1, ...}
  * ...
+ *
+ * Each subcache is locked on its own, so that the provider is safe to
+ * use from multiple processes and threads without a global mutex.
+ * Stores, removes, status and iteration take the lock of the subcache,
+ * with an atomic spinlock in the shared memory segment, and increment
+ * its sequence number before and after changing it.  Retrieves don't
+ * take any lock: they read the subcache optimistically and start over
+ * if the sequence number was odd or has changed meanwhile (a seqlock),
+ * so they never wait for each other.  While being changed, the subcache
+ * may be seen inconsistent by a retrieve, which checks every position
+ * and length it reads against the size of the subcache before use.
+ *
+ * The statistics in the header are not protected, concurrent updates
+ * may get lost.
  */
 
 /* This macro takes a pointer to the header and a zero-based index and returns
@@ -233,6 +294,72 @@ static int shmcb_cyclic_memcmp(unsigned int buf_size, unsigned char *data,
     }
 }
 
+/* The value of the subcache locks taken by this process */
+static apr_uint32_t shmcb_owner(void)
+{
+#ifdef WIN32
+    return 1;
+#else
+    return (apr_uint32_t)getpid();
+#endif
+}
+
+/* Whether the owner of a subcache lock died while holding it */
+static int shmcb_owner_dead(apr_uint32_t owner)
+{
+#ifdef WIN32
+    /* A single child process, which creates its own segment */
+    return 0;
+#else
+    return owner && kill((pid_t)owner, 0) < 0 && errno == ESRCH;
+#endif
+}
+
+/* Take the lock of a subcache, to change it.  Returns zero on success,
+ * non-zero if the lock could not be taken in time.  A lock whose holder
+ * died is taken over, and the subcache emptied if it was left half
+ * changed (odd 'seq'). */
+static int shmcb_subcache_lock(server_rec *s, SHMCBSubcache *subcache)
+{
+    apr_uint32_t self = shmcb_owner(), owner;
+    unsigned int tries;
+
+    for (tries = 0; tries < SHMCB_TRIES; tries++) {
+        owner = apr_atomic_cas32(&subcache->lock, self, 0);
+        if (owner == 0) {
+            /* odd: the readers try again */
+            apr_atomic_inc32(&subcache->seq);
+            return 0;
+        }
+        if (tries >= SHMCB_SPINS) {
+            if (shmcb_owner_dead(owner)
+                && apr_atomic_cas32(&subcache->lock, self, owner) == owner) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(02355)
+                             "process %" APR_UINT64_T_FMT " died holding "
+                             "an socache subcache lock, recovering",
+                             (apr_uint64_t)owner);
+                if (apr_atomic_read32(&subcache->seq) & 1) {
+                    /* the changes were not finished, start over */
+                    subcache->idx_pos = subcache->idx_used = 0;
+                    subcache->data_pos = subcache->data_used = 0;
+                }
+                else {
+                    apr_atomic_inc32(&subcache->seq);
+                }
+                return 0;
+            }
+            apr_sleep(SHMCB_DELAY);
+        }
+    }
+    return -1;
+}
+
+static void shmcb_subcache_unlock(SHMCBSubcache *subcache)
+{
+    /* even again, after the changes are visible (full barrier) */
+    apr_atomic_inc32(&subcache->seq);
+    apr_atomic_set32(&subcache->lock, 0);
+}
 
 /* Prototypes for low-level subcache operations */
 static void shmcb_subcache_expire(server_rec *, SHMCBHeader *, SHMCBSubcache *,
@@ -445,6 +572,7 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
         subcache->idx_pos = subcache->idx_used = 0;
         subcache->data_pos = subcache->data_used = 0;
+        subcache->lock = subcache->seq = 0;
     }
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(00830)
                  "Shared memory socache initialised");
@@ -481,13 +609,20 @@ static apr_status_t socache_shmcb_store(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    if (shmcb_subcache_lock(s, subcache)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(02351)
+                     "can't lock the subcache to store an socache entry");
+        return APR_EAGAIN;
+    }
     tryreplace = shmcb_subcache_remove(s, header, subcache, id, idlen);
     if (shmcb_subcache_store(s, header, subcache, encoded,
                              len_encoded, id, idlen, expiry)) {
+        shmcb_subcache_unlock(subcache);
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00833)
                      "can't store an socache entry!");
         return APR_ENOSPC;
     }
+    shmcb_subcache_unlock(subcache);
     if (tryreplace == 0) {
         header->stat_replaced++;
     }
@@ -542,6 +677,11 @@ static apr_status_t socache_shmcb_remove(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    if (shmcb_subcache_lock(s, subcache)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(02352)
+                     "can't lock the subcache to remove an socache entry");
+        return APR_EAGAIN;
+    }
     if (shmcb_subcache_remove(s, header, subcache, id, idlen) == 0) {
         header->stat_removes_hit++;
         rv = APR_SUCCESS;
@@ -549,6 +689,7 @@ static apr_status_t socache_shmcb_remove(ap_socache_instance_t *ctx,
         header->stat_removes_miss++;
         rv = APR_NOTFOUND;
     }
+    shmcb_subcache_unlock(subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00839)
                  "leaving socache_shmcb_remove successfully");
 
@@ -568,12 +709,15 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
 
     AP_DEBUG_ASSERT(header->subcache_num > 0);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00840) "inside shmcb_status");
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
+    /* Lock each subcache in turn to avoid corruption or invalid pointer
+     * arithmetic. The rest of our logic uses read-only header data so
      * doesn't need the lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        if (shmcb_subcache_lock(s, subcache)) {
+            continue;
+        }
         shmcb_subcache_expire(s, header, subcache, now);
         total += subcache->idx_used;
         cache_total += subcache->data_used;
@@ -588,6 +732,7 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
             else
                 min_expiry = ((idx_expiry < min_expiry) ? idx_expiry : min_expiry);
         }
+        shmcb_subcache_unlock(subcache);
     }
     index_pct = (100 * total) / (header->index_num *
                                  header->subcache_num);
@@ -642,14 +787,21 @@ static apr_status_t socache_shmcb_iterate(ap_socache_instance_t *instance,
     apr_size_t buflen = 0;
     unsigned char *buf = NULL;
 
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
+    /* Lock each subcache in turn to avoid corruption or invalid pointer
+     * arithmetic. The rest of our logic uses read-only header data so
+     * doesn't need the lock. The iterator is called with the subcache
+     * locked, it must not store into or remove from this cache. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num && rv == APR_SUCCESS; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        if (shmcb_subcache_lock(s, subcache)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(02353)
+                         "can't lock subcache %u to iterate", loop);
+            return APR_EAGAIN;
+        }
         rv = shmcb_subcache_iterate(instance, s, userctx, header, subcache,
                                     iterator, &buf, &buflen, pool, now);
+        shmcb_subcache_unlock(subcache);
     }
     return rv;
 }
@@ -808,61 +960,120 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
     return 0;
 }
 
-static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
-                                   SHMCBSubcache *subcache,
-                                   const unsigned char *id, unsigned int idlen,
-                                   unsigned char *dest, unsigned int *destlen)
+/* Look for the id in a subcache which may be changed meanwhile, so
+ * every value read is checked before it is used.  Returns zero if found,
+ * with the data copied to dest, 1 if found expired, -1 otherwise. */
+static int shmcb_subcache_find(SHMCBHeader *header, SHMCBSubcache *subcache,
+                               const unsigned char *id, unsigned int idlen,
+                               unsigned char *dest, unsigned int *destlen,
+                               unsigned int *match, apr_time_t now)
 {
-    unsigned int pos;
+    volatile SHMCBSubcache *vsubcache = subcache;
+    unsigned int index_num = header->index_num;
+    unsigned int data_size = header->subcache_data_size;
+    unsigned int pos = vsubcache->idx_pos;
+    unsigned int used = vsubcache->idx_used;
     unsigned int loop = 0;
-    apr_time_t now = apr_time_now();
 
-    pos = subcache->idx_pos;
+    if (pos >= index_num || used > index_num) {
+        return -1;
+    }
 
-    while (loop < subcache->idx_used) {
-        SHMCBIndex *idx = SHMCB_INDEX(subcache, pos);
+    while (loop < used) {
+        /* volatile, the values checked are the values used */
+        volatile SHMCBIndex *idx = SHMCB_INDEX(subcache, pos);
+        unsigned int data_pos = idx->data_pos;
+        unsigned int data_used = idx->data_used;
+        unsigned int id_len = idx->id_len;
 
         /* Only consider 'idx' if the id matches, and the "removed"
          * flag isn't set, and the record is not expired.
-         * Check the data length too to avoid a buffer overflow
-         * in case of corruption, which should be impossible,
-         * but it's cheap to be safe. */
+         * Check the data length too to avoid a buffer overflow,
+         * the index may be half written. */
         if (!idx->removed
-            && idx->id_len == idlen
-            && (idx->data_used - idx->id_len) <= *destlen
-            && shmcb_cyclic_memcmp(header->subcache_data_size,
-                                   SHMCB_DATA(header, subcache),
-                                   idx->data_pos, id, idx->id_len) == 0) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00849)
-                         "match at idx=%d, data=%d", pos, idx->data_pos);
+            && id_len == idlen
+            && data_pos < data_size
+            && data_used <= data_size
+            && id_len <= data_used
+            && (data_used - id_len) <= *destlen
+            && shmcb_cyclic_memcmp(data_size, SHMCB_DATA(header, subcache),
+                                   data_pos, id, id_len) == 0) {
+            *match = pos;
             if (idx->expires > now) {
-                unsigned int data_offset;
-
                 /* Find the offset of the data segment, after the id */
-                data_offset = SHMCB_CYCLIC_INCREMENT(idx->data_pos,
-                                                     idx->id_len,
-                                                     header->subcache_data_size);
+                unsigned int data_offset = SHMCB_CYCLIC_INCREMENT(data_pos,
+                                                                  id_len,
+                                                                  data_size);
 
-                *destlen = idx->data_used - idx->id_len;
+                *destlen = data_used - id_len;
 
                 /* Copy out the data */
-                shmcb_cyclic_cton_memcpy(header->subcache_data_size,
-                                         dest, SHMCB_DATA(header, subcache),
+                shmcb_cyclic_cton_memcpy(data_size, dest,
+                                         SHMCB_DATA(header, subcache),
                                          data_offset, *destlen);
 
                 return 0;
             }
-            else {
-                /* Already stale, quietly remove and treat as not-found */
-                idx->removed = 1;
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00850)
-                             "shmcb_subcache_retrieve discarding expired entry");
-                return -1;
-            }
+            /* Already stale, the expiry reclaims it */
+            return 1;
         }
         /* Increment */
         loop++;
-        pos = SHMCB_CYCLIC_INCREMENT(pos, 1, header->index_num);
+        pos = SHMCB_CYCLIC_INCREMENT(pos, 1, index_num);
+    }
+
+    return -1;
+}
+
+static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
+                                   SHMCBSubcache *subcache,
+                                   const unsigned char *id, unsigned int idlen,
+                                   unsigned char *dest, unsigned int *destlen)
+{
+    unsigned int tries, len, match = 0;
+    apr_uint32_t seq;
+    apr_time_t now = apr_time_now();
+    int rv;
+
+    for (tries = 0; tries < SHMCB_TRIES; tries++) {
+        if (tries >= SHMCB_SPINS) {
+            apr_sleep(SHMCB_DELAY);
+        }
+
+        /* odd while a writer changes the subcache */
+        seq = SHMCB_LOAD_ACQUIRE(&subcache->seq);
+        if (seq & 1) {
+            /* the writer may be dead, the next one recovers the lock */
+            if (tries >= SHMCB_SPINS
+                && shmcb_owner_dead(apr_atomic_read32(&subcache->lock))
+                && !shmcb_subcache_lock(s, subcache)) {
+                shmcb_subcache_unlock(subcache);
+            }
+            continue;
+        }
+
+        len = *destlen;
+        rv = shmcb_subcache_find(header, subcache, id, idlen, dest, &len,
+                                 &match, now);
+
+        /* unchanged meanwhile? */
+        SHMCB_READ_BARRIER();
+        if (*(volatile apr_uint32_t *)&subcache->seq != seq) {
+            continue;
+        }
+
+        if (rv == 0) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00849)
+                         "match at idx=%d", match);
+            *destlen = len;
+            return 0;
+        }
+        if (rv > 0) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00850)
+                         "shmcb_subcache_retrieve discarding expired entry");
+            return -1;
+        }
+        break;
     }
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00851)
@@ -992,7 +1203,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
 
 static const ap_socache_provider_t socache_shmcb = {
     "shmcb",
-    AP_SOCACHE_FLAG_NOTMPSAFE,
+    0,
     socache_shmcb_create,
     socache_shmcb_init,
     socache_shmcb_destroy,
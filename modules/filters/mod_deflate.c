@@ -43,6 +43,7 @@
 #include "util_filter.h"
 #include "apr_buckets.h"
 #include "http_request.h"
+#include "http_protocol.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 
@@ -585,7 +586,7 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         if (!apr_table_get(r->subprocess_env, "force-gzip")) {
             const char *accepts;
             /* if they don't have the line, then they can't play */
-            accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+            accepts = ap_get_header_in(r, AP_HEADER_ACCEPT_ENCODING);
             if (accepts == NULL) {
                 ap_remove_output_filter(f);
                 return ap_pass_brigade(f->next, bb);
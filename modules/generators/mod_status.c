@@ -191,6 +191,8 @@ static int status_handler(request_rec *r)
     unsigned long lres, my_lres, conn_lres;
     apr_off_t bytes, my_bytes, conn_bytes;
     apr_off_t bcount, kbcount;
+    unsigned long wcount, wiovecs;
+    apr_off_t wbytes;
     long req_time;
     int short_report;
     int no_table_report;
@@ -231,6 +233,9 @@ static int status_handler(request_rec *r)
     count = 0;
     bcount = 0;
     kbcount = 0;
+    wcount = 0;
+    wiovecs = 0;
+    wbytes = 0;
     short_report = 0;
     no_table_report = 0;
 
@@ -343,6 +348,10 @@ static int status_handler(request_rec *r)
                 lres = ws_record->access_count;
                 bytes = ws_record->bytes_served;
 
+                wcount += ws_record->write_count;
+                wiovecs += ws_record->write_iovecs;
+                wbytes += ws_record->write_bytes;
+
                 if (lres != 0 || (res != SERVER_READY && res != SERVER_DEAD)) {
 #ifdef HAVE_TIMES
                     tmp_tu = ws_record->times.tms_utime;
@@ -445,6 +454,13 @@ static int status_handler(request_rec *r)
             if (count > 0)
                 ap_rprintf(r, "BytesPerReq: %g\n",
                            KBYTE * (float) kbcount / (float) count);
+            if (wcount > 0) {
+                ap_rprintf(r, "Writes: %lu\n", wcount);
+                ap_rprintf(r, "IovecsPerWrite: %g\n",
+                           (float) wiovecs / (float) wcount);
+                ap_rprintf(r, "BytesPerWrite: %g\n",
+                           (float) wbytes / (float) wcount);
+            }
         }
         else { /* !short_report */
             ap_rprintf(r, "<dt>Total accesses: %lu - Total Traffic: ", count);
@@ -477,6 +493,14 @@ static int status_handler(request_rec *r)
             }
 
             ap_rputs("</dt>\n", r);
+
+            if (wcount > 0) {
+                ap_rprintf(r, "<dt>%lu writes - %.3g iovecs/write - ",
+                           wcount, (float) wiovecs / (float) wcount);
+                format_byte_out(r, (unsigned long)((float) wbytes
+                                                   / (float) wcount));
+                ap_rputs("/write</dt>\n", r);
+            }
         } /* short_report */
     } /* ap_extended_status */
 
@@ -113,7 +113,7 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
      * Navigator 2-3 and MSIE 3.
      */
 
-    if (!(range = apr_table_get(r->headers_in, "Range"))) {
+    if (!(range = ap_get_header_in(r, AP_HEADER_RANGE))) {
         range = apr_table_get(r->headers_in, "Request-Range");
     }
 
@@ -138,7 +138,7 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
      * Note that this check will return false (as required) if either
      * of the two etags are weak.
      */
-    if ((if_range = apr_table_get(r->headers_in, "If-Range"))) {
+    if ((if_range = ap_get_header_in(r, AP_HEADER_IF_RANGE))) {
         if (if_range[0] == '"') {
             if (!(match = apr_table_get(r->headers_out, "Etag"))
                 || (strcmp(if_range, match) != 0)) {
@@ -323,7 +323,7 @@ static int use_range_x(request_rec *r)
 {
     const char *ua;
     return (apr_table_get(r->headers_in, "Request-Range")
-            || ((ua = apr_table_get(r->headers_in, "User-Agent"))
+            || ((ua = ap_get_header_in(r, AP_HEADER_USER_AGENT))
                 && ap_strstr_c(ua, "MSIE 3")));
 }
 
@@ -542,7 +542,7 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         ap_xlate_proto_to_ascii(bound_head, strlen(bound_head));
     }
 
-    tmpbb = apr_brigade_create(r->pool, c->bucket_alloc);
+    tmpbb = ap_acquire_brigade(c);
 
     idx = (indexes_t *)indexes->elts;
     for (i = 0; i < indexes->nelts; i++, idx++) {
@@ -592,12 +592,16 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
              * header already present.
              */
             apr_table_unset(r->headers_out, "Content-Length");
-            if ((rv = ap_pass_brigade(f->next, bsend)) != APR_SUCCESS)
+            if ((rv = ap_pass_brigade(f->next, bsend)) != APR_SUCCESS) {
+                ap_release_brigade(c, tmpbb);
                 return rv;
+            }
             apr_brigade_cleanup(bsend);
         }
     }
 
+    ap_release_brigade(c, tmpbb);
+
     if (found == 0) {
         /* bsend is assumed to be empty if we get here. */
         return send_416(f, bsend);
@@ -619,7 +623,6 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
 
     /* we're done with the original content - all of our data is in bsend. */
     apr_brigade_cleanup(bb);
-    apr_brigade_destroy(tmpbb);
 
     /* send our multipart output */
     return ap_pass_brigade(f->next, bsend);
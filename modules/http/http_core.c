@@ -34,12 +34,15 @@
 
 #include "mod_core.h"
 
+module AP_MODULE_DECLARE_DATA http_module;
+
 /* Handles for core filters */
 AP_DECLARE_DATA ap_filter_rec_t *ap_http_input_filter_handle;
 AP_DECLARE_DATA ap_filter_rec_t *ap_http_header_filter_handle;
 AP_DECLARE_DATA ap_filter_rec_t *ap_chunk_filter_handle;
 AP_DECLARE_DATA ap_filter_rec_t *ap_http_outerror_filter_handle;
 AP_DECLARE_DATA ap_filter_rec_t *ap_byterange_filter_handle;
+AP_DECLARE_DATA ap_filter_rec_t *ap_body_prefetch_filter_handle;
 
 AP_DECLARE_DATA const char *ap_multipart_boundary;
 
@@ -47,6 +50,58 @@ AP_DECLARE_DATA const char *ap_multipart_boundary;
  * use a different processing function
  */
 static int async_mpm = 0;
+/* and whether it can wait for request heads and bodies, too */
+static int async_head = 0;
+static int async_body = 0;
+
+/* how much of the request head wait_for_request_head() peeks at */
+#define REQUEST_HEAD_PEEK_MAX (2 * HUGE_STRING_LEN)
+
+/* Per connection state while the MPM waits for more of a request */
+typedef struct {
+    /** to peek at the request head, see wait_for_request_head() */
+    apr_bucket_brigade *bb;
+    /** what was peeked at, for ap_read_request_from() to parse */
+    char *head;
+    apr_size_t head_len;
+    /** whether the MPM was asked to wait for more of the head */
+    int waiting;
+    /** the request waiting for its body, see wait_for_request_body() */
+    request_rec *r;
+    /** when the head, or the body, has waited long enough (TimeOut since
+     *  the MPM was first asked to wait for it) */
+    apr_time_t deadline;
+} http_conn_ctx;
+
+#define DEFAULT_ASYNC_REQUEST_BODY_BUFFER 65536
+
+typedef struct {
+    apr_off_t async_body_buffer;
+    int async_body_buffer_set;
+} http_server_conf;
+
+static void *create_http_server_config(apr_pool_t *p, server_rec *s)
+{
+    http_server_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    conf->async_body_buffer = DEFAULT_ASYNC_REQUEST_BODY_BUFFER;
+    return conf;
+}
+
+static void *merge_http_server_config(apr_pool_t *p, void *basev,
+                                      void *addv)
+{
+    http_server_conf *base = basev;
+    http_server_conf *add = addv;
+    http_server_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    conf->async_body_buffer = add->async_body_buffer_set
+                              ? add->async_body_buffer
+                              : base->async_body_buffer;
+    conf->async_body_buffer_set = add->async_body_buffer_set
+                                  || base->async_body_buffer_set;
+    return conf;
+}
 
 static const char *set_keep_alive_timeout(cmd_parms *cmd, void *dummy,
                                           const char *arg)
@@ -88,6 +143,26 @@ static const char *set_keep_alive_max(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_async_body_buffer(cmd_parms *cmd, void *dummy,
+                                         const char *arg)
+{
+    http_server_conf *conf =
+        ap_get_module_config(cmd->server->module_config, &http_module);
+    char *endstr;
+    const char *err = ap_check_cmd_context(cmd, NOT_IN_DIR_LOC_FILE);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (apr_strtoff(&conf->async_body_buffer, arg, &endstr, 10)
+        || *endstr || conf->async_body_buffer < 0) {
+        return "AsyncRequestBodyBuffer must be a number of bytes, "
+               "or 0 to disable";
+    }
+    conf->async_body_buffer_set = 1;
+    return NULL;
+}
+
 static const command_rec http_cmds[] = {
     AP_INIT_TAKE1("KeepAliveTimeout", set_keep_alive_timeout, NULL, RSRC_CONF,
                   "Keep-Alive timeout duration (sec)"),
@@ -96,6 +171,10 @@ static const command_rec http_cmds[] = {
                   "or 0 for infinite"),
     AP_INIT_FLAG("KeepAlive", set_keep_alive, NULL, RSRC_CONF,
                   "Whether persistent connections should be On or Off"),
+    AP_INIT_TAKE1("AsyncRequestBodyBuffer", set_async_body_buffer, NULL,
+                  RSRC_CONF,
+                  "How much of a request body an async MPM waits for "
+                  "before running the handler, or 0 to not wait"),
     { NULL }
 };
 
@@ -121,41 +200,242 @@ static apr_port_t http_port(const request_rec *r)
     return DEFAULT_HTTP_PORT;
 }
 
+static http_conn_ctx *get_conn_ctx(conn_rec *c)
+{
+    http_conn_ctx *ctx = ap_get_module_config(c->conn_config, &http_module);
+
+    if (!ctx) {
+        ctx = apr_pcalloc(c->pool, sizeof(*ctx));
+        ctx->bb = apr_brigade_create(c->pool, c->bucket_alloc);
+        ctx->head = apr_palloc(c->pool, REQUEST_HEAD_PEEK_MAX);
+        ap_set_module_config(c->conn_config, &http_module, ctx);
+    }
+    return ctx;
+}
+
+/*
+ * Has the client sent the whole request head, i.e. the request line and
+ * the header fields up to the empty line?
+ */
+static int request_head_complete(const char *buf, apr_size_t len)
+{
+    const char *end = buf + len, *p = buf, *eol;
+    int spaces = 0;
+
+    /* read_request_line() skips empty lines before the request line */
+    while (p < end && (*p == APR_ASCII_CR || *p == APR_ASCII_LF)) {
+        p++;
+    }
+    eol = memchr(p, APR_ASCII_LF, end - p);
+    if (!eol) {
+        return 0;
+    }
+
+    /* an HTTP/0.9 request line is all there is */
+    for (; p < eol; p++) {
+        if (*p == ' ') {
+            spaces++;
+        }
+    }
+    if (spaces < 2) {
+        return 1;
+    }
+
+    /* the header fields, up to the empty line */
+    return ap_http_headers_end(eol + 1, end - eol - 1) != 0;
+}
+
+static int wait_for_request_body(conn_rec *c, request_rec *r, int again);
+
+/* Run the handler of a request which passed the access checks */
+static void process_async_handler(conn_rec *c, request_rec *r)
+{
+    conn_state_t *cs = c->cs;
+
+    cs->state = CONN_STATE_HANDLER;
+    ap_process_async_request_handler(r);
+
+    if (cs->state != CONN_STATE_WRITE_COMPLETION &&
+        cs->state != CONN_STATE_SUSPENDED) {
+        /* Something went wrong; close the connection */
+        cs->state = CONN_STATE_LINGER;
+    }
+}
+
+static void process_async_request(conn_rec *c, request_rec *r)
+{
+    conn_state_t *cs = c->cs;
+
+    /* process the request if it was read without error */
+    ap_update_child_status(c->sbh, SERVER_BUSY_WRITE, r);
+    if (r->status == HTTP_OK) {
+        cs->state = CONN_STATE_HANDLER;
+        if (ap_process_async_request_access(r) == OK) {
+            /* Only now that the walks and access checks are done, read
+             * ahead the body, with the limits of the request's directory.
+             */
+            if (!wait_for_request_body(c, r, 0)) {
+                process_async_handler(c, r);
+            }
+            return;
+        }
+        /* After the call to ap_process_request, the
+         * request pool may have been deleted.  We set
+         * r=NULL here to ensure that any dereference
+         * of r that might be added later in this function
+         * will result in a segfault immediately instead
+         * of nondeterministic failures later.
+         */
+        r = NULL;
+    }
+
+    if (cs->state != CONN_STATE_WRITE_COMPLETION &&
+        cs->state != CONN_STATE_SUSPENDED) {
+        /* Something went wrong; close the connection */
+        cs->state = CONN_STATE_LINGER;
+    }
+}
+
+/*
+ * Look at what there is of the next request without blocking or consuming
+ * it.  If the request head is not complete yet, hand the connection back
+ * to the MPM in CONN_STATE_READ_REQUEST_HEAD rather than blocking in
+ * ap_read_request().  The MPM also calls us back when it times out, so
+ * a head which is not complete TimeOut after we first waited for it is
+ * answered with 408 Request Time-out, however slowly it trickles in.
+ * A complete head is left in ctx->head, for ap_read_request_from().
+ * return: 1 if the connection was handed back to the MPM, 0 if the
+ *         request is to be read
+ */
+static int wait_for_request_head(conn_rec *c)
+{
+    http_conn_ctx *ctx;
+    apr_size_t len = 0;
+    apr_status_t rv;
+    apr_time_t now;
+
+    if (!async_head) {
+        return 0;
+    }
+
+    ctx = get_conn_ctx(c);
+    ctx->head_len = 0;
+    rv = ap_get_brigade(c->input_filters, ctx->bb, AP_MODE_SPECULATIVE,
+                        APR_NONBLOCK_READ, REQUEST_HEAD_PEEK_MAX);
+    if (rv == APR_SUCCESS) {
+        len = REQUEST_HEAD_PEEK_MAX;
+        rv = apr_brigade_flatten(ctx->bb, ctx->head, &len);
+    }
+    apr_brigade_cleanup(ctx->bb);
+
+    /* Leave errors, EOF and heads too large to buffer here to
+     * ap_read_request().
+     */
+    if (rv != APR_SUCCESS || len == REQUEST_HEAD_PEEK_MAX) {
+        ctx->waiting = 0;
+        return 0;
+    }
+    if (request_head_complete(ctx->head, len)) {
+        ctx->waiting = 0;
+        ctx->head_len = len;
+        return 0;
+    }
+
+    now = apr_time_now();
+    if (!ctx->waiting) {
+        ctx->waiting = 1;
+        ctx->deadline = now + c->base_server->timeout;
+    }
+    else if (now >= ctx->deadline) {
+        ctx->waiting = 0;
+        process_async_request(c, ap_read_request_timed_out(c));
+        return 1;
+    }
+
+    c->cs->state = CONN_STATE_READ_REQUEST_HEAD;
+    return 1;
+}
+
+/*
+ * Read ahead what is already there of the request body, once the request
+ * passed the access checks.  If the client
+ * has not sent enough of it yet, hand the connection back to the MPM in
+ * CONN_STATE_READ_REQUEST_BODY, instead of blocking in the handler.
+ * Once TimeOut has passed since we first waited, the handler runs with
+ * what there is and reads the rest itself, as it would without waiting.
+ * return: 1 if the MPM will call us again once more data has arrived
+ */
+static int wait_for_request_body(conn_rec *c, request_rec *r, int again)
+{
+    http_server_conf *conf = ap_get_module_config(r->server->module_config,
+                                                  &http_module);
+    http_conn_ctx *ctx;
+
+    if (!async_body || r->status != HTTP_OK
+        || ap_http_prefetch_body(r, conf->async_body_buffer) != APR_EAGAIN) {
+        return 0;
+    }
+
+    ctx = get_conn_ctx(c);
+    if (!again) {
+        ctx->deadline = apr_time_now() + r->server->timeout;
+    }
+    else if (apr_time_now() >= ctx->deadline) {
+        return 0;
+    }
+
+    ctx->r = r;
+    c->cs->state = CONN_STATE_READ_REQUEST_BODY;
+    return 1;
+}
+
 static int ap_process_http_async_connection(conn_rec *c)
 {
     request_rec *r;
     conn_state_t *cs = c->cs;
 
     AP_DEBUG_ASSERT(cs != NULL);
-    AP_DEBUG_ASSERT(cs->state == CONN_STATE_READ_REQUEST_LINE);
+    AP_DEBUG_ASSERT(cs->state == CONN_STATE_READ_REQUEST_LINE
+                    || cs->state == CONN_STATE_READ_REQUEST_HEAD
+                    || cs->state == CONN_STATE_READ_REQUEST_BODY);
+
+    if (cs->state == CONN_STATE_READ_REQUEST_HEAD) {
+        /* more of the head has arrived, look again below */
+        cs->state = CONN_STATE_READ_REQUEST_LINE;
+    }
+    else if (cs->state == CONN_STATE_READ_REQUEST_BODY) {
+        /* more of the body has arrived for the request we parked */
+        http_conn_ctx *ctx = get_conn_ctx(c);
+
+        r = ctx->r;
+        ctx->r = NULL;
+        ap_update_child_status(c->sbh, SERVER_BUSY_READ, r);
+        if (wait_for_request_body(c, r, 1)) {
+            return OK;
+        }
+        process_async_handler(c, r);
+    }
 
     while (cs->state == CONN_STATE_READ_REQUEST_LINE) {
         ap_update_child_status_from_conn(c->sbh, SERVER_BUSY_READ, c);
 
-        if ((r = ap_read_request(c))) {
+        if (wait_for_request_head(c)) {
+            break;
+        }
 
-            c->keepalive = AP_CONN_UNKNOWN;
-            /* process the request if it was read without error */
+        if (async_head) {
+            http_conn_ctx *ctx = get_conn_ctx(c);
 
-            ap_update_child_status(c->sbh, SERVER_BUSY_WRITE, r);
-            if (r->status == HTTP_OK) {
-                cs->state = CONN_STATE_HANDLER;
-                ap_process_async_request(r);
-                /* After the call to ap_process_request, the
-                 * request pool may have been deleted.  We set
-                 * r=NULL here to ensure that any dereference
-                 * of r that might be added later in this function
-                 * will result in a segfault immediately instead
-                 * of nondeterministic failures later.
-                 */
-                r = NULL;
-            }
+            r = ap_read_request_from(c, ctx->head_len ? ctx->head : NULL,
+                                     ctx->head_len);
+        }
+        else {
+            r = ap_read_request(c);
+        }
+        if (r) {
 
-            if (cs->state != CONN_STATE_WRITE_COMPLETION &&
-                cs->state != CONN_STATE_SUSPENDED) {
-                /* Something went wrong; close the connection */
-                cs->state = CONN_STATE_LINGER;
-            }
+            c->keepalive = AP_CONN_UNKNOWN;
+            process_async_request(c, r);
         }
         else {   /* ap_read_request failed - client may have closed */
             cs->state = CONN_STATE_LINGER;
@@ -263,6 +543,14 @@ static int http_post_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp,
     if (ap_mpm_query(AP_MPMQ_IS_ASYNC, &async_mpm) != APR_SUCCESS) {
         async_mpm = 0;
     }
+    if (!async_mpm
+        || ap_mpm_query(AP_MPMQ_CAN_WAIT_FOR_HEAD, &async_head) != APR_SUCCESS) {
+        async_head = 0;
+    }
+    if (!async_mpm
+        || ap_mpm_query(AP_MPMQ_CAN_WAIT_FOR_BODY, &async_body) != APR_SUCCESS) {
+        async_body = 0;
+    }
     ap_random_insecure_bytes(&val, sizeof(val));
     ap_multipart_boundary = apr_psprintf(p, "%0" APR_UINT64_T_HEX_FMT, val);
 
@@ -294,6 +582,10 @@ static void register_hooks(apr_pool_t *p)
     ap_byterange_filter_handle =
         ap_register_output_filter("BYTERANGE", ap_byterange_filter,
                                   NULL, AP_FTYPE_PROTOCOL);
+    /* right above HTTP_IN */
+    ap_body_prefetch_filter_handle =
+        ap_register_input_filter("BODY_PREFETCH", ap_body_prefetch_filter,
+                                 NULL, AP_FTYPE_PROTOCOL - 1);
     ap_method_registry_init(p);
 }
 
@@ -301,8 +593,8 @@ AP_DECLARE_MODULE(http) = {
     STANDARD20_MODULE_STUFF,
     NULL,              /* create per-directory config structure */
     NULL,              /* merge per-directory config structures */
-    NULL,              /* create per-server config structure */
-    NULL,              /* merge per-server config structures */
+    create_http_server_config, /* create per-server config structure */
+    merge_http_server_config,  /* merge per-server config structures */
     http_cmds,         /* command apr_table_t */
     register_hooks     /* register hooks */
 };
@@ -586,6 +586,202 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
     return APR_SUCCESS;
 }
 
+/*
+ * Request body read ahead for the async MPMs.  ap_http_prefetch_body()
+ * reads the body from HTTP_IN without blocking, so that the MPM can wait
+ * for the rest of it in its pollset instead of in a worker thread.  The
+ * BODY_PREFETCH filter sits right above HTTP_IN and hands what was read
+ * ahead to the handler, then gets out of the way.
+ */
+typedef struct body_prefetch_ctx {
+    apr_bucket_brigade *bb;     /* body read ahead, not yet consumed */
+    apr_off_t buffered;
+    apr_status_t rv;            /* to return once bb is drained */
+    int done;                   /* EOS, error or limit reached */
+} body_prefetch_ctx;
+
+/* Does the request announce a body that HTTP_IN would have to read? */
+static int request_has_body(request_rec *r)
+{
+    const char *tenc = ap_get_header_in(r, AP_HEADER_TRANSFER_ENCODING);
+    const char *lenp = ap_get_header_in(r, AP_HEADER_CONTENT_LENGTH);
+
+    if (tenc) {
+        return 1;
+    }
+    return lenp && !(lenp[0] == '0' && lenp[1] == '\0');
+}
+
+apr_status_t ap_http_prefetch_body(request_rec *r, apr_off_t limit)
+{
+    ap_filter_t *f;
+    body_prefetch_ctx *ctx;
+    apr_bucket_brigade *tmp;
+    apr_bucket *e;
+    apr_status_t rv;
+
+    for (f = r->input_filters; f; f = f->next) {
+        if (f->frec == ap_body_prefetch_filter_handle) {
+            break;
+        }
+    }
+    if (!f) {
+        /* Nothing to wait for, or a 100-continue which only the handler
+         * may decide to send.
+         */
+        if (limit <= 0 || r->main || r->expecting_100
+            || !request_has_body(r)) {
+            return APR_SUCCESS;
+        }
+        ctx = apr_pcalloc(r->pool, sizeof(*ctx));
+        ctx->bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        ctx->rv = APR_SUCCESS;
+        f = ap_add_input_filter_handle(ap_body_prefetch_filter_handle, ctx,
+                                       r, r->connection);
+    }
+    ctx = f->ctx;
+
+    tmp = ap_acquire_brigade(r->connection);
+    while (!ctx->done) {
+        rv = ap_get_brigade(f->next, tmp, AP_MODE_READBYTES,
+                            APR_NONBLOCK_READ, limit - ctx->buffered);
+        if (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(tmp)) {
+            rv = APR_EAGAIN;
+        }
+        if (APR_STATUS_IS_EAGAIN(rv)) {
+            ap_release_brigade(r->connection, tmp);
+            return APR_EAGAIN;
+        }
+
+        /* Keep whatever came with an error too, the handler gets both */
+        for (e = APR_BRIGADE_FIRST(tmp);
+             e != APR_BRIGADE_SENTINEL(tmp);
+             e = APR_BUCKET_NEXT(e)) {
+            apr_bucket_setaside(e, r->pool);
+            if (APR_BUCKET_IS_EOS(e)) {
+                ctx->done = 1;
+            }
+            else if (e->length != (apr_size_t)-1) {
+                ctx->buffered += e->length;
+            }
+        }
+        APR_BRIGADE_CONCAT(ctx->bb, tmp);
+
+        if (rv != APR_SUCCESS) {
+            ctx->rv = rv;
+            ctx->done = 1;
+        }
+        else if (ctx->buffered >= limit) {
+            ctx->done = 1;
+        }
+    }
+
+    ap_release_brigade(r->connection, tmp);
+    return APR_SUCCESS;
+}
+
+/* Does the brigade end with a complete line? */
+static int ends_with_lf(apr_bucket_brigade *bb)
+{
+    apr_bucket *e;
+    const char *str;
+    apr_size_t len;
+
+    for (e = APR_BRIGADE_LAST(bb);
+         e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_PREV(e)) {
+        if (APR_BUCKET_IS_EOS(e)) {
+            return 1;
+        }
+        if (apr_bucket_read(e, &str, &len, APR_BLOCK_READ) != APR_SUCCESS) {
+            return 1;
+        }
+        if (len) {
+            return str[len - 1] == APR_ASCII_LF;
+        }
+    }
+    return 0;
+}
+
+apr_status_t ap_body_prefetch_filter(ap_filter_t *f, apr_bucket_brigade *b,
+                                     ap_input_mode_t mode,
+                                     apr_read_type_e block,
+                                     apr_off_t readbytes)
+{
+    body_prefetch_ctx *ctx = f->ctx;
+    apr_bucket *e;
+    apr_status_t rv;
+
+    if (APR_BRIGADE_EMPTY(ctx->bb)) {
+        ap_remove_input_filter(f);
+        if (ctx->rv != APR_SUCCESS) {
+            return ctx->rv;
+        }
+        return ap_get_brigade(f->next, b, mode, block, readbytes);
+    }
+
+    switch (mode) {
+    case AP_MODE_READBYTES:
+        rv = apr_brigade_partition(ctx->bb, readbytes, &e);
+        if (rv != APR_SUCCESS && rv != APR_INCOMPLETE) {
+            return rv;
+        }
+        while (APR_BRIGADE_FIRST(ctx->bb) != e) {
+            apr_bucket *next = APR_BRIGADE_FIRST(ctx->bb);
+            APR_BUCKET_REMOVE(next);
+            APR_BRIGADE_INSERT_TAIL(b, next);
+        }
+        break;
+    case AP_MODE_GETLINE:
+        rv = apr_brigade_split_line(b, ctx->bb, block, HUGE_STRING_LEN);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        /* The rest of the line is still to be read from HTTP_IN */
+        if (APR_BRIGADE_EMPTY(ctx->bb) && ctx->rv == APR_SUCCESS
+            && !ends_with_lf(b)) {
+            apr_bucket_brigade *rest;
+
+            ap_remove_input_filter(f);
+            rest = apr_brigade_create(f->r->pool, f->c->bucket_alloc);
+            rv = ap_get_brigade(f->next, rest, AP_MODE_GETLINE, block,
+                                readbytes);
+            APR_BRIGADE_CONCAT(b, rest);
+            apr_brigade_destroy(rest);
+            return rv;
+        }
+        break;
+    case AP_MODE_SPECULATIVE:
+        for (e = APR_BRIGADE_FIRST(ctx->bb);
+             e != APR_BRIGADE_SENTINEL(ctx->bb) && readbytes > 0;
+             e = APR_BUCKET_NEXT(e)) {
+            apr_bucket *copy;
+
+            rv = apr_bucket_copy(e, &copy);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            APR_BRIGADE_INSERT_TAIL(b, copy);
+            if (copy->length != (apr_size_t)-1) {
+                if ((apr_off_t)copy->length > readbytes) {
+                    apr_bucket_split(copy, (apr_size_t)readbytes);
+                    apr_bucket_delete(APR_BUCKET_NEXT(copy));
+                    break;
+                }
+                readbytes -= copy->length;
+            }
+        }
+        break;
+    case AP_MODE_EXHAUSTIVE:
+        APR_BRIGADE_CONCAT(b, ctx->bb);
+        break;
+    default:
+        return ap_get_brigade(f->next, b, mode, block, readbytes);
+    }
+
+    return APR_SUCCESS;
+}
+
 /**
  * Parse a chunk extension, detect overflow.
  * There are two error cases:
@@ -1365,7 +1561,7 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
         return OK;
     }
 
-    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    bb = ap_acquire_brigade(r->connection);
     seen_eos = 0;
     do {
         apr_bucket *bucket;
@@ -1382,11 +1578,11 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
              * Otherwise, we should assume we have a bad request.
              */
             if (rv == AP_FILTER_ERROR) {
-                apr_brigade_destroy(bb);
+                ap_release_brigade(r->connection, bb);
                 return rv;
             }
             else {
-                apr_brigade_destroy(bb);
+                ap_release_brigade(r->connection, bb);
                 return HTTP_BAD_REQUEST;
             }
         }
@@ -1413,13 +1609,14 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
              */
             rv = apr_bucket_read(bucket, &data, &len, APR_BLOCK_READ);
             if (rv != APR_SUCCESS) {
-                apr_brigade_destroy(bb);
+                ap_release_brigade(r->connection, bb);
                 return HTTP_BAD_REQUEST;
             }
         }
         apr_brigade_cleanup(bb);
     } while (!seen_eos);
 
+    ap_release_brigade(r->connection, bb);
     return OK;
 }
 
@@ -1462,8 +1659,8 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
 
 AP_DECLARE(int) ap_setup_client_block(request_rec *r, int read_policy)
 {
-    const char *tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
-    const char *lenp = apr_table_get(r->headers_in, "Content-Length");
+    const char *tenc = ap_get_header_in(r, AP_HEADER_TRANSFER_ENCODING);
+    const char *lenp = ap_get_header_in(r, AP_HEADER_CONTENT_LENGTH);
 
     r->read_body = read_policy;
     r->read_chunked = 0;
@@ -1545,11 +1742,7 @@ AP_DECLARE(long) ap_get_client_block(request_rec *r, char *buffer,
         return 0;
     }
 
-    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
-    if (bb == NULL) {
-        r->connection->keepalive = AP_CONN_CLOSE;
-        return -1;
-    }
+    bb = ap_acquire_brigade(r->connection);
 
     rv = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
                         APR_BLOCK_READ, bufsiz);
@@ -1562,7 +1755,7 @@ AP_DECLARE(long) ap_get_client_block(request_rec *r, char *buffer,
          * stop trying to read data from the client.
          */
         r->connection->keepalive = AP_CONN_CLOSE;
-        apr_brigade_destroy(bb);
+        ap_release_brigade(r->connection, bb);
         return -1;
     }
 
@@ -1588,14 +1781,14 @@ AP_DECLARE(long) ap_get_client_block(request_rec *r, char *buffer,
 
     rv = apr_brigade_flatten(bb, buffer, &bufsiz);
     if (rv != APR_SUCCESS) {
-        apr_brigade_destroy(bb);
+        ap_release_brigade(r->connection, bb);
         return -1;
     }
 
     /* XXX yank me? */
     r->read_length += bufsiz;
 
-    apr_brigade_destroy(bb);
+    ap_release_brigade(r->connection, bb);
     return bufsiz;
 }
 
@@ -174,7 +174,7 @@ AP_DECLARE(int) ap_set_keepalive(request_rec *r)
     int wimpy = ap_find_token(r->pool,
                               apr_table_get(r->headers_out, "Connection"),
                               "close");
-    const char *conn = apr_table_get(r->headers_in, "Connection");
+    const char *conn = ap_get_header_in(r, AP_HEADER_CONNECTION);
 
     /* The following convoluted conditional determines whether or not
      * the current connection should remain persistent after this response
@@ -316,7 +316,7 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
      * AND if our strong ETag does not match any entity tag in that field,
      *     respond with a status of 412 (Precondition Failed).
      */
-    if ((if_match = apr_table_get(r->headers_in, "If-Match")) != NULL) {
+    if ((if_match = ap_get_header_in(r, AP_HEADER_IF_MATCH)) != NULL) {
         if (if_match[0] != '*'
             && (etag == NULL || etag[0] == 'W'
                 || !ap_find_list_item(r->pool, if_match, etag))) {
@@ -329,7 +329,7 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
          * specified in this field, then the server MUST
          *     respond with a status of 412 (Precondition Failed).
          */
-        if_unmodified = apr_table_get(r->headers_in, "If-Unmodified-Since");
+        if_unmodified = ap_get_header_in(r, AP_HEADER_IF_UNMODIFIED_SINCE);
         if (if_unmodified != NULL) {
             apr_time_t ius = apr_date_parse_http(if_unmodified);
 
@@ -351,14 +351,14 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
      * GET or HEAD allow weak etag comparison, all other methods require
      * strong comparison.  We can only use weak if it's not a range request.
      */
-    if_nonematch = apr_table_get(r->headers_in, "If-None-Match");
+    if_nonematch = ap_get_header_in(r, AP_HEADER_IF_NONE_MATCH);
     if (if_nonematch != NULL) {
         if (r->method_number == M_GET) {
             if (if_nonematch[0] == '*') {
                 not_modified = 1;
             }
             else if (etag != NULL) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_header_in(r, AP_HEADER_RANGE)) {
                     not_modified = etag[0] != 'W'
                                    && ap_find_list_item(r->pool,
                                                         if_nonematch, etag);
@@ -386,8 +386,7 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
     if (r->method_number == M_GET
         && (not_modified || !if_nonematch)
         && (if_modified_since =
-              apr_table_get(r->headers_in,
-                            "If-Modified-Since")) != NULL) {
+              ap_get_header_in(r, AP_HEADER_IF_MODIFIED_SINCE)) != NULL) {
         apr_time_t ims_time;
         apr_int64_t ims, reqtime;
 
@@ -1017,7 +1016,7 @@ static const char *get_canned_error_string(int status,
                "request-header field overlap the current extent\n"
                "of the selected resource.</p>\n");
     case HTTP_EXPECTATION_FAILED:
-        s1 = apr_table_get(r->headers_in, "Expect");
+        s1 = ap_get_header_in(r, AP_HEADER_EXPECT);
         if (s1)
             s1 = apr_pstrcat(p,
                      "<p>The expectation given in the Expect request-header\n"
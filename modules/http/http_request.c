@@ -220,7 +220,7 @@ static void check_pipeline(conn_rec *c)
 {
     if (c->keepalive != AP_CONN_CLOSE) {
         apr_status_t rv;
-        apr_bucket_brigade *bb = apr_brigade_create(c->pool, c->bucket_alloc);
+        apr_bucket_brigade *bb = ap_acquire_brigade(c);
 
         rv = ap_get_brigade(c->input_filters, bb, AP_MODE_SPECULATIVE,
                             APR_NONBLOCK_READ, 1);
@@ -234,7 +234,7 @@ static void check_pipeline(conn_rec *c)
         else {
             c->data_in_input_filters = 1;
         }
-        apr_brigade_destroy(bb);
+        ap_release_brigade(c, bb);
     }
 }
 
@@ -249,7 +249,7 @@ AP_DECLARE(void) ap_process_request_after_handler(request_rec *r)
      * this bucket is destroyed, the request will be logged and
      * its pool will be freed
      */
-    bb = apr_brigade_create(r->connection->pool, r->connection->bucket_alloc);
+    bb = ap_acquire_brigade(c);
     b = ap_bucket_eor_create(r->connection->bucket_alloc, r);
     APR_BRIGADE_INSERT_HEAD(bb, b);
 
@@ -260,6 +260,13 @@ AP_DECLARE(void) ap_process_request_after_handler(request_rec *r)
      * already by the EOR bucket's cleanup function.
      */
 
+    /* On error the EOR bucket may still be in bb: leave it there, as before,
+     * so that r lives on until the connection pool is cleaned up.
+     */
+    if (APR_BRIGADE_EMPTY(bb)) {
+        ap_release_brigade(c, bb);
+    }
+
     if (c->cs)
         c->cs->state = CONN_STATE_WRITE_COMPLETION;
     check_pipeline(c);
@@ -269,9 +276,50 @@ AP_DECLARE(void) ap_process_request_after_handler(request_rec *r)
     }
 }
 
-void ap_process_async_request(request_rec *r)
+/* Finish a request once its handler (or whatever stood in for it) has
+ * returned access_status.  r->invoke_mtx is locked on entry.
+ */
+static void process_async_request_finish(request_rec *r, int access_status)
 {
     conn_rec *c = r->connection;
+
+    if (access_status == SUSPENDED) {
+        /* TODO: Should move these steps into a generic function, so modules
+         * working on a suspended request can also call _ENTRY again.
+         */
+        AP_PROCESS_REQUEST_RETURN((uintptr_t)r, r->uri, access_status);
+        if (ap_extended_status) {
+            ap_time_process_request(c->sbh, STOP_PREQUEST);
+        }
+        if (c->cs)
+            c->cs->state = CONN_STATE_SUSPENDED;
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+        return;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+
+    if (access_status == DONE) {
+        /* e.g., something not in storage like TRACE */
+        access_status = OK;
+    }
+
+    if (access_status == OK) {
+        ap_finalize_request_protocol(r);
+    }
+    else {
+        r->status = HTTP_OK;
+        ap_die(access_status, r);
+    }
+
+    ap_process_request_after_handler(r);
+}
+
+int ap_process_async_request_access(request_rec *r)
+{
     int access_status;
 
     /* Give quick handlers a shot at serving the request on the fast
@@ -314,45 +362,33 @@ void ap_process_async_request(request_rec *r)
     if (access_status == DECLINED) {
         access_status = ap_process_request_internal(r);
         if (access_status == OK) {
-            access_status = ap_invoke_handler(r);
-        }
-    }
-
-    if (access_status == SUSPENDED) {
-        /* TODO: Should move these steps into a generic function, so modules
-         * working on a suspended request can also call _ENTRY again.
-         */
-        AP_PROCESS_REQUEST_RETURN((uintptr_t)r, r->uri, access_status);
-        if (ap_extended_status) {
-            ap_time_process_request(c->sbh, STOP_PREQUEST);
-        }
-        if (c->cs)
-            c->cs->state = CONN_STATE_SUSPENDED;
 #if APR_HAS_THREADS
-        apr_thread_mutex_unlock(r->invoke_mtx);
+            apr_thread_mutex_unlock(r->invoke_mtx);
 #endif
-        return;
+            return OK;
+        }
     }
+
+    process_async_request_finish(r, access_status);
+    return DONE;
+}
+
+void ap_process_async_request_handler(request_rec *r)
+{
 #if APR_HAS_THREADS
-    apr_thread_mutex_unlock(r->invoke_mtx);
+    apr_thread_mutex_lock(r->invoke_mtx);
 #endif
+    process_async_request_finish(r, ap_invoke_handler(r));
+}
 
-    if (access_status == DONE) {
-        /* e.g., something not in storage like TRACE */
-        access_status = OK;
-    }
-
-    if (access_status == OK) {
-        ap_finalize_request_protocol(r);
-    }
-    else {
-        r->status = HTTP_OK;
-        ap_die(access_status, r);
+void ap_process_async_request(request_rec *r)
+{
+    if (ap_process_async_request_access(r) == OK) {
+        ap_process_async_request_handler(r);
     }
-
-    ap_process_request_after_handler(r);
 }
 
+
 void ap_process_request(request_rec *r)
 {
     apr_bucket_brigade *bb;
@@ -363,7 +399,7 @@ void ap_process_request(request_rec *r)
     ap_process_async_request(r);
 
     if (!c->data_in_input_filters) {
-        bb = apr_brigade_create(c->pool, c->bucket_alloc);
+        bb = ap_acquire_brigade(c);
         b = apr_bucket_flush_create(c->bucket_alloc);
         APR_BRIGADE_INSERT_HEAD(bb, b);
         rv = ap_pass_brigade(c->output_filters, bb);
@@ -380,6 +416,9 @@ void ap_process_request(request_rec *r)
                           "Timeout while writing data for URI %s to the"
                           " client", r->unparsed_uri);
         }
+        if (APR_BRIGADE_EMPTY(bb)) {
+            ap_release_brigade(c, bb);
+        }
     }
     if (ap_extended_status) {
         ap_time_process_request(c->sbh, STOP_PREQUEST);
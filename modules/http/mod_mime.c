@@ -35,6 +35,7 @@
 #include "http_log.h"
 #include "http_request.h"
 #include "http_protocol.h"
+#include "util_filter.h"
 
 /* XXXX - fix me / EBCDIC
  *        there was a cludge here which would use its
@@ -66,6 +67,8 @@ typedef struct extension_info {
     char *charset_type;               /* Added with AddCharset... */
     char *input_filters;              /* Added with AddInputFilter... */
     char *output_filters;             /* Added with AddOutputFilter... */
+    ap_filter_chain_t *input_chain;   /* input_filters, looked up */
+    ap_filter_chain_t *output_chain;  /* output_filters, looked up */
 } extension_info;
 
 #define MULTIMATCH_UNSET      0
@@ -161,9 +164,11 @@ static void *overlay_extension_mappings(apr_pool_t *p,
     }
     if (overlay_info->input_filters) {
         new_info->input_filters = overlay_info->input_filters;
+        new_info->input_chain = overlay_info->input_chain;
     }
     if (overlay_info->output_filters) {
         new_info->output_filters = overlay_info->output_filters;
+        new_info->output_chain = overlay_info->output_chain;
     }
 
     return new_info;
@@ -270,6 +275,14 @@ static const char *add_extension_info(cmd_parms *cmd, void *m_,
         apr_hash_set(m->extension_mappings, key, APR_HASH_KEY_STRING, exinfo);
     }
     *(const char**)((char *)exinfo + offset) = value;
+
+    /* the filters are looked up once, not for every request */
+    if (offset == APR_OFFSETOF(extension_info, input_filters)) {
+        exinfo->input_chain = ap_filter_chain_make(cmd->pool, value, 1);
+    }
+    else if (offset == APR_OFFSETOF(extension_info, output_filters)) {
+        exinfo->output_chain = ap_filter_chain_make(cmd->pool, value, 0);
+    }
     return NULL;
 }
 
@@ -896,21 +909,13 @@ static int find_ct(request_rec *r)
              * config hook, which may be too early (dunno.)
              */
             if (exinfo->input_filters) {
-                const char *filter, *filters = exinfo->input_filters;
-                while (*filters
-                    && (filter = ap_getword(r->pool, &filters, ';'))) {
-                    ap_add_input_filter(filter, NULL, r, r->connection);
-                }
+                ap_add_filter_chain(exinfo->input_chain, r);
                 if (conf->multimatch & MULTIMATCH_FILTERS) {
                     found = 1;
                 }
             }
             if (exinfo->output_filters) {
-                const char *filter, *filters = exinfo->output_filters;
-                while (*filters
-                    && (filter = ap_getword(r->pool, &filters, ';'))) {
-                    ap_add_output_filter(filter, NULL, r, r->connection);
-                }
+                ap_add_filter_chain(exinfo->output_chain, r);
                 if (conf->multimatch & MULTIMATCH_FILTERS) {
                     found = 1;
                 }
@@ -4,12 +4,15 @@ dnl APACHE_MODULE(name, helptext[, objects[, structname[, default[, config]]]])
 
 APACHE_MODPATH_INIT(loggers)
 	
-APACHE_MODULE(log_config, logging configuration.  You won't be able to log requests to the server without this module., , , yes)
+log_config_objects="mod_log_config.lo log_program.lo"
+
+APACHE_MODULE(log_config, logging configuration.  You won't be able to log requests to the server without this module., $log_config_objects, , yes)
 APACHE_MODULE(log_debug, configurable debug logging, , , most)
+APACHE_MODULE(log_binary, binary access logs, , , most)
 APACHE_MODULE(log_forensic, forensic logging)
 
-if test "x$enable_log_forensic" != "xno"; then
-    # mod_log_forensic needs test_char.h
+if test "x$enable_log_config" != "xno" -o "x$enable_log_forensic" != "xno"; then
+    # mod_log_config and mod_log_forensic need test_char.h
     APR_ADDTO(INCLUDES, [-I\$(top_builddir)/server])
 fi   
 
@@ -0,0 +1,317 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * log_program.c: run the log formats of mod_log_config, compiled into a
+ * list of steps which write an entry straight into one buffer.  The usual
+ * items of the Common and Combined formats are done here, without pool
+ * allocations; any other item is handed back to mod_log_config.
+ *
+ * Besides APR, this only depends on ap_get_remote_host(), ap_header_id(),
+ * ap_get_header_in() and util_time.c, so that test/time-log-format.c can
+ * link it.
+ */
+
+#include "apr_strings.h"
+#include "apr_lib.h"
+
+#define APR_WANT_STRFUNC
+#include "apr_want.h"
+
+#include "httpd.h"
+#include "http_core.h"          /* For REMOTE_NAME */
+#include "http_protocol.h"
+#include "util_time.h"
+#include "test_char.h"
+
+#include "log_program.h"
+
+#define TEST_CHAR(c, f)        (test_char_table[(unsigned char)(c)] & (f))
+
+typedef struct {
+    log_op_e op;
+    int want_orig;
+    const char *arg;
+    apr_size_t arglen;
+    int header_id;              /* of arg, for LOG_OP_HEADER_IN */
+    void *item;
+} log_step;
+
+struct log_program {
+    int nsteps;
+    log_step *steps;
+};
+
+/* The entry being written */
+typedef struct {
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+    apr_pool_t *pool;
+} log_line;
+
+log_program *log_program_make(apr_pool_t *p, int nops)
+{
+    log_program *prog = apr_palloc(p, sizeof(*prog));
+
+    prog->nsteps = 0;
+    prog->steps = apr_palloc(p, nops * sizeof(log_step));
+    return prog;
+}
+
+void log_program_add(log_program *prog, log_op_e op, int want_orig,
+                     const char *arg, void *item)
+{
+    log_step *step = &prog->steps[prog->nsteps++];
+
+    step->op = op;
+    step->want_orig = want_orig;
+    step->arg = arg;
+    step->arglen = arg ? strlen(arg) : 0;
+    step->header_id = op == LOG_OP_HEADER_IN ? ap_header_id(arg, step->arglen)
+                                             : -1;
+    step->item = item;
+}
+
+/* Make room for n more bytes */
+static char *line_room(log_line *l, apr_size_t n)
+{
+    if (l->size - l->len < n) {
+        apr_size_t size = l->size * 2;
+        char *buf;
+
+        while (size - l->len < n) {
+            size *= 2;
+        }
+        buf = apr_palloc(l->pool, size);
+        memcpy(buf, l->buf, l->len);
+        l->buf = buf;
+        l->size = size;
+    }
+    return l->buf + l->len;
+}
+
+static APR_INLINE void line_put(log_line *l, const char *s, apr_size_t n)
+{
+    memcpy(line_room(l, n), s, n);
+    l->len += n;
+}
+
+static void line_put_num(log_line *l, apr_off_t n)
+{
+    char digits[24], *d = digits + sizeof(digits);
+    int negative = n < 0;
+
+    if (negative) {
+        n = -n;
+    }
+    do {
+        *--d = '0' + (char)(n % 10);
+        n /= 10;
+    } while (n);
+    if (negative) {
+        *--d = '-';
+    }
+    line_put(l, d, digits + sizeof(digits) - d);
+}
+
+/* As ap_escape_logitem(), "-" for NULL */
+static void line_put_escaped(log_line *l, const char *str)
+{
+    static const char c2x_table[] = "0123456789abcdef";
+    const unsigned char *s = (const unsigned char *)str;
+    unsigned char *d;
+
+    if (!s) {
+        line_put(l, "-", 1);
+        return;
+    }
+
+    d = (unsigned char *)line_room(l, 4 * strlen(str));
+    for (; *s; ++s) {
+        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
+            *d++ = '\\';
+            switch (*s) {
+            case '\b':
+                *d++ = 'b';
+                break;
+            case '\n':
+                *d++ = 'n';
+                break;
+            case '\r':
+                *d++ = 'r';
+                break;
+            case '\t':
+                *d++ = 't';
+                break;
+            case '\v':
+                *d++ = 'v';
+                break;
+            case '\\':
+            case '"':
+                *d++ = *s;
+                break;
+            default:
+                *d++ = 'x';
+                *d++ = c2x_table[*s >> 4];
+                *d++ = c2x_table[*s & 0xf];
+            }
+        }
+        else {
+            *d++ = *s;
+        }
+    }
+    l->len = (char *)d - l->buf;
+}
+
+apr_size_t log_program_run(const log_program *prog, request_rec *r,
+                           request_rec *orig, log_program_item_fn *item_fn,
+                           log_program_time_fn *end_time_fn,
+                           char *buf, apr_size_t size, char **line)
+{
+    const log_step *step = prog->steps, *end = step + prog->nsteps;
+    log_line l;
+
+    l.buf = buf;
+    l.len = 0;
+    l.size = size;
+    l.pool = r->pool;
+
+    for (; step < end; step++) {
+        request_rec *rr = step->want_orig ? orig : r;
+        const char *s;
+
+        switch (step->op) {
+        case LOG_OP_CONST:
+            line_put(&l, step->arg, step->arglen);
+            break;
+
+        case LOG_OP_REMOTE_HOST:
+            line_put_escaped(&l, ap_get_remote_host(rr->connection,
+                                                    rr->per_dir_config,
+                                                    REMOTE_NAME, NULL));
+            break;
+
+        case LOG_OP_TIME_CLF:
+            l.len += log_clf_time(line_room(&l, LOG_CLF_TIME_SIZE),
+                                  rr->request_time);
+            break;
+
+        case LOG_OP_REQUEST_LINE:
+            if (rr->parsed_uri.password) {
+                /* rewritten without the password the slow way */
+                s = item_fn(r, orig, step->item);
+                line_put(&l, s, strlen(s));
+            }
+            else {
+                line_put_escaped(&l, rr->the_request);
+            }
+            break;
+
+        case LOG_OP_STATUS:
+            if (rr->status <= 0) {
+                line_put(&l, "-", 1);
+            }
+            else {
+                line_put_num(&l, rr->status);
+            }
+            break;
+
+        case LOG_OP_BYTES_CLF:
+            if (!rr->sent_bodyct || !rr->bytes_sent) {
+                line_put(&l, "-", 1);
+            }
+            else {
+                line_put_num(&l, rr->bytes_sent);
+            }
+            break;
+
+        case LOG_OP_DURATION_US:
+            line_put_num(&l, end_time_fn(rr) - rr->request_time);
+            break;
+
+        case LOG_OP_HEADER_IN:
+            line_put_escaped(&l, step->header_id >= 0
+                             ? ap_get_header_in(rr, step->header_id)
+                             : apr_table_get(rr->headers_in, step->arg));
+            break;
+
+        case LOG_OP_ITEM:
+        default:
+            s = item_fn(r, orig, step->item);
+            line_put(&l, s, strlen(s));
+            break;
+        }
+    }
+
+    *line = l.buf;
+    return l.len;
+}
+
+/* This uses the same technique as ap_explode_recent_localtime():
+ * optimistic caching with logic to detect and correct race conditions.
+ * See the comments in server/util_time.c for more information.
+ */
+typedef struct {
+    unsigned t;
+    char timestr[LOG_CLF_TIME_SIZE];
+    apr_size_t len;
+    unsigned t_validate;
+} cached_request_time;
+
+#define TIME_CACHE_SIZE 4
+#define TIME_CACHE_MASK 3
+static cached_request_time request_time_cache[TIME_CACHE_SIZE];
+
+apr_size_t log_clf_time(char *buf, apr_time_t t)
+{
+    cached_request_time cached_time;
+    unsigned t_seconds = (unsigned)apr_time_sec(t);
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+
+    cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time.t) ||
+        (t_seconds != cached_time.t_validate)) {
+
+        /* Invalid or old snapshot, so compute the proper time string
+         * and store it in the cache
+         */
+        apr_time_exp_t xt;
+        char sign;
+        int timz;
+
+        ap_explode_recent_localtime(&xt, t);
+        timz = xt.tm_gmtoff;
+        if (timz < 0) {
+            timz = -timz;
+            sign = '-';
+        }
+        else {
+            sign = '+';
+        }
+        cached_time.t = t_seconds;
+        cached_time.len =
+            apr_snprintf(cached_time.timestr, LOG_CLF_TIME_SIZE,
+                         "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                         xt.tm_mday, apr_month_snames[xt.tm_mon],
+                         xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                         sign, timz / (60*60), (timz % (60*60)) / 60);
+        cached_time.t_validate = t_seconds;
+        request_time_cache[i] = cached_time;
+    }
+    memcpy(buf, cached_time.timestr, cached_time.len + 1);
+    return cached_time.len;
+}
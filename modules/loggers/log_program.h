@@ -0,0 +1,104 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file log_program.h
+ * @brief Log formats of mod_log_config compiled into programs
+ *
+ * @defgroup MOD_LOG_CONFIG_PROGRAM Log format programs
+ * @ingroup MOD_LOG_CONFIG
+ * @{
+ */
+
+#ifndef LOG_PROGRAM_H
+#define LOG_PROGRAM_H
+
+#include "apr_pools.h"
+#include "apr_time.h"
+#include "httpd.h"
+
+/** What a step of a log program writes */
+typedef enum {
+    LOG_OP_ITEM,            /**< anything else, see log_program_item_fn */
+    LOG_OP_CONST,           /**< a constant string */
+    LOG_OP_REMOTE_HOST,     /**< %h */
+    LOG_OP_TIME_CLF,        /**< %t, %{begin}t */
+    LOG_OP_REQUEST_LINE,    /**< %r */
+    LOG_OP_STATUS,          /**< %s, %>s */
+    LOG_OP_BYTES_CLF,       /**< %b */
+    LOG_OP_DURATION_US,     /**< %D */
+    LOG_OP_HEADER_IN        /**< %{...}i */
+} log_op_e;
+
+typedef struct log_program log_program;
+
+/** Get the value of an item for LOG_OP_ITEM, "-" for none */
+typedef const char *log_program_item_fn(request_rec *r, request_rec *orig,
+                                        void *item);
+
+/** Get the time the request ended, for LOG_OP_DURATION_US */
+typedef apr_time_t log_program_time_fn(request_rec *r);
+
+/** Size of a buffer for log_clf_time() */
+#define LOG_CLF_TIME_SIZE 32
+
+/**
+ * Make an empty program
+ * @param p The pool to allocate it from
+ * @param nops How many steps it will have
+ */
+log_program *log_program_make(apr_pool_t *p, int nops);
+
+/**
+ * Add a step to a program
+ * @param prog The program
+ * @param op What the step writes
+ * @param want_orig Nonzero to log the original request, not the final one
+ * @param arg The string for LOG_OP_CONST, the header for LOG_OP_HEADER_IN
+ * @param item What to pass to the log_program_item_fn for LOG_OP_ITEM,
+ *        and for any step which needs to be done the slow way
+ */
+void log_program_add(log_program *prog, log_op_e op, int want_orig,
+                     const char *arg, void *item);
+
+/**
+ * Write the log entry for a request
+ * @param prog The program
+ * @param r The final request
+ * @param orig The original request
+ * @param item_fn Called for LOG_OP_ITEM steps
+ * @param end_time_fn Called for LOG_OP_DURATION_US steps
+ * @param buf Where to write the entry, if it is large enough
+ * @param size The size of buf
+ * @param line Set to buf, or to a copy in r->pool if buf was too small
+ * @return The length of the entry
+ */
+apr_size_t log_program_run(const log_program *prog, request_rec *r,
+                           request_rec *orig, log_program_item_fn *item_fn,
+                           log_program_time_fn *end_time_fn,
+                           char *buf, apr_size_t size, char **line);
+
+/**
+ * Format a time as "[10/Oct/2000:13:55:36 -0700]", from a cache of the
+ * last few seconds.
+ * @param buf At least LOG_CLF_TIME_SIZE bytes, NUL terminated on return
+ * @param t The time
+ * @return The length written
+ */
+apr_size_t log_clf_time(char *buf, apr_time_t t);
+
+#endif /* LOG_PROGRAM_H */
+/** @} */
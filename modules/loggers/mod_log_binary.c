@@ -0,0 +1,226 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_log_binary: write the access logs of mod_log_config as binary
+ * records instead of text, see mod_log_binary.h for the format and
+ * support/binlog2txt to turn them back into text.
+ *
+ *    BinaryLogs On
+ *
+ * makes every CustomLog and TransferLog binary.  The record holds the
+ * fields of the Combined format, the virtual host and the time taken to
+ * serve the request, whatever the LogFormat of the log is.
+ *
+ * The records are written through the log writer mod_log_config would
+ * have used otherwise, so BufferedLogs still applies, and cuts what it
+ * writes to a piped log between records rather than at '\n'.
+ */
+
+#include "apr_strings.h"
+#include "apr_uri.h"
+
+#include "ap_config.h"
+#include "httpd.h"
+#include "http_config.h"
+#include "http_core.h"          /* For REMOTE_NAME */
+#include "http_log.h"
+#include "http_protocol.h"
+#include "util_time.h"
+#include "mod_log_config.h"
+#include "mod_log_binary.h"
+
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+
+module AP_MODULE_DECLARE_DATA log_binary_module;
+
+/* Records are no larger than what a pipe writes atomically (see
+ * LOG_BUFSIZE in mod_log_config.c), the strings are cut to fit.
+ */
+#ifdef PIPE_BUF
+#define BINLOG_RECORD_MAX   PIPE_BUF
+#else
+#define BINLOG_RECORD_MAX   (512)
+#endif
+
+static int binary_logs = 0;
+static ap_log_writer *next_writer;
+static APR_OPTIONAL_FN_TYPE(ap_log_get_request_end_time) *request_end_time;
+
+static APR_INLINE unsigned char *put16(unsigned char *p, apr_uint16_t n)
+{
+    p[0] = (unsigned char)(n >> 8);
+    p[1] = (unsigned char)n;
+    return p + 2;
+}
+
+static APR_INLINE unsigned char *put32(unsigned char *p, apr_uint32_t n)
+{
+    p = put16(p, (apr_uint16_t)(n >> 16));
+    return put16(p, (apr_uint16_t)n);
+}
+
+static APR_INLINE unsigned char *put64(unsigned char *p, apr_uint64_t n)
+{
+    p = put32(p, (apr_uint32_t)(n >> 32));
+    return put32(p, (apr_uint32_t)n);
+}
+
+/* As %r of mod_log_config: without the password, if any */
+static const char *request_line(request_rec *r)
+{
+    if (!r->parsed_uri.password) {
+        return r->the_request;
+    }
+    return apr_pstrcat(r->pool, r->method, " ",
+                       apr_uri_unparse(r->pool, &r->parsed_uri, 0),
+                       r->assbackwards ? NULL : " ", r->protocol, NULL);
+}
+
+static apr_status_t binary_log_writer(request_rec *r, void *handle,
+                                      const char **strs, int *strl,
+                                      int nelts, apr_size_t len)
+{
+    unsigned char rec[BINLOG_RECORD_MAX];
+    unsigned char *p = rec, *end = rec + sizeof(rec);
+    const char *str[BINLOG_NSTRINGS];
+    const char *rec_str = (const char *)rec;
+    int rec_len;
+    apr_time_exp_t xt;
+    int i;
+
+    /* nothing is formatted for a records writer (nelts is 0) */
+    str[BINLOG_S_REMOTE_HOST] = ap_get_remote_host(r->connection,
+                                                   r->per_dir_config,
+                                                   REMOTE_NAME, NULL);
+    str[BINLOG_S_REMOTE_LOGNAME] = ap_get_remote_logname(r);
+    str[BINLOG_S_REMOTE_USER] = r->user;
+    str[BINLOG_S_REQUEST_LINE] = request_line(r);
+    str[BINLOG_S_REFERER] = ap_get_header_in(r, AP_HEADER_REFERER);
+    str[BINLOG_S_USER_AGENT] = ap_get_header_in(r, AP_HEADER_USER_AGENT);
+    str[BINLOG_S_VHOST] = r->server->server_hostname;
+
+    ap_explode_recent_localtime(&xt, r->request_time);
+
+    p = put32(p, 0);            /* the length, below */
+    *p++ = BINLOG_VERSION;
+    *p++ = r->sent_bodyct ? BINLOG_F_BODY : 0;
+    p = put16(p, (apr_uint16_t)(r->status > 0 ? r->status : 0));
+    p = put64(p, (apr_uint64_t)r->request_time);
+    p = put64(p, (apr_uint64_t)(request_end_time(r) - r->request_time));
+    p = put64(p, (apr_uint64_t)r->bytes_sent);
+    p = put32(p, (apr_uint32_t)xt.tm_gmtoff);
+    p = put16(p, BINLOG_NSTRINGS);
+
+    for (i = 0; i < BINLOG_NSTRINGS; i++) {
+        apr_size_t n;
+
+        if (!str[i]) {
+            p = put16(p, BINLOG_NO_STRING);
+            continue;
+        }
+        /* room is left for the lengths of the strings still to come */
+        n = strlen(str[i]);
+        if (n > (apr_size_t)(end - p) - 2 * (BINLOG_NSTRINGS - i)) {
+            n = (end - p) - 2 * (BINLOG_NSTRINGS - i);
+        }
+        if (n >= BINLOG_NO_STRING) {
+            n = BINLOG_NO_STRING - 1;
+        }
+        p = put16(p, (apr_uint16_t)n);
+        memcpy(p, str[i], n);
+        p += n;
+    }
+
+    rec_len = p - rec;
+    put32(rec, (apr_uint32_t)rec_len);
+
+    return next_writer(r, handle, &rec_str, &rec_len, 1, rec_len);
+}
+
+static int log_binary_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                 apr_pool_t *ptemp)
+{
+    binary_logs = 0;
+    return OK;
+}
+
+static int log_binary_open_logs(apr_pool_t *pconf, apr_pool_t *plog,
+                                apr_pool_t *ptemp, server_rec *s)
+{
+    APR_OPTIONAL_FN_TYPE(ap_log_set_writer) *log_set_writer;
+    APR_OPTIONAL_FN_TYPE(ap_log_set_records) *log_set_records;
+
+    if (!binary_logs) {
+        return OK;
+    }
+
+    log_set_writer = APR_RETRIEVE_OPTIONAL_FN(ap_log_set_writer);
+    log_set_records = APR_RETRIEVE_OPTIONAL_FN(ap_log_set_records);
+    request_end_time = APR_RETRIEVE_OPTIONAL_FN(ap_log_get_request_end_time);
+    if (!log_set_writer || !log_set_records || !request_end_time) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, APLOGNO(02313)
+                     "BinaryLogs needs mod_log_config");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* mod_log_config resets its writer in pre_config, so this is only
+     * stacked once per configuration
+     */
+    next_writer = log_set_writer(binary_log_writer);
+    log_set_records(1);
+    return OK;
+}
+
+static const char *set_binary_logs(cmd_parms *cmd, void *dummy, int flag)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+    binary_logs = flag;
+    return NULL;
+}
+
+static const command_rec binary_log_cmds[] =
+{
+    AP_INIT_FLAG("BinaryLogs", set_binary_logs, NULL, RSRC_CONF,
+                 "Write the access logs as binary records"),
+    { NULL }
+};
+
+static void register_hooks(apr_pool_t *p)
+{
+    /* the writer must be set before mod_log_config opens the logs */
+    static const char * const succ[] = { "mod_log_config.c", NULL };
+
+    ap_hook_pre_config(log_binary_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_open_logs(log_binary_open_logs, NULL, succ, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(log_binary) =
+{
+    STANDARD20_MODULE_STUFF,
+    NULL,                       /* create per-dir config */
+    NULL,                       /* merge per-dir config */
+    NULL,                       /* server config */
+    NULL,                       /* merge server config */
+    binary_log_cmds,            /* command apr_table_t */
+    register_hooks              /* register hooks */
+};
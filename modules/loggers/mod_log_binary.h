@@ -0,0 +1,72 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  mod_log_binary.h
+ * @brief Record format of the binary access logs, shared by mod_log_binary
+ *        and support/binlog2txt
+ *
+ * @defgroup MOD_LOG_BINARY mod_log_binary
+ * @ingroup APACHE_MODS
+ * @{
+ */
+
+#ifndef MOD_LOG_BINARY_H
+#define MOD_LOG_BINARY_H
+
+/*
+ * A binary log is a sequence of records.  Each record starts with a fixed
+ * header, all numbers in network byte order:
+ *
+ *   offset size
+ *        0    4  length of the whole record, this field included
+ *        4    1  BINLOG_VERSION
+ *        5    1  flags, BINLOG_F_*
+ *        6    2  status (%>s), 0 if none
+ *        8    8  time the request was received, microseconds since the epoch
+ *       16    8  time taken to serve the request, microseconds
+ *       24    8  bytes sent, excluding HTTP headers
+ *       32    4  offset of the server's local time from UTC, seconds, signed
+ *       36    2  number of strings which follow
+ *
+ * followed by the strings, indexed by binlog_string_e, each as its length
+ * in two bytes and the bytes, unescaped and not NUL terminated.  A length
+ * of BINLOG_NO_STRING stands for a missing value ("-" in text logs).
+ * Readers skip the strings they do not know, and treat strings missing at
+ * the end of a record as missing values.
+ */
+#define BINLOG_HEADER_SIZE      38
+#define BINLOG_VERSION          1
+
+/** a response body was sent (%b logs "-" if not) */
+#define BINLOG_F_BODY           0x01
+
+#define BINLOG_NO_STRING        0xffff
+
+/** The strings of a record */
+typedef enum {
+    BINLOG_S_REMOTE_HOST,       /**< %h */
+    BINLOG_S_REMOTE_LOGNAME,    /**< %l */
+    BINLOG_S_REMOTE_USER,       /**< %u */
+    BINLOG_S_REQUEST_LINE,      /**< %r */
+    BINLOG_S_REFERER,           /**< %{Referer}i */
+    BINLOG_S_USER_AGENT,        /**< %{User-Agent}i */
+    BINLOG_S_VHOST,             /**< %v */
+    BINLOG_NSTRINGS
+} binlog_string_e;
+
+#endif /* MOD_LOG_BINARY_H */
+/** @} */
@@ -148,8 +148,12 @@
 #include "apr_hash.h"
 #include "apr_optional.h"
 #include "apr_anylock.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_cond.h"
 
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
 
 #include "ap_config.h"
@@ -162,6 +166,8 @@
 #include "util_time.h"
 #include "ap_mpm.h"
 
+#include "log_program.h"
+
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -198,6 +204,7 @@ static ap_log_writer_init* ap_log_set_writer_init(ap_log_writer_init *handle);
 static ap_log_writer* ap_log_set_writer(ap_log_writer *handle);
 static ap_log_writer *log_writer = ap_default_log_writer;
 static ap_log_writer_init *log_writer_init = ap_default_log_writer_init;
+static int log_records = 0; /* default lines, see ap_log_set_records() */
 static int buffered_logs = 0; /* default unbuffered */
 static apr_array_header_t *all_buffered_logs = NULL;
 
@@ -216,6 +223,35 @@ static apr_array_header_t *all_buffered_logs = NULL;
 #define LOG_BUFSIZE     (512)
 #endif
 
+#if APR_HAS_THREADS
+/* With a threaded MPM, each thread buffers the entries it logs in a ring
+ * of its own for each log, and a writer thread writes them out, when a
+ * ring is LOG_RING_WAKEUP full or every BufferedLogsFlushInterval.  The
+ * size must be a power of two.
+ */
+#define LOG_RING_SIZE   (32 * 1024)
+#define LOG_RING_WAKEUP (LOG_RING_SIZE / 4)
+
+/* iovecs per writev() of the writer thread */
+#define LOG_WRITEV_MAX  64
+
+typedef struct log_ring log_ring;
+struct log_ring {
+    log_ring *next;                 /* rings of the same log */
+    volatile apr_uint32_t head;     /* moved by the writer thread */
+    volatile apr_uint32_t tail;     /* moved by the thread owning the ring */
+    char data[LOG_RING_SIZE];
+};
+
+static apr_interval_time_t buffered_logs_interval;
+static int log_rings = 0;           /* set in the child if threaded */
+static apr_threadkey_t *log_ring_key;
+static apr_thread_t *log_writer_thread;
+static apr_thread_mutex_t *log_writer_mutex;
+static apr_thread_cond_t *log_writer_cond;
+static int log_writer_stop;
+#endif
+
 /*
  * multi_log_state is our per-(virtual)-server configuration. We store
  * an array of the logs we are going to use, each of type config_log_state.
@@ -231,9 +267,18 @@ static apr_array_header_t *all_buffered_logs = NULL;
  * which might be empty.
  */
 
+/*
+ * A parsed log format: its items, and the program compiled from them which
+ * writes the log entries.
+ */
+typedef struct {
+    apr_array_header_t *items;
+    log_program *program;
+} log_format;
+
 typedef struct {
     const char *default_format_string;
-    apr_array_header_t *default_format;
+    log_format *default_format;
     apr_array_header_t *config_logs;
     apr_array_header_t *server_config_logs;
     apr_table_t *formats;
@@ -254,12 +299,17 @@ typedef struct {
     apr_size_t outcnt;
     char outbuf[LOG_BUFSIZE];
     apr_anylock_t mutex;
+#if APR_HAS_THREADS
+    int index;                      /* in all_buffered_logs */
+    int piped;
+    log_ring *volatile rings;
+#endif
 } buffered_log;
 
 typedef struct {
     const char *fname;
     const char *format_string;
-    apr_array_header_t *format;
+    log_format *format;
     void *log_writer;
     char *condition_var;
     ap_expr_info_t *condition_expr;
@@ -574,13 +624,6 @@ static const char *log_request_time_custom(request_rec *r, char *a,
     return apr_pstrdup(r->pool, tstr);
 }
 
-#define DEFAULT_REQUEST_TIME_SIZE 32
-typedef struct {
-    unsigned t;
-    char timestr[DEFAULT_REQUEST_TIME_SIZE];
-    unsigned t_validate;
-} cached_request_time;
-
 #define TIME_FMT_CUSTOM          0
 #define TIME_FMT_CLF             1
 #define TIME_FMT_ABS_SEC         2
@@ -589,10 +632,6 @@ typedef struct {
 #define TIME_FMT_ABS_MSEC_FRAC   5
 #define TIME_FMT_ABS_USEC_FRAC   6
 
-#define TIME_CACHE_SIZE 4
-#define TIME_CACHE_MASK 3
-static cached_request_time request_time_cache[TIME_CACHE_SIZE];
-
 static apr_time_t get_request_end_time(request_rec *r)
 {
     log_request_state *state = (log_request_state *)ap_get_module_config(r->request_config,
@@ -699,43 +738,9 @@ static const char *log_request_time(request_rec *r, char *a)
         return log_request_time_custom(r, a, &xt);
     }
     else {                                   /* CLF format */
-        /* This code uses the same technique as ap_explode_recent_localtime():
-         * optimistic caching with logic to detect and correct race conditions.
-         * See the comments in server/util_time.c for more information.
-         */
-        cached_request_time* cached_time = apr_palloc(r->pool,
-                                                      sizeof(*cached_time));
-        unsigned t_seconds = (unsigned)apr_time_sec(request_time);
-        unsigned i = t_seconds & TIME_CACHE_MASK;
-        *cached_time = request_time_cache[i];
-        if ((t_seconds != cached_time->t) ||
-            (t_seconds != cached_time->t_validate)) {
-
-            /* Invalid or old snapshot, so compute the proper time string
-             * and store it in the cache
-             */
-            char sign;
-            int timz;
-
-            ap_explode_recent_localtime(&xt, request_time);
-            timz = xt.tm_gmtoff;
-            if (timz < 0) {
-                timz = -timz;
-                sign = '-';
-            }
-            else {
-                sign = '+';
-            }
-            cached_time->t = t_seconds;
-            apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
-                         "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
-                         xt.tm_mday, apr_month_snames[xt.tm_mon],
-                         xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
-                         sign, timz / (60*60), (timz % (60*60)) / 60);
-            cached_time->t_validate = t_seconds;
-            request_time_cache[i] = *cached_time;
-        }
-        return cached_time->timestr;
+        char *buf = apr_palloc(r->pool, LOG_CLF_TIME_SIZE);
+        log_clf_time(buf, request_time);
+        return buf;
     }
 }
 
@@ -992,8 +997,57 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
     return "Ran off end of LogFormat parsing args to some directive";
 }
 
-static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
+/*
+ * Compile the items of a format into a program, which writes the items of
+ * the Common and Combined formats itself and calls back process_item() for
+ * the others.  Conditional items always go through process_item().
+ */
+static log_program *compile_log_format(apr_pool_t *p, apr_array_header_t *a)
+{
+    log_program *prog = log_program_make(p, a->nelts);
+    log_format_item *items = (log_format_item *) a->elts;
+    int i;
+
+    for (i = 0; i < a->nelts; ++i) {
+        log_format_item *item = &items[i];
+        log_op_e op = LOG_OP_ITEM;
+
+        if (item->func == constant_item) {
+            op = LOG_OP_CONST;
+        }
+        else if (item->conditions) {
+            op = LOG_OP_ITEM;
+        }
+        else if (item->func == log_remote_host) {
+            op = LOG_OP_REMOTE_HOST;
+        }
+        else if (item->func == log_request_time
+                 && (!*item->arg || !strcmp(item->arg, "begin"))) {
+            op = LOG_OP_TIME_CLF;
+        }
+        else if (item->func == log_request_line) {
+            op = LOG_OP_REQUEST_LINE;
+        }
+        else if (item->func == log_status) {
+            op = LOG_OP_STATUS;
+        }
+        else if (item->func == clf_log_bytes_sent) {
+            op = LOG_OP_BYTES_CLF;
+        }
+        else if (item->func == log_request_duration_microseconds) {
+            op = LOG_OP_DURATION_US;
+        }
+        else if (item->func == log_header_in) {
+            op = LOG_OP_HEADER_IN;
+        }
+        log_program_add(prog, op, item->want_orig, item->arg, item);
+    }
+    return prog;
+}
+
+static log_format *parse_log_string(apr_pool_t *p, const char *s, const char **err)
 {
+    log_format *format = apr_palloc(p, sizeof(*format));
     apr_array_header_t *a = apr_array_make(p, 30, sizeof(log_format_item));
     char *res;
 
@@ -1006,7 +1060,10 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
 
     s = APR_EOL_STR;
     parse_log_item(p, (log_format_item *) apr_array_push(a), &s);
-    return a;
+
+    format->items = a;
+    format->program = compile_log_format(p, a);
+    return format;
 }
 
 /*****************************************************************
@@ -1045,6 +1102,12 @@ static const char *process_item(request_rec *r, request_rec *orig,
     return cp ? cp : "-";
 }
 
+/* The log_program_item_fn of log_program_run() */
+static const char *run_item(request_rec *r, request_rec *orig, void *item)
+{
+    return process_item(r, orig, item);
+}
+
 static void flush_log(buffered_log *buf)
 {
     if (buf->outcnt && buf->handle != NULL) {
@@ -1055,15 +1118,14 @@ static void flush_log(buffered_log *buf)
 
 
 static int config_log_transaction(request_rec *r, config_log_state *cls,
-                                  apr_array_header_t *default_format)
+                                  log_format *default_format)
 {
-    log_format_item *items;
-    const char **strs;
-    int *strl;
+    char buf[HUGE_STRING_LEN];
+    char *line;
+    int linel;
     request_rec *orig;
-    int i;
-    apr_size_t len = 0;
-    apr_array_header_t *format;
+    apr_size_t len;
+    log_format *format;
     char *envar;
     apr_status_t rv;
 
@@ -1100,10 +1162,6 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
 
     format = cls->format ? cls->format : default_format;
 
-    strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
-    strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
-    items = (log_format_item *) format->elts;
-
     orig = r;
     while (orig->prev) {
         orig = orig->prev;
@@ -1112,19 +1170,48 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
         r = r->next;
     }
 
-    for (i = 0; i < format->nelts; ++i) {
-        strs[i] = process_item(r, orig, &items[i]);
-    }
-
-    for (i = 0; i < format->nelts; ++i) {
-        len += strl[i] = strlen(strs[i]);
-    }
     if (!log_writer) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00645)
                 "log writer isn't correctly setup");
          return HTTP_INTERNAL_SERVER_ERROR;
     }
-    rv = log_writer(r, cls->log_writer, strs, strl, format->nelts, len);
+
+    if (log_records) {
+        /* The writer makes the records from r itself, see
+         * ap_log_set_records(), nothing is formatted for it.
+         */
+        rv = log_writer(r, cls->log_writer, NULL, NULL, 0, 0);
+    }
+    else if (log_writer != ap_default_log_writer
+             && log_writer != ap_buffered_log_writer) {
+        /* A writer registered with ap_log_set_writer() gets one string
+         * per format item, as it always did.
+         */
+        log_format_item *items = (log_format_item *)format->items->elts;
+        const char **strs;
+        int *strl;
+        int i;
+
+        strs = apr_palloc(r->pool, sizeof(char *) * (format->items->nelts));
+        strl = apr_palloc(r->pool, sizeof(int) * (format->items->nelts));
+        len = 0;
+        for (i = 0; i < format->items->nelts; ++i) {
+            strs[i] = process_item(r, orig, &items[i]);
+            len += strl[i] = strlen(strs[i]);
+        }
+        rv = log_writer(r, cls->log_writer, strs, strl,
+                        format->items->nelts, len);
+    }
+    else {
+        /* The whole entry is written into buf, or into r->pool if it is
+         * larger, and handed to the built-in writer as a single string.
+         */
+        len = log_program_run(format->program, r, orig, run_item,
+                              get_request_end_time, buf, sizeof(buf), &line);
+        linel = (int)len;
+        rv = log_writer(r, cls->log_writer, (const char **)&line, &linel,
+                        1, len);
+    }
     if (rv != APR_SUCCESS)
         ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00646) "Error writing to %s",
                       cls->fname);
@@ -1291,6 +1378,18 @@ static const char *set_transfer_log(cmd_parms *cmd, void *dummy,
     return add_custom_log(cmd, dummy, fn, NULL, NULL);
 }
 
+#if APR_HAS_THREADS
+static const char *set_buffered_logs_interval(cmd_parms *cmd, void *dummy,
+                                              const char *arg)
+{
+    if (ap_timeout_parameter_parse(arg, &buffered_logs_interval, "s")
+        != APR_SUCCESS || buffered_logs_interval <= 0) {
+        return "BufferedLogsFlushInterval must be a positive time";
+    }
+    return NULL;
+}
+#endif
+
 static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
 {
     buffered_logs = flag;
@@ -1315,12 +1414,17 @@ AP_INIT_TAKE12("LogFormat", log_format, NULL, RSRC_CONF,
      "a log format string (see docs) and an optional format name"),
 AP_INIT_FLAG("BufferedLogs", set_buffered_logs_on, NULL, RSRC_CONF,
                  "Enable Buffered Logging (experimental)"),
+#if APR_HAS_THREADS
+AP_INIT_TAKE1("BufferedLogsFlushInterval", set_buffered_logs_interval, NULL,
+              RSRC_CONF, "Maximum time buffered log entries are kept in "
+              "memory with a threaded MPM, default 1 second"),
+#endif
     {NULL}
 };
 
 static config_log_state *open_config_log(server_rec *s, apr_pool_t *p,
                                          config_log_state *cls,
-                                         apr_array_header_t *default_format)
+                                         log_format *default_format)
 {
     if (cls->log_writer != NULL) {
         return cls;             /* virtual config shared w/main server */
@@ -1431,6 +1535,237 @@ static apr_status_t flush_all_logs(void *data)
 }
 
 
+#if APR_HAS_THREADS
+/* For a pipe, how much of the n bytes at head of the ring can be written
+ * in one piece of at most room bytes: whole lines if possible, or whole
+ * records, which start with their length.
+ */
+static apr_uint32_t log_ring_cut(log_ring *ring, apr_uint32_t head,
+                                 apr_uint32_t n, apr_size_t room)
+{
+    apr_uint32_t cut;
+
+    if (n <= room) {
+        return n;
+    }
+    if (log_records) {
+        apr_uint32_t rec_len;
+        int i;
+
+        for (cut = 0; cut + 4 <= n; cut += rec_len) {
+            for (rec_len = 0, i = 0; i < 4; i++) {
+                rec_len = (rec_len << 8) | (unsigned char)
+                    ring->data[(head + cut + i) & (LOG_RING_SIZE - 1)];
+            }
+            if (!rec_len || cut + rec_len > room) {
+                break;
+            }
+        }
+        return cut;
+    }
+    for (cut = room; cut > 0; cut--) {
+        if (ring->data[(head + cut - 1) & (LOG_RING_SIZE - 1)] == '\n') {
+            return cut;
+        }
+    }
+    return 0;
+}
+
+/* Write out what the rings of buf hold, with as few writev()s as possible,
+ * or pieces of at most PIPE_BUF bytes for a pipe.
+ */
+static void drain_log(buffered_log *buf)
+{
+    log_ring *ring = buf->rings;
+
+    while (ring) {
+        struct iovec vec[LOG_WRITEV_MAX];
+        log_ring *from[LOG_WRITEV_MAX / 2];
+        apr_uint32_t taken[LOG_WRITEV_MAX / 2];
+        apr_size_t total = 0, written;
+        int nvec = 0, n, i;
+
+        for (n = 0; ring && n < LOG_WRITEV_MAX / 2; ring = ring->next) {
+            apr_uint32_t head = ring->head;
+            /* the barrier makes the entries visible before the tail */
+            apr_uint32_t len = apr_atomic_add32(&ring->tail, 0) - head;
+            apr_uint32_t at = head & (LOG_RING_SIZE - 1);
+            int partial = 0;
+
+            if (!len) {
+                continue;
+            }
+            if (buf->piped && total + len > LOG_BUFSIZE) {
+                apr_uint32_t cut = log_ring_cut(ring, head, len,
+                                                LOG_BUFSIZE - total);
+
+                if (!cut && total) {
+                    break;
+                }
+                len = cut ? cut : LOG_BUFSIZE;
+                partial = 1;
+            }
+
+            vec[nvec].iov_base = ring->data + at;
+            if (at + len > LOG_RING_SIZE) {
+                vec[nvec++].iov_len = LOG_RING_SIZE - at;
+                vec[nvec].iov_base = ring->data;
+                vec[nvec++].iov_len = at + len - LOG_RING_SIZE;
+            }
+            else {
+                vec[nvec++].iov_len = len;
+            }
+            from[n] = ring;
+            taken[n++] = len;
+            total += len;
+
+            if (partial) {
+                /* the rest of this ring goes with the next writev() */
+                break;
+            }
+        }
+        if (!n) {
+            break;
+        }
+
+        /* the entries are dropped on error, as with flush_log() */
+        apr_file_writev_full(buf->handle, vec, nvec, &written);
+        for (i = 0; i < n; i++) {
+            apr_atomic_add32(&from[i]->head, taken[i]);
+        }
+    }
+}
+
+static void * APR_THREAD_FUNC log_writer_main(apr_thread_t *thd, void *data)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    int stop, i;
+
+    do {
+        apr_thread_mutex_lock(log_writer_mutex);
+        if (!log_writer_stop) {
+            apr_thread_cond_timedwait(log_writer_cond, log_writer_mutex,
+                                      buffered_logs_interval);
+        }
+        stop = log_writer_stop;
+        apr_thread_mutex_unlock(log_writer_mutex);
+
+        for (i = 0; i < all_buffered_logs->nelts; i++) {
+            drain_log(array[i]);
+        }
+    } while (!stop);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t stop_log_writer(void *data)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    apr_status_t rv;
+    int i;
+
+    /* the writer drains the rings one last time before exiting */
+    apr_thread_mutex_lock(log_writer_mutex);
+    log_writer_stop = 1;
+    apr_thread_cond_signal(log_writer_cond);
+    apr_thread_mutex_unlock(log_writer_mutex);
+    apr_thread_join(&rv, log_writer_thread);
+
+    for (i = 0; i < all_buffered_logs->nelts; i++) {
+        log_ring *ring = array[i]->rings;
+
+        array[i]->rings = NULL;
+        while (ring) {
+            log_ring *next = ring->next;
+            free(ring);
+            ring = next;
+        }
+    }
+    log_rings = 0;
+    return APR_SUCCESS;
+}
+
+static apr_status_t start_log_writer(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+
+    log_writer_stop = 0;
+    if ((rv = apr_threadkey_private_create(&log_ring_key, free, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_mutex_create(&log_writer_mutex,
+                                         APR_THREAD_MUTEX_DEFAULT, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&log_writer_cond, p)) != APR_SUCCESS
+        || (rv = apr_thread_create(&log_writer_thread, NULL, log_writer_main,
+                                   NULL, p)) != APR_SUCCESS) {
+        return rv;
+    }
+    apr_pool_cleanup_register(p, NULL, stop_log_writer,
+                              apr_pool_cleanup_null);
+    log_rings = 1;
+    return APR_SUCCESS;
+}
+
+/* The ring of the calling thread for buf, made on first use */
+static log_ring *get_log_ring(buffered_log *buf)
+{
+    log_ring **rings;
+
+    apr_threadkey_private_get((void **)&rings, log_ring_key);
+    if (!rings) {
+        /* freed when the thread exits */
+        rings = ap_calloc(all_buffered_logs->nelts, sizeof(log_ring *));
+        apr_threadkey_private_set(rings, log_ring_key);
+    }
+    if (!rings[buf->index]) {
+        log_ring *ring = ap_calloc(1, sizeof(log_ring));
+
+        /* hand it over to the writer thread */
+        do {
+            ring->next = buf->rings;
+        } while (apr_atomic_casptr((void *)&buf->rings, ring,
+                                   ring->next) != ring->next);
+        rings[buf->index] = ring;
+    }
+    return rings[buf->index];
+}
+
+/* Append an entry to the ring, if there is room */
+static int log_ring_put(log_ring *ring, const char **strs, int *strl,
+                        int nelts, apr_size_t len)
+{
+    apr_uint32_t tail = ring->tail;
+    apr_uint32_t used = tail - apr_atomic_read32(&ring->head);
+    int i;
+
+    if (len > LOG_RING_SIZE - used) {
+        return 0;
+    }
+    for (i = 0; i < nelts; ++i) {
+        const char *s = strs[i];
+        apr_size_t n = strl[i];
+
+        while (n) {
+            apr_uint32_t at = tail & (LOG_RING_SIZE - 1);
+            apr_size_t chunk = LOG_RING_SIZE - at < n ? LOG_RING_SIZE - at : n;
+
+            memcpy(ring->data + at, s, chunk);
+            s += chunk;
+            n -= chunk;
+            tail += chunk;
+        }
+    }
+    /* publish the entry, after a barrier */
+    apr_atomic_add32(&ring->tail, len);
+
+    if (used < LOG_RING_WAKEUP && used + len >= LOG_RING_WAKEUP) {
+        apr_thread_cond_signal(log_writer_cond);
+    }
+    return 1;
+}
+#endif
+
 static int init_config_log(apr_pool_t *pc, apr_pool_t *p, apr_pool_t *pt, server_rec *s)
 {
     int res;
@@ -1467,6 +1802,22 @@ static void init_child(apr_pool_t *p, server_rec *s)
 
         apr_pool_cleanup_register(p, s, flush_all_logs, flush_all_logs);
 
+#if APR_HAS_THREADS
+        /* no locking needed with the rings */
+        if (mpm_threads > 1 && all_buffered_logs->nelts) {
+            apr_status_t rv = start_log_writer(p, s);
+
+            if (rv == APR_SUCCESS) {
+                mpm_threads = 1;
+            }
+            else {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02312)
+                             "could not start the buffered log writer "
+                             "thread, using a mutex for each log");
+            }
+        }
+#endif
+
         for (i = 0; i < all_buffered_logs->nelts; i++) {
             buffered_log *this = array[i];
 
@@ -1519,6 +1870,16 @@ static ap_log_writer *ap_log_set_writer(ap_log_writer *handle)
     return old;
 }
 
+static void ap_log_set_records(int on)
+{
+    log_records = on;
+}
+
+static apr_time_t ap_log_get_request_end_time(request_rec *r)
+{
+    return get_request_end_time(r);
+}
+
 static apr_status_t ap_default_log_writer( request_rec *r,
                            void *handle,
                            const char **strs,
@@ -1532,6 +1893,11 @@ static apr_status_t ap_default_log_writer( request_rec *r,
     int i;
     apr_status_t rv;
 
+    if (nelts == 1) {
+        /* a whole entry, as config_log_transaction() writes it */
+        return apr_file_write((apr_file_t*)handle, strs[0], &len);
+    }
+
     str = apr_palloc(r->pool, len + 1);
 
     for (i = 0, s = str; i < nelts; ++i) {
@@ -1582,6 +1948,10 @@ static void *ap_buffered_log_writer_init(apr_pool_t *p, server_rec *s,
     b->handle = ap_default_log_writer_init(p, s, name);
 
     if (b->handle) {
+#if APR_HAS_THREADS
+        b->index = all_buffered_logs->nelts;
+        b->piped = (*name == '|');
+#endif
         *(buffered_log **)apr_array_push(all_buffered_logs) = b;
         return b;
     }
@@ -1602,6 +1972,17 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
     apr_status_t rv;
     buffered_log *buf = (buffered_log*)handle;
 
+#if APR_HAS_THREADS
+    if (log_rings) {
+        /* written directly only if the ring is full */
+        if (len < LOG_BUFSIZE
+            && log_ring_put(get_log_ring(buf), strs, strl, nelts, len)) {
+            return APR_SUCCESS;
+        }
+        return ap_default_log_writer(r, buf->handle, strs, strl, nelts, len);
+    }
+#endif
+
     if ((rv = APR_ANYLOCK_LOCK(&buf->mutex)) != APR_SUCCESS) {
         return rv;
     }
@@ -1676,7 +2057,11 @@ static int log_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
     /* reset to default conditions */
     ap_log_set_writer_init(ap_default_log_writer_init);
     ap_log_set_writer(ap_default_log_writer);
+    log_records = 0;
     buffered_logs = 0;
+#if APR_HAS_THREADS
+    buffered_logs_interval = apr_time_from_sec(1);
+#endif
 
     return OK;
 }
@@ -1748,6 +2133,8 @@ static void register_hooks(apr_pool_t *p)
     APR_REGISTER_OPTIONAL_FN(ap_register_log_handler);
     APR_REGISTER_OPTIONAL_FN(ap_log_set_writer_init);
     APR_REGISTER_OPTIONAL_FN(ap_log_set_writer);
+    APR_REGISTER_OPTIONAL_FN(ap_log_set_records);
+    APR_REGISTER_OPTIONAL_FN(ap_log_get_request_end_time);
 }
 
 AP_DECLARE_MODULE(log_config) =
@@ -41,7 +41,8 @@ typedef const char *ap_log_handler_fn_t(request_rec *r, char *a);
 typedef void *ap_log_writer_init(apr_pool_t *p, server_rec *s,
                                  const char *name);
 /**
- * callback which gets called where there is a log line to write.
+ * callback which gets called where there is a log line to write,
+ * with one portion per item of the log format.
  */
 typedef apr_status_t ap_log_writer(
                             request_rec *r,
@@ -68,6 +69,21 @@ APR_DECLARE_OPTIONAL_FN(ap_log_writer_init*, ap_log_set_writer_init,(ap_log_writ
  * you should probably set the writer at the same time (ie..before open_logs)
  */
 APR_DECLARE_OPTIONAL_FN(ap_log_writer*, ap_log_set_writer, (ap_log_writer* func));
+/**
+ * the entries passed to the writer are records which start with their
+ * length, as a 32-bit number in network byte order, rather than lines
+ * ending with '\n', so that BufferedLogs writes whole records to a piped
+ * log; to be set before open_logs too, each record no larger than PIPE_BUF.
+ * The writer set with ap_log_set_writer() then makes the records from the
+ * request itself: it is called with no portions (nelts 0), the log format
+ * is not applied, and passes the records on to the writer it replaced
+ */
+APR_DECLARE_OPTIONAL_FN(void, ap_log_set_records, (int on));
+/**
+ * the time the request ended, as used by %D, %T and %{end}t
+ */
+APR_DECLARE_OPTIONAL_FN(apr_time_t, ap_log_get_request_end_time,
+                        (request_rec *r));
 
 #endif /* MOD_LOG_CONFIG */
 /** @} */
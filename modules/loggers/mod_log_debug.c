@@ -59,6 +59,10 @@ static void do_debug_log(request_rec *r, const char *hookname)
     if (dconf->entries == NULL)
         return;
 
+    /* the messages are logged at info: don't evaluate them for nothing */
+    if (!APLOGrinfo(r))
+        return;
+
     for (i = 0; i < dconf->entries->nelts; i++) {
         const char *msg, *err;
         msg_entry *entry = APR_ARRAY_IDX(dconf->entries, i, msg_entry *);
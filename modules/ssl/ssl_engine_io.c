@@ -103,6 +103,7 @@ typedef struct {
     ap_filter_t        *pInputFilter;
     ap_filter_t        *pOutputFilter;
     SSLConnRec         *config;
+    char               *file_buf; /* see ssl_io_filter_output_file() */
 } ssl_filter_ctx_t;
 
 typedef struct {
@@ -1510,6 +1511,50 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);
 }
 
+/* One TLS record's worth of plaintext */
+#define SSL_FILE_READ_SIZE 16384
+
+/* Encrypt the start of a FILE bucket which won't be mmap()ed.
+ * apr_bucket_read() would read it APR_BUCKET_BUFF_SIZE (8000) bytes at a
+ * time into a new heap bucket, and so make twice as many TLS records, and
+ * writes, as needed.  Read a full record into a per connection buffer
+ * instead.
+ */
+static apr_status_t ssl_io_filter_output_file(ap_filter_t *f,
+                                              apr_bucket *bucket)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    apr_bucket_file *a = bucket->data;
+    apr_off_t offset = bucket->start;
+    apr_size_t len;
+    apr_status_t status;
+
+    if (!filter_ctx->file_buf) {
+        filter_ctx->file_buf = apr_palloc(f->c->pool, SSL_FILE_READ_SIZE);
+    }
+
+    len = bucket->length < SSL_FILE_READ_SIZE ? bucket->length
+                                              : SSL_FILE_READ_SIZE;
+    status = apr_file_seek(a->fd, APR_SET, &offset);
+    if (status == APR_SUCCESS) {
+        status = apr_file_read_full(a->fd, filter_ctx->file_buf, len, &len);
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = ssl_filter_write(f, filter_ctx->file_buf, len);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    if (len < bucket->length) {
+        apr_bucket_split(bucket, len);
+    }
+    apr_bucket_delete(bucket);
+    return APR_SUCCESS;
+}
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1584,6 +1629,20 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
             }
             break;
         }
+        else if (APR_BUCKET_IS_FILE(bucket) && bucket->length
+#if APR_HAS_MMAP
+                 && !((apr_bucket_file *)bucket->data)->can_mmap
+#endif
+#if APR_HAS_THREADS && !APR_HAS_XTHREAD_FILES
+                 && !(apr_file_flags_get(((apr_bucket_file *)bucket->data)->fd)
+                      & APR_FOPEN_XTHREAD)
+#endif
+                 ) {
+            status = ssl_io_filter_output_file(f, bucket);
+            if (status != APR_SUCCESS) {
+                break;
+            }
+        }
         else {
             /* filter output */
             const char *data;
@@ -1857,6 +1916,7 @@ void ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
     filter_ctx = apr_palloc(c->pool, sizeof(ssl_filter_ctx_t));
 
     filter_ctx->config          = myConnConfig(c);
+    filter_ctx->file_buf        = NULL;
 
     ap_add_output_filter(ssl_io_coalesce, NULL, r, c);
 
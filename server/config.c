@@ -1515,6 +1515,27 @@ AP_DECLARE_NONSTD(const char *) ap_set_deprecated(cmd_parms *cmd,
     return cmd->cmd->errmsg;
 }
 
+/* The effective level of each module of a merged server config, so that
+ * the loglevel checks take a single lookup.
+ */
+static void resolve_log_levels(apr_pool_t *p, server_rec *s)
+{
+    const struct ap_logconf *l = &s->log;
+    signed char *levels;
+    int i;
+
+    /* one more for APLOG_NO_MODULE, in front */
+    levels = (signed char *)apr_palloc(p, conf_vector_length + 1) + 1;
+    levels[APLOG_NO_MODULE] = l->level;
+    for (i = 0; i < conf_vector_length; i++) {
+        if (l->module_levels == NULL || l->module_levels[i] < 0)
+            levels[i] = l->level;
+        else
+            levels[i] = l->module_levels[i];
+    }
+    s->log_levels = levels;
+}
+
 AP_DECLARE(void) ap_reset_module_loglevels(struct ap_logconf *l, int val)
 {
     if (l->module_levels)
@@ -2242,6 +2263,7 @@ AP_DECLARE(void) ap_fixup_virtual_hosts(apr_pool_t *p, server_rec *main_server)
     core_dir_config *dconf =
         ap_get_core_module_config(main_server->lookup_defaults);
     dconf->log = &main_server->log;
+    resolve_log_levels(p, main_server);
 
     for (virt = main_server->next; virt; virt = virt->next) {
         merge_server_configs(p, main_server->module_config,
@@ -2267,6 +2289,7 @@ AP_DECLARE(void) ap_fixup_virtual_hosts(apr_pool_t *p, server_rec *main_server)
             virt->keep_alive_max = main_server->keep_alive_max;
 
         ap_merge_log_config(&main_server->log, &virt->log);
+        resolve_log_levels(p, virt);
 
         dconf = ap_get_core_module_config(virt->lookup_defaults);
         dconf->log = &virt->log;
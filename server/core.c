@@ -360,10 +360,12 @@ static void *merge_core_dir_configs(apr_pool_t *a, void *basev, void *newv)
 
     if (new->output_filters) {
         conf->output_filters = new->output_filters;
+        conf->output_filter_chain = new->output_filter_chain;
     }
 
     if (new->input_filters) {
         conf->input_filters = new->input_filters;
+        conf->input_filter_chain = new->input_filter_chain;
     }
 
     /*
@@ -504,6 +506,15 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
     if (virt->trace_enable != AP_TRACE_UNSET)
         conf->trace_enable = virt->trace_enable;
 
+    if (virt->flush_min_threshold)
+        conf->flush_min_threshold = virt->flush_min_threshold;
+
+    if (virt->flush_max_threshold)
+        conf->flush_max_threshold = virt->flush_max_threshold;
+
+    if (virt->flush_max_pipelined)
+        conf->flush_max_pipelined = virt->flush_max_pipelined;
+
     /* no action for virt->accf_map, not allowed per-vhost */
 
     if (virt->protocol)
@@ -1933,6 +1944,25 @@ static const char *set_etag_bits(cmd_parms *cmd, void *mconfig,
     return NULL;
 }
 
+static const char *set_filters(cmd_parms *cmd, void *d_, const char *arg)
+{
+    core_dir_config *d = d_;
+    ap_filter_chain_t *chain = ap_filter_chain_make(cmd->pool, arg,
+                                                    cmd->info != NULL);
+
+    /* look the filters up once, not for every request */
+    if (cmd->info) {
+        d->input_filters = arg;
+        d->input_filter_chain = chain;
+    }
+    else {
+        d->output_filters = arg;
+        d->output_filter_chain = chain;
+    }
+
+    return NULL;
+}
+
 static const char *set_enable_mmap(cmd_parms *cmd, void *d_,
                                    const char *arg)
 {
@@ -3480,6 +3510,46 @@ static const char *set_recursion_limit(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_flush_threshold(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    apr_off_t size;
+    char *end;
+
+    if (apr_strtoff(&size, arg, &end, 10) != APR_SUCCESS || *end
+        || size <= 0 || size > APR_INT32_MAX) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be a positive number of bytes", NULL);
+    }
+
+    if (cmd->info) {
+        conf->flush_max_threshold = (apr_size_t)size;
+    }
+    else {
+        conf->flush_min_threshold = (apr_size_t)size;
+    }
+
+    return NULL;
+}
+
+static const char *set_flush_max_pipelined(cmd_parms *cmd, void *dummy,
+                                           const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    int n = atoi(arg);
+
+    if (n <= 0) {
+        return "FlushMaxPipelined must be greater than zero.";
+    }
+
+    conf->flush_max_pipelined = n;
+
+    return NULL;
+}
+
 static void log_backtrace(const request_rec *r)
 {
     const request_rec *top = r;
@@ -3829,6 +3899,21 @@ static const char *set_errorlog_format(cmd_parms *cmd, void *dummy,
     return err_string;
 }
 
+static const char *set_buffered_error_logs(cmd_parms *cmd, void *dummy,
+                                           int flag)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    conf->buffered_error_logs = flag;
+    return NULL;
+}
+
 AP_DECLARE(void) ap_register_errorlog_handler(apr_pool_t *p, char *tag,
                                               ap_errorlog_handler_fn_t *handler,
                                               int flags)
@@ -3953,6 +4038,8 @@ AP_INIT_TAKE1("ErrorLog", set_server_string_slot,
   "The filename of the error log"),
 AP_INIT_TAKE12("ErrorLogFormat", set_errorlog_format, NULL, RSRC_CONF,
   "Format string for the ErrorLog"),
+AP_INIT_FLAG("BufferedErrorLogs", set_buffered_error_logs, NULL, RSRC_CONF,
+  "Write the error logs from a separate thread with a threaded MPM"),
 AP_INIT_RAW_ARGS("ServerAlias", set_server_alias, NULL, RSRC_CONF,
   "A name or names alternately used to access the server"),
 AP_INIT_TAKE1("ServerPath", set_serverpath, NULL, RSRC_CONF,
@@ -4045,11 +4132,9 @@ AP_INIT_TAKE1("ForceType", ap_set_string_slot_lower,
 AP_INIT_TAKE1("SetHandler", ap_set_string_slot_lower,
        (void *)APR_OFFSETOF(core_dir_config, handler), OR_FILEINFO,
    "a handler name that overrides any other configured handler"),
-AP_INIT_TAKE1("SetOutputFilter", ap_set_string_slot,
-       (void *)APR_OFFSETOF(core_dir_config, output_filters), OR_FILEINFO,
+AP_INIT_TAKE1("SetOutputFilter", set_filters, NULL, OR_FILEINFO,
    "filter (or ; delimited list of filters) to be run on the request content"),
-AP_INIT_TAKE1("SetInputFilter", ap_set_string_slot,
-       (void *)APR_OFFSETOF(core_dir_config, input_filters), OR_FILEINFO,
+AP_INIT_TAKE1("SetInputFilter", set_filters, (void *)1, OR_FILEINFO,
    "filter (or ; delimited list of filters) to be run on the request body"),
 AP_INIT_TAKE1("AllowEncodedSlashes", set_allow2f, NULL, RSRC_CONF,
              "Allow URLs containing '/' encoded as '%2F'"),
@@ -4088,6 +4173,16 @@ AP_INIT_TAKE1("EnableExceptionHook", ap_mpm_set_exception_hook, NULL, RSRC_CONF,
 #endif
 AP_INIT_TAKE1("TraceEnable", set_trace_enable, NULL, RSRC_CONF,
               "'on' (default), 'off' or 'extended' to trace request body content"),
+AP_INIT_TAKE1("FlushMinThreshold", set_flush_threshold, NULL, RSRC_CONF,
+              "Minimum number of bytes the output filter buffers before "
+              "writing, adapted upwards for fast connections (default 4096)"),
+AP_INIT_TAKE1("FlushMaxThreshold", set_flush_threshold, (void *)1, RSRC_CONF,
+              "Maximum number of bytes the output filter buffers before "
+              "blocking, adapted downwards for slow connections "
+              "(default 65536)"),
+AP_INIT_TAKE1("FlushMaxPipelined", set_flush_max_pipelined, NULL, RSRC_CONF,
+              "Maximum number of pipelined responses the output filter "
+              "buffers before blocking (default 5)"),
 { NULL }
 };
 
@@ -4462,14 +4557,20 @@ static void core_insert_filter(request_rec *r)
                             ap_get_core_module_config(r->per_dir_config);
     const char *filter, *filters = conf->output_filters;
 
-    if (filters) {
+    if (conf->output_filter_chain) {
+        ap_add_filter_chain(conf->output_filter_chain, r);
+    }
+    else if (filters) {
         while (*filters && (filter = ap_getword(r->pool, &filters, ';'))) {
             ap_add_output_filter(filter, NULL, r, r->connection);
         }
     }
 
     filters = conf->input_filters;
-    if (filters) {
+    if (conf->input_filter_chain) {
+        ap_add_filter_chain(conf->input_filter_chain, r);
+    }
+    else if (filters) {
         while (*filters && (filter = ap_getword(r->pool, &filters, ';'))) {
             ap_add_input_filter(filter, NULL, r, r->connection);
         }
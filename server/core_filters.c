@@ -53,6 +53,17 @@
 
 #include "mod_so.h" /* for ap_find_loaded_module_symbol */
 
+#if defined(__linux__) && APR_HAVE_NETINET_TCP_H
+#include <sys/ioctl.h>
+#include <netinet/tcp.h>    /* TCP_INFO */
+#include <linux/sockios.h>  /* SIOCOUTQ */
+#endif
+#if defined(TCP_INFO) && defined(SIOCOUTQ)
+#define CORE_ADAPTIVE_THRESHOLDS 1
+#else
+#define CORE_ADAPTIVE_THRESHOLDS 0
+#endif
+
 #define AP_MIN_SENDFILE_BYTES           (256)
 
 /**
@@ -83,6 +94,14 @@ struct core_output_filter_ctx {
     apr_bucket_brigade *tmp_flush_bb;
     apr_pool_t *deferred_write_pool;
     apr_size_t bytes_written;
+    /* the thresholds in use, see adapt_thresholds() */
+    apr_size_t min_write;
+    apr_size_t max_buffer;
+    int max_pipelined;
+    apr_size_t next_adapt;      /* bytes_written when to adapt again */
+    /* small buckets are copied here, see send_brigade_nonblocking() */
+    char *coalesce_buf;
+    apr_size_t coalesce_used;
 };
 
 struct core_filter_ctx {
@@ -336,14 +355,14 @@ static void setaside_remaining_output(ap_filter_t *f,
 
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
+                                             core_output_filter_ctx_t *ctx,
                                              conn_rec *c);
 
 static void remove_empty_buckets(apr_bucket_brigade *bb);
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c);
 
 static apr_status_t writev_nonblocking(apr_socket_t *s,
@@ -359,11 +378,101 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
                                          conn_rec *c);
 #endif
 
-/* XXX: Should these be configurable parameters? */
+/* Defaults of FlushMinThreshold, FlushMaxThreshold and FlushMaxPipelined */
 #define THRESHOLD_MIN_WRITE 4096
 #define THRESHOLD_MAX_BUFFER 65536
 #define MAX_REQUESTS_IN_PIPELINE 5
 
+static void init_thresholds(core_output_filter_ctx_t *ctx, conn_rec *c)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(c->base_server->module_config);
+
+    ctx->max_buffer = conf->flush_max_threshold ? conf->flush_max_threshold
+                                                : THRESHOLD_MAX_BUFFER;
+    ctx->min_write = conf->flush_min_threshold ? conf->flush_min_threshold
+                                               : THRESHOLD_MIN_WRITE;
+    if (ctx->min_write > ctx->max_buffer) {
+        ctx->min_write = ctx->max_buffer;
+    }
+    ctx->max_pipelined = conf->flush_max_pipelined ? conf->flush_max_pipelined
+                                                   : MAX_REQUESTS_IN_PIPELINE;
+
+    /* Connections which never write more than the configured buffer
+     * won't pay for looking at the socket.
+     */
+    ctx->next_adapt = CORE_ADAPTIVE_THRESHOLDS ? ctx->max_buffer
+                                               : (apr_size_t)-1;
+}
+
+#if CORE_ADAPTIVE_THRESHOLDS
+/*
+ * Size the buffering after what the client actually takes, within the
+ * configured bounds.  cwnd * mss is what TCP sends per round trip, so a
+ * client on a fast LAN quickly gets a window worth many KB, and a slow
+ * mobile client with a long RTT a few KB.  Then:
+ *   - buffer at most two round trips worth before blocking the handler,
+ *     since the socket would not take more any sooner
+ *   - coalesce up to one round trip worth before writing, but no more
+ *     than the send buffer has room for right now
+ * This is done again each time as much as the buffer was written.
+ */
+static void adapt_thresholds(core_output_filter_ctx_t *ctx, apr_socket_t *s,
+                             conn_rec *c)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(c->base_server->module_config);
+    apr_size_t lo = conf->flush_min_threshold ? conf->flush_min_threshold
+                                              : THRESHOLD_MIN_WRITE;
+    apr_size_t hi = conf->flush_max_threshold ? conf->flush_max_threshold
+                                              : THRESHOLD_MAX_BUFFER;
+    apr_size_t window, room;
+    apr_os_sock_t fd;
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    int sndbuf, queued;
+    socklen_t sndbuf_len = sizeof(sndbuf);
+
+    if (lo > hi) {
+        lo = hi;
+    }
+    if (apr_os_sock_get(&fd, s) != APR_SUCCESS
+        || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0
+        || getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &sndbuf_len) != 0
+        || ioctl(fd, SIOCOUTQ, &queued) != 0
+        || !ti.tcpi_rtt || !ti.tcpi_snd_mss) {
+        /* not TCP, or no RTT measured yet */
+        ctx->next_adapt = ctx->bytes_written + ctx->max_buffer;
+        return;
+    }
+
+    window = (apr_size_t)ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+    room = sndbuf > queued ? (apr_size_t)(sndbuf - queued) : 0;
+
+    ctx->max_buffer = 2 * window;
+    if (ctx->max_buffer > hi) {
+        ctx->max_buffer = hi;
+    }
+    if (ctx->max_buffer < lo) {
+        ctx->max_buffer = lo;
+    }
+    ctx->min_write = window < room ? window : room;
+    if (ctx->min_write > ctx->max_buffer / 2) {
+        ctx->min_write = ctx->max_buffer / 2;
+    }
+    if (ctx->min_write < lo) {
+        ctx->min_write = lo;
+    }
+    ctx->next_adapt = ctx->bytes_written + ctx->max_buffer;
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, c,
+                  "core_output_filter: rtt %uus, window %" APR_SIZE_T_FMT
+                  ", room %" APR_SIZE_T_FMT ": min write %" APR_SIZE_T_FMT
+                  ", max buffer %" APR_SIZE_T_FMT,
+                  ti.tcpi_rtt, window, room, ctx->min_write, ctx->max_buffer);
+}
+#endif
+
 /* Optional function coming from mod_logio, used for logging of output
  * traffic
  */
@@ -403,7 +512,13 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         ctx->tmp_flush_bb = apr_brigade_create(c->pool, c->bucket_alloc);
         /* same for buffered_bb and ap_save_brigade */
         ctx->buffered_bb = apr_brigade_create(c->pool, c->bucket_alloc);
+        init_thresholds(ctx, c);
     }
+#if CORE_ADAPTIVE_THRESHOLDS
+    else if (ctx->bytes_written >= ctx->next_adapt) {
+        adapt_thresholds(ctx, net->client_socket, c);
+    }
+#endif
 
     if (new_bb != NULL)
         bb = new_bb;
@@ -439,23 +554,23 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
      *     of everything up that point.
      *
      *  b) The request is in CONN_STATE_HANDLER state, and the brigade
-     *     contains at least THRESHOLD_MAX_BUFFER bytes in non-file
+     *     contains at least max_buffer bytes in non-file
      *     buckets: Do blocking writes until the amount of data in the
-     *     buffer is less than THRESHOLD_MAX_BUFFER.  (The point of this
+     *     buffer is less than max_buffer.  (The point of this
      *     rule is to provide flow control, in case a handler is
      *     streaming out lots of data faster than the data can be
      *     sent to the client.)
      *
      *  c) The request is in CONN_STATE_HANDLER state, and the brigade
-     *     contains at least MAX_REQUESTS_IN_PIPELINE EOR buckets:
-     *     Do blocking writes until less than MAX_REQUESTS_IN_PIPELINE EOR
+     *     contains at least max_pipelined EOR buckets:
+     *     Do blocking writes until less than max_pipelined EOR
      *     buckets are left. (The point of this rule is to prevent too many
      *     FDs being kept open by pipelined requests, possibly allowing a
      *     DoS).
      *
      *  d) The brigade contains a morphing bucket: If there was no other
      *     reason to do a blocking write yet, try reading the bucket. If its
-     *     contents fit into memory before THRESHOLD_MAX_BUFFER is reached,
+     *     contents fit into memory before max_buffer is reached,
      *     everything is fine. Otherwise we need to do a blocking write the
      *     up to and including the morphing bucket, because ap_save_brigade()
      *     would read the whole bucket into memory later on.
@@ -464,14 +579,17 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
      *     by rules 2a-d. The point of doing only one flush is to make as
      *     few calls to writev() as possible.
      *
-     *  4) If the brigade contains at least THRESHOLD_MIN_WRITE
+     *  4) If the brigade contains at least min_write
      *     bytes: Do a nonblocking write of as much data as possible,
      *     then save the rest in ctx->buffered_bb.
+     *
+     * max_buffer, max_pipelined and min_write come from FlushMaxThreshold,
+     * FlushMaxPipelined and FlushMinThreshold, and the first and last are
+     * adapted to the connection by adapt_thresholds().
      */
 
     if (new_bb == NULL) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if (APR_STATUS_IS_EAGAIN(rv)) {
             rv = APR_SUCCESS;
         }
@@ -512,18 +630,18 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         }
 
         if (APR_BUCKET_IS_FLUSH(bucket)
-            || non_file_bytes_in_brigade >= THRESHOLD_MAX_BUFFER
+            || non_file_bytes_in_brigade >= ctx->max_buffer
             || morphing_bucket_in_brigade
-            || eor_buckets_in_brigade > MAX_REQUESTS_IN_PIPELINE) {
+            || eor_buckets_in_brigade > ctx->max_pipelined) {
             /* this segment of the brigade MUST be sent before returning. */
 
             if (APLOGctrace6(c)) {
                 char *reason = APR_BUCKET_IS_FLUSH(bucket) ?
                                "FLUSH bucket" :
-                               (non_file_bytes_in_brigade >= THRESHOLD_MAX_BUFFER) ?
-                               "THRESHOLD_MAX_BUFFER" :
+                               (non_file_bytes_in_brigade >= ctx->max_buffer) ?
+                               "max buffer" :
                                morphing_bucket_in_brigade ? "morphing bucket" :
-                               "MAX_REQUESTS_IN_PIPELINE";
+                               "max pipelined";
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, c,
                               "core_output_filter: flushing because of %s",
                               reason);
@@ -543,8 +661,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
     if (flush_upto != NULL) {
         ctx->tmp_flush_bb = apr_brigade_split_ex(bb, flush_upto,
                                                  ctx->tmp_flush_bb);
-        rv = send_brigade_blocking(net->client_socket, bb,
-                                   &(ctx->bytes_written), c);
+        rv = send_brigade_blocking(net->client_socket, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             /* The client has aborted the connection */
             c->aborted = 1;
@@ -553,9 +670,8 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         APR_BRIGADE_CONCAT(bb, ctx->tmp_flush_bb);
     }
 
-    if (bytes_in_brigade >= THRESHOLD_MIN_WRITE) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+    if (bytes_in_brigade >= ctx->min_write) {
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if ((rv != APR_SUCCESS) && (!APR_STATUS_IS_EAGAIN(rv))) {
             /* The client has aborted the connection */
             c->aborted = 1;
@@ -601,25 +717,50 @@ static void setaside_remaining_output(ap_filter_t *f,
     }
 }
 
+/* How many buckets send_brigade_nonblocking() gives to one writev() */
 #ifndef APR_MAX_IOVEC_SIZE
 #define MAX_IOVEC_TO_WRITE 16
 #else
-#if APR_MAX_IOVEC_SIZE > 16
-#define MAX_IOVEC_TO_WRITE 16
+#if APR_MAX_IOVEC_SIZE > 64
+#define MAX_IOVEC_TO_WRITE 64
 #else
 #define MAX_IOVEC_TO_WRITE APR_MAX_IOVEC_SIZE
 #endif
 #endif
 
-static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
-                                             apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
-                                             conn_rec *c)
+/* Adjacent buckets smaller than this are copied into one iovec, using a
+ * per connection buffer of COALESCE_BUFFER_SIZE bytes.
+ */
+#define COALESCE_BUCKET_MAX 512
+#define COALESCE_BUFFER_SIZE 16384
+
+static APR_INLINE int is_small_bucket(apr_bucket *b)
+{
+    /* morphing buckets have a length of -1 */
+    return !APR_BUCKET_IS_METADATA(b) && b->length < COALESCE_BUCKET_MAX;
+}
+
+/*
+ * Write as much of bb as the socket takes without blocking, with as few
+ * syscalls as possible: up to MAX_IOVEC_TO_WRITE buckets per writev(), and
+ * one sendfile() per file bucket.  Only stops early when the socket is
+ * full (APR_EAGAIN) or on errors.
+ *
+ * Runs of small buckets, like chunk headers or the pieces mod_include
+ * makes, are copied into ctx->coalesce_buf and replaced by a single
+ * transient bucket, so that they take one iovec.
+ */
+static apr_status_t send_brigade_nonblocking_core(apr_socket_t *s,
+                                                  apr_bucket_brigade *bb,
+                                                  core_output_filter_ctx_t *ctx,
+                                                  conn_rec *c)
 {
     apr_bucket *bucket, *next;
+    apr_bucket *run = NULL;     /* the coalesced bucket vec ends with */
     apr_status_t rv;
     struct iovec vec[MAX_IOVEC_TO_WRITE];
     apr_size_t nvec = 0;
+    apr_size_t *bytes_written = &ctx->bytes_written;
 
     remove_empty_buckets(bb);
 
@@ -639,23 +780,35 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
 
             if ((apr_file_flags_get(fd) & APR_SENDFILE_ENABLED) &&
                 (bucket->length >= AP_MIN_SENDFILE_BYTES)) {
+                apr_size_t file_length = bucket->length;
+                apr_size_t written_before;
+
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 1);
                     rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
-                    nvec = 0;
                     if (rv != APR_SUCCESS) {
                         (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
                         return rv;
                     }
                 }
+                written_before = *bytes_written;
                 rv = sendfile_nonblocking(s, bucket, bytes_written, c);
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
+                    nvec = 0;
+                    run = NULL;
+                    ctx->coalesce_used = 0;
                 }
                 if (rv != APR_SUCCESS) {
                     return rv;
                 }
-                break;
+                if (*bytes_written - written_before < file_length) {
+                    /* the socket is full, the rest of the file is at the
+                     * head of bb now */
+                    return APR_EAGAIN;
+                }
+                /* the file bucket is gone, go on with the next one */
+                continue;
             }
         }
 #endif /* APR_HAS_SENDFILE */
@@ -675,6 +828,8 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                         return rv;
                     }
                     nvec = 0;
+                    run = NULL;
+                    ctx->coalesce_used = 0;
                 }
                 
                 rv = apr_bucket_read(bucket, &data, &length, APR_BLOCK_READ);
@@ -685,18 +840,56 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
 
             /* reading may have split the bucket, so recompute next: */
             next = APR_BUCKET_NEXT(bucket);
+
+            if (length < COALESCE_BUCKET_MAX
+                && ctx->coalesce_used + length <= COALESCE_BUFFER_SIZE
+                && (run || (next != APR_BRIGADE_SENTINEL(bb)
+                            && is_small_bucket(next)))) {
+                char *buf;
+
+                if (!ctx->coalesce_buf) {
+                    ctx->coalesce_buf = apr_palloc(c->pool,
+                                                   COALESCE_BUFFER_SIZE);
+                }
+                buf = ctx->coalesce_buf + ctx->coalesce_used;
+                memcpy(buf, data, length);
+                ctx->coalesce_used += length;
+                if (run) {
+                    /* the buffer is contiguous, just grow the run */
+                    run->length += length;
+                    vec[nvec - 1].iov_len += length;
+                    apr_bucket_delete(bucket);
+                    continue;
+                }
+                run = apr_bucket_transient_create(buf, length,
+                                                  c->bucket_alloc);
+                APR_BUCKET_INSERT_BEFORE(bucket, run);
+                apr_bucket_delete(bucket);
+                data = buf;
+            }
+            else {
+                run = NULL;
+            }
+
             vec[nvec].iov_base = (char *)data;
             vec[nvec].iov_len = length;
             nvec++;
             if (nvec == MAX_IOVEC_TO_WRITE) {
+                /* all of vec was written on success, and the buckets
+                 * from next on were not touched */
                 rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
                 nvec = 0;
+                run = NULL;
                 if (rv != APR_SUCCESS) {
                     return rv;
                 }
-                break;
+                ctx->coalesce_used = 0;
             }
         }
+        else {
+            /* don't coalesce across FLUSH or EOR buckets */
+            run = NULL;
+        }
     }
 
     if (nvec > 0) {
@@ -711,6 +904,36 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
     return APR_SUCCESS;
 }
 
+static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
+                                             apr_bucket_brigade *bb,
+                                             core_output_filter_ctx_t *ctx,
+                                             conn_rec *c)
+{
+    apr_status_t rv = send_brigade_nonblocking_core(s, bb, ctx, c);
+
+    if (ctx->coalesce_used) {
+        /* What was not written yet must not point to the buffer anymore,
+         * the next call reuses it.
+         */
+        const char *start = ctx->coalesce_buf;
+        const char *end = start + COALESCE_BUFFER_SIZE;
+        apr_bucket *bucket;
+
+        for (bucket = APR_BRIGADE_FIRST(bb);
+             bucket != APR_BRIGADE_SENTINEL(bb);
+             bucket = APR_BUCKET_NEXT(bucket)) {
+            if (APR_BUCKET_IS_TRANSIENT(bucket)
+                && (const char *)bucket->data >= start
+                && (const char *)bucket->data < end) {
+                apr_bucket_setaside(bucket, c->pool);
+            }
+        }
+        ctx->coalesce_used = 0;
+    }
+
+    return rv;
+}
+
 static void remove_empty_buckets(apr_bucket_brigade *bb)
 {
     apr_bucket *bucket;
@@ -723,14 +946,14 @@ static void remove_empty_buckets(apr_bucket_brigade *bb)
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c)
 {
     apr_status_t rv;
 
     rv = APR_SUCCESS;
     while (!APR_BRIGADE_EMPTY(bb)) {
-        rv = send_brigade_nonblocking(s, bb, bytes_written, c);
+        rv = send_brigade_nonblocking(s, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Wait until we can send more data */
@@ -783,6 +1006,12 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
     while (bytes_written < bytes_to_write) {
         apr_size_t n = 0;
         rv = apr_socket_sendv(s, vec + offset, nvec - offset, &n);
+        /* only writes which got something out, lest EAGAIN skew the
+         * average size of a write
+         */
+        if (ap_extended_status && n > 0) {
+            ap_increment_write_counts(c->sbh, nvec - offset, n);
+        }
         if (n > 0) {
             bytes_written += n;
             for (i = offset; i < nvec; ) {
@@ -864,6 +1093,9 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
             return arv;
         }
         rv = apr_socket_sendfile(s, fd, NULL, &file_offset, &n, 0);
+        if (ap_extended_status && rv == APR_SUCCESS && n > 0) {
+            ap_increment_write_counts(c->sbh, 1, n);
+        }
         if (rv == APR_SUCCESS) {
             bytes_written += n;
             file_offset += n;
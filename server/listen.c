@@ -15,6 +15,7 @@
  */
 
 #include "apr_network_io.h"
+#include "apr_portable.h"
 #include "apr_strings.h"
 
 #define APR_WANT_STRFUNC
@@ -33,8 +34,29 @@
 #define APLOG_MODULE_INDEX AP_CORE_MODULE_INDEX
 
 AP_DECLARE_DATA ap_listen_rec *ap_listeners = NULL;
+AP_DECLARE_DATA int ap_listen_reuseport = 0;
+
+/* The socket option which lets several sockets listen on the same address
+ * with the kernel balancing the connections between them: SO_REUSEPORT on
+ * Linux, SO_REUSEPORT_LB on FreeBSD.  The other systems' SO_REUSEPORT
+ * hands all the connections to one of the sockets, which is useless here.
+ */
+#if defined(SO_REUSEPORT_LB)
+#define AP_SO_REUSEPORT SO_REUSEPORT_LB
+#define AP_SO_REUSEPORT_NAME "SO_REUSEPORT_LB"
+#elif defined(SO_REUSEPORT) && defined(__linux__)
+#define AP_SO_REUSEPORT SO_REUSEPORT
+#define AP_SO_REUSEPORT_NAME "SO_REUSEPORT"
+#endif
 
 static ap_listen_rec *old_listeners;
+#ifdef AP_SO_REUSEPORT
+/* The sockets of ap_duplicate_listeners(), kept open across restarts like
+ * ap_listeners so that the connections queued on them are not lost:
+ * dup_buckets[1] to dup_buckets[num_dup_buckets - 1] */
+static ap_listen_rec **dup_buckets;
+static int num_dup_buckets;
+#endif
 static int ap_listenbacklog;
 static int send_buffer_size;
 static int receive_buffer_size;
@@ -64,6 +86,24 @@ static apr_status_t make_sock(apr_pool_t *p, ap_listen_rec *server)
     }
 #endif
 
+#ifdef AP_SO_REUSEPORT
+    if (ap_listen_reuseport) {
+        apr_os_sock_t thesock;
+
+        apr_os_sock_get(&thesock, s);
+        if (setsockopt(thesock, SOL_SOCKET, AP_SO_REUSEPORT,
+                       (void *)&one, sizeof(one)) < 0) {
+            stat = apr_get_netos_error();
+            ap_log_perror(APLOG_MARK, APLOG_WARNING, stat, p, APLOGNO(02306)
+                          "make_sock: for address %pI, setsockopt: "
+                          "(" AP_SO_REUSEPORT_NAME "), listeners will not "
+                          "be duplicated", server->bind_addr);
+            /* not a fatal error, ap_duplicate_listeners() will refuse */
+            ap_listen_reuseport = 0;
+        }
+    }
+#endif
+
     stat = apr_socket_opt_set(s, APR_SO_KEEPALIVE, one);
     if (stat != APR_SUCCESS && stat != APR_ENOTIMPL) {
         ap_log_perror(APLOG_MARK, APLOG_CRIT, stat, p, APLOGNO(00068)
@@ -520,6 +560,23 @@ static int open_listeners(apr_pool_t *pool)
     return num_open ? 0 : -1;
 }
 
+/* Find the server whose accept filter settings apply to a listener */
+static server_rec *find_listener_server(server_rec *s, ap_listen_rec *lr)
+{
+    server_rec *ls;
+    server_addr_rec *addr;
+
+    for (ls = s; ls; ls = ls->next) {
+        for (addr = ls->addrs; addr; addr = addr->next) {
+            if (apr_sockaddr_equal(lr->bind_addr, addr->host_addr) &&
+                lr->bind_addr->port == addr->host_port) {
+                return ls;
+            }
+        }
+    }
+    return s;
+}
+
 AP_DECLARE(int) ap_setup_listeners(server_rec *s)
 {
     server_rec *ls;
@@ -560,23 +617,130 @@ AP_DECLARE(int) ap_setup_listeners(server_rec *s)
 
     for (lr = ap_listeners; lr; lr = lr->next) {
         num_listeners++;
-        found = 0;
-        for (ls = s; ls && !found; ls = ls->next) {
-            for (addr = ls->addrs; addr && !found; addr = addr->next) {
-                if (apr_sockaddr_equal(lr->bind_addr, addr->host_addr) &&
-                    lr->bind_addr->port == addr->host_port) {
-                    found = 1;
-                    ap_apply_accept_filter(s->process->pool, lr, ls);
+        ap_apply_accept_filter(s->process->pool, lr,
+                               find_listener_server(s, lr));
+    }
+
+    return num_listeners;
+}
+
+#ifdef AP_SO_REUSEPORT
+static void close_duplicates(ap_listen_rec *lr)
+{
+    for (; lr; lr = lr->next) {
+        apr_socket_close(lr->sd);
+        lr->active = 0;
+    }
+}
+#endif
+
+AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
+                                                ap_listen_rec ***buckets,
+                                                int num_buckets)
+{
+#ifdef AP_SO_REUSEPORT
+    apr_pool_t *pproc = s->process->pool;
+    ap_listen_rec *lr, *dup, **walk, **last, **old;
+    apr_status_t stat = APR_SUCCESS;
+    int i, num_old;
+#if AP_NONBLOCK_WHEN_MULTI_LISTEN
+    int use_nonblock = (ap_listeners && ap_listeners->next);
+#endif
+#endif
+
+    *buckets = apr_pcalloc(p, num_buckets * sizeof(ap_listen_rec *));
+    (*buckets)[0] = ap_listeners;
+
+#ifdef AP_SO_REUSEPORT
+    old = dup_buckets;
+    num_old = num_dup_buckets;
+    num_dup_buckets = 0;
+
+    if (num_buckets > 1 && !ap_listen_reuseport) {
+        stat = APR_ENOTIMPL;
+    }
+
+    for (i = 1; i < num_buckets && stat == APR_SUCCESS; i++) {
+        last = &(*buckets)[i];
+        for (lr = ap_listeners; lr && stat == APR_SUCCESS; lr = lr->next) {
+            /* the socket of the previous generation, if any */
+            dup = NULL;
+            if (i < num_old) {
+                for (walk = &old[i]; *walk; walk = &(*walk)->next) {
+                    /* closed by the MPM on a full restart */
+                    if (!(*walk)->active) {
+                        continue;
+                    }
+                    if (apr_sockaddr_equal((*walk)->bind_addr, lr->bind_addr)
+                        && (*walk)->bind_addr->port == lr->bind_addr->port) {
+                        dup = *walk;
+                        *walk = dup->next;
+                        break;
+                    }
+                }
+            }
+            if (!dup) {
+                dup = apr_pcalloc(pproc, sizeof(ap_listen_rec));
+                dup->bind_addr = lr->bind_addr;
+                stat = apr_socket_create(&dup->sd, dup->bind_addr->family,
+                                         SOCK_STREAM, 0, pproc);
+                if (stat != APR_SUCCESS) {
+                    ap_log_perror(APLOG_MARK, APLOG_CRIT, stat, p,
+                                  APLOGNO(02307) "ap_duplicate_listeners: "
+                                  "failed to get a socket for %pI",
+                                  dup->bind_addr);
+                    break;
+                }
+                /* make_sock() closes the socket on failure */
+                stat = make_sock(pproc, dup);
+                if (stat != APR_SUCCESS) {
+                    break;
                 }
             }
+            dup->protocol = lr->protocol;
+            dup->slave = lr->slave;
+            dup->next = NULL;
+            *last = dup;
+            last = &dup->next;
+
+#if AP_NONBLOCK_WHEN_MULTI_LISTEN
+            stat = apr_socket_opt_set(dup->sd, APR_SO_NONBLOCK, use_nonblock);
+            if (stat != APR_SUCCESS) {
+                ap_log_perror(APLOG_MARK, APLOG_ERR, stat, p, APLOGNO(02308)
+                              "unable to control socket non-blocking status");
+                break;
+            }
+#endif
+            ap_apply_accept_filter(pproc, dup, find_listener_server(s, lr));
         }
+    }
+
+    /* close what this configuration does not use anymore */
+    for (i = 1; i < num_old; i++) {
+        close_duplicates(old[i]);
+    }
 
-        if (!found) {
-            ap_apply_accept_filter(s->process->pool, lr, s);
+    if (stat != APR_SUCCESS) {
+        for (i = 1; i < num_buckets; i++) {
+            close_duplicates((*buckets)[i]);
+            (*buckets)[i] = NULL;
         }
+        return stat;
     }
 
-    return num_listeners;
+    if (num_buckets > 1) {
+        if (num_buckets > num_old) {
+            old = apr_palloc(pproc, num_buckets * sizeof(ap_listen_rec *));
+        }
+        memcpy(old, *buckets, num_buckets * sizeof(ap_listen_rec *));
+        dup_buckets = old;
+        num_dup_buckets = num_buckets;
+    }
+
+    return APR_SUCCESS;
+#else
+    return num_buckets > 1 ? APR_ENOTIMPL : APR_SUCCESS;
+#endif
 }
 
 AP_DECLARE_NONSTD(void) ap_close_listeners(void)
@@ -610,6 +774,7 @@ AP_DECLARE(void) ap_listen_pre_config(void)
     old_listeners = ap_listeners;
     ap_listeners = NULL;
     ap_listenbacklog = DEFAULT_LISTENBACKLOG;
+    ap_listen_reuseport = 0;
 }
 
 /* Hack: populate an extra field
@@ -30,6 +30,8 @@
 #include "apr_signal.h"
 #include "apr_portable.h"
 #include "apr_base64.h"
+#include "apr_atomic.h"
+#include "apr_hash.h"
 
 #define APR_WANT_STDIO
 #define APR_WANT_STRFUNC
@@ -44,6 +46,9 @@
 #if APR_HAVE_PROCESS_H
 #include <process.h>            /* for getpid() on Win32 */
 #endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>             /* for PIPE_BUF */
+#endif
 
 #include "ap_config.h"
 #include "httpd.h"
@@ -172,6 +177,53 @@ typedef struct read_handle_t {
 
 static read_handle_t *read_handles;
 
+#if APR_HAS_THREADS
+/* With BufferedErrorLogs On and a threaded MPM, each thread appends the
+ * lines it logs to a ring of its own for each error log, and a writer
+ * thread writes them out as soon as it can, so that a thread logging does
+ * not wait for the others, nor for a slow log.  A line is written directly
+ * when its ring is full, and so are the messages at error and above, which
+ * must not be lost if the process crashes before the writer gets to them.
+ * The size must be a power of two.
+ */
+#define ERRLOG_RING_SIZE        (16 * 1024)
+
+/* The writer also looks at the rings this often, in case a wakeup is lost */
+#define ERRLOG_WRITER_INTERVAL  apr_time_from_msec(100)
+
+#ifdef PIPE_BUF
+#define ERRLOG_PIPE_BUF         PIPE_BUF
+#else
+#define ERRLOG_PIPE_BUF         (512)
+#endif
+
+typedef struct errlog_ring errlog_ring;
+struct errlog_ring {
+    errlog_ring *next;              /* rings of the same error log */
+    volatile apr_uint32_t head;     /* moved by the writer thread */
+    volatile apr_uint32_t tail;     /* moved by the thread owning the ring */
+    char data[ERRLOG_RING_SIZE];
+};
+
+typedef struct {
+    apr_file_t *handle;
+    int index;                      /* in the rings of a thread */
+    int piped;
+    errlog_ring *volatile rings;
+} buffered_errlog;
+
+/* The error logs of the child by handle, NULL when the lines are written
+ * directly.
+ */
+static apr_hash_t *buffered_errlog_hash;
+static int buffered_errlog_count;
+static apr_threadkey_t *errlog_ring_key;
+static apr_thread_t *errlog_writer_thread;
+static apr_thread_mutex_t *errlog_writer_mutex;
+static apr_thread_cond_t *errlog_writer_cond;
+static int errlog_writer_stop;
+#endif
+
 /**
  * @brief The piped logging structure.
  *
@@ -225,6 +277,217 @@ static void close_handle_in_child(apr_pool_t *p, apr_file_t *f)
 #endif
 }
 
+#if APR_HAS_THREADS
+/* For a pipe, how much of the n bytes at head of the ring to write at once:
+ * whole lines of at most ERRLOG_PIPE_BUF bytes if possible, so that the
+ * lines of several children don't interleave, else the first line.
+ */
+static apr_uint32_t errlog_ring_cut(errlog_ring *ring, apr_uint32_t head,
+                                    apr_uint32_t n)
+{
+    apr_uint32_t cut;
+
+    if (n <= ERRLOG_PIPE_BUF) {
+        return n;
+    }
+    for (cut = ERRLOG_PIPE_BUF; cut > 0; cut--) {
+        if (ring->data[(head + cut - 1) & (ERRLOG_RING_SIZE - 1)] == '\n') {
+            return cut;
+        }
+    }
+    for (cut = ERRLOG_PIPE_BUF + 1; cut < n; cut++) {
+        if (ring->data[(head + cut - 1) & (ERRLOG_RING_SIZE - 1)] == '\n') {
+            return cut;
+        }
+    }
+    return n;
+}
+
+/* Write out what the rings of buf hold, return how much */
+static apr_size_t drain_errlog(buffered_errlog *buf)
+{
+    errlog_ring *ring;
+    apr_size_t total = 0;
+
+    for (ring = buf->rings; ring; ring = ring->next) {
+        apr_uint32_t head = ring->head;
+        /* the barrier makes the lines visible before the tail */
+        apr_uint32_t len = apr_atomic_add32(&ring->tail, 0) - head;
+
+        while (len) {
+            struct iovec vec[2];
+            apr_uint32_t at = head & (ERRLOG_RING_SIZE - 1);
+            apr_uint32_t n = buf->piped ? errlog_ring_cut(ring, head, len)
+                                        : len;
+            apr_size_t written;
+            int nvec = 1;
+
+            vec[0].iov_base = ring->data + at;
+            if (at + n > ERRLOG_RING_SIZE) {
+                vec[0].iov_len = ERRLOG_RING_SIZE - at;
+                vec[1].iov_base = ring->data;
+                vec[1].iov_len = at + n - ERRLOG_RING_SIZE;
+                nvec = 2;
+            }
+            else {
+                vec[0].iov_len = n;
+            }
+
+            /* the lines are dropped on error, as with apr_file_puts() */
+            apr_file_writev_full(buf->handle, vec, nvec, &written);
+            apr_atomic_add32(&ring->head, n);
+            head += n;
+            len -= n;
+            total += n;
+        }
+    }
+    return total;
+}
+
+static void * APR_THREAD_FUNC errlog_writer_main(apr_thread_t *thd,
+                                                 void *data)
+{
+    apr_array_header_t *logs = data;
+    buffered_errlog **array = (buffered_errlog **)logs->elts;
+    apr_size_t written = 0;
+    int stop, i;
+
+    do {
+        apr_thread_mutex_lock(errlog_writer_mutex);
+        /* look again right away while there are lines coming */
+        if (!errlog_writer_stop && !written) {
+            apr_thread_cond_timedwait(errlog_writer_cond, errlog_writer_mutex,
+                                      ERRLOG_WRITER_INTERVAL);
+        }
+        stop = errlog_writer_stop;
+        apr_thread_mutex_unlock(errlog_writer_mutex);
+
+        written = 0;
+        for (i = 0; i < logs->nelts; i++) {
+            written += drain_errlog(array[i]);
+        }
+    } while (!stop);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t stop_errlog_writer(void *data)
+{
+    apr_status_t rv;
+
+    /* from now on the lines are written directly, and the writer drains
+     * the rings one last time before exiting.  The rings are left to the
+     * exit of the process, a thread may still be about to use one.
+     */
+    buffered_errlog_hash = NULL;
+
+    apr_thread_mutex_lock(errlog_writer_mutex);
+    errlog_writer_stop = 1;
+    apr_thread_cond_signal(errlog_writer_cond);
+    apr_thread_mutex_unlock(errlog_writer_mutex);
+    apr_thread_join(&rv, errlog_writer_thread);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t start_errlog_writer(apr_pool_t *p, server_rec *s_main)
+{
+    apr_array_header_t *logs = apr_array_make(p, 5, sizeof(buffered_errlog *));
+    apr_hash_t *hash = apr_hash_make(p);
+    server_rec *s;
+    apr_status_t rv;
+
+    /* the virtual hosts may share the error log of another server */
+    for (s = s_main; s; s = s->next) {
+        buffered_errlog *buf;
+
+        if (!s->error_log
+            || apr_hash_get(hash, &s->error_log, sizeof(apr_file_t *))) {
+            continue;
+        }
+        buf = apr_pcalloc(p, sizeof(buffered_errlog));
+        buf->handle = s->error_log;
+        buf->index = logs->nelts;
+        buf->piped = s->error_fname && *s->error_fname == '|';
+        APR_ARRAY_PUSH(logs, buffered_errlog *) = buf;
+        apr_hash_set(hash, &buf->handle, sizeof(apr_file_t *), buf);
+    }
+    if (!logs->nelts) {
+        /* syslog only */
+        return APR_SUCCESS;
+    }
+
+    errlog_writer_stop = 0;
+    if ((rv = apr_threadkey_private_create(&errlog_ring_key, free, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_mutex_create(&errlog_writer_mutex,
+                                         APR_THREAD_MUTEX_DEFAULT, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&errlog_writer_cond, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_create(&errlog_writer_thread, NULL,
+                                   errlog_writer_main, logs, p))
+            != APR_SUCCESS) {
+        return rv;
+    }
+    apr_pool_cleanup_register(p, NULL, stop_errlog_writer,
+                              apr_pool_cleanup_null);
+    buffered_errlog_count = logs->nelts;
+    buffered_errlog_hash = hash;
+    return APR_SUCCESS;
+}
+
+/* The ring of the calling thread for buf, made on first use */
+static errlog_ring *get_errlog_ring(buffered_errlog *buf)
+{
+    errlog_ring **rings;
+
+    apr_threadkey_private_get((void **)&rings, errlog_ring_key);
+    if (!rings) {
+        /* freed when the thread exits */
+        rings = ap_calloc(buffered_errlog_count, sizeof(errlog_ring *));
+        apr_threadkey_private_set(rings, errlog_ring_key);
+    }
+    if (!rings[buf->index]) {
+        errlog_ring *ring = ap_calloc(1, sizeof(errlog_ring));
+
+        /* hand it over to the writer thread */
+        do {
+            ring->next = buf->rings;
+        } while (apr_atomic_casptr((void *)&buf->rings, ring,
+                                   ring->next) != ring->next);
+        rings[buf->index] = ring;
+    }
+    return rings[buf->index];
+}
+
+/* Append a line to the ring, if there is room */
+static int errlog_ring_put(errlog_ring *ring, const char *line,
+                           apr_size_t len)
+{
+    apr_uint32_t tail = ring->tail;
+    apr_uint32_t used = tail - apr_atomic_read32(&ring->head);
+    apr_uint32_t at = tail & (ERRLOG_RING_SIZE - 1);
+    apr_size_t chunk;
+
+    if (len > ERRLOG_RING_SIZE - used) {
+        return 0;
+    }
+    chunk = ERRLOG_RING_SIZE - at < len ? ERRLOG_RING_SIZE - at : len;
+    memcpy(ring->data + at, line, chunk);
+    memcpy(ring->data, line + chunk, len - chunk);
+
+    /* publish the line, after a barrier */
+    apr_atomic_add32(&ring->tail, len);
+
+    if (!used) {
+        apr_thread_cond_signal(errlog_writer_cond);
+    }
+    return 1;
+}
+#endif
+
 void ap_logs_child_init(apr_pool_t *p, server_rec *s)
 {
     read_handle_t *cur = read_handles;
@@ -233,6 +496,24 @@ void ap_logs_child_init(apr_pool_t *p, server_rec *s)
         apr_file_close(cur->handle);
         cur = cur->next;
     }
+
+#if APR_HAS_THREADS
+    {
+        core_server_config *sconf = ap_get_core_module_config(s->module_config);
+        int mpm_threads = 0;
+
+        ap_mpm_query(AP_MPMQ_MAX_THREADS, &mpm_threads);
+        if (sconf->buffered_error_logs == 1 && mpm_threads > 1) {
+            apr_status_t rv = start_errlog_writer(p, s);
+
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02314)
+                             "could not start the error log writer thread, "
+                             "writing the error logs directly");
+            }
+        }
+    }
+#endif
 }
 
 AP_DECLARE(void) ap_open_stderr_log(apr_pool_t *p)
@@ -1080,6 +1361,17 @@ static void write_logline(char *errstr, apr_size_t len, apr_file_t *logf,
             len = MAX_STRING_LEN - sizeof(APR_EOL_STR);
         }
         strcpy(errstr + len, APR_EOL_STR);
+#if APR_HAS_THREADS
+        if (buffered_errlog_hash && level > APLOG_ERR) {
+            buffered_errlog *buf = apr_hash_get(buffered_errlog_hash, &logf,
+                                                sizeof(apr_file_t *));
+
+            if (buf && errlog_ring_put(get_errlog_ring(buf), errstr,
+                                       len + sizeof(APR_EOL_STR) - 1)) {
+                return;
+            }
+        }
+#endif
         apr_file_puts(errstr, logf);
         apr_file_flush(logf);
     }
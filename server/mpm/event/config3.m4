@@ -6,6 +6,7 @@ if test "$ac_cv_serf" = yes ; then
 fi
 APACHE_SUBST(MOD_MPM_EVENT_LDADD)
 
-APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo pod.lo,[
-    AC_CHECK_FUNCS(pthread_kill)
+APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo timer_heap.lo pod.lo,[
+    AC_CHECK_FUNCS(pthread_kill epoll_create1)
+    AC_CHECK_HEADERS(sys/epoll.h)
 ], , [\$(MOD_MPM_EVENT_LDADD)])
@@ -76,6 +76,10 @@
 #error The Event MPM requires APR threads, but they are unavailable.
 #endif
 
+#if !APR_VERSION_AT_LEAST(1,4,0)
+#error The Event MPM requires APR 1.4 or later for wakeable pollsets.
+#endif
+
 #include "ap_config.h"
 #include "httpd.h"
 #include "http_main.h"
@@ -89,10 +93,18 @@
 #include "ap_listen.h"
 #include "scoreboard.h"
 #include "fdqueue.h"
+#include "timer_heap.h"
 #include "mpm_default.h"
 #include "http_vhost.h"
 #include "unixd.h"
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#include <sys/epoll.h>
+#define EVENT_USE_EPOLL 1
+#else
+#define EVENT_USE_EPOLL 0
+#endif
+
 #include <signal.h>
 #include <limits.h>             /* for INT_MAX */
 
@@ -144,10 +156,6 @@
 
 #define MPM_CHILD_PID(i) (ap_scoreboard_image->parent[i].pid)
 
-#if !APR_VERSION_AT_LEAST(1,4,0)
-#define apr_time_from_msec(x) (x * 1000)
-#endif
-
 #ifndef MAX_SECS_TO_LINGER
 #define MAX_SECS_TO_LINGER 30
 #endif
@@ -163,6 +171,18 @@
 #define WORKER_FACTOR_SCALE   16  /* scale factor to allow fractional values */
 static unsigned int worker_factor = DEFAULT_WORKER_FACTOR * WORKER_FACTOR_SCALE;
 
+/* Number of independently locked shards of the timer heap.  Threads
+ * registering timed callbacks concurrently are spread over the shards.
+ */
+#ifndef EVENT_TIMER_SHARDS
+#define EVENT_TIMER_SHARDS 8
+#endif
+
+#ifndef MAX_LISTENER_THREADS
+#define MAX_LISTENER_THREADS 64
+#endif
+static int num_listener_threads = 1; /* ListenerThreads */
+
 static int threads_per_child = 0;   /* Worker threads per child */
 static int ap_daemons_to_start = 0;
 static int min_spare_threads = 0;
@@ -176,20 +196,35 @@ static int workers_may_exit = 0;
 static int start_thread_may_exit = 0;
 static int listener_may_exit = 0;
 static int requests_this_child;
-static int num_listensocks = 0;
+static int num_listensocks = 0;       /* per listener thread */
+static ap_listen_rec **listen_buckets; /* one socket set per listener thread */
+static int num_listen_buckets = 1;
 static apr_uint32_t connection_count = 0;
 static int resource_shortage = 0;
 static fd_queue_t *worker_queue;
 static fd_queue_info_t *worker_queue_info;
 static int mpm_state = AP_MPMQ_STARTING;
 
-static apr_thread_mutex_t *timeout_mutex;
+typedef struct event_listener_t event_listener_t;
+
+/* how a connection is registered with the poller of its listener */
+typedef enum {
+    CONN_POLL_NONE,         /* not registered */
+    CONN_POLL_ARMED,        /* waiting for pfd.reqevents */
+    CONN_POLL_DISARMED      /* still registered (epoll), but not armed */
+} conn_poll_state_e;
 
 struct event_conn_state_t {
+    /** the listener thread this connection belongs to */
+    event_listener_t *listener;
     /** APR_RING of expiration timeouts */
     APR_RING_ENTRY(event_conn_state_t) timeout_list;
     /** the expiration time of the next keepalive timeout */
     apr_time_t expiration_time;
+    /** the timeout queue this connection is (to be) in */
+    struct timeout_queue *q;
+    /** next connection handed over to the listener, see park_connection() */
+    struct event_conn_state_t *pending_next;
     /** connection record this struct refers to */
     conn_rec *c;
     /** memory pool to allocate from */
@@ -198,6 +233,8 @@ struct event_conn_state_t {
     apr_bucket_alloc_t *bucket_alloc;
     /** poll file descriptor information */
     apr_pollfd_t pfd;
+    /** registration of pfd, only used by the listener thread */
+    conn_poll_state_e poll_state;
     /** public parts of the connection state */
     conn_state_t pub;
 };
@@ -207,22 +244,11 @@ struct timeout_queue {
     struct timeout_head_t head;
     int count;
     const char *tag;
+    apr_interval_time_t timeout;
 };
-/*
- * Several timeout queues that use different timeouts, so that we always can
- * simply append to the end.
- *   write_completion_q uses TimeOut
- *   keepalive_q        uses KeepAliveTimeOut
- *   linger_q           uses MAX_SECS_TO_LINGER
- *   short_linger_q     uses SECONDS_TO_LINGER
- */
-static struct timeout_queue write_completion_q, keepalive_q, linger_q,
-                            short_linger_q;
-static apr_pollfd_t *listener_pollfd;
-
 /*
  * Macros for accessing struct timeout_queue.
- * For TO_QUEUE_APPEND and TO_QUEUE_REMOVE, timeout_mutex must be held.
+ * These may only be used by the listener thread.
  */
 #define TO_QUEUE_APPEND(q, el)                                                  \
     do {                                                                        \
@@ -236,24 +262,73 @@ static apr_pollfd_t *listener_pollfd;
         (q).count--;                       \
     } while (0)
 
-#define TO_QUEUE_INIT(q)                                                  \
+#define TO_QUEUE_INIT(l, q, t)                                            \
     do {                                                                  \
-            APR_RING_INIT(&(q).head, event_conn_state_t, timeout_list);   \
-            (q).tag = #q;                                                 \
+            APR_RING_INIT(&(l)->q.head, event_conn_state_t, timeout_list);\
+            (l)->q.tag = #q;                                              \
+            (l)->q.timeout = (t);                                         \
     } while (0)
 
 #define TO_QUEUE_ELEM_INIT(el) APR_RING_ELEM_INIT(el, timeout_list)
 
 /*
- * The pollset for sockets that are in any of the timeout queues. Currently
- * we use the timeout_mutex to make sure that connections are added/removed
- * atomically to/from both event_pollset and a timeout queue. Otherwise
- * some confusion can happen under high load if timeout queues and pollset
- * get out of sync.
- * XXX: It should be possible to make the lock unnecessary in many or even all
- * XXX: cases.
+ * Per listener thread state.  Each listener thread polls its own set of
+ * listening sockets (see ap_duplicate_listeners()), and connections stay
+ * with the listener that accepted them for their whole lifetime.
  */
-static apr_pollset_t *event_pollset;
+struct event_listener_t {
+    /** index in listeners[], listener 0 also runs timers (and serf) */
+    int id;
+    /** the listening sockets this thread accepts on */
+    ap_listen_rec *listen_recs;
+    apr_pollfd_t *listener_pollfd;
+    /*
+     * The pollset for the listening sockets and the connections in any of
+     * the timeout queues. Only the listener thread adds connections to or
+     * removes them from its pollset and timeout queues, so both always stay
+     * in sync without any locking.
+     */
+    apr_pollset_t *pollset;
+    /*
+     * Several timeout queues that use different timeouts, so that we always
+     * can simply append to the end.  Workers hand connections over through
+     * the pending_conns list instead, see park_connection().
+     *   write_completion_q uses TimeOut
+     *   read_request_q     uses TimeOut
+     *   keepalive_q        uses KeepAliveTimeOut
+     *   linger_q           uses MAX_SECS_TO_LINGER
+     *   short_linger_q     uses SECONDS_TO_LINGER
+     */
+    struct timeout_queue write_completion_q, read_request_q, keepalive_q,
+                         linger_q, short_linger_q;
+    /*
+     * Connections that workers have handed over to this listener, but
+     * which it has not yet put into a timeout queue and the pollset.
+     * Workers push onto this list with a CAS, the listener takes the whole
+     * list at once.
+     */
+    event_conn_state_t * volatile pending_conns;
+#if EVENT_USE_EPOLL
+    /*
+     * On Linux, connections are not put into the APR pollset but into
+     * this epoll set, which is itself polled through the APR pollset
+     * (conns_pfd).  They stay registered with EPOLLONESHOT for their whole
+     * lifetime and are only re-armed when they go back into a timeout
+     * queue, see conn_poll_arm().  -1 if epoll is not available.
+     */
+    int conns_epfd;
+    apr_pollfd_t conns_pfd;
+    struct epoll_event *conns_events;
+#endif
+    /** connections waiting to be queued for the workers, see push2worker() */
+    fd_queue_elem_t *batch;
+    int batch_count;
+    apr_thread_t *thread;
+    apr_os_thread_t *os_thread;
+};
+
+static event_listener_t *listeners;
+static apr_uint32_t listeners_running;
 
 #if HAVE_SERF
 typedef struct {
@@ -270,6 +345,7 @@ typedef struct
     int pid;
     int tid;
     int sd;
+    event_listener_t *listener; /* listener threads only */
 } proc_info;
 
 /* Structure used to pass information to the thread responsible for
@@ -278,7 +354,6 @@ typedef struct
 typedef struct
 {
     apr_thread_t **threads;
-    apr_thread_t *listener;
     int child_num_arg;
     apr_threadattr_t *threadattr;
 } thread_starter;
@@ -287,6 +362,9 @@ typedef enum
 {
     PT_CSD,
     PT_ACCEPT
+#if EVENT_USE_EPOLL
+    , PT_EPOLL
+#endif
 #if HAVE_SERF
     , PT_SERF
 #endif
@@ -360,7 +438,6 @@ static apr_pool_t *pchild;      /* Pool for httpd child stuff */
 static pid_t ap_my_pid;         /* Linux getpid() doesn't work except in main
                                    thread. Use this instead */
 static pid_t parent_pid;
-static apr_os_thread_t *listener_os_thread;
 
 /* The LISTENER_SIGNAL signal will be sent from the main thread to the
  * listener thread to wake it up for graceful termination (what a child
@@ -375,16 +452,16 @@ static apr_os_thread_t *listener_os_thread;
  */
 static apr_socket_t **worker_sockets;
 
-static void disable_listensocks(int process_slot)
+static void disable_listensocks(event_listener_t *l, int process_slot)
 {
     int i;
     for (i = 0; i < num_listensocks; i++) {
-        apr_pollset_remove(event_pollset, &listener_pollfd[i]);
+        apr_pollset_remove(l->pollset, &l->listener_pollfd[i]);
     }
     ap_scoreboard_image->parent[process_slot].not_accepting = 1;
 }
 
-static void enable_listensocks(int process_slot)
+static void enable_listensocks(event_listener_t *l, int process_slot)
 {
     int i;
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(00457)
@@ -393,7 +470,7 @@ static void enable_listensocks(int process_slot)
                  apr_atomic_read32(&connection_count),
                  ap_queue_info_get_idlers(worker_queue_info));
     for (i = 0; i < num_listensocks; i++)
-        apr_pollset_add(event_pollset, &listener_pollfd[i]);
+        apr_pollset_add(l->pollset, &l->listener_pollfd[i]);
     /*
      * XXX: This is not yet optimal. If many workers suddenly become available,
      * XXX: the parent may kill some processes off too soon.
@@ -414,29 +491,37 @@ static void close_worker_sockets(void)
 
 static void wakeup_listener(void)
 {
+    int i;
+
     listener_may_exit = 1;
-    if (!listener_os_thread) {
+    if (!listeners || !listeners[0].os_thread) {
         /* XXX there is an obscure path that this doesn't handle perfectly:
          *     right after listener thread is created but before
-         *     listener_os_thread is set, the first worker thread hits an
+         *     os_thread is set, the first worker thread hits an
          *     error and starts graceful termination
          */
         return;
     }
 
-    /* unblock the listener if it's waiting for a worker */
+    /* unblock the listeners if they are waiting for a worker */
     ap_queue_info_term(worker_queue_info);
 
-    /*
-     * we should just be able to "kill(ap_my_pid, LISTENER_SIGNAL)" on all
-     * platforms and wake up the listener thread since it is the only thread
-     * with SIGHUP unblocked, but that doesn't work on Linux
-     */
+    for (i = 0; i < num_listen_buckets; i++) {
+        if (!listeners[i].os_thread) {
+            continue;
+        }
+        /*
+         * we should just be able to "kill(ap_my_pid, LISTENER_SIGNAL)" on
+         * all platforms and wake up the listener threads since they are the
+         * only threads with SIGHUP unblocked, but that doesn't work on Linux
+         * (and it would only wake one of them anyway)
+         */
 #ifdef HAVE_PTHREAD_KILL
-    pthread_kill(*listener_os_thread, LISTENER_SIGNAL);
+        pthread_kill(*listeners[i].os_thread, LISTENER_SIGNAL);
 #else
-    kill(ap_my_pid, LISTENER_SIGNAL);
+        apr_pollset_wakeup(listeners[i].pollset);
 #endif
+    }
 }
 
 #define ST_INIT              0
@@ -488,6 +573,10 @@ static int event_query(int query_code, int *result, apr_status_t *rv)
     case AP_MPMQ_HAS_SERF:
         *result = 1;
         break;
+    case AP_MPMQ_CAN_WAIT_FOR_BODY:
+    case AP_MPMQ_CAN_WAIT_FOR_HEAD:
+        *result = 1;
+        break;
     case AP_MPMQ_HARD_LIMIT_DAEMONS:
         *result = server_limit;
         break;
@@ -755,14 +844,224 @@ static void set_signals(void)
 #endif
 }
 
-static int start_lingering_close_common(event_conn_state_t *cs)
+#if EVENT_USE_EPOLL
+/* the number of events taken from the epoll set of a listener at once */
+#ifndef EVENT_EPOLL_EVENTS
+#define EVENT_EPOLL_EVENTS 64
+#endif
+#endif
+
+/*
+ * Start waiting for cs->pfd.reqevents.
+ * With epoll this is a single epoll_ctl(): EPOLL_CTL_ADD the first time,
+ * EPOLL_CTL_MOD to re-arm the connection afterwards.  Otherwise the
+ * connection is added to the APR pollset.
+ * May only be called by the listener thread.
+ */
+static apr_status_t conn_poll_arm(event_conn_state_t *cs)
+{
+    event_listener_t *l = cs->listener;
+    apr_status_t rv;
+
+#if EVENT_USE_EPOLL
+    if (l->conns_epfd >= 0) {
+        struct epoll_event ev;
+        apr_os_sock_t fd;
+        int op;
+
+        /* EPOLLERR and EPOLLHUP are always reported */
+        ev.events = EPOLLONESHOT;
+        if (cs->pfd.reqevents & APR_POLLIN) {
+            ev.events |= EPOLLIN;
+        }
+        if (cs->pfd.reqevents & APR_POLLOUT) {
+            ev.events |= EPOLLOUT;
+        }
+        ev.data.ptr = cs;
+        apr_os_sock_get(&fd, cs->pfd.desc.s);
+        op = (cs->poll_state == CONN_POLL_NONE) ? EPOLL_CTL_ADD
+                                                : EPOLL_CTL_MOD;
+        if (epoll_ctl(l->conns_epfd, op, fd, &ev) < 0) {
+            return apr_get_netos_error();
+        }
+        cs->poll_state = CONN_POLL_ARMED;
+        return APR_SUCCESS;
+    }
+#endif
+
+    rv = apr_pollset_add(l->pollset, &cs->pfd);
+    if (rv == APR_SUCCESS || APR_STATUS_IS_EEXIST(rv)) {
+        cs->poll_state = CONN_POLL_ARMED;
+        return APR_SUCCESS;
+    }
+    return rv;
+}
+
+/*
+ * Stop waiting for events on cs, because one fired or it timed out.
+ * With epoll there is nothing to do: EPOLLONESHOT disarmed the connection
+ * when the event fired, and a connection that timed out is closed or
+ * re-armed before the listener polls again.
+ * May only be called by the listener thread.
+ */
+static apr_status_t conn_poll_disarm(event_conn_state_t *cs)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+#if EVENT_USE_EPOLL
+    if (cs->listener->conns_epfd >= 0) {
+        if (cs->poll_state != CONN_POLL_NONE) {
+            cs->poll_state = CONN_POLL_DISARMED;
+        }
+        return APR_SUCCESS;
+    }
+#endif
+
+    if (cs->poll_state == CONN_POLL_ARMED) {
+        rv = apr_pollset_remove(cs->listener->pollset, &cs->pfd);
+        cs->poll_state = CONN_POLL_NONE;
+    }
+    return rv;
+}
+
+/*
+ * Unregister cs completely, before its socket is closed or its pool is
+ * recycled.  With epoll the registration outlives conn_poll_disarm(), and
+ * closing the socket only drops it if no other descriptor refers to the
+ * same file, so it is removed explicitly (EPOLL_CTL_DEL).
+ * May be called by a worker thread for a connection it owns, i.e. one
+ * that is not armed.
+ */
+static apr_status_t conn_poll_forget(event_conn_state_t *cs)
+{
+#if EVENT_USE_EPOLL
+    if (cs->listener->conns_epfd >= 0) {
+        if (cs->poll_state != CONN_POLL_NONE) {
+            apr_os_sock_t fd;
+
+            apr_os_sock_get(&fd, cs->pfd.desc.s);
+            cs->poll_state = CONN_POLL_NONE;
+            if (epoll_ctl(cs->listener->conns_epfd, EPOLL_CTL_DEL, fd,
+                          NULL) < 0) {
+                return apr_get_netos_error();
+            }
+        }
+        return APR_SUCCESS;
+    }
+#endif
+
+    return conn_poll_disarm(cs);
+}
+
+/*
+ * Put a connection into its timeout queue and the pollset.
+ * Pre-condition: cs is not in any timeout queue and not armed
+ * return: 0 if the connection had to be closed,
+ *         1 if it is now waiting for an event
+ * May only be called by the listener thread.
+ */
+static int add_to_pollset(event_conn_state_t *cs, struct timeout_queue *q,
+                          apr_time_t now)
 {
     apr_status_t rv;
+
+    cs->expiration_time = now + q->timeout;
+    cs->q = q;
+    TO_QUEUE_APPEND(*q, cs);
+    rv = conn_poll_arm(cs);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(02305)
+                     "add_to_pollset: apr_pollset_add failure for %s",
+                     q->tag);
+        TO_QUEUE_REMOVE(*q, cs);
+        TO_QUEUE_ELEM_INIT(cs);
+        conn_poll_forget(cs);
+        apr_socket_close(cs->pfd.desc.s);
+        apr_pool_clear(cs->p);
+        ap_push_pool(worker_queue_info, cs->p);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hand a connection over to its listener thread, which will put it into
+ * timeout queue q and into the pollset, waiting for cs->pfd.reqevents.
+ * This is lock free: the connection is pushed onto pending_conns, and the
+ * listener is only woken up if that list was empty before.
+ * Pre-condition: cs is not in any timeout queue and not in the pollset
+ * The caller must not touch cs anymore after this returns.
+ * May only be called by a worker thread.
+ */
+static void park_connection(event_conn_state_t *cs, struct timeout_queue *q)
+{
+    event_listener_t *l = cs->listener;
+    event_conn_state_t *head;
+
+    /*
+     * Prevent this connection from writing to our connection state after it
+     * is no longer associated with this thread. This would happen if the EOR
+     * bucket is destroyed from the listener thread due to a connection abort
+     * or timeout.
+     */
+    cs->c->sbh = NULL;
+    cs->q = q;
+
+    do {
+        head = l->pending_conns;
+        cs->pending_next = head;
+    } while (apr_atomic_casptr((void *)&l->pending_conns, cs, head) != head);
+
+    if (head == NULL) {
+        apr_pollset_wakeup(l->pollset);
+    }
+}
+
+/*
+ * Move all connections handed over by park_connection() into their timeout
+ * queues and the pollset.
+ * May only be called by the listener thread.
+ */
+static void process_pending_conns(event_listener_t *l)
+{
+    event_conn_state_t *cs, *next, *list = NULL;
+    apr_time_t now;
+
+    cs = apr_atomic_xchgptr((void *)&l->pending_conns, NULL);
+    if (cs == NULL) {
+        return;
+    }
+
+    /* pending_conns is LIFO, restore the order in which connections were
+     * parked.  Not strictly necessary, since expiration times are set
+     * here, but it is fairer.
+     */
+    while (cs) {
+        next = cs->pending_next;
+        cs->pending_next = list;
+        list = cs;
+        cs = next;
+    }
+
+    now = apr_time_now();
+    for (cs = list; cs; cs = next) {
+        next = cs->pending_next;
+        cs->pending_next = NULL;
+        add_to_pollset(cs, cs->q, now);
+    }
+}
+
+/*
+ * Start lingering close from a worker (hand_over != 0) or from the
+ * listener thread.
+ */
+static int start_lingering_close_common(event_conn_state_t *cs, int hand_over)
+{
     struct timeout_queue *q;
     apr_socket_t *csd = cs->pfd.desc.s;
 #ifdef AP_DEBUG
     {
-        rv = apr_socket_timeout_set(csd, 0);
+        apr_status_t rv = apr_socket_timeout_set(csd, 0);
         AP_DEBUG_ASSERT(rv == APR_SUCCESS);
     }
 #else
@@ -774,63 +1073,50 @@ static int start_lingering_close_common(event_conn_state_t *cs)
      * DoS attacks.
      */
     if (apr_table_get(cs->c->notes, "short-lingering-close")) {
-        cs->expiration_time =
-            apr_time_now() + apr_time_from_sec(SECONDS_TO_LINGER);
-        q = &short_linger_q;
+        q = &cs->listener->short_linger_q;
         cs->pub.state = CONN_STATE_LINGER_SHORT;
     }
     else {
-        cs->expiration_time =
-            apr_time_now() + apr_time_from_sec(MAX_SECS_TO_LINGER);
-        q = &linger_q;
+        q = &cs->listener->linger_q;
         cs->pub.state = CONN_STATE_LINGER_NORMAL;
     }
-    apr_thread_mutex_lock(timeout_mutex);
-    TO_QUEUE_APPEND(*q, cs);
     cs->pfd.reqevents = APR_POLLIN | APR_POLLHUP | APR_POLLERR;
-    rv = apr_pollset_add(event_pollset, &cs->pfd);
-    apr_thread_mutex_unlock(timeout_mutex);
-    if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
-                     "start_lingering_close: apr_pollset_add failure");
-        apr_thread_mutex_lock(timeout_mutex);
-        TO_QUEUE_REMOVE(*q, cs);
-        apr_thread_mutex_unlock(timeout_mutex);
-        apr_socket_close(cs->pfd.desc.s);
-        apr_pool_clear(cs->p);
-        ap_push_pool(worker_queue_info, cs->p);
-        return 0;
+    if (hand_over) {
+        park_connection(cs, q);
+        return 1;
     }
-    return 1;
+    return add_to_pollset(cs, q, apr_time_now());
 }
 
 /*
  * Close our side of the connection, flushing data to the client first.
- * Pre-condition: cs is not in any timeout queue and not in the pollset,
- *                timeout_mutex is not locked
+ * Pre-condition: cs is not in any timeout queue and not in the pollset
  * return: 0 if connection is fully closed,
  *         1 if connection is lingering
  * May only be called by worker thread.
  */
 static int start_lingering_close_blocking(event_conn_state_t *cs)
 {
+    /* the socket may be closed below, and a lingering connection is
+     * registered again by the listener
+     */
+    conn_poll_forget(cs);
     if (ap_start_lingering_close(cs->c)) {
         apr_pool_clear(cs->p);
         ap_push_pool(worker_queue_info, cs->p);
         return 0;
     }
-    return start_lingering_close_common(cs);
+    return start_lingering_close_common(cs, 1);
 }
 
 /*
  * Close our side of the connection, NOT flushing data to the client.
  * This should only be called if there has been an error or if we know
  * that our send buffers are empty.
- * Pre-condition: cs is not in any timeout queue and not in the pollset,
- *                timeout_mutex is not locked
+ * Pre-condition: cs is not in any timeout queue and not in the pollset
  * return: 0 if connection is fully closed,
  *         1 if connection is lingering
- * may be called by listener thread
+ * May only be called by listener thread.
  */
 static int start_lingering_close_nonblocking(event_conn_state_t *cs)
 {
@@ -839,12 +1125,13 @@ static int start_lingering_close_nonblocking(event_conn_state_t *cs)
 
     if (c->aborted
         || apr_socket_shutdown(csd, APR_SHUTDOWN_WRITE) != APR_SUCCESS) {
+        conn_poll_forget(cs);
         apr_socket_close(csd);
         apr_pool_clear(cs->p);
         ap_push_pool(worker_queue_info, cs->p);
         return 0;
     }
-    return start_lingering_close_common(cs);
+    return start_lingering_close_common(cs, 0);
 }
 
 /*
@@ -859,6 +1146,7 @@ static int stop_lingering_close(event_conn_state_t *cs)
     apr_socket_t *csd = ap_get_conn_socket(cs->c);
     ap_log_error(APLOG_MARK, APLOG_TRACE4, 0, ap_server_conf,
                  "socket reached timeout in lingering-close state");
+    conn_poll_forget(cs);
     rv = apr_socket_close(csd);
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(00468) "error closing socket");
@@ -886,9 +1174,8 @@ static int process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * sock
     /* XXX: This will cause unbounded mem usage for long lasting connections */
     ap_create_sb_handle(&sbh, p, my_child_num, my_thread_num);
 
-    if (cs == NULL) {           /* This is a new connection */
+    if (cs->c == NULL) {        /* This is a new connection */
         listener_poll_type *pt = apr_pcalloc(p, sizeof(*pt));
-        cs = apr_pcalloc(p, sizeof(event_conn_state_t));
         cs->bucket_alloc = apr_bucket_alloc_create(p);
         c = ap_run_create_connection(p, ap_server_conf, sock,
                                      conn_id, sbh, cs->bucket_alloc);
@@ -955,7 +1242,9 @@ static int process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * sock
     }
 
 read_request:
-    if (cs->pub.state == CONN_STATE_READ_REQUEST_LINE) {
+    if (cs->pub.state == CONN_STATE_READ_REQUEST_LINE
+        || cs->pub.state == CONN_STATE_READ_REQUEST_HEAD
+        || cs->pub.state == CONN_STATE_READ_REQUEST_BODY) {
         if (!c->aborted) {
             ap_run_process_connection(c);
 
@@ -969,6 +1258,16 @@ read_request:
         }
     }
 
+    if (cs->pub.state == CONN_STATE_READ_REQUEST_HEAD
+        || cs->pub.state == CONN_STATE_READ_REQUEST_BODY) {
+        /* The request is only processed once its head, and (enough of)
+         * its body, are here, let the listener wait for the rest.
+         */
+        cs->pfd.reqevents = APR_POLLIN;
+        park_connection(cs, &cs->listener->read_request_q);
+        return 1;
+    }
+
     if (cs->pub.state == CONN_STATE_WRITE_COMPLETION) {
         ap_filter_t *output_filter = c->output_filters;
         apr_status_t rv;
@@ -987,12 +1286,8 @@ read_request:
              * Set a write timeout for this connection, and let the
              * event thread poll for writeability.
              */
-            cs->expiration_time = ap_server_conf->timeout + apr_time_now();
-            apr_thread_mutex_lock(timeout_mutex);
-            TO_QUEUE_APPEND(write_completion_q, cs);
             cs->pfd.reqevents = APR_POLLOUT | APR_POLLHUP | APR_POLLERR;
-            rc = apr_pollset_add(event_pollset, &cs->pfd);
-            apr_thread_mutex_unlock(timeout_mutex);
+            park_connection(cs, &cs->listener->write_completion_q);
             return 1;
         }
         else if (c->keepalive != AP_CONN_KEEPALIVE || c->aborted ||
@@ -1013,8 +1308,6 @@ read_request:
             return 0;
     }
     else if (cs->pub.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
-        apr_status_t rc;
-
         /* It greatly simplifies the logic to use a single timeout value here
          * because the new element can just be added to the end of the list and
          * it will stay sorted in expiration time sequence.  If brand new
@@ -1023,29 +1316,15 @@ read_request:
          * timeout today.  With a normal client, the socket will be readable in
          * a few milliseconds anyway.
          */
-        cs->expiration_time = ap_server_conf->keep_alive_timeout +
-                              apr_time_now();
-        apr_thread_mutex_lock(timeout_mutex);
-        TO_QUEUE_APPEND(keepalive_q, cs);
-
-        /* Add work to pollset. */
         cs->pfd.reqevents = APR_POLLIN;
-        rc = apr_pollset_add(event_pollset, &cs->pfd);
-        apr_thread_mutex_unlock(timeout_mutex);
-
-        if (rc != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
-                         "process_socket: apr_pollset_add failure");
-            AP_DEBUG_ASSERT(rc == APR_SUCCESS);
-        }
+        park_connection(cs, &cs->listener->keepalive_q);
+    }
+    else {
+        /* Not handed over to the listener (e.g. suspended), see the
+         * comment in park_connection()
+         */
+        c->sbh = NULL;
     }
-    /*
-     * Prevent this connection from writing to our connection state after it
-     * is no longer associated with this thread. This would happen if the EOR
-     * bucket is destroyed from the listener thread due to a connection abort
-     * or timeout.
-     */
-    c->sbh = NULL;
     return 1;
 }
 
@@ -1062,12 +1341,21 @@ static void check_infinite_requests(void)
     }
 }
 
-static void close_listeners(int process_slot, int *closed) {
+static void close_listeners(event_listener_t *l, int process_slot,
+                            int *closed) {
     if (!*closed) {
+        ap_listen_rec *lr;
         int i;
-        disable_listensocks(process_slot);
-        ap_close_listeners();
+        disable_listensocks(l, process_slot);
+        for (lr = l->listen_recs; lr; lr = lr->next) {
+            apr_socket_close(lr->sd);
+            lr->active = 0;
+        }
         *closed = 1;
+        if (dying) {
+            /* another listener thread already did the rest */
+            return;
+        }
         dying = 1;
         ap_scoreboard_image->parent[process_slot].quiescing = 1;
         for (i = 0; i < threads_per_child; ++i) {
@@ -1079,6 +1367,20 @@ static void close_listeners(int process_slot, int *closed) {
     }
 }
 
+/* Close the extra listening sockets of ap_duplicate_listeners() */
+static void close_duplicate_listeners(void)
+{
+    ap_listen_rec *lr;
+    int i;
+
+    for (i = 1; i < num_listen_buckets; i++) {
+        for (lr = listen_buckets[i]; lr; lr = lr->next) {
+            apr_socket_close(lr->sd);
+            lr->active = 0;
+        }
+    }
+}
+
 static void unblock_signal(int sig)
 {
     sigset_t sig_mask;
@@ -1125,7 +1427,57 @@ static apr_status_t s_socket_remove(void *user_baton,
 }
 #endif
 
-static apr_status_t init_pollset(apr_pool_t *p)
+#if EVENT_USE_EPOLL
+static apr_status_t conns_epfd_cleanup(void *data)
+{
+    event_listener_t *l = data;
+
+    close(l->conns_epfd);
+    l->conns_epfd = -1;
+    return APR_SUCCESS;
+}
+
+/*
+ * Create the epoll set for the connections of listener l, and add it to
+ * the APR pollset.  If epoll is not usable, connections go directly into
+ * the APR pollset.
+ */
+static apr_status_t init_conns_epoll(event_listener_t *l, apr_pool_t *p)
+{
+    listener_poll_type *pt;
+    apr_file_t *f = NULL;
+    apr_status_t rv;
+
+    l->conns_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (l->conns_epfd < 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, apr_get_os_error(),
+                     ap_server_conf, APLOGNO(02310)
+                     "epoll_create1 failed, listener %d will use "
+                     "the APR pollset for connections", l->id);
+        return APR_SUCCESS;
+    }
+    apr_pool_cleanup_register(p, l, conns_epfd_cleanup,
+                              apr_pool_cleanup_null);
+
+    rv = apr_os_file_put(&f, &l->conns_epfd, APR_FOPEN_READ, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    pt = apr_pcalloc(p, sizeof(*pt));
+    pt->type = PT_EPOLL;
+    pt->baton = l;
+    l->conns_pfd.desc_type = APR_POLL_FILE;
+    l->conns_pfd.desc.f = f;
+    l->conns_pfd.reqevents = APR_POLLIN;
+    l->conns_pfd.client_data = pt;
+    l->conns_events = apr_palloc(p, EVENT_EPOLL_EVENTS
+                                    * sizeof(struct epoll_event));
+
+    return apr_pollset_add(l->pollset, &l->conns_pfd);
+}
+#endif
+
+static apr_status_t init_pollset(event_listener_t *l, apr_pool_t *p)
 {
 #if HAVE_SERF
     s_baton_t *baton = NULL;
@@ -1133,17 +1485,30 @@ static apr_status_t init_pollset(apr_pool_t *p)
     ap_listen_rec *lr;
     listener_poll_type *pt;
     int i = 0;
+#if EVENT_USE_EPOLL
+    apr_status_t rv;
 
-    TO_QUEUE_INIT(write_completion_q);
-    TO_QUEUE_INIT(keepalive_q);
-    TO_QUEUE_INIT(linger_q);
-    TO_QUEUE_INIT(short_linger_q);
+    rv = init_conns_epoll(l, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
+    TO_QUEUE_INIT(l, write_completion_q, ap_server_conf->timeout);
+    TO_QUEUE_INIT(l, read_request_q, ap_server_conf->timeout);
+    TO_QUEUE_INIT(l, keepalive_q, ap_server_conf->keep_alive_timeout);
+    TO_QUEUE_INIT(l, linger_q, apr_time_from_sec(MAX_SECS_TO_LINGER));
+    TO_QUEUE_INIT(l, short_linger_q, apr_time_from_sec(SECONDS_TO_LINGER));
+
+    /* there can't be more connections pushed than workers reserved */
+    l->batch = apr_palloc(p, sizeof(fd_queue_elem_t) * threads_per_child);
+    l->batch_count = 0;
 
-    listener_pollfd = apr_palloc(p, sizeof(apr_pollfd_t) * num_listensocks);
-    for (lr = ap_listeners; lr != NULL; lr = lr->next, i++) {
+    l->listener_pollfd = apr_palloc(p, sizeof(apr_pollfd_t) * num_listensocks);
+    for (lr = l->listen_recs; lr != NULL; lr = lr->next, i++) {
         apr_pollfd_t *pfd;
         AP_DEBUG_ASSERT(i < num_listensocks);
-        pfd = &listener_pollfd[i];
+        pfd = &l->listener_pollfd[i];
         pt = apr_pcalloc(p, sizeof(*pt));
         pfd->desc_type = APR_POLL_SOCKET;
         pfd->desc.s = lr->sd;
@@ -1155,14 +1520,17 @@ static apr_status_t init_pollset(apr_pool_t *p)
         pfd->client_data = pt;
 
         apr_socket_opt_set(pfd->desc.s, APR_SO_NONBLOCK, 1);
-        apr_pollset_add(event_pollset, pfd);
+        apr_pollset_add(l->pollset, pfd);
 
         lr->accept_func = ap_unixd_accept;
     }
 
 #if HAVE_SERF
+    if (l->id != 0) {
+        return APR_SUCCESS;
+    }
     baton = apr_pcalloc(p, sizeof(*baton));
-    baton->pollset = event_pollset;
+    baton->pollset = l->pollset;
     /* TODO: subpools, threads, reuse, etc.  -- currently use malloc() inside :( */
     baton->pool = p;
 
@@ -1178,48 +1546,82 @@ static apr_status_t init_pollset(apr_pool_t *p)
     return APR_SUCCESS;
 }
 
-static apr_status_t push_timer2worker(timer_event_t* te)
+static void push_timer2worker(timer_event_t* te)
 {
-    return ap_queue_push_timer(worker_queue, te);
+    ap_queue_push_timer(worker_queue, te);
 }
 
 /*
- * Pre-condition: pfd->cs is neither in pollset nor timeout queue
+ * Hand all connections collected by push2worker() to the workers, with a
+ * single lock of the worker queue and a single wakeup.
  * this function may only be called by the listener
  */
-static apr_status_t push2worker(const apr_pollfd_t * pfd,
-                                apr_pollset_t * pollset)
+static void flush_batch(event_listener_t *l)
 {
-    listener_poll_type *pt = (listener_poll_type *) pfd->client_data;
-    event_conn_state_t *cs = (event_conn_state_t *) pt->baton;
     apr_status_t rc;
+    int i;
 
-    rc = ap_queue_push(worker_queue, cs->pfd.desc.s, cs, cs->p);
+    if (!l->batch_count) {
+        return;
+    }
+
+    rc = ap_queue_push_batch(worker_queue, l->batch, l->batch_count);
     if (rc != APR_SUCCESS) {
-        /* trash the connection; we couldn't queue the connected
-         * socket to a worker
-         */
-        apr_bucket_alloc_destroy(cs->bucket_alloc);
-        apr_socket_close(cs->pfd.desc.s);
         ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
-                     ap_server_conf, APLOGNO(00471) "push2worker: ap_queue_push failed");
-        apr_pool_clear(cs->p);
-        ap_push_pool(worker_queue_info, cs->p);
+                     ap_server_conf, APLOGNO(00471) "push2worker: ap_queue_push_batch failed");
+        for (i = 0; i < l->batch_count; i++) {
+            fd_queue_elem_t *elem = &l->batch[i];
+
+            /* trash the connection; we couldn't queue the connected
+             * socket to a worker
+             */
+            if (elem->ecs->bucket_alloc) {
+                apr_bucket_alloc_destroy(elem->ecs->bucket_alloc);
+            }
+            conn_poll_forget(elem->ecs);
+            apr_socket_close(elem->sd);
+            apr_pool_clear(elem->p);
+            ap_push_pool(worker_queue_info, elem->p);
+            /* and give back the worker reserved for it */
+            ap_queue_info_set_idle(worker_queue_info, NULL);
+        }
     }
+    l->batch_count = 0;
+}
+
+/*
+ * Queue a connection for a worker.  It is only handed over by the next
+ * flush_batch(), at the latest when the listener has processed all events
+ * from the current poll, or before it has to block for an idle worker.
+ * Pre-condition: cs is neither in pollset nor timeout queue, and an idle
+ *                worker has been reserved for it with get_worker()
+ * this function may only be called by the listener
+ */
+static void push2worker(event_listener_t *l, apr_socket_t *csd,
+                        event_conn_state_t *cs, apr_pool_t *ptrans)
+{
+    fd_queue_elem_t *elem = &l->batch[l->batch_count++];
 
-    return rc;
+    elem->sd = csd;
+    elem->ecs = cs;
+    elem->p = ptrans;
+    if (l->batch_count == threads_per_child) {
+        flush_batch(l);
+    }
 }
 
 /* get_worker:
  *     If *have_idle_worker_p == 0, reserve a worker thread, and set
  *     *have_idle_worker_p = 1.
  *     If *have_idle_worker_p is already 1, will do nothing.
- *     If blocking == 1, block if all workers are currently busy.
+ *     If blocking == 1, block if all workers are currently busy, after
+ *     handing the connections queued by push2worker() to the workers.
  *     If no worker was available immediately, will set *all_busy to 1.
  *     XXX: If there are no workers, we should not block immediately but
  *     XXX: close all keep-alive connections first.
  */
-static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
+static void get_worker(event_listener_t *l, int *have_idle_worker_p,
+                       int blocking, int *all_busy)
 {
     apr_status_t rc;
 
@@ -1230,10 +1632,14 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
         return;
     }
 
-    if (blocking)
+    rc = ap_queue_info_try_get_idler(worker_queue_info);
+    if (blocking && rc == APR_EAGAIN) {
+        /* the reserved workers must not wait for the batch while we wait
+         * for them
+         */
+        flush_batch(l);
         rc = ap_queue_info_wait_for_idler(worker_queue_info, all_busy);
-    else
-        rc = ap_queue_info_try_get_idler(worker_queue_info);
+    }
 
     if (rc == APR_SUCCESS) {
         *have_idle_worker_p = 1;
@@ -1249,62 +1655,38 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
     }
 }
 
-/* XXXXXX: Convert to skiplist or other better data structure
- * (yes, this is VERY VERY VERY VERY BAD)
+/*
+ * A connection waited too long for the rest of its request head or body:
+ * let a worker answer it (e.g. with 408 Request Time-out) and log it, so
+ * the request is finished like any other.
+ * Only to be called in the listener thread.
  */
+static int read_request_timeout(event_conn_state_t *cs)
+{
+    event_listener_t *l = cs->listener;
+    int have_idle_worker = 0, workers_were_busy = 0;
 
-/* Structures to reuse */
-static APR_RING_HEAD(timer_free_ring_t, timer_event_t) timer_free_ring;
-/* Active timers */
-static APR_RING_HEAD(timer_ring_t, timer_event_t) timer_ring;
+    get_worker(l, &have_idle_worker, 1, &workers_were_busy);
+    if (!have_idle_worker) {
+        /* shutting down */
+        return start_lingering_close_nonblocking(cs);
+    }
+    /* With epoll the connection is still armed, it must not fire once a
+     * worker owns it.
+     */
+    conn_poll_forget(cs);
+    push2worker(l, cs->pfd.desc.s, cs, cs->p);
+    return 1;
+}
 
-static apr_thread_mutex_t *g_timer_ring_mtx;
+/* Pending timers, see timer_heap.h */
+static timer_heap_t *timer_heap;
 
 static apr_status_t event_register_timed_callback(apr_time_t t,
                                                   ap_mpm_callback_fn_t *cbfn,
                                                   void *baton)
 {
-    int inserted = 0;
-    timer_event_t *ep;
-    timer_event_t *te;
-    /* oh yeah, and make locking smarter/fine grained. */
-    apr_thread_mutex_lock(g_timer_ring_mtx);
-
-    if (!APR_RING_EMPTY(&timer_free_ring, timer_event_t, link)) {
-        te = APR_RING_FIRST(&timer_free_ring);
-        APR_RING_REMOVE(te, link);
-    }
-    else {
-        /* XXXXX: lol, pool allocation without a context from any thread.Yeah. Right. MPMs Suck. */
-        te = ap_malloc(sizeof(timer_event_t));
-        APR_RING_ELEM_INIT(te, link);
-    }
-
-    te->cbfunc = cbfn;
-    te->baton = baton;
-    /* XXXXX: optimize */
-    te->when = t + apr_time_now();
-
-    /* Okay, insert sorted by when.. */
-    for (ep = APR_RING_FIRST(&timer_ring);
-         ep != APR_RING_SENTINEL(&timer_ring,
-                                 timer_event_t, link);
-         ep = APR_RING_NEXT(ep, link))
-    {
-        if (ep->when > te->when) {
-            inserted = 1;
-            APR_RING_INSERT_BEFORE(ep, te, link);
-            break;
-        }
-    }
-
-    if (!inserted) {
-        APR_RING_INSERT_TAIL(&timer_ring, te, timer_event_t, link);
-    }
-
-    apr_thread_mutex_unlock(g_timer_ring_mtx);
-
-    return APR_SUCCESS;
+    return ap_timer_heap_insert(timer_heap, t + apr_time_now(), cbfn, baton);
 }
 
 /*
@@ -1313,14 +1695,15 @@ static apr_status_t event_register_timed_callback(apr_time_t t,
  * Only to be called in the listener thread;
  * Pre-condition: cs is in one of the linger queues and in the pollset
  */
-static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *pfd)
+static void process_lingering_close(event_conn_state_t *cs)
 {
     apr_socket_t *csd = ap_get_conn_socket(cs->c);
     char dummybuf[2048];
     apr_size_t nbytes;
     apr_status_t rv;
     struct timeout_queue *q;
-    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ?  &short_linger_q : &linger_q;
+    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ? &cs->listener->short_linger_q
+                                                   : &cs->listener->linger_q;
 
     /* socket is already in non-blocking state */
     do {
@@ -1329,18 +1712,28 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
     } while (rv == APR_SUCCESS);
 
     if (!APR_STATUS_IS_EOF(rv)) {
+        /* keep waiting, the event disarmed a oneshot registration */
+        if (cs->poll_state != CONN_POLL_ARMED) {
+            rv = conn_poll_arm(cs);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                             APLOGNO(02309) "process_lingering_close: "
+                             "re-arming failed, closing");
+                TO_QUEUE_REMOVE(*q, cs);
+                TO_QUEUE_ELEM_INIT(cs);
+                stop_lingering_close(cs);
+            }
+        }
         return;
     }
 
-    apr_thread_mutex_lock(timeout_mutex);
-    rv = apr_pollset_remove(event_pollset, pfd);
+    rv = conn_poll_forget(cs);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
     rv = apr_socket_close(csd);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
     TO_QUEUE_REMOVE(*q, cs);
-    apr_thread_mutex_unlock(timeout_mutex);
     TO_QUEUE_ELEM_INIT(cs);
 
     apr_pool_clear(cs->p);
@@ -1348,8 +1741,7 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
 }
 
 /* call 'func' for all elements of 'q' with timeout less than 'timeout_time'.
- * Pre-condition: timeout_mutex must already be locked
- * Post-condition: timeout_mutex will be locked again
+ * May only be called by the listener thread.
  */
 static void process_timeout_queue(struct timeout_queue *q,
                                   apr_time_t timeout_time,
@@ -1367,7 +1759,7 @@ static void process_timeout_queue(struct timeout_queue *q,
     while (cs != APR_RING_SENTINEL(&q->head, event_conn_state_t, timeout_list)
            && cs->expiration_time < timeout_time) {
         last = cs;
-        rv = apr_pollset_remove(event_pollset, &cs->pfd);
+        rv = conn_poll_disarm(cs);
         if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
             ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, cs->c, APLOGNO(00473)
                           "apr_pollset_remove failed");
@@ -1381,7 +1773,6 @@ static void process_timeout_queue(struct timeout_queue *q,
     APR_RING_UNSPLICE(first, last, timeout_list);
     AP_DEBUG_ASSERT(q->count >= count);
     q->count -= count;
-    apr_thread_mutex_unlock(timeout_mutex);
     while (count) {
         cs = APR_RING_NEXT(first, timeout_list);
         TO_QUEUE_ELEM_INIT(first);
@@ -1389,16 +1780,98 @@ static void process_timeout_queue(struct timeout_queue *q,
         first = cs;
         count--;
     }
-    apr_thread_mutex_lock(timeout_mutex);
 }
 
+/*
+ * Handle an event on a connection waiting in one of the timeout queues.
+ * Only to be called in the listener thread.
+ */
+static void process_conn_event(event_listener_t *l, event_conn_state_t *cs,
+                               int *have_idle_worker, int *workers_were_busy)
+{
+    int blocking = 1;
+    apr_status_t rc;
+
+    switch (cs->pub.state) {
+    case CONN_STATE_CHECK_REQUEST_LINE_READABLE:
+        cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
+        /* don't wait for a worker for a keepalive request */
+        blocking = 0;
+        /* FALL THROUGH */
+    case CONN_STATE_READ_REQUEST_HEAD:
+    case CONN_STATE_READ_REQUEST_BODY:
+    case CONN_STATE_WRITE_COMPLETION:
+        get_worker(l, have_idle_worker, blocking, workers_were_busy);
+        /* cs->q is the queue add_to_pollset() put it in */
+        TO_QUEUE_REMOVE(*cs->q, cs);
+        rc = conn_poll_disarm(cs);
+
+        /*
+         * Some of the pollset backends, like KQueue or Epoll
+         * automagically remove the FD if the socket is closed,
+         * therefore, we can accept _SUCCESS or _NOTFOUND,
+         * and we still want to keep going
+         */
+        if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
+                         "pollset remove failed");
+            TO_QUEUE_ELEM_INIT(cs);
+            start_lingering_close_nonblocking(cs);
+            break;
+        }
+
+        TO_QUEUE_ELEM_INIT(cs);
+        /* If we didn't get a worker immediately for a keep-alive
+         * request, we close the connection, so that the client can
+         * re-connect to a different process.
+         */
+        if (!*have_idle_worker) {
+            start_lingering_close_nonblocking(cs);
+            break;
+        }
+        push2worker(l, cs->pfd.desc.s, cs, cs->p);
+        *have_idle_worker = 0;
+        break;
+    case CONN_STATE_LINGER_NORMAL:
+    case CONN_STATE_LINGER_SHORT:
+        process_lingering_close(cs);
+        break;
+    default:
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, ap_server_conf,
+                     "event_loop: unexpected state %d",
+                     cs->pub.state);
+        ap_assert(0);
+    }
+}
+
+#if EVENT_USE_EPOLL
+/*
+ * Handle the connections of the epoll set that are ready.  EPOLLONESHOT
+ * disarmed them, they are re-armed once they go back into a timeout queue.
+ * Only to be called in the listener thread.
+ */
+static void process_epoll_events(event_listener_t *l, int *have_idle_worker,
+                                 int *workers_were_busy)
+{
+    int i, n;
+
+    n = epoll_wait(l->conns_epfd, l->conns_events, EVENT_EPOLL_EVENTS, 0);
+    for (i = 0; i < n; i++) {
+        event_conn_state_t *cs = l->conns_events[i].data.ptr;
+
+        cs->poll_state = CONN_POLL_DISARMED;
+        process_conn_event(l, cs, have_idle_worker, workers_were_busy);
+    }
+}
+#endif
+
 static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 {
-    timer_event_t *ep;
-    timer_event_t *te;
+    apr_time_t timer_when;
     apr_status_t rc;
     proc_info *ti = dummy;
     int process_slot = ti->pid;
+    event_listener_t *l = ti->listener;
     apr_pool_t *tpool = apr_thread_pool_get(thd);
     void *csd = NULL;
     apr_pool_t *ptrans;         /* Pool for per-transaction stuff */
@@ -1411,6 +1884,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
     apr_time_t timeout_time = 0, now, last_log;
     listener_poll_type *pt;
     int closed = 0, listeners_disabled = 0;
+    int i;
 
     last_log = apr_time_now();
     free(ti);
@@ -1423,7 +1897,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 #define TIMEOUT_FUDGE_FACTOR 100000
 #define EVENT_FUDGE_FACTOR 10000
 
-    rc = init_pollset(tpool);
+    rc = init_pollset(l, tpool);
     if (rc != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
                      "failed to initialize pollset, "
@@ -1441,7 +1915,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
     for (;;) {
         int workers_were_busy = 0;
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            close_listeners(l, process_slot, &closed);
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
@@ -1456,22 +1930,23 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             /* trace log status every second */
             if (now - last_log > apr_time_from_msec(1000)) {
                 last_log = now;
-                apr_thread_mutex_lock(timeout_mutex);
                 ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
-                             "connections: %d (write-completion: %d "
+                             "listener %d: connections: %d "
+                             "(write-completion: %d reading: %d "
                              "keep-alive: %d lingering: %d)",
-                             connection_count, write_completion_q.count,
-                             keepalive_q.count,
-                             linger_q.count + short_linger_q.count);
-                apr_thread_mutex_unlock(timeout_mutex);
+                             l->id, connection_count,
+                             l->write_completion_q.count,
+                             l->read_request_q.count,
+                             l->keepalive_q.count,
+                             l->linger_q.count + l->short_linger_q.count);
             }
         }
 
-        apr_thread_mutex_lock(g_timer_ring_mtx);
-        if (!APR_RING_EMPTY(&timer_ring, timer_event_t, link)) {
-            te = APR_RING_FIRST(&timer_ring);
-            if (te->when > now) {
-                timeout_interval = te->when - now;
+        /* timed callbacks are only run from the first listener */
+        if (l->id == 0
+            && ap_timer_heap_next(timer_heap, &timer_when) == APR_SUCCESS) {
+            if (timer_when > now) {
+                timeout_interval = timer_when - now;
             }
             else {
                 timeout_interval = 1;
@@ -1480,20 +1955,28 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         else {
             timeout_interval = apr_time_from_msec(100);
         }
-        apr_thread_mutex_unlock(g_timer_ring_mtx);
 
 #if HAVE_SERF
-        rc = serf_context_prerun(g_serf);
-        if (rc != APR_SUCCESS) {
-            /* TOOD: what should do here? ugh. */
+        if (l->id == 0) {
+            rc = serf_context_prerun(g_serf);
+            if (rc != APR_SUCCESS) {
+                /* TOOD: what should do here? ugh. */
+            }
         }
 #endif
-        rc = apr_pollset_poll(event_pollset, timeout_interval, &num, &out_pfd);
+        /* Connections handed over by workers since the last poll; if any
+         * arrives after this, park_connection() wakes up the poll below.
+         */
+        process_pending_conns(l);
+
+        rc = apr_pollset_poll(l->pollset, timeout_interval, &num, &out_pfd);
         if (rc != APR_SUCCESS) {
-            if (APR_STATUS_IS_EINTR(rc)) {
-                continue;
-            }
-            if (!APR_STATUS_IS_TIMEUP(rc)) {
+            /* A wakeup (EINTR) from park_connection() falls through to the
+             * timers and timeout queues like a timeout, lest a steady
+             * stream of parked connections starve them.
+             */
+            num = 0;
+            if (!APR_STATUS_IS_TIMEUP(rc) && !APR_STATUS_IS_EINTR(rc)) {
                 ap_log_error(APLOG_MARK, APLOG_CRIT, rc, ap_server_conf,
                              "apr_pollset_poll failed.  Attempting to "
                              "shutdown process gracefully");
@@ -1502,100 +1985,36 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         }
 
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            close_listeners(l, process_slot, &closed);
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
         }
 
         now = apr_time_now();
-        apr_thread_mutex_lock(g_timer_ring_mtx);
-        for (ep = APR_RING_FIRST(&timer_ring);
-             ep != APR_RING_SENTINEL(&timer_ring,
-                                     timer_event_t, link);
-             ep = APR_RING_FIRST(&timer_ring))
-        {
-            if (ep->when < now + EVENT_FUDGE_FACTOR) {
-                APR_RING_REMOVE(ep, link);
-                push_timer2worker(ep);
-            }
-            else {
-                break;
-            }
+        if (l->id == 0) {
+            ap_timer_heap_expire(timer_heap, now + EVENT_FUDGE_FACTOR,
+                                 push_timer2worker);
         }
-        apr_thread_mutex_unlock(g_timer_ring_mtx);
 
         while (num) {
             pt = (listener_poll_type *) out_pfd->client_data;
             if (pt->type == PT_CSD) {
                 /* one of the sockets is readable */
-                struct timeout_queue *remove_from_q = &write_completion_q;
-                int blocking = 1;
-                cs = (event_conn_state_t *) pt->baton;
-                switch (cs->pub.state) {
-                case CONN_STATE_CHECK_REQUEST_LINE_READABLE:
-                    cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
-                    remove_from_q = &keepalive_q;
-                    /* don't wait for a worker for a keepalive request */
-                    blocking = 0;
-                    /* FALL THROUGH */
-                case CONN_STATE_WRITE_COMPLETION:
-                    get_worker(&have_idle_worker, blocking,
-                               &workers_were_busy);
-                    apr_thread_mutex_lock(timeout_mutex);
-                    TO_QUEUE_REMOVE(*remove_from_q, cs);
-                    rc = apr_pollset_remove(event_pollset, &cs->pfd);
-
-                    /*
-                     * Some of the pollset backends, like KQueue or Epoll
-                     * automagically remove the FD if the socket is closed,
-                     * therefore, we can accept _SUCCESS or _NOTFOUND,
-                     * and we still want to keep going
-                     */
-                    if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) {
-                        ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
-                                     "pollset remove failed");
-                        apr_thread_mutex_unlock(timeout_mutex);
-                        start_lingering_close_nonblocking(cs);
-                        break;
-                    }
-
-                    apr_thread_mutex_unlock(timeout_mutex);
-                    TO_QUEUE_ELEM_INIT(cs);
-                    /* If we didn't get a worker immediately for a keep-alive
-                     * request, we close the connection, so that the client can
-                     * re-connect to a different process.
-                     */
-                    if (!have_idle_worker) {
-                        start_lingering_close_nonblocking(cs);
-                        break;
-                    }
-                    rc = push2worker(out_pfd, event_pollset);
-                    if (rc != APR_SUCCESS) {
-                        ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
-                                     ap_server_conf, "push2worker failed");
-                    }
-                    else {
-                        have_idle_worker = 0;
-                    }
-                    break;
-                case CONN_STATE_LINGER_NORMAL:
-                case CONN_STATE_LINGER_SHORT:
-                    process_lingering_close(cs, out_pfd);
-                    break;
-                default:
-                    ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
-                                 ap_server_conf,
-                                 "event_loop: unexpected state %d",
-                                 cs->pub.state);
-                    ap_assert(0);
-                }
+                process_conn_event(l, (event_conn_state_t *) pt->baton,
+                                   &have_idle_worker, &workers_were_busy);
+            }
+#if EVENT_USE_EPOLL
+            else if (pt->type == PT_EPOLL) {
+                /* some connections of the epoll set are ready */
+                process_epoll_events(l, &have_idle_worker, &workers_were_busy);
             }
+#endif
             else if (pt->type == PT_ACCEPT) {
                 /* A Listener Socket is ready for an accept() */
                 if (workers_were_busy) {
                     if (!listeners_disabled)
-                        disable_listensocks(process_slot);
+                        disable_listensocks(l, process_slot);
                     listeners_disabled = 1;
                     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                                  "All workers busy, not accepting new conns"
@@ -1606,7 +2025,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                            worker_factor / WORKER_FACTOR_SCALE)
                 {
                     if (!listeners_disabled)
-                        disable_listensocks(process_slot);
+                        disable_listensocks(l, process_slot);
                     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                                  "Too many open connections (%u), "
                                  "not accepting new conns in this process",
@@ -1618,7 +2037,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                 }
                 else if (listeners_disabled) {
                     listeners_disabled = 0;
-                    enable_listensocks(process_slot);
+                    enable_listensocks(l, process_slot);
                 }
                 if (!listeners_disabled) {
                     lr = (ap_listen_rec *) pt->baton;
@@ -1637,13 +2056,14 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                             ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
                                          ap_server_conf,
                                          "Failed to create transaction pool");
+                            flush_batch(l);
                             signal_threads(ST_GRACEFUL);
                             return NULL;
                         }
                     }
                     apr_pool_tag(ptrans, "transaction");
 
-                    get_worker(&have_idle_worker, 1, &workers_were_busy);
+                    get_worker(l, &have_idle_worker, 1, &workers_were_busy);
                     rc = lr->accept_func(&csd, lr, ptrans);
 
                     /* later we trash rv and rely on csd to indicate
@@ -1658,21 +2078,11 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     }
 
                     if (csd != NULL) {
-                        rc = ap_queue_push(worker_queue, csd, NULL, ptrans);
-                        if (rc != APR_SUCCESS) {
-                            /* trash the connection; we couldn't queue the connected
-                             * socket to a worker
-                             */
-                            apr_socket_close(csd);
-                            ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
-                                         ap_server_conf,
-                                         "ap_queue_push failed");
-                            apr_pool_clear(ptrans);
-                            ap_push_pool(worker_queue_info, ptrans);
-                        }
-                        else {
-                            have_idle_worker = 0;
-                        }
+                        /* pin the new connection to this listener */
+                        cs = apr_pcalloc(ptrans, sizeof(event_conn_state_t));
+                        cs->listener = l;
+                        push2worker(l, csd, cs, ptrans);
+                        have_idle_worker = 0;
                     }
                     else {
                         apr_pool_clear(ptrans);
@@ -1682,6 +2092,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             }               /* if:else on pt->type */
 #if HAVE_SERF
             else if (pt->type == PT_SERF) {
+                /* only in the pollset of listener 0 */
                 /* send socket to serf. */
                 /* XXXX: this doesn't require get_worker() */
                 serf_event_trigger(g_serf, pt->baton, out_pfd);
@@ -1691,6 +2102,9 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             num--;
         }                   /* while for processing poll */
 
+        /* wake up the workers for everything we've got in one go */
+        flush_batch(l);
+
         /* XXX possible optimization: stash the current time for use as
          * r->request_time for new requests
          */
@@ -1701,41 +2115,57 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             timeout_time = now + TIMEOUT_FUDGE_FACTOR;
 
             /* handle timed out sockets */
-            apr_thread_mutex_lock(timeout_mutex);
-
             /* Step 1: keepalive timeouts */
             /* If all workers are busy, we kill older keep-alive connections so that they
              * may connect to another process.
              */
-            if (workers_were_busy && keepalive_q.count) {
+            if (workers_were_busy && l->keepalive_q.count) {
                 ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
                              "All workers are busy, will close %d keep-alive "
                              "connections",
-                             keepalive_q.count);
-                process_timeout_queue(&keepalive_q,
+                             l->keepalive_q.count);
+                process_timeout_queue(&l->keepalive_q,
                                       timeout_time + ap_server_conf->keep_alive_timeout,
                                       start_lingering_close_nonblocking);
             }
             else {
-                process_timeout_queue(&keepalive_q, timeout_time,
+                process_timeout_queue(&l->keepalive_q, timeout_time,
                                       start_lingering_close_nonblocking);
             }
             /* Step 2: write completion timeouts */
-            process_timeout_queue(&write_completion_q, timeout_time,
+            process_timeout_queue(&l->write_completion_q, timeout_time,
                                   start_lingering_close_nonblocking);
-            /* Step 3: (normal) lingering close completion timeouts */
-            process_timeout_queue(&linger_q, timeout_time, stop_lingering_close);
-            /* Step 4: (short) lingering close completion timeouts */
-            process_timeout_queue(&short_linger_q, timeout_time, stop_lingering_close);
-
-            ps = ap_get_scoreboard_process(process_slot);
-            ps->write_completion = write_completion_q.count;
-            ps->lingering_close = linger_q.count + short_linger_q.count;
-            ps->keep_alive = keepalive_q.count;
-            apr_thread_mutex_unlock(timeout_mutex);
+            /* Step 3: request head and body timeouts */
+            process_timeout_queue(&l->read_request_q, timeout_time,
+                                  read_request_timeout);
+            /* Step 4: (normal) lingering close completion timeouts */
+            process_timeout_queue(&l->linger_q, timeout_time,
+                                  stop_lingering_close);
+            /* Step 5: (short) lingering close completion timeouts */
+            process_timeout_queue(&l->short_linger_q, timeout_time,
+                                  stop_lingering_close);
+
+            /* The first listener reports for all of them; the counts of
+             * the others may be slightly stale, which is fine here.
+             */
+            if (l->id == 0) {
+                int write_completion = 0, lingering_close = 0,
+                    keep_alive = 0;
+
+                for (i = 0; i < num_listen_buckets; i++) {
+                    write_completion += listeners[i].write_completion_q.count;
+                    lingering_close += listeners[i].linger_q.count
+                                       + listeners[i].short_linger_q.count;
+                    keep_alive += listeners[i].keepalive_q.count;
+                }
+                ps = ap_get_scoreboard_process(process_slot);
+                ps->write_completion = write_completion;
+                ps->lingering_close = lingering_close;
+                ps->keep_alive = keep_alive;
 
-            ps->connections = apr_atomic_read32(&connection_count);
-            /* XXX: should count CONN_STATE_SUSPENDED and set ps->suspended */
+                ps->connections = apr_atomic_read32(&connection_count);
+                /* XXX: should count CONN_STATE_SUSPENDED and set ps->suspended */
+            }
         }
         if (listeners_disabled && !workers_were_busy &&
             (int)apr_atomic_read32(&connection_count) <
@@ -1743,7 +2173,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             worker_factor / WORKER_FACTOR_SCALE + threads_per_child)
         {
             listeners_disabled = 0;
-            enable_listensocks(process_slot);
+            enable_listensocks(l, process_slot);
         }
         /*
          * XXX: do we need to set some timeout that re-enables the listensocks
@@ -1751,8 +2181,11 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
          */
     }     /* listener main loop */
 
-    close_listeners(process_slot, &closed);
-    ap_queue_term(worker_queue);
+    close_listeners(l, process_slot, &closed);
+    /* the last listener thread to exit lets the workers go */
+    if (!apr_atomic_dec32(&listeners_running)) {
+        ap_queue_term(worker_queue);
+    }
 
     apr_thread_exit(thd, APR_SUCCESS);
     return NULL;
@@ -1806,7 +2239,8 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         }
 
         te = NULL;
-        rv = ap_queue_pop_something(worker_queue, &csd, &cs, &ptrans, &te);
+        rv = ap_queue_pop_something(worker_queue, thread_slot,
+                                    &csd, &cs, &ptrans, &te);
 
         if (rv != APR_SUCCESS) {
             /* We get APR_EOF during a graceful shutdown once all the
@@ -1838,12 +2272,7 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         }
         if (te != NULL) {
             te->cbfunc(te->baton);
-
-            {
-                apr_thread_mutex_lock(g_timer_ring_mtx);
-                APR_RING_INSERT_TAIL(&timer_free_ring, te, timer_event_t, link);
-                apr_thread_mutex_unlock(g_timer_ring_mtx);
-            }
+            ap_timer_heap_release(timer_heap, te);
         }
         else {
             is_idle = 0;
@@ -1877,26 +2306,33 @@ static int check_signal(int signum)
 
 
 
-static void create_listener_thread(thread_starter * ts)
+static void create_listener_threads(thread_starter * ts)
 {
     int my_child_num = ts->child_num_arg;
     apr_threadattr_t *thread_attr = ts->threadattr;
     proc_info *my_info;
     apr_status_t rv;
+    int i;
 
-    my_info = (proc_info *) ap_malloc(sizeof(proc_info));
-    my_info->pid = my_child_num;
-    my_info->tid = -1;          /* listener thread doesn't have a thread slot */
-    my_info->sd = 0;
-    rv = apr_thread_create(&ts->listener, thread_attr, listener_thread,
-                           my_info, pchild);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
-                     "apr_thread_create: unable to create listener thread");
-        /* let the parent decide how bad this really is */
-        clean_child_exit(APEXIT_CHILDSICK);
+    apr_atomic_set32(&listeners_running, num_listen_buckets);
+    for (i = 0; i < num_listen_buckets; i++) {
+        event_listener_t *l = &listeners[i];
+
+        my_info = (proc_info *) ap_malloc(sizeof(proc_info));
+        my_info->pid = my_child_num;
+        my_info->tid = -1;      /* listener threads don't have a thread slot */
+        my_info->sd = 0;
+        my_info->listener = l;
+        rv = apr_thread_create(&l->thread, thread_attr, listener_thread,
+                               my_info, pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
+                         "apr_thread_create: unable to create listener thread");
+            /* let the parent decide how bad this really is */
+            clean_child_exit(APEXIT_CHILDSICK);
+        }
+        apr_os_thread_get(&l->os_thread, l->thread);
     }
-    apr_os_thread_get(&listener_os_thread, ts->listener);
 }
 
 /* XXX under some circumstances not understood, children can get stuck
@@ -1923,7 +2359,8 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
     /* We must create the fd queues before we start up the listener
      * and worker threads. */
     worker_queue = apr_pcalloc(pchild, sizeof(*worker_queue));
-    rv = ap_queue_init(worker_queue, threads_per_child, pchild);
+    rv = ap_queue_init(worker_queue, threads_per_child, threads_per_child,
+                       pchild);
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf,
                      "ap_queue_init() failed");
@@ -1945,28 +2382,26 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    /* Create the timeout mutex and main pollset before the listener
-     * thread starts.
+    /* Create the pollsets before the listener threads start.
+     * They must be wakeable so that park_connection() can notify a
+     * listener about new pending connections.
      */
-    rv = apr_thread_mutex_create(&timeout_mutex, APR_THREAD_MUTEX_DEFAULT,
-                                 pchild);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
-                     "creation of the timeout mutex failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
-    }
-
-    /* Create the main pollset */
-    rv = apr_pollset_create(&event_pollset,
-                            threads_per_child, /* XXX don't we need more, to handle
-                                                * connections in K-A or lingering
-                                                * close?
-                                                */
-                            pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
-                     "apr_pollset_create with Thread Safety failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
+    listeners = apr_pcalloc(pchild, num_listen_buckets * sizeof(*listeners));
+    for (i = 0; i < num_listen_buckets; i++) {
+        listeners[i].id = i;
+        listeners[i].listen_recs = listen_buckets[i];
+        rv = apr_pollset_create(&listeners[i].pollset,
+                                threads_per_child, /* XXX don't we need more, to handle
+                                                    * connections in K-A or lingering
+                                                    * close?
+                                                    */
+                                pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY
+                                        | APR_POLLSET_WAKEABLE);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                         "apr_pollset_create with Thread Safety failed.");
+            clean_child_exit(APEXIT_CHILDFATAL);
+        }
     }
 
     worker_sockets = apr_pcalloc(pchild, threads_per_child
@@ -2005,9 +2440,9 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
             threads_created++;
         }
 
-        /* Start the listener only when there are workers available */
+        /* Start the listeners only when there are workers available */
         if (!listener_started && threads_created) {
-            create_listener_thread(ts);
+            create_listener_threads(ts);
             listener_started = 1;
         }
 
@@ -2044,16 +2479,16 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
     return NULL;
 }
 
-static void join_workers(apr_thread_t * listener, apr_thread_t ** threads)
+static void join_workers(apr_thread_t ** threads)
 {
     int i;
     apr_status_t rv, thread_rv;
 
-    if (listener) {
+    if (listeners && listeners[0].thread) {
         int iter;
 
         /* deal with a rare timing window which affects waking up the
-         * listener thread...  if the signal sent to the listener thread
+         * listener threads...  if the signal sent to a listener thread
          * is delivered between the time it verifies that the
          * listener_may_exit flag is clear and the time it enters a
          * blocking syscall, the signal didn't do any good...  work around
@@ -2072,10 +2507,15 @@ static void join_workers(apr_thread_t * listener, apr_thread_t ** threads)
                          "the listener thread didn't stop accepting");
         }
         else {
-            rv = apr_thread_join(&thread_rv, listener);
-            if (rv != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
-                             "apr_thread_join: unable to join listener thread");
+            for (i = 0; i < num_listen_buckets; i++) {
+                if (!listeners[i].thread) {
+                    continue;
+                }
+                rv = apr_thread_join(&thread_rv, listeners[i].thread);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
+                                 "apr_thread_join: unable to join listener thread");
+                }
             }
         }
     }
@@ -2129,9 +2569,12 @@ static void child_main(int child_num_arg)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    apr_thread_mutex_create(&g_timer_ring_mtx, APR_THREAD_MUTEX_DEFAULT, pchild);
-    APR_RING_INIT(&timer_free_ring, timer_event_t, link);
-    APR_RING_INIT(&timer_ring, timer_event_t, link);
+    rv = ap_timer_heap_create(&timer_heap, EVENT_TIMER_SHARDS, pchild);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, rv, ap_server_conf, APLOGNO(02304)
+                     "Couldn't create timer heap");
+        clean_child_exit(APEXIT_CHILDFATAL);
+    }
     ap_run_child_init(pchild, ap_server_conf);
 
     /* done with init critical section */
@@ -2172,7 +2615,6 @@ static void child_main(int child_num_arg)
     }
 
     ts->threads = threads;
-    ts->listener = NULL;
     ts->child_num_arg = child_num_arg;
     ts->threadattr = thread_attr;
 
@@ -2213,7 +2655,7 @@ static void child_main(int child_num_arg)
          *   If the worker hasn't exited, then this blocks until
          *   they have (then cleans up).
          */
-        join_workers(ts->listener, threads);
+        join_workers(threads);
     }
     else {                      /* !one_process */
         /* remove SIGTERM from the set of blocked signals...  if one of
@@ -2254,7 +2696,7 @@ static void child_main(int child_num_arg)
          *   If the worker hasn't exited, then this blocks until
          *   they have (then cleans up).
          */
-        join_workers(ts->listener, threads);
+        join_workers(threads);
     }
 
     free(threads);
@@ -2711,6 +3153,7 @@ static int event_run(apr_pool_t * _pconf, apr_pool_t * plog, server_rec * s)
 
         /* Close our listeners, and then ask our children to do same */
         ap_close_listeners();
+        close_duplicate_listeners();
         ap_event_pod_killpg(pod, ap_daemons_limit, TRUE);
         ap_relieve_child_processes(event_note_child_killed);
 
@@ -2819,6 +3262,11 @@ static int event_open_logs(apr_pool_t * p, apr_pool_t * plog,
         level_flags |= APLOG_STARTUP;
     }
 
+    /* more than one listener thread needs one socket set per thread, with
+     * SO_REUSEPORT; without it, a second server started on the same port
+     * must still fail rather than quietly share the connections */
+    ap_listen_reuseport = (num_listener_threads > 1);
+
     if ((num_listensocks = ap_setup_listeners(ap_server_conf)) < 1) {
         ap_log_error(APLOG_MARK, APLOG_ALERT | level_flags, 0,
                      (startup ? NULL : s),
@@ -2826,6 +3274,18 @@ static int event_open_logs(apr_pool_t * p, apr_pool_t * plog,
         return DONE;
     }
 
+    num_listen_buckets = num_listener_threads;
+    rv = ap_duplicate_listeners(pconf, ap_server_conf, &listen_buckets,
+                                num_listen_buckets);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING | level_flags, rv,
+                     (startup ? NULL : s), APLOGNO(02354)
+                     "ListenerThreads %d needs SO_REUSEPORT listening "
+                     "sockets, using a single listener thread",
+                     num_listener_threads);
+        num_listen_buckets = 1;
+    }
+
     if (!one_process) {
         if ((rv = ap_event_pod_open(pconf, &pod))) {
             ap_log_error(APLOG_MARK, APLOG_CRIT | level_flags, rv,
@@ -2843,6 +3303,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     int no_detach, debug, foreground;
     apr_status_t rv;
     const char *userdata_key = "mpm_event_module";
+    apr_pollset_t *event_pollset;
 
     mpm_state = AP_MPMQ_STARTING;
 
@@ -2868,7 +3329,8 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     ++retained->module_loads;
     if (retained->module_loads == 2) {
         rv = apr_pollset_create(&event_pollset, 1, plog,
-                                APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
+                                APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY
+                                | APR_POLLSET_WAKEABLE);
         if (rv != APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(00495)
                          "Couldn't create a Thread Safe Pollset. "
@@ -2902,6 +3364,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     ap_daemons_limit = server_limit;
     threads_per_child = DEFAULT_THREADS_PER_CHILD;
     max_workers = ap_daemons_limit * threads_per_child;
+    num_listener_threads = 1;
     ap_extended_status = 0;
 
     return OK;
@@ -3270,6 +3733,25 @@ static const char *set_worker_factor(cmd_parms * cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_listener_threads(cmd_parms * cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    num_listener_threads = atoi(arg);
+    if (num_listener_threads < 1) {
+        return "ListenerThreads must be at least 1";
+    }
+    if (num_listener_threads > MAX_LISTENER_THREADS) {
+        return apr_psprintf(cmd->pool, "ListenerThreads must not exceed %d",
+                            MAX_LISTENER_THREADS);
+    }
+    return NULL;
+}
+
 
 static const command_rec event_cmds[] = {
     LISTEN_COMMANDS,
@@ -3293,6 +3775,9 @@ static const command_rec event_cmds[] = {
     AP_INIT_TAKE1("AsyncRequestWorkerFactor", set_worker_factor, NULL, RSRC_CONF,
                   "How many additional connects will be accepted per idle "
                   "worker thread"),
+    AP_INIT_TAKE1("ListenerThreads", set_listener_threads, NULL, RSRC_CONF,
+                  "Number of listener threads per child, each accepting on "
+                  "its own SO_REUSEPORT copy of the listening sockets"),
     AP_GRACEFUL_SHUTDOWN_TIMEOUT_COMMAND,
     {NULL}
 };
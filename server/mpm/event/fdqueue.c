@@ -129,13 +129,23 @@ apr_status_t ap_queue_info_set_idle(fd_queue_info_t * queue_info,
 
 apr_status_t ap_queue_info_try_get_idler(fd_queue_info_t * queue_info)
 {
-    int prev_idlers;
-    prev_idlers = apr_atomic_dec32((apr_uint32_t *)&(queue_info->idlers));
-    if (prev_idlers <= 0) {
-        apr_atomic_inc32((apr_uint32_t *)&(queue_info->idlers));    /* back out dec */
-        return APR_EAGAIN;
+    apr_int32_t prev_idlers;
+
+    /* Never let the count go negative here, even for a moment: a worker
+     * going idle would then think the listener is blocked and take the
+     * mutex to signal it.
+     */
+    for (;;) {
+        prev_idlers = (apr_int32_t)apr_atomic_read32((apr_uint32_t *)&(queue_info->idlers));
+        if (prev_idlers <= 0) {
+            return APR_EAGAIN;
+        }
+        if (apr_atomic_cas32((apr_uint32_t *)&(queue_info->idlers),
+                             prev_idlers - 1, prev_idlers)
+            == (apr_uint32_t)prev_idlers) {
+            return APR_SUCCESS;
+        }
     }
-    return APR_SUCCESS;
 }
 
 apr_status_t ap_queue_info_wait_for_idler(fd_queue_info_t * queue_info,
@@ -292,17 +302,35 @@ apr_status_t ap_queue_info_term(fd_queue_info_t * queue_info)
     return apr_thread_mutex_unlock(queue_info->idlers_mutex);
 }
 
-/**
- * Detects when the fd_queue_t is full. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+/*
+ * The fd_queue_t is a set of deques, one per worker thread, each with its
+ * own small mutex.  Pushers spread the elements over the deques round robin.
+ * A worker first looks at its own deque, taking the newest element, and
+ * when it is empty steals the oldest element of the others.  The sleep
+ * mutex and condition variable are only used by workers that found nothing
+ * at all and have to block, and for the timers.
  */
-#define ap_queue_full(queue) ((queue)->nelts == (queue)->bounds)
+
+/* keep the deques on separate cache lines, they are locked independently */
+#define FD_QUEUE_DEQUE_ALIGN 64
+
+struct fd_queue_deque_t
+{
+    apr_thread_mutex_t *mutex;
+    fd_queue_elem_t *data;
+    unsigned int bounds;
+    unsigned int head;          /* oldest element, thieves take it */
+    unsigned int nelts;
+};
 
 /**
- * Detects when the fd_queue_t is empty. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+ * Detects when the fd_queue_t is empty.  The counters are maintained with
+ * atomics, so this may be called without holding any lock; it is only
+ * reliable with the sleep mutex held.
  */
-#define ap_queue_empty(queue) ((queue)->nelts == 0 && APR_RING_EMPTY(&queue->timers ,timer_event_t, link))
+#define ap_queue_empty(queue) \
+    ((apr_int32_t)apr_atomic_read32(&(queue)->nelts) <= 0 \
+     && !apr_atomic_read32(&(queue)->ntimers))
 
 /**
  * Callback routine that is called to destroy this
@@ -311,26 +339,35 @@ apr_status_t ap_queue_info_term(fd_queue_info_t * queue_info)
 static apr_status_t ap_queue_destroy(void *data)
 {
     fd_queue_t *queue = data;
+    unsigned int i;
 
     /* Ignore errors here, we can't do anything about them anyway.
      * XXX: We should at least try to signal an error here, it is
      * indicative of a programmer error. -aaron */
     apr_thread_cond_destroy(queue->not_empty);
-    apr_thread_mutex_destroy(queue->one_big_mutex);
+    apr_thread_mutex_destroy(queue->sleep_mutex);
+    for (i = 0; i < queue->ndeques; i++) {
+        apr_thread_mutex_destroy(queue->deques[i]->mutex);
+    }
 
     return APR_SUCCESS;
 }
 
 /**
- * Initialize the fd_queue_t.
+ * Initialize the fd_queue_t with one deque per worker thread.
  */
 apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
-                           apr_pool_t * a)
+                           int nworkers, apr_pool_t * a)
 {
-    int i;
+    unsigned int i, deque_bounds;
+    apr_size_t size;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_create(&queue->one_big_mutex,
+    if (nworkers < 1) {
+        nworkers = 1;
+    }
+
+    if ((rv = apr_thread_mutex_create(&queue->sleep_mutex,
                                       APR_THREAD_MUTEX_DEFAULT,
                                       a)) != APR_SUCCESS) {
         return rv;
@@ -341,15 +378,37 @@ apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
 
     APR_RING_INIT(&queue->timers, timer_event_t, link);
 
-    queue->data = apr_palloc(a, queue_capacity * sizeof(fd_queue_elem_t));
+    /* Twice the fair share each, so that a push rarely has to skip a full
+     * deque.  Together they can always hold queue_capacity elements.
+     */
+    deque_bounds = 2 * ((queue_capacity + nworkers - 1) / nworkers);
+    size = sizeof(fd_queue_deque_t) + deque_bounds * sizeof(fd_queue_elem_t);
+    size = (size + FD_QUEUE_DEQUE_ALIGN - 1)
+           / FD_QUEUE_DEQUE_ALIGN * FD_QUEUE_DEQUE_ALIGN;
+
+    queue->deques = apr_palloc(a, nworkers * sizeof(fd_queue_deque_t *));
+    queue->ndeques = nworkers;
     queue->bounds = queue_capacity;
+    queue->next_deque = 0;
+    queue->next_steal = 0;
     queue->nelts = 0;
-    queue->in = 0;
-    queue->out = 0;
+    queue->ntimers = 0;
+    queue->waiters = 0;
+    queue->terminated = 0;
 
-    /* Set all the sockets in the queue to NULL */
-    for (i = 0; i < queue_capacity; ++i)
-        queue->data[i].sd = NULL;
+    for (i = 0; i < queue->ndeques; i++) {
+        fd_queue_deque_t *dq = apr_pcalloc(a, size);
+
+        if ((rv = apr_thread_mutex_create(&dq->mutex,
+                                          APR_THREAD_MUTEX_DEFAULT,
+                                          a)) != APR_SUCCESS) {
+            queue->ndeques = i;
+            return rv;
+        }
+        dq->data = (fd_queue_elem_t *)(dq + 1);
+        dq->bounds = deque_bounds;
+        queue->deques[i] = dq;
+    }
 
     apr_pool_cleanup_register(a, queue, ap_queue_destroy,
                               apr_pool_cleanup_null);
@@ -357,6 +416,40 @@ apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
     return APR_SUCCESS;
 }
 
+/*
+ * Wake up to n workers blocked in ap_queue_pop_something() after n
+ * elements were added.  Reading 'waiters' after the atomic update of
+ * 'nelts' pairs with the workers incrementing 'waiters' before they look
+ * at 'nelts' a last time, so no wakeup is lost.
+ */
+static apr_status_t wake_waiters(fd_queue_t * queue, int n)
+{
+    apr_status_t rv;
+    int i;
+
+    if (!apr_atomic_read32(&queue->waiters)) {
+        return APR_SUCCESS;
+    }
+
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* One broadcast is cheaper than several signals if it doesn't wake
+     * up more workers than there are new elements.
+     */
+    if (n >= (int)queue->waiters) {
+        apr_thread_cond_broadcast(queue->not_empty);
+    }
+    else {
+        for (i = 0; i < n; i++) {
+            apr_thread_cond_signal(queue->not_empty);
+        }
+    }
+
+    return apr_thread_mutex_unlock(queue->sleep_mutex);
+}
+
 /**
  * Push a new socket onto the queue.
  *
@@ -366,141 +459,253 @@ apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
 apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
                            event_conn_state_t * ecs, apr_pool_t * p)
 {
-    fd_queue_elem_t *elem;
-    apr_status_t rv;
+    fd_queue_elem_t elem;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
+    elem.sd = sd;
+    elem.ecs = ecs;
+    elem.p = p;
+
+    return ap_queue_push_batch(queue, &elem, 1);
+}
+
+/**
+ * Push n sockets onto the queue at once.  They go to as few deques as
+ * possible, usually one, the idle workers steal them from there.
+ *
+ * precondition: an idle worker thread has been reserved for every element
+ *               with ap_queue_info_wait_for_idler or
+ *               ap_queue_info_try_get_idler
+ */
+apr_status_t ap_queue_push_batch(fd_queue_t * queue,
+                                 const fd_queue_elem_t * elems, int n)
+{
+    unsigned int idx, tries;
+    apr_status_t rv;
+    int done = 0;
 
     AP_DEBUG_ASSERT(!queue->terminated);
-    AP_DEBUG_ASSERT(!ap_queue_full(queue));
 
-    elem = &queue->data[queue->in];
-    queue->in++;
-    if (queue->in >= queue->bounds)
-        queue->in -= queue->bounds;
-    elem->sd = sd;
-    elem->ecs = ecs;
-    elem->p = p;
-    queue->nelts++;
+    idx = apr_atomic_inc32(&queue->next_deque) % queue->ndeques;
+    for (tries = 0; done < n; tries++) {
+        fd_queue_deque_t *dq = queue->deques[idx];
 
-    apr_thread_cond_signal(queue->not_empty);
+        /* the reserved idlers guarantee there is room somewhere */
+        AP_DEBUG_ASSERT(tries <= queue->ndeques);
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+        if ((rv = apr_thread_mutex_lock(dq->mutex)) != APR_SUCCESS) {
+            if (done) {
+                apr_atomic_add32(&queue->nelts, done);
+                wake_waiters(queue, done);
+            }
+            return rv;
+        }
+        while (done < n && dq->nelts < dq->bounds) {
+            unsigned int in = dq->head + dq->nelts;
+            if (in >= dq->bounds)
+                in -= dq->bounds;
+            dq->data[in] = elems[done++];
+            dq->nelts++;
+        }
+        apr_thread_mutex_unlock(dq->mutex);
+
+        if (++idx == queue->ndeques) {
+            idx = 0;
+        }
     }
 
-    return APR_SUCCESS;
+    apr_atomic_add32(&queue->nelts, n);
+
+    return wake_waiters(queue, n);
 }
 
 apr_status_t ap_queue_push_timer(fd_queue_t * queue, timer_event_t *te)
 {
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
 
     AP_DEBUG_ASSERT(!queue->terminated);
 
     APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
+    apr_atomic_inc32(&queue->ntimers);
 
     apr_thread_cond_signal(queue->not_empty);
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
 
     return APR_SUCCESS;
 }
 
+/*
+ * Take one element from the back (owner) or the front (thief) of a deque.
+ * The others stay where idle workers can steal them, rather than wait
+ * behind the connection this worker is about to serve.
+ * Returns the number of elements taken.
+ */
+static int deque_take(fd_queue_t * queue, fd_queue_deque_t * dq, int owner,
+                      fd_queue_elem_t * elem)
+{
+    unsigned int pos;
+
+    /* unlocked peek, a thief doesn't need to lock an empty deque */
+    if (!dq->nelts) {
+        return 0;
+    }
+
+    if (apr_thread_mutex_lock(dq->mutex) != APR_SUCCESS) {
+        return 0;
+    }
+    if (!dq->nelts) {
+        apr_thread_mutex_unlock(dq->mutex);
+        return 0;
+    }
+
+    if (owner) {
+        pos = dq->head + dq->nelts - 1;
+        if (pos >= dq->bounds)
+            pos -= dq->bounds;
+    }
+    else {
+        pos = dq->head++;
+        if (dq->head >= dq->bounds)
+            dq->head -= dq->bounds;
+    }
+    dq->nelts--;
+    *elem = dq->data[pos];
+#ifdef AP_DEBUG
+    dq->data[pos].sd = NULL;
+    dq->data[pos].p = NULL;
+#endif /* AP_DEBUG */
+    apr_atomic_dec32(&queue->nelts);
+    apr_thread_mutex_unlock(dq->mutex);
+
+    return 1;
+}
+
 /**
- * Retrieves the next available socket from the queue. If there are no
- * sockets available, it will block until one becomes available.
- * Once retrieved, the socket is placed into the address specified by
- * 'sd'.
+ * Retrieves the next available socket from the queue for the worker
+ * thread 'slot', looking at its own deque first and then stealing from
+ * the others. If there are no sockets available, it will block until one
+ * becomes available. Once retrieved, the socket is placed into the
+ * address specified by 'sd'.
  */
-apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
+apr_status_t ap_queue_pop_something(fd_queue_t * queue, int slot,
+                                    apr_socket_t ** sd,
                                     event_conn_state_t ** ecs, apr_pool_t ** p,
                                     timer_event_t ** te_out)
 {
-    fd_queue_elem_t *elem;
+    fd_queue_elem_t elem;
+    unsigned int own = (unsigned int)slot % queue->ndeques;
+    unsigned int i;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
+    *te_out = NULL;
 
-    /* Keep waiting until we wake up and find that the queue is not empty. */
-    if (ap_queue_empty(queue)) {
-        if (!queue->terminated) {
-            apr_thread_cond_wait(queue->not_empty, queue->one_big_mutex);
+    for (;;) {
+        if (apr_atomic_read32(&queue->ntimers)) {
+            if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
+                return rv;
+            }
+            if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
+                *te_out = APR_RING_FIRST(&queue->timers);
+                APR_RING_REMOVE(*te_out, link);
+                apr_atomic_dec32(&queue->ntimers);
+            }
+            if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
+                return rv;
+            }
+            if (*te_out) {
+                return APR_SUCCESS;
+            }
+        }
+
+        if ((apr_int32_t)apr_atomic_read32(&queue->nelts) > 0) {
+            int taken = deque_take(queue, queue->deques[own], 1, &elem);
+            /* Steal the oldest sockets first: the pushers fill the deques
+             * round robin, so they are usually found in the deque the last
+             * thief took from or right after it.  Stop as soon as others
+             * took everything.
+             */
+            unsigned int victim = apr_atomic_read32(&queue->next_steal)
+                                  % queue->ndeques;
+            for (i = 0; !taken && i < queue->ndeques
+                        && !ap_queue_empty(queue); i++) {
+                if (victim != own) {
+                    taken = deque_take(queue, queue->deques[victim], 0, &elem);
+                }
+                if (taken) {
+                    apr_atomic_set32(&queue->next_steal, victim);
+                }
+                else if (++victim == queue->ndeques) {
+                    victim = 0;
+                }
+            }
+            if (taken) {
+                *sd = elem.sd;
+                *ecs = elem.ecs;
+                *p = elem.p;
+                return APR_SUCCESS;
+            }
+        }
+
+        /* Nothing to do, block until something is pushed. */
+        if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
+            return rv;
+        }
+        apr_atomic_inc32(&queue->waiters);
+        if (ap_queue_empty(queue) && !queue->terminated) {
+            apr_thread_cond_wait(queue->not_empty, queue->sleep_mutex);
         }
+        apr_atomic_dec32(&queue->waiters);
+
         /* If we wake up and it's still empty, then we were interrupted */
         if (ap_queue_empty(queue)) {
-            rv = apr_thread_mutex_unlock(queue->one_big_mutex);
+            int terminated = queue->terminated;
+            rv = apr_thread_mutex_unlock(queue->sleep_mutex);
             if (rv != APR_SUCCESS) {
                 return rv;
             }
-            if (queue->terminated) {
+            if (terminated) {
                 return APR_EOF; /* no more elements ever again */
             }
             else {
                 return APR_EINTR;
             }
         }
+        if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
+            return rv;
+        }
     }
-
-    *te_out = NULL;
-
-    if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
-        *te_out = APR_RING_FIRST(&queue->timers);
-        APR_RING_REMOVE(*te_out, link);
-    }
-    else {
-        elem = &queue->data[queue->out];
-        queue->out++;
-        if (queue->out >= queue->bounds)
-            queue->out -= queue->bounds;
-        queue->nelts--;
-        *sd = elem->sd;
-        *ecs = elem->ecs;
-        *p = elem->p;
-#ifdef AP_DEBUG
-        elem->sd = NULL;
-        elem->p = NULL;
-#endif /* AP_DEBUG */
-    }
-
-    rv = apr_thread_mutex_unlock(queue->one_big_mutex);
-    return rv;
 }
 
 apr_status_t ap_queue_interrupt_all(fd_queue_t * queue)
 {
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
     apr_thread_cond_broadcast(queue->not_empty);
-    return apr_thread_mutex_unlock(queue->one_big_mutex);
+    return apr_thread_mutex_unlock(queue->sleep_mutex);
 }
 
 apr_status_t ap_queue_term(fd_queue_t * queue)
 {
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
-    /* we must hold one_big_mutex when setting this... otherwise,
+    /* we must hold sleep_mutex when setting this... otherwise,
      * we could end up setting it and waking everybody up just after a
      * would-be popper checks it but right before they block
      */
     queue->terminated = 1;
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
     return ap_queue_interrupt_all(queue);
@@ -68,18 +68,25 @@ struct timer_event_t {
     apr_time_t when;
     ap_mpm_callback_fn_t *cbfunc;
     void *baton;
+    /** timer heap shard this entry belongs to */
+    unsigned int shard;
 };
 
 
+typedef struct fd_queue_deque_t fd_queue_deque_t;
+
 struct fd_queue_t
 {
     APR_RING_HEAD(timers_t, timer_event_t) timers;
-    fd_queue_elem_t *data;
-    unsigned int nelts;
+    fd_queue_deque_t **deques;  /* one per worker thread */
+    unsigned int ndeques;
     unsigned int bounds;
-    unsigned int in;
-    unsigned int out;
-    apr_thread_mutex_t *one_big_mutex;
+    apr_uint32_t next_deque;    /* where the next push starts looking */
+    apr_uint32_t next_steal;    /* where thieves start looking */
+    apr_uint32_t nelts;         /* in all the deques */
+    apr_uint32_t ntimers;
+    apr_uint32_t waiters;       /* threads blocked in ap_queue_pop_something */
+    apr_thread_mutex_t *sleep_mutex;
     apr_thread_cond_t *not_empty;
     int terminated;
 };
@@ -90,11 +97,14 @@ void ap_push_pool(fd_queue_info_t * queue_info,
                                     apr_pool_t * pool_to_recycle);
 
 apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
-                           apr_pool_t * a);
+                           int nworkers, apr_pool_t * a);
 apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
                            event_conn_state_t * ecs, apr_pool_t * p);
+apr_status_t ap_queue_push_batch(fd_queue_t * queue,
+                                 const fd_queue_elem_t * elems, int n);
 apr_status_t ap_queue_push_timer(fd_queue_t *queue, timer_event_t *te);
-apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
+apr_status_t ap_queue_pop_something(fd_queue_t * queue, int slot,
+                                    apr_socket_t ** sd,
                                     event_conn_state_t ** ecs, apr_pool_t ** p,
                                     timer_event_t ** te);
 apr_status_t ap_queue_interrupt_all(fd_queue_t * queue);
@@ -0,0 +1,285 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timer_heap.h"
+#include "apr_atomic.h"
+
+#define TIMER_HEAP_INITIAL_SIZE 64
+
+/* keep the shards on separate cache lines, they are locked independently */
+#define TIMER_SHARD_ALIGN 64
+
+typedef struct timer_shard_t
+{
+    apr_thread_mutex_t *mutex;
+    timer_event_t **heap;
+    apr_uint32_t nelts;
+    apr_uint32_t nalloc;
+    APR_RING_HEAD(timer_free_t, timer_event_t) free_ring;
+} timer_shard_t;
+
+/* pads each shard to a multiple of the alignment, the array of them is
+ * aligned by ap_timer_heap_create() */
+typedef union
+{
+    timer_shard_t s;
+    char pad[(sizeof(timer_shard_t) + TIMER_SHARD_ALIGN - 1)
+             / TIMER_SHARD_ALIGN * TIMER_SHARD_ALIGN];
+} timer_shard_slot_t;
+
+struct timer_heap_t
+{
+    timer_shard_slot_t *shards;
+    unsigned int nshards;
+    apr_uint32_t next_shard;
+    apr_uint32_t count;
+};
+
+static apr_status_t timer_heap_cleanup(void *data)
+{
+    timer_heap_t *th = data;
+    unsigned int i;
+
+    for (i = 0; i < th->nshards; i++) {
+        timer_shard_t *shard = &th->shards[i].s;
+        apr_uint32_t n;
+
+        for (n = 0; n < shard->nelts; n++) {
+            free(shard->heap[n]);
+        }
+        free(shard->heap);
+        shard->heap = NULL;
+        shard->nelts = shard->nalloc = 0;
+
+        while (!APR_RING_EMPTY(&shard->free_ring, timer_event_t, link)) {
+            timer_event_t *te = APR_RING_FIRST(&shard->free_ring);
+            APR_RING_REMOVE(te, link);
+            free(te);
+        }
+        apr_thread_mutex_destroy(shard->mutex);
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_timer_heap_create(timer_heap_t **th_out, int nshards,
+                                  apr_pool_t *p)
+{
+    timer_heap_t *th;
+    apr_status_t rv;
+    void *shards;
+    int i;
+
+    if (nshards < 1) {
+        nshards = 1;
+    }
+
+    th = apr_pcalloc(p, sizeof(*th));
+    shards = apr_pcalloc(p, nshards * sizeof(timer_shard_slot_t)
+                            + TIMER_SHARD_ALIGN - 1);
+    th->shards = (timer_shard_slot_t *)APR_ALIGN((apr_uintptr_t)shards,
+                                                 TIMER_SHARD_ALIGN);
+    th->nshards = nshards;
+
+    for (i = 0; i < nshards; i++) {
+        timer_shard_t *shard = &th->shards[i].s;
+
+        rv = apr_thread_mutex_create(&shard->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                     p);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        APR_RING_INIT(&shard->free_ring, timer_event_t, link);
+        shard->nalloc = TIMER_HEAP_INITIAL_SIZE;
+        shard->heap = ap_malloc(shard->nalloc * sizeof(timer_event_t *));
+    }
+
+    apr_pool_cleanup_register(p, th, timer_heap_cleanup,
+                              apr_pool_cleanup_null);
+
+    *th_out = th;
+    return APR_SUCCESS;
+}
+
+/*
+ * Classic array based binary min-heap, ordered by 'when'.
+ * The caller must hold the shard mutex.
+ */
+static void heap_sift_up(timer_event_t **heap, apr_uint32_t i)
+{
+    timer_event_t *te = heap[i];
+
+    while (i > 0) {
+        apr_uint32_t parent = (i - 1) / 2;
+        if (heap[parent]->when <= te->when) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = te;
+}
+
+static void heap_sift_down(timer_event_t **heap, apr_uint32_t nelts,
+                           apr_uint32_t i)
+{
+    timer_event_t *te = heap[i];
+
+    for (;;) {
+        apr_uint32_t child = 2 * i + 1;
+        if (child >= nelts) {
+            break;
+        }
+        if (child + 1 < nelts && heap[child + 1]->when < heap[child]->when) {
+            child++;
+        }
+        if (te->when <= heap[child]->when) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = te;
+}
+
+static timer_event_t *heap_pop(timer_shard_t *shard)
+{
+    timer_event_t *top = shard->heap[0];
+
+    shard->nelts--;
+    if (shard->nelts) {
+        shard->heap[0] = shard->heap[shard->nelts];
+        heap_sift_down(shard->heap, shard->nelts, 0);
+    }
+    return top;
+}
+
+apr_status_t ap_timer_heap_insert(timer_heap_t *th, apr_time_t when,
+                                  ap_mpm_callback_fn_t *cbfn, void *baton)
+{
+    unsigned int idx = apr_atomic_inc32(&th->next_shard) % th->nshards;
+    timer_shard_t *shard = &th->shards[idx].s;
+    timer_event_t *te;
+
+    apr_thread_mutex_lock(shard->mutex);
+
+    if (!APR_RING_EMPTY(&shard->free_ring, timer_event_t, link)) {
+        te = APR_RING_FIRST(&shard->free_ring);
+        APR_RING_REMOVE(te, link);
+    }
+    else {
+        te = ap_malloc(sizeof(timer_event_t));
+        APR_RING_ELEM_INIT(te, link);
+        te->shard = idx;
+    }
+    te->cbfunc = cbfn;
+    te->baton = baton;
+    te->when = when;
+
+    if (shard->nelts == shard->nalloc) {
+        shard->nalloc *= 2;
+        shard->heap = ap_realloc(shard->heap,
+                                 shard->nalloc * sizeof(timer_event_t *));
+    }
+    shard->heap[shard->nelts] = te;
+    heap_sift_up(shard->heap, shard->nelts);
+    shard->nelts++;
+    apr_atomic_inc32(&th->count);
+
+    apr_thread_mutex_unlock(shard->mutex);
+
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_timer_heap_next(timer_heap_t *th, apr_time_t *when)
+{
+    apr_status_t rv = APR_ENOENT;
+    unsigned int i;
+
+    /* Nothing to look at: avoid taking all shard locks */
+    if (!apr_atomic_read32(&th->count)) {
+        return APR_ENOENT;
+    }
+
+    for (i = 0; i < th->nshards; i++) {
+        timer_shard_t *shard = &th->shards[i].s;
+
+        apr_thread_mutex_lock(shard->mutex);
+        if (shard->nelts
+            && (rv != APR_SUCCESS || shard->heap[0]->when < *when)) {
+            *when = shard->heap[0]->when;
+            rv = APR_SUCCESS;
+        }
+        apr_thread_mutex_unlock(shard->mutex);
+    }
+
+    return rv;
+}
+
+int ap_timer_heap_expire(timer_heap_t *th, apr_time_t until,
+                         void (*func)(timer_event_t *te))
+{
+    APR_RING_HEAD(timer_expired_t, timer_event_t) expired;
+    unsigned int i;
+    int count = 0;
+
+    if (!apr_atomic_read32(&th->count)) {
+        return 0;
+    }
+
+    APR_RING_INIT(&expired, timer_event_t, link);
+
+    for (i = 0; i < th->nshards; i++) {
+        timer_shard_t *shard = &th->shards[i].s;
+
+        apr_thread_mutex_lock(shard->mutex);
+        while (shard->nelts && shard->heap[0]->when < until) {
+            timer_event_t *te = heap_pop(shard);
+            APR_RING_INSERT_TAIL(&expired, te, timer_event_t, link);
+            count++;
+        }
+        apr_thread_mutex_unlock(shard->mutex);
+    }
+
+    if (count) {
+        apr_atomic_sub32(&th->count, count);
+    }
+
+    /* Run the callbacks without holding any shard lock, so that they may
+     * register new timers.
+     */
+    while (!APR_RING_EMPTY(&expired, timer_event_t, link)) {
+        timer_event_t *te = APR_RING_FIRST(&expired);
+        APR_RING_REMOVE(te, link);
+        func(te);
+    }
+
+    return count;
+}
+
+void ap_timer_heap_release(timer_heap_t *th, timer_event_t *te)
+{
+    timer_shard_t *shard = &th->shards[te->shard].s;
+
+    apr_thread_mutex_lock(shard->mutex);
+    APR_RING_INSERT_TAIL(&shard->free_ring, te, timer_event_t, link);
+    apr_thread_mutex_unlock(shard->mutex);
+}
+
+apr_uint32_t ap_timer_heap_count(timer_heap_t *th)
+{
+    return apr_atomic_read32(&th->count);
+}
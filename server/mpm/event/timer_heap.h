@@ -0,0 +1,83 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  event/timer_heap.h
+ * @brief sharded binary heap of pending timed callbacks
+ *
+ * Timers are spread over a small number of shards, each one a binary
+ * min-heap ordered by expiration time and protected by its own mutex.
+ * Insertion is O(log n) in the size of one shard, and threads inserting
+ * concurrently usually hit different shards.  Only the listener thread
+ * looks at the earliest expiration time and pops expired timers.
+ *
+ * @addtogroup APACHE_MPM_EVENT
+ * @{
+ */
+
+#ifndef TIMER_HEAP_H
+#define TIMER_HEAP_H
+
+#include "fdqueue.h"
+
+typedef struct timer_heap_t timer_heap_t;
+
+/**
+ * Create a timer heap with @a nshards independently locked shards.
+ * The heap, its pending timers and the timer_event_t entries given back
+ * with ap_timer_heap_release() are freed when @a p is cleared; entries
+ * passed to the expire callback and not released yet are not.
+ */
+apr_status_t ap_timer_heap_create(timer_heap_t **th, int nshards,
+                                  apr_pool_t *p);
+
+/**
+ * Schedule @a cbfn to be called with @a baton at absolute time @a when.
+ * Entries are recycled from the free list of the selected shard.
+ */
+apr_status_t ap_timer_heap_insert(timer_heap_t *th, apr_time_t when,
+                                  ap_mpm_callback_fn_t *cbfn, void *baton);
+
+/**
+ * Get the earliest expiration time of all pending timers.
+ * @return APR_SUCCESS and sets @a when, or APR_ENOENT if no timer is
+ * pending.
+ */
+apr_status_t ap_timer_heap_next(timer_heap_t *th, apr_time_t *when);
+
+/**
+ * Remove every timer expiring before @a until and pass it to @a func.
+ * @a func is called without any shard lock held; it becomes the owner of
+ * the timer_event_t and must eventually give it back with
+ * ap_timer_heap_release().
+ * @return the number of expired timers
+ */
+int ap_timer_heap_expire(timer_heap_t *th, apr_time_t until,
+                         void (*func)(timer_event_t *te));
+
+/**
+ * Return an expired timer_event_t to the free list of its shard.
+ */
+void ap_timer_heap_release(timer_heap_t *th, timer_event_t *te);
+
+/**
+ * Get the number of pending timers.  The value is only a snapshot when
+ * other threads are inserting concurrently.
+ */
+apr_uint32_t ap_timer_heap_count(timer_heap_t *th);
+
+#endif /* TIMER_HEAP_H */
+/** @} */
@@ -23,7 +23,12 @@ typedef struct recycled_pool {
 } recycled_pool;
 
 struct fd_queue_info_t {
-    apr_uint32_t idlers;
+    apr_uint32_t idlers;     /**
+                              * read as signed:
+                              * 0 or positive: number of idle worker threads
+                              * negative: the listener is blocked waiting
+                              *           for an idle worker
+                              */
     apr_thread_mutex_t *idlers_mutex;
     apr_thread_cond_t *wait_for_idler;
     int terminated;
@@ -83,7 +88,7 @@ apr_status_t ap_queue_info_set_idle(fd_queue_info_t *queue_info,
                                     apr_pool_t *pool_to_recycle)
 {
     apr_status_t rv;
-    int prev_idlers;
+    apr_uint32_t prev_idlers;
 
     /* If we have been given a pool to recycle, atomically link
      * it into the queue_info's list of recycled pools
@@ -108,17 +113,12 @@ apr_status_t ap_queue_info_set_idle(fd_queue_info_t *queue_info,
     }
 
     /* Atomically increment the count of idle workers */
-    for (;;) {
-        prev_idlers = queue_info->idlers;
-        if (apr_atomic_cas32(&(queue_info->idlers), prev_idlers + 1,
-                             prev_idlers) == prev_idlers) {
-            break;
-        }
-    }
+    prev_idlers = apr_atomic_inc32(&(queue_info->idlers));
 
-    /* If this thread just made the idle worker count nonzero,
-     * wake up the listener. */
-    if (prev_idlers == 0) {
+    /* If the listener is blocked waiting for an idle worker, wake it up.
+     * As long as it isn't, going idle costs no more than the increment.
+     */
+    if ((apr_int32_t)prev_idlers < 0) {
         rv = apr_thread_mutex_lock(queue_info->idlers_mutex);
         if (rv != APR_SUCCESS) {
             return rv;
@@ -141,40 +141,42 @@ apr_status_t ap_queue_info_wait_for_idler(fd_queue_info_t *queue_info,
                                           apr_pool_t **recycled_pool)
 {
     apr_status_t rv;
+    apr_uint32_t prev_idlers;
 
     *recycled_pool = NULL;
 
-    /* Block if the count of idle workers is zero */
-    if (queue_info->idlers == 0) {
+    /* Atomically decrement the idle worker count, saving the old value.
+     * This reserves the next worker to go idle if there is none right now.
+     */
+    prev_idlers = apr_atomic_add32(&(queue_info->idlers), -1);
+
+    /* Block if there weren't any idle workers */
+    if ((apr_int32_t)prev_idlers <= 0) {
         rv = apr_thread_mutex_lock(queue_info->idlers_mutex);
         if (rv != APR_SUCCESS) {
+            apr_atomic_inc32(&(queue_info->idlers));    /* back out dec */
             return rv;
         }
         /* Re-check the idle worker count to guard against a
          * race condition.  Now that we're in the mutex-protected
          * region, one of two things may have happened:
-         *   - If the idle worker count is still zero, the
+         *   - If the idle worker count is still negative, the
          *     workers are all still busy, so it's safe to
-         *     block on a condition variable, BUT
-         *     we need to check for idle worker count again
-         *     when we are signaled since it can happen that
-         *     we are signaled by a worker thread that went idle
-         *     but received a context switch before it could
-         *     tell us. If it does signal us later once it is on
-         *     CPU again there might be no idle worker left.
-         *     See
-         *     https://issues.apache.org/bugzilla/show_bug.cgi?id=45605#c4
-         *   - If the idle worker count is nonzero, then a
-         *     worker has become idle since the first check
-         *     of queue_info->idlers above.  It's possible
-         *     that the worker has also signaled the condition
-         *     variable--and if so, the listener missed it
+         *     block on a condition variable.
+         *   - If the idle worker count is non-negative, then a
+         *     worker has become idle since the decrement above.
+         *     It's possible that the worker has also signaled the
+         *     condition variable--and if so, the listener missed it
          *     because it wasn't yet blocked on the condition
-         *     variable.  But if the idle worker count is
-         *     now nonzero, it's safe for this function to
-         *     return immediately.
+         *     variable.  But that worker is the one we reserved, so
+         *     it's safe for this function to return immediately.
+         *
+         * Only the listener ever decrements the count, so the worker
+         * we were signaled for can't be taken by anybody else (see
+         * https://issues.apache.org/bugzilla/show_bug.cgi?id=45605#c4).
          */
-        while (queue_info->idlers == 0) {
+        while ((apr_int32_t)queue_info->idlers < 0
+               && !queue_info->terminated) {
             rv = apr_thread_cond_wait(queue_info->wait_for_idler,
                                   queue_info->idlers_mutex);
             if (rv != APR_SUCCESS) {
@@ -192,9 +194,6 @@ apr_status_t ap_queue_info_wait_for_idler(fd_queue_info_t *queue_info,
         }
     }
 
-    /* Atomically decrement the idle worker count */
-    apr_atomic_dec32(&(queue_info->idlers));
-
     /* Atomically pop a pool from the recycled list */
 
     /* This function is safe only as long as it is single threaded because
@@ -236,17 +235,33 @@ apr_status_t ap_queue_info_term(fd_queue_info_t *queue_info)
     return apr_thread_mutex_unlock(queue_info->idlers_mutex);
 }
 
-/**
- * Detects when the fd_queue_t is full. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+/*
+ * The fd_queue_t is a set of deques, one per worker thread, each with its
+ * own small mutex.  The listener spreads the sockets over the deques round
+ * robin.  A worker first looks at its own deque, taking the newest socket,
+ * and when it is empty steals the oldest socket of the others.  The sleep
+ * mutex and condition variable are only used by workers that found nothing
+ * at all and have to block.
  */
-#define ap_queue_full(queue) ((queue)->nelts == (queue)->bounds)
+
+/* keep the deques on separate cache lines, they are locked independently */
+#define FD_QUEUE_DEQUE_ALIGN 64
+
+struct fd_queue_deque_t {
+    apr_thread_mutex_t *mutex;
+    fd_queue_elem_t    *data;
+    unsigned int        bounds;
+    unsigned int        head;       /* oldest element, thieves take it */
+    unsigned int        nelts;
+};
 
 /**
- * Detects when the fd_queue_t is empty. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+ * Detects when the fd_queue_t is empty.  The counter is maintained with
+ * atomics, so this may be called without holding any lock; it is only
+ * reliable with the sleep mutex held.
  */
-#define ap_queue_empty(queue) ((queue)->nelts == 0)
+#define ap_queue_empty(queue) \
+    ((apr_int32_t)apr_atomic_read32(&(queue)->nelts) <= 0)
 
 /**
  * Callback routine that is called to destroy this
@@ -255,25 +270,35 @@ apr_status_t ap_queue_info_term(fd_queue_info_t *queue_info)
 static apr_status_t ap_queue_destroy(void *data)
 {
     fd_queue_t *queue = data;
+    unsigned int i;
 
     /* Ignore errors here, we can't do anything about them anyway.
      * XXX: We should at least try to signal an error here, it is
      * indicative of a programmer error. -aaron */
     apr_thread_cond_destroy(queue->not_empty);
-    apr_thread_mutex_destroy(queue->one_big_mutex);
+    apr_thread_mutex_destroy(queue->sleep_mutex);
+    for (i = 0; i < queue->ndeques; i++) {
+        apr_thread_mutex_destroy(queue->deques[i]->mutex);
+    }
 
     return APR_SUCCESS;
 }
 
 /**
- * Initialize the fd_queue_t.
+ * Initialize the fd_queue_t with one deque per worker thread.
  */
-apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity, apr_pool_t *a)
+apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity,
+                           int nworkers, apr_pool_t *a)
 {
-    int i;
+    unsigned int i, deque_bounds;
+    apr_size_t size;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_create(&queue->one_big_mutex,
+    if (nworkers < 1) {
+        nworkers = 1;
+    }
+
+    if ((rv = apr_thread_mutex_create(&queue->sleep_mutex,
                                       APR_THREAD_MUTEX_DEFAULT, a)) != APR_SUCCESS) {
         return rv;
     }
@@ -281,15 +306,35 @@ apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity, apr_pool_t *a)
         return rv;
     }
 
-    queue->data = apr_palloc(a, queue_capacity * sizeof(fd_queue_elem_t));
+    /* Twice the fair share each, so that a push rarely has to skip a full
+     * deque.  Together they can always hold queue_capacity sockets.
+     */
+    deque_bounds = 2 * ((queue_capacity + nworkers - 1) / nworkers);
+    size = sizeof(fd_queue_deque_t) + deque_bounds * sizeof(fd_queue_elem_t);
+    size = (size + FD_QUEUE_DEQUE_ALIGN - 1)
+           / FD_QUEUE_DEQUE_ALIGN * FD_QUEUE_DEQUE_ALIGN;
+
+    queue->deques = apr_palloc(a, nworkers * sizeof(fd_queue_deque_t *));
+    queue->ndeques = nworkers;
     queue->bounds = queue_capacity;
+    queue->next_deque = 0;
+    queue->next_steal = 0;
     queue->nelts = 0;
-    queue->in = 0;
-    queue->out = 0;
+    queue->waiters = 0;
+    queue->terminated = 0;
 
-    /* Set all the sockets in the queue to NULL */
-    for (i = 0; i < queue_capacity; ++i)
-        queue->data[i].sd = NULL;
+    for (i = 0; i < queue->ndeques; i++) {
+        fd_queue_deque_t *dq = apr_pcalloc(a, size);
+
+        if ((rv = apr_thread_mutex_create(&dq->mutex,
+                                          APR_THREAD_MUTEX_DEFAULT, a)) != APR_SUCCESS) {
+            queue->ndeques = i;
+            return rv;
+        }
+        dq->data = (fd_queue_elem_t *)(dq + 1);
+        dq->bounds = deque_bounds;
+        queue->deques[i] = dq;
+    }
 
     apr_pool_cleanup_register(a, queue, ap_queue_destroy, apr_pool_cleanup_null);
 
@@ -304,108 +349,193 @@ apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity, apr_pool_t *a)
  */
 apr_status_t ap_queue_push(fd_queue_t *queue, apr_socket_t *sd, apr_pool_t *p)
 {
-    fd_queue_elem_t *elem;
+    fd_queue_deque_t *dq;
+    unsigned int idx, in, tries;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    AP_DEBUG_ASSERT(!queue->terminated);
+
+    idx = apr_atomic_inc32(&queue->next_deque) % queue->ndeques;
+    for (tries = 0; ; tries++) {
+        /* the reserved idler guarantees there is room somewhere */
+        AP_DEBUG_ASSERT(tries < queue->ndeques);
+
+        dq = queue->deques[idx];
+        if ((rv = apr_thread_mutex_lock(dq->mutex)) != APR_SUCCESS) {
+            return rv;
+        }
+        if (dq->nelts < dq->bounds) {
+            break;
+        }
+        apr_thread_mutex_unlock(dq->mutex);
+        if (++idx == queue->ndeques) {
+            idx = 0;
+        }
+    }
+
+    in = dq->head + dq->nelts;
+    if (in >= dq->bounds)
+        in -= dq->bounds;
+    dq->data[in].sd = sd;
+    dq->data[in].p = p;
+    dq->nelts++;
+    apr_thread_mutex_unlock(dq->mutex);
+
+    /* Reading 'waiters' after the atomic update of 'nelts' pairs with the
+     * workers incrementing 'waiters' before they look at 'nelts' a last
+     * time, so no wakeup is lost.
+     */
+    apr_atomic_inc32(&queue->nelts);
+    if (!apr_atomic_read32(&queue->waiters)) {
+        return APR_SUCCESS;
+    }
+
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
+    apr_thread_cond_signal(queue->not_empty);
+    return apr_thread_mutex_unlock(queue->sleep_mutex);
+}
 
-    AP_DEBUG_ASSERT(!queue->terminated);
-    AP_DEBUG_ASSERT(!ap_queue_full(queue));
+/*
+ * Take the newest (owner) or the oldest (thief) socket of a deque.
+ */
+static int deque_take(fd_queue_t *queue, fd_queue_deque_t *dq, int owner,
+                      apr_socket_t **sd, apr_pool_t **p)
+{
+    unsigned int pos;
 
-    elem = &queue->data[queue->in];
-    queue->in++;
-    if (queue->in >= queue->bounds)
-        queue->in -= queue->bounds;
-    elem->sd = sd;
-    elem->p = p;
-    queue->nelts++;
+    /* unlocked peek, a thief doesn't need to lock an empty deque */
+    if (!dq->nelts) {
+        return 0;
+    }
 
-    apr_thread_cond_signal(queue->not_empty);
+    if (apr_thread_mutex_lock(dq->mutex) != APR_SUCCESS) {
+        return 0;
+    }
+    if (!dq->nelts) {
+        apr_thread_mutex_unlock(dq->mutex);
+        return 0;
+    }
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+    if (owner) {
+        pos = dq->head + dq->nelts - 1;
+        if (pos >= dq->bounds)
+            pos -= dq->bounds;
+    }
+    else {
+        pos = dq->head++;
+        if (dq->head >= dq->bounds)
+            dq->head -= dq->bounds;
     }
+    dq->nelts--;
+    *sd = dq->data[pos].sd;
+    *p = dq->data[pos].p;
+#ifdef AP_DEBUG
+    dq->data[pos].sd = NULL;
+    dq->data[pos].p = NULL;
+#endif /* AP_DEBUG */
+    apr_atomic_dec32(&queue->nelts);
+    apr_thread_mutex_unlock(dq->mutex);
 
-    return APR_SUCCESS;
+    return 1;
 }
 
 /**
- * Retrieves the next available socket from the queue. If there are no
- * sockets available, it will block until one becomes available.
- * Once retrieved, the socket is placed into the address specified by
- * 'sd'.
+ * Retrieves the next available socket from the queue for the worker
+ * thread 'slot', looking at its own deque first and then stealing from
+ * the others. If there are no sockets available, it will block until one
+ * becomes available. Once retrieved, the socket is placed into the
+ * address specified by 'sd'.
  */
-apr_status_t ap_queue_pop(fd_queue_t *queue, apr_socket_t **sd, apr_pool_t **p)
+apr_status_t ap_queue_pop(fd_queue_t *queue, int slot, apr_socket_t **sd,
+                          apr_pool_t **p)
 {
-    fd_queue_elem_t *elem;
+    unsigned int own = (unsigned int)slot % queue->ndeques;
+    unsigned int i;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
+    for (;;) {
+        if (!ap_queue_empty(queue)) {
+            int taken = deque_take(queue, queue->deques[own], 1, sd, p);
+            /* Steal the oldest sockets first: the pushers fill the deques
+             * round robin, so they are usually found in the deque the last
+             * thief took from or right after it.  Stop as soon as others
+             * took everything.
+             */
+            unsigned int victim = apr_atomic_read32(&queue->next_steal)
+                                  % queue->ndeques;
+            for (i = 0; !taken && i < queue->ndeques
+                        && !ap_queue_empty(queue); i++) {
+                if (victim != own) {
+                    taken = deque_take(queue, queue->deques[victim], 0, sd, p);
+                }
+                if (taken) {
+                    apr_atomic_set32(&queue->next_steal, victim);
+                }
+                else if (++victim == queue->ndeques) {
+                    victim = 0;
+                }
+            }
+            if (taken) {
+                return APR_SUCCESS;
+            }
+        }
 
-    /* Keep waiting until we wake up and find that the queue is not empty. */
-    if (ap_queue_empty(queue)) {
-        if (!queue->terminated) {
-            apr_thread_cond_wait(queue->not_empty, queue->one_big_mutex);
+        /* Nothing to do, block until something is pushed. */
+        if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
+            return rv;
         }
+        apr_atomic_inc32(&queue->waiters);
+        if (ap_queue_empty(queue) && !queue->terminated) {
+            apr_thread_cond_wait(queue->not_empty, queue->sleep_mutex);
+        }
+        apr_atomic_dec32(&queue->waiters);
+
         /* If we wake up and it's still empty, then we were interrupted */
         if (ap_queue_empty(queue)) {
-            rv = apr_thread_mutex_unlock(queue->one_big_mutex);
+            int terminated = queue->terminated;
+            rv = apr_thread_mutex_unlock(queue->sleep_mutex);
             if (rv != APR_SUCCESS) {
                 return rv;
             }
-            if (queue->terminated) {
+            if (terminated) {
                 return APR_EOF; /* no more elements ever again */
             }
             else {
                 return APR_EINTR;
             }
         }
+        if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
+            return rv;
+        }
     }
-
-    elem = &queue->data[queue->out];
-    queue->out++;
-    if (queue->out >= queue->bounds)
-        queue->out -= queue->bounds;
-    queue->nelts--;
-    *sd = elem->sd;
-    *p = elem->p;
-#ifdef AP_DEBUG
-    elem->sd = NULL;
-    elem->p = NULL;
-#endif /* AP_DEBUG */
-
-    rv = apr_thread_mutex_unlock(queue->one_big_mutex);
-    return rv;
 }
 
 apr_status_t ap_queue_interrupt_all(fd_queue_t *queue)
 {
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
     apr_thread_cond_broadcast(queue->not_empty);
-    return apr_thread_mutex_unlock(queue->one_big_mutex);
+    return apr_thread_mutex_unlock(queue->sleep_mutex);
 }
 
 apr_status_t ap_queue_term(fd_queue_t *queue)
 {
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_lock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
-    /* we must hold one_big_mutex when setting this... otherwise,
+    /* we must hold sleep_mutex when setting this... otherwise,
      * we could end up setting it and waking everybody up just after a
      * would-be popper checks it but right before they block
      */
     queue->terminated = 1;
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
+    if ((rv = apr_thread_mutex_unlock(queue->sleep_mutex)) != APR_SUCCESS) {
         return rv;
     }
     return ap_queue_interrupt_all(queue);
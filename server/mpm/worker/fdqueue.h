@@ -53,21 +53,27 @@ struct fd_queue_elem_t {
 };
 typedef struct fd_queue_elem_t fd_queue_elem_t;
 
+typedef struct fd_queue_deque_t fd_queue_deque_t;
+
 struct fd_queue_t {
-    fd_queue_elem_t    *data;
-    unsigned int       nelts;
-    unsigned int       bounds;
-    unsigned int       in;
-    unsigned int       out;
-    apr_thread_mutex_t *one_big_mutex;
+    fd_queue_deque_t  **deques;     /* one per worker thread */
+    unsigned int        ndeques;
+    unsigned int        bounds;
+    apr_uint32_t        next_deque; /* where the next push starts looking */
+    apr_uint32_t        next_steal; /* where thieves start looking */
+    apr_uint32_t        nelts;      /* in all the deques */
+    apr_uint32_t        waiters;    /* threads blocked in ap_queue_pop */
+    apr_thread_mutex_t *sleep_mutex;
     apr_thread_cond_t  *not_empty;
     int                 terminated;
 };
 typedef struct fd_queue_t fd_queue_t;
 
-apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity, apr_pool_t *a);
+apr_status_t ap_queue_init(fd_queue_t *queue, int queue_capacity,
+                           int nworkers, apr_pool_t *a);
 apr_status_t ap_queue_push(fd_queue_t *queue, apr_socket_t *sd, apr_pool_t *p);
-apr_status_t ap_queue_pop(fd_queue_t *queue, apr_socket_t **sd, apr_pool_t **p);
+apr_status_t ap_queue_pop(fd_queue_t *queue, int slot, apr_socket_t **sd,
+                          apr_pool_t **p);
 apr_status_t ap_queue_interrupt_all(fd_queue_t *queue);
 apr_status_t ap_queue_term(fd_queue_t *queue);
 
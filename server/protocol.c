@@ -474,9 +474,9 @@ AP_DECLARE(int) ap_getline(char *s, int n, request_rec *r, int fold)
     apr_size_t len;
     apr_bucket_brigade *tmp_bb;
 
-    tmp_bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    tmp_bb = ap_acquire_brigade(r->connection);
     rv = ap_rgetline(&tmp_s, n, &len, r, fold, tmp_bb);
-    apr_brigade_destroy(tmp_bb);
+    ap_release_brigade(r->connection, tmp_bb);
 
     /* Map the out-of-space condition to the old API. */
     if (rv == APR_ENOSPC) {
@@ -555,71 +555,18 @@ AP_CORE_DECLARE(void) ap_parse_uri(request_rec *r, const char *uri)
     }
 }
 
-static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
+/* Split r->the_request into the method, URI and protocol */
+static void parse_request_line(request_rec *r)
 {
-    const char *ll;
-    const char *uri;
-    const char *pro;
-
 #if 0
     conn_rec *conn = r->connection;
 #endif
+    const char *ll;
+    const char *uri;
+    const char *pro;
     int major = 1, minor = 0;   /* Assume HTTP/1.0 if non-"HTTP" protocol */
     char http[5];
     apr_size_t len;
-    int num_blank_lines = 0;
-    int max_blank_lines = r->server->limit_req_fields;
-
-    if (max_blank_lines <= 0) {
-        max_blank_lines = DEFAULT_LIMIT_REQUEST_FIELDS;
-    }
-
-    /* Read past empty lines until we get a real request line,
-     * a read error, the connection closes (EOF), or we timeout.
-     *
-     * We skip empty lines because browsers have to tack a CRLF on to the end
-     * of POSTs to support old CERN webservers.  But note that we may not
-     * have flushed any previous response completely to the client yet.
-     * We delay the flush as long as possible so that we can improve
-     * performance for clients that are pipelining requests.  If a request
-     * is pipelined then we won't block during the (implicit) read() below.
-     * If the requests aren't pipelined, then the client is still waiting
-     * for the final buffer flush from us, and we will block in the implicit
-     * read().  B_SAFEREAD ensures that the BUFF layer flushes if it will
-     * have to block during a read.
-     */
-
-    do {
-        apr_status_t rv;
-
-        /* ensure ap_rgetline allocates memory each time thru the loop
-         * if there are empty lines
-         */
-        r->the_request = NULL;
-        rv = ap_rgetline(&(r->the_request), (apr_size_t)(r->server->limit_req_line + 2),
-                         &len, r, 0, bb);
-
-        if (rv != APR_SUCCESS) {
-            r->request_time = apr_time_now();
-
-            /* ap_rgetline returns APR_ENOSPC if it fills up the
-             * buffer before finding the end-of-line.  This is only going to
-             * happen if it exceeds the configured limit for a request-line.
-             */
-            if (APR_STATUS_IS_ENOSPC(rv)) {
-                r->status    = HTTP_REQUEST_URI_TOO_LARGE;
-                r->proto_num = HTTP_VERSION(1,0);
-                r->protocol  = apr_pstrdup(r->pool, "HTTP/1.0");
-            }
-            else if (APR_STATUS_IS_TIMEUP(rv)) {
-                r->status = HTTP_REQUEST_TIME_OUT;
-            }
-            else if (APR_STATUS_IS_EINVAL(rv)) {
-                r->status = HTTP_BAD_REQUEST;
-            }
-            return 0;
-        }
-    } while ((len <= 0) && (++num_blank_lines < max_blank_lines));
 
     if (APLOGrtrace5(r)) {
         ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r,
@@ -678,7 +625,66 @@ static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
         r->proto_num = HTTP_VERSION(major, minor);
     else
         r->proto_num = HTTP_VERSION(1, 0);
+}
 
+static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
+{
+    apr_size_t len;
+    int num_blank_lines = 0;
+    int max_blank_lines = r->server->limit_req_fields;
+
+    if (max_blank_lines <= 0) {
+        max_blank_lines = DEFAULT_LIMIT_REQUEST_FIELDS;
+    }
+
+    /* Read past empty lines until we get a real request line,
+     * a read error, the connection closes (EOF), or we timeout.
+     *
+     * We skip empty lines because browsers have to tack a CRLF on to the end
+     * of POSTs to support old CERN webservers.  But note that we may not
+     * have flushed any previous response completely to the client yet.
+     * We delay the flush as long as possible so that we can improve
+     * performance for clients that are pipelining requests.  If a request
+     * is pipelined then we won't block during the (implicit) read() below.
+     * If the requests aren't pipelined, then the client is still waiting
+     * for the final buffer flush from us, and we will block in the implicit
+     * read().  B_SAFEREAD ensures that the BUFF layer flushes if it will
+     * have to block during a read.
+     */
+
+    do {
+        apr_status_t rv;
+
+        /* ensure ap_rgetline allocates memory each time thru the loop
+         * if there are empty lines
+         */
+        r->the_request = NULL;
+        rv = ap_rgetline(&(r->the_request), (apr_size_t)(r->server->limit_req_line + 2),
+                         &len, r, 0, bb);
+
+        if (rv != APR_SUCCESS) {
+            r->request_time = apr_time_now();
+
+            /* ap_rgetline returns APR_ENOSPC if it fills up the
+             * buffer before finding the end-of-line.  This is only going to
+             * happen if it exceeds the configured limit for a request-line.
+             */
+            if (APR_STATUS_IS_ENOSPC(rv)) {
+                r->status    = HTTP_REQUEST_URI_TOO_LARGE;
+                r->proto_num = HTTP_VERSION(1,0);
+                r->protocol  = apr_pstrdup(r->pool, "HTTP/1.0");
+            }
+            else if (APR_STATUS_IS_TIMEUP(rv)) {
+                r->status = HTTP_REQUEST_TIME_OUT;
+            }
+            else if (APR_STATUS_IS_EINVAL(rv)) {
+                r->status = HTTP_BAD_REQUEST;
+            }
+            return 0;
+        }
+    } while ((len <= 0) && (++num_blank_lines < max_blank_lines));
+
+    parse_request_line(r);
     return 1;
 }
 
@@ -711,6 +717,17 @@ static int field_name_len(const char *field)
     return end - field;
 }
 
+static void finish_mime_headers(request_rec *r)
+{
+    /* Combine multiple message-header fields with the same
+     * field-name, following RFC 2616, 4.2.
+     */
+    apr_table_compress(r->headers_in, APR_OVERLAP_TABLES_MERGE);
+
+    /* enforce LimitRequestFieldSize for merged headers */
+    apr_table_do(table_do_fn_check_lengths, r, r->headers_in, NULL);
+}
+
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb)
 {
     char *last_field = NULL;
@@ -886,33 +903,252 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
         }
     }
 
-    /* Combine multiple message-header fields with the same
-     * field-name, following RFC 2616, 4.2.
-     */
-    apr_table_compress(r->headers_in, APR_OVERLAP_TABLES_MERGE);
+    finish_mime_headers(r);
+}
 
-    /* enforce LimitRequestFieldSize for merged headers */
-    apr_table_do(table_do_fn_check_lengths, r, r->headers_in, NULL);
+#if !APR_CHARSET_EBCDIC
+/* how much of the header fields get_mime_headers_buffered() looks at */
+#define MIME_HEADERS_PEEK_MAX (2 * HUGE_STRING_LEN)
+
+/*
+ * Consume the len bytes of the request head which were parsed from what
+ * was peeked at, they are there already.
+ * return: 1, or 0 with r->status set if they could not be read
+ */
+static int consume_head(request_rec *r, apr_bucket_brigade *bb,
+                        apr_size_t len)
+{
+    apr_status_t rv;
+
+    while (len) {
+        apr_off_t got = 0;
+
+        rv = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                            APR_BLOCK_READ, len);
+        if (rv == APR_SUCCESS) {
+            apr_brigade_length(bb, 1, &got);
+        }
+        apr_brigade_cleanup(bb);
+        if (rv != APR_SUCCESS || got <= 0) {
+            r->status = APR_STATUS_IS_TIMEUP(rv) ? HTTP_REQUEST_TIME_OUT
+                                                 : HTTP_BAD_REQUEST;
+            return 0;
+        }
+        len -= got;
+    }
+    return 1;
+}
+
+/*
+ * Fast path for ap_read_request(): the header fields usually are all
+ * buffered in the input filters already.  If so, take them with a single
+ * copy into the request pool and let ap_parse_http_headers() split them
+ * there, instead of reading and copying them line by line.
+ * return: 1 if the header fields were read (check r->status), or 0 if
+ *         ap_get_mime_headers_core() has to do it (nothing was consumed)
+ */
+static int get_mime_headers_buffered(request_rec *r, apr_bucket_brigade *bb)
+{
+    apr_status_t rv;
+    apr_size_t len, head_len;
+    char *buf;
+
+    if (!apr_is_empty_table(r->headers_in)) {
+        return 0;
+    }
+
+    apr_brigade_cleanup(bb);
+    rv = ap_get_brigade(r->input_filters, bb, AP_MODE_SPECULATIVE,
+                        APR_NONBLOCK_READ, MIME_HEADERS_PEEK_MAX);
+    if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
+        apr_brigade_cleanup(bb);
+        return 0;
+    }
+    rv = apr_brigade_pflatten(bb, &buf, &len, r->pool);
+    apr_brigade_cleanup(bb);
+    if (rv != APR_SUCCESS) {
+        return 0;
+    }
+
+    head_len = ap_http_headers_end(buf, len);
+    if (!head_len) {
+        return 0;
+    }
+    rv = ap_parse_http_headers(buf, head_len, r->headers_in,
+                               r->server->limit_req_fieldsize,
+                               r->server->limit_req_fields);
+    if (rv != APR_SUCCESS) {
+        /* let the line by line parser report what is wrong */
+        apr_table_clear(r->headers_in);
+        return 0;
+    }
+
+    /* Now consume what was parsed, it is there already */
+    if (consume_head(r, bb, head_len)) {
+        finish_mime_headers(r);
+    }
+    return 1;
+}
+
+/*
+ * For ap_read_request_from(): parse the request line and the header fields
+ * from the head the caller peeked at, and consume them.  Anything unusual,
+ * an incomplete head, a request line too long or invalid header fields,
+ * is left to read_request_line() and ap_get_mime_headers_core().
+ * return: 1 if the head was read (check r->status), or 0 if it has to be
+ *         read from the input (nothing was consumed)
+ */
+static int read_head_buffered(request_rec *r, const char *head,
+                              apr_size_t len, apr_bucket_brigade *bb)
+{
+    const char *p = head, *end = head + len, *eol, *fields;
+    apr_size_t line_len, fields_len = 0;
+    char *buf = NULL;
+    apr_status_t rv;
+    int num_blank_lines = 0;
+    int max_blank_lines = r->server->limit_req_fields;
+
+    if (max_blank_lines <= 0) {
+        max_blank_lines = DEFAULT_LIMIT_REQUEST_FIELDS;
+    }
+
+    /* the empty lines read_request_line() skips */
+    for (;;) {
+        eol = memchr(p, APR_ASCII_LF, end - p);
+        if (!eol) {
+            return 0;
+        }
+        line_len = eol - p;
+        if (line_len && p[line_len - 1] == APR_ASCII_CR) {
+            line_len--;
+        }
+        if (line_len || ++num_blank_lines >= max_blank_lines) {
+            break;
+        }
+        p = eol + 1;
+    }
+    if (line_len > (apr_size_t)r->server->limit_req_line
+        || memchr(p, '\0', line_len)) {
+        return 0;
+    }
+
+    r->the_request = apr_pstrmemdup(r->pool, p, line_len);
+    parse_request_line(r);
+
+    fields = eol + 1;
+    if (!r->assbackwards) {
+        fields_len = ap_http_headers_end(fields, end - fields);
+        if (!fields_len) {
+            return 0;
+        }
+        buf = apr_pmemdup(r->pool, fields, fields_len);
+        rv = ap_parse_http_headers(buf, fields_len, r->headers_in,
+                                   r->server->limit_req_fieldsize,
+                                   r->server->limit_req_fields);
+        if (rv != APR_SUCCESS) {
+            /* let the line by line parser report what is wrong */
+            apr_table_clear(r->headers_in);
+            return 0;
+        }
+    }
+
+    if (consume_head(r, bb, fields + fields_len - head) && buf) {
+        finish_mime_headers(r);
+    }
+    return 1;
+}
+#endif
+
+/* Where the well known fields are in r->headers_in, see ap_get_header_in().
+ * The index is only valid for the table it was built for, as long as no
+ * field was added or removed: nelts and the last key tell.  An entry also
+ * has to still have the same key pointer, or the table was reordered.
+ */
+struct ap_header_index {
+    const apr_table_t *t;
+    int nelts;
+    const char *last_key;
+    int idx[AP_HEADER_KNOWN];       /* -1 if the field is not there */
+    const char *key[AP_HEADER_KNOWN];
+};
+
+static void build_header_index(struct ap_header_index *hi,
+                               const apr_table_t *t)
+{
+    const apr_array_header_t *arr = apr_table_elts(t);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    int i, id;
+
+    for (i = 0; i < AP_HEADER_KNOWN; i++) {
+        hi->idx[i] = -1;
+    }
+    for (i = 0; i < arr->nelts; i++) {
+        if (!elts[i].key) {
+            continue;
+        }
+        id = ap_header_id(elts[i].key, strlen(elts[i].key));
+        /* apr_table_get() gives the first one */
+        if (id >= 0 && hi->idx[id] < 0) {
+            hi->idx[id] = i;
+            hi->key[id] = elts[i].key;
+        }
+    }
+    hi->t = t;
+    hi->nelts = arr->nelts;
+    hi->last_key = arr->nelts ? elts[arr->nelts - 1].key : NULL;
+}
+
+AP_DECLARE(const char *) ap_get_header_in(request_rec *r, ap_header_id_e id)
+{
+    const apr_array_header_t *arr = apr_table_elts(r->headers_in);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    core_request_config *conf;
+    struct ap_header_index *hi;
+    int i;
+
+    conf = r->request_config ? ap_get_core_module_config(r->request_config)
+                             : NULL;
+    if (!conf) {
+        return apr_table_get(r->headers_in, ap_header_name(id));
+    }
+
+    hi = conf->headers_in_index;
+    if (!hi) {
+        hi = conf->headers_in_index = apr_palloc(r->pool, sizeof(*hi));
+        build_header_index(hi, r->headers_in);
+    }
+    else if (hi->t != r->headers_in || hi->nelts != arr->nelts
+             || hi->last_key != (arr->nelts ? elts[arr->nelts - 1].key
+                                            : NULL)) {
+        build_header_index(hi, r->headers_in);
+    }
+
+    i = hi->idx[id];
+    if (i < 0) {
+        return NULL;
+    }
+    if (elts[i].key != hi->key[id]) {
+        build_header_index(hi, r->headers_in);
+        i = hi->idx[id];
+        if (i < 0) {
+            return NULL;
+        }
+    }
+    return elts[i].val;
 }
 
 AP_DECLARE(void) ap_get_mime_headers(request_rec *r)
 {
     apr_bucket_brigade *tmp_bb;
-    tmp_bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    tmp_bb = ap_acquire_brigade(r->connection);
     ap_get_mime_headers_core(r, tmp_bb);
-    apr_brigade_destroy(tmp_bb);
+    ap_release_brigade(r->connection, tmp_bb);
 }
 
-request_rec *ap_read_request(conn_rec *conn)
+static request_rec *init_request(conn_rec *conn)
 {
     request_rec *r;
     apr_pool_t *p;
-    const char *expect;
-    int access_status;
-    apr_bucket_brigade *tmp_bb;
-    apr_socket_t *csd;
-    apr_interval_time_t cur_timeout;
-
 
     apr_pool_create(&p, conn->pool);
     apr_pool_tag(p, "request");
@@ -959,12 +1195,39 @@ request_rec *ap_read_request(conn_rec *conn)
     r->useragent_addr = conn->client_addr;
     r->useragent_ip = conn->client_ip;
 
-    tmp_bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
-
     ap_run_pre_read_request(r, conn);
 
+    return r;
+}
+
+request_rec *ap_read_request(conn_rec *conn)
+{
+    return ap_read_request_from(conn, NULL, 0);
+}
+
+AP_DECLARE(request_rec *) ap_read_request_from(conn_rec *conn,
+                                               const char *head,
+                                               apr_size_t len)
+{
+    request_rec *r;
+    const char *expect;
+    int access_status;
+    apr_bucket_brigade *tmp_bb;
+    apr_socket_t *csd;
+    apr_interval_time_t cur_timeout;
+    int buffered = 0;
+
+    r = init_request(conn);
+    tmp_bb = ap_acquire_brigade(conn);
+
+#if !APR_CHARSET_EBCDIC
+    if (head) {
+        buffered = read_head_buffered(r, head, len, tmp_bb);
+    }
+#endif
+
     /* Get the request... */
-    if (!read_request_line(r, tmp_bb)) {
+    if (!buffered && !read_request_line(r, tmp_bb)) {
         if (r->status == HTTP_REQUEST_URI_TOO_LARGE
             || r->status == HTTP_BAD_REQUEST) {
             if (r->status == HTTP_REQUEST_URI_TOO_LARGE) {
@@ -979,7 +1242,7 @@ request_rec *ap_read_request(conn_rec *conn)
             ap_send_error_response(r, 0);
             ap_update_child_status(conn->sbh, SERVER_BUSY_LOG, r);
             ap_run_log_transaction(r);
-            apr_brigade_destroy(tmp_bb);
+            ap_release_brigade(conn, tmp_bb);
             goto traceout;
         }
         else if (r->status == HTTP_REQUEST_TIME_OUT) {
@@ -987,11 +1250,11 @@ request_rec *ap_read_request(conn_rec *conn)
             if (!r->connection->keepalives) {
                 ap_run_log_transaction(r);
             }
-            apr_brigade_destroy(tmp_bb);
+            ap_release_brigade(conn, tmp_bb);
             goto traceout;
         }
 
-        apr_brigade_destroy(tmp_bb);
+        ap_release_brigade(conn, tmp_bb);
         r = NULL;
         goto traceout;
     }
@@ -1008,19 +1271,26 @@ request_rec *ap_read_request(conn_rec *conn)
     }
 
     if (!r->assbackwards) {
+#if !APR_CHARSET_EBCDIC
+        /* what was peeked at is not looked at twice */
+        if (!buffered && (head || !get_mime_headers_buffered(r, tmp_bb))) {
+            ap_get_mime_headers_core(r, tmp_bb);
+        }
+#else
         ap_get_mime_headers_core(r, tmp_bb);
+#endif
         if (r->status != HTTP_OK) {
             ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(00567)
                           "request failed: error reading the headers");
             ap_send_error_response(r, 0);
             ap_update_child_status(conn->sbh, SERVER_BUSY_LOG, r);
             ap_run_log_transaction(r);
-            apr_brigade_destroy(tmp_bb);
+            ap_release_brigade(conn, tmp_bb);
             goto traceout;
         }
 
-        if (apr_table_get(r->headers_in, "Transfer-Encoding")
-            && apr_table_get(r->headers_in, "Content-Length")) {
+        if (ap_get_header_in(r, AP_HEADER_TRANSFER_ENCODING)
+            && ap_get_header_in(r, AP_HEADER_CONTENT_LENGTH)) {
             /* 2616 section 4.4, point 3: "if both Transfer-Encoding
              * and Content-Length are received, the latter MUST be
              * ignored"; so unset it here to prevent any confusion
@@ -1043,12 +1313,12 @@ request_rec *ap_read_request(conn_rec *conn)
             ap_send_error_response(r, 0);
             ap_update_child_status(conn->sbh, SERVER_BUSY_LOG, r);
             ap_run_log_transaction(r);
-            apr_brigade_destroy(tmp_bb);
+            ap_release_brigade(conn, tmp_bb);
             goto traceout;
         }
     }
 
-    apr_brigade_destroy(tmp_bb);
+    ap_release_brigade(conn, tmp_bb);
 
     /* update what we think the virtual host is based on the headers we've
      * now read. may update status.
@@ -1068,7 +1338,7 @@ request_rec *ap_read_request(conn_rec *conn)
 
     if ((!r->hostname && (r->proto_num >= HTTP_VERSION(1, 1)))
         || ((r->proto_num == HTTP_VERSION(1, 1))
-            && !apr_table_get(r->headers_in, "Host"))) {
+            && !ap_get_header_in(r, AP_HEADER_HOST))) {
         /*
          * Client sent us an HTTP/1.1 or later request without telling us the
          * hostname, either with a full URL or a Host: header. We therefore
@@ -1107,7 +1377,7 @@ request_rec *ap_read_request(conn_rec *conn)
         goto traceout;
     }
 
-    if (((expect = apr_table_get(r->headers_in, "Expect")) != NULL)
+    if (((expect = ap_get_header_in(r, AP_HEADER_EXPECT)) != NULL)
         && (expect[0] != '\0')) {
         /*
          * The Expect header field was added to HTTP/1.1 after RFC 2068
@@ -1137,6 +1407,26 @@ request_rec *ap_read_request(conn_rec *conn)
     return r;
 }
 
+AP_DECLARE(request_rec *) ap_read_request_timed_out(conn_rec *conn)
+{
+    request_rec *r = init_request(conn);
+
+    r->request_time = apr_time_now();
+    r->status = HTTP_REQUEST_TIME_OUT;
+    r->proto_num = HTTP_VERSION(1,0);
+    r->protocol = "HTTP/1.0";
+    conn->keepalive = AP_CONN_CLOSE;
+
+    ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(02356)
+                  "request failed: timed out waiting for the request head");
+    ap_send_error_response(r, 0);
+    ap_update_child_status(conn->sbh, SERVER_BUSY_LOG, r);
+    ap_run_log_transaction(r);
+
+    AP_READ_REQUEST_FAILURE((uintptr_t)r);
+    return r;
+}
+
 /* if a request with a body creates a subrequest, remove original request's
  * input headers which pertain to the body which has already been read.
  * out-of-line helper function for ap_set_sub_req_protocol.
@@ -1182,8 +1472,8 @@ AP_DECLARE(void) ap_set_sub_req_protocol(request_rec *rnew,
     /* did the original request have a body?  (e.g. POST w/SSI tags)
      * if so, make sure the subrequest doesn't inherit body headers
      */
-    if (!r->kept_body && (apr_table_get(r->headers_in, "Content-Length")
-        || apr_table_get(r->headers_in, "Transfer-Encoding"))) {
+    if (!r->kept_body && (ap_get_header_in(r, AP_HEADER_CONTENT_LENGTH)
+        || ap_get_header_in(r, AP_HEADER_TRANSFER_ENCODING))) {
         strip_headers_request_body(rnew);
     }
     rnew->subprocess_env  = apr_table_copy(rnew->pool, r->subprocess_env);
@@ -1758,7 +2048,7 @@ AP_DECLARE(void) ap_send_interim_response(request_rec *r, int send_headers)
     ap_xlate_proto_to_ascii(status_line, strlen(status_line));
 
     x.f = r->connection->output_filters;
-    x.bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    x.bb = ap_acquire_brigade(r->connection);
 
     ap_fputs(x.f, x.bb, status_line);
     if (send_headers) {
@@ -1767,7 +2057,7 @@ AP_DECLARE(void) ap_send_interim_response(request_rec *r, int send_headers)
     }
     ap_fputs(x.f, x.bb, CRLF_ASCII);
     ap_fflush(x.f, x.bb);
-    apr_brigade_destroy(x.bb);
+    ap_release_brigade(r->connection, x.bb);
 }
 
 
@@ -385,6 +385,21 @@ AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sb, request_rec *r)
     ws->conn_bytes += bytes;
 }
 
+AP_DECLARE(void) ap_increment_write_counts(ap_sb_handle_t *sb,
+                                           apr_size_t iovecs,
+                                           apr_size_t bytes)
+{
+    worker_score *ws;
+
+    if (!sb)
+        return;
+
+    ws = &ap_scoreboard_image->servers[sb->child_num][sb->thread_num];
+    ws->write_count++;
+    ws->write_iovecs += iovecs;
+    ws->write_bytes += bytes;
+}
+
 AP_DECLARE(int) ap_find_child_by_pid(apr_proc_t *pid)
 {
     int i;
@@ -125,6 +125,9 @@ AP_DECLARE(int) ap_get_server_module_loglevel(const server_rec *s, int module_in
 
 AP_DECLARE(int) ap_get_server_module_loglevel(const server_rec *s, int module_index)
 {
+    if (s->log_levels) {
+        return s->log_levels[module_index];
+    }
     if (module_index < 0 || s->log.module_levels == NULL ||
         s->log.module_levels[module_index] < 0)
     {
@@ -142,6 +145,9 @@ AP_DECLARE(int) ap_get_conn_module_loglevel(const conn_rec *c, int module_index)
 AP_DECLARE(int) ap_get_conn_module_loglevel(const conn_rec *c, int module_index)
 {
     const struct ap_logconf *l = (c)->log ? (c)->log : &(c)->base_server->log;
+    if (l == &c->base_server->log && c->base_server->log_levels) {
+        return c->base_server->log_levels[module_index];
+    }
     if (module_index < 0 || l->module_levels == NULL ||
         l->module_levels[module_index] < 0)
     {
@@ -164,6 +170,9 @@ AP_DECLARE(int) ap_get_conn_server_module_loglevel(const conn_rec *c,
 {
     const struct ap_logconf *l = (c->log && c->log != &c->base_server->log) ?
                                  c->log : &s->log;
+    if (l == &s->log && s->log_levels) {
+        return s->log_levels[module_index];
+    }
     if (module_index < 0 || l->module_levels == NULL ||
         l->module_levels[module_index] < 0)
     {
@@ -183,6 +192,9 @@ AP_DECLARE(int) ap_get_request_module_loglevel(const request_rec *r, int module_
     const struct ap_logconf *l = r->log             ? r->log             :
                                  r->connection->log ? r->connection->log :
                                  &r->server->log;
+    if (l == &r->server->log && r->server->log_levels) {
+        return r->server->log_levels[module_index];
+    }
     if (module_index < 0 || l->module_levels == NULL ||
         l->module_levels[module_index] < 0)
     {
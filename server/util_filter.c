@@ -279,14 +279,13 @@ AP_DECLARE(ap_filter_rec_t *) ap_register_output_filter_protocol(
     return ret ;
 }
 
-static ap_filter_t *add_any_filter_handle(ap_filter_rec_t *frec, void *ctx,
-                                          request_rec *r, conn_rec *c,
-                                          ap_filter_t **r_filters,
-                                          ap_filter_t **p_filters,
-                                          ap_filter_t **c_filters)
+/* Link the (uninitialized) filter f for frec into the right chain */
+static ap_filter_t *link_any_filter(ap_filter_t *f, ap_filter_rec_t *frec,
+                                    void *ctx, request_rec *r, conn_rec *c,
+                                    ap_filter_t **r_filters,
+                                    ap_filter_t **p_filters,
+                                    ap_filter_t **c_filters)
 {
-    apr_pool_t *p = frec->ftype < AP_FTYPE_CONNECTION && r ? r->pool : c->pool;
-    ap_filter_t *f = apr_palloc(p, sizeof(*f));
     ap_filter_t **outf;
 
     if (frec->ftype < AP_FTYPE_PROTOCOL) {
@@ -359,6 +358,24 @@ static ap_filter_t *add_any_filter_handle(ap_filter_rec_t *frec, void *ctx,
     return f;
 }
 
+static ap_filter_t *add_any_filter_handle(ap_filter_rec_t *frec, void *ctx,
+                                          request_rec *r, conn_rec *c,
+                                          ap_filter_t **r_filters,
+                                          ap_filter_t **p_filters,
+                                          ap_filter_t **c_filters)
+{
+    apr_pool_t *p = frec->ftype < AP_FTYPE_CONNECTION && r ? r->pool : c->pool;
+
+    return link_any_filter(apr_palloc(p, sizeof(ap_filter_t)), frec, ctx,
+                           r, c, r_filters, p_filters, c_filters);
+}
+
+static void log_unknown_filter(conn_rec *c, const char *name)
+{
+    ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(00082)
+                  "an unknown filter was not added: %s", name);
+}
+
 static ap_filter_t *add_any_filter(const char *name, void *ctx,
                                    request_rec *r, conn_rec *c,
                                    const filter_trie_node *reg_filter_set,
@@ -401,8 +418,7 @@ static ap_filter_t *add_any_filter(const char *name, void *ctx,
         }
     }
 
-    ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, r ? r->connection : c, APLOGNO(00082)
-                  "an unknown filter was not added: %s", name);
+    log_unknown_filter(r ? r->connection : c, name);
     return NULL;
 }
 
@@ -442,6 +458,95 @@ AP_DECLARE(ap_filter_t *) ap_add_output_filter_handle(ap_filter_rec_t *f,
                                  &c->output_filters);
 }
 
+struct ap_filter_chain_t {
+    int input;
+    int nelts;
+    struct {
+        const char *name;
+        /* NULL if not registered yet when the chain was made */
+        ap_filter_rec_t *frec;
+    } *elts;
+};
+
+AP_DECLARE(ap_filter_chain_t *) ap_filter_chain_make(apr_pool_t *p,
+                                                     const char *names,
+                                                     int input)
+{
+    ap_filter_chain_t *chain = apr_pcalloc(p, sizeof(*chain));
+    const char *s;
+    int n = 1;
+
+    for (s = names; *s; s++) {
+        n += (*s == ';');
+    }
+    chain->input = input;
+    chain->elts = apr_palloc(p, n * sizeof(*chain->elts));
+
+    while (*names) {
+        const char *end = names;
+
+        while (*end && *end != ';') {
+            end++;
+        }
+        if (end > names) {
+            const char *name = apr_pstrmemdup(p, names, end - names);
+
+            chain->elts[chain->nelts].name = name;
+            chain->elts[chain->nelts].frec =
+                get_filter_handle(name, input ? registered_input_filters
+                                              : registered_output_filters);
+            chain->nelts++;
+        }
+        names = *end ? end + 1 : end;
+    }
+    return chain;
+}
+
+AP_DECLARE(void) ap_add_filter_chain(const ap_filter_chain_t *chain,
+                                     request_rec *r)
+{
+    conn_rec *c = r->connection;
+    ap_filter_t **r_filters, **p_filters, **c_filters;
+    ap_filter_t *f;
+    int i;
+
+    if (chain->input) {
+        r_filters = &r->input_filters;
+        p_filters = &r->proto_input_filters;
+        c_filters = &c->input_filters;
+    }
+    else {
+        r_filters = &r->output_filters;
+        p_filters = &r->proto_output_filters;
+        c_filters = &c->output_filters;
+    }
+
+    /* one allocation for the whole chain */
+    f = apr_palloc(r->pool, chain->nelts * sizeof(*f));
+    for (i = 0; i < chain->nelts; i++) {
+        ap_filter_rec_t *frec = chain->elts[i].frec;
+
+        if (!frec) {
+            frec = get_filter_handle(chain->elts[i].name,
+                                     chain->input ? registered_input_filters
+                                                  : registered_output_filters);
+            if (!frec) {
+                log_unknown_filter(c, chain->elts[i].name);
+                continue;
+            }
+        }
+        if (frec->ftype >= AP_FTYPE_CONNECTION) {
+            /* must live as long as the connection */
+            add_any_filter_handle(frec, NULL, r, c, r_filters, p_filters,
+                                  c_filters);
+        }
+        else {
+            link_any_filter(&f[i], frec, NULL, r, c, r_filters, p_filters,
+                            c_filters);
+        }
+    }
+}
+
 static void remove_any_filter(ap_filter_t *f, ap_filter_t **r_filt, ap_filter_t **p_filt,
                               ap_filter_t **c_filt)
 {
@@ -616,6 +721,64 @@ AP_DECLARE(apr_status_t) ap_save_brigade(ap_filter_t *f,
     return srv;
 }
 
+/* Brigades given back with ap_release_brigade(), for reuse on c */
+struct ap_filter_conn_ctx {
+    apr_array_header_t *spare;
+    /* how many brigades were asked for, and how many had to be made */
+    apr_uint32_t acquired;
+    apr_uint32_t created;
+};
+
+static apr_status_t filter_conn_ctx_cleanup(void *data)
+{
+    conn_rec *c = data;
+    struct ap_filter_conn_ctx *x = c->filter_conn_ctx;
+
+#if APR_POOL_DEBUG
+    /* only pool debugging builds of APR can tell how large a pool is */
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, c,
+                  "%u brigades acquired over %d requests, %u of them created, "
+                  "connection pool %" APR_SIZE_T_FMT " bytes",
+                  x->acquired, c->keepalives + 1, x->created,
+                  apr_pool_num_bytes(c->pool, 0));
+#else
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, c,
+                  "%u brigades acquired over %d requests, %u of them created",
+                  x->acquired, c->keepalives + 1, x->created);
+#endif
+    c->filter_conn_ctx = NULL;
+    return APR_SUCCESS;
+}
+
+AP_DECLARE(apr_bucket_brigade *) ap_acquire_brigade(conn_rec *c)
+{
+    struct ap_filter_conn_ctx *x = c->filter_conn_ctx;
+
+    if (!x) {
+        x = c->filter_conn_ctx = apr_pcalloc(c->pool, sizeof(*x));
+        x->spare = apr_array_make(c->pool, 4, sizeof(apr_bucket_brigade *));
+        apr_pool_cleanup_register(c->pool, c, filter_conn_ctx_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+
+    x->acquired++;
+    if (x->spare->nelts) {
+        return ((apr_bucket_brigade **)x->spare->elts)[--x->spare->nelts];
+    }
+    x->created++;
+    return apr_brigade_create(c->pool, c->bucket_alloc);
+}
+
+AP_DECLARE(void) ap_release_brigade(conn_rec *c, apr_bucket_brigade *bb)
+{
+    struct ap_filter_conn_ctx *x = c->filter_conn_ctx;
+
+    apr_brigade_cleanup(bb);
+    if (x) {
+        *(apr_bucket_brigade **)apr_array_push(x->spare) = bb;
+    }
+}
+
 AP_DECLARE_NONSTD(apr_status_t) ap_filter_flush(apr_bucket_brigade *bb,
                                                 void *ctx)
 {
@@ -0,0 +1,327 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * util_scan.c: split a buffered block of HTTP header fields in place,
+ * see ap_parse_http_headers(), and tell well known field names.  This file
+ * only depends on APR, so that test/time-header-parse.c can link it.
+ */
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_lib.h"
+#include "apr_tables.h"
+
+#define APR_WANT_STRFUNC
+#include "apr_want.h"
+
+#include "httpd.h"
+#include "http_protocol.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define SCAN_SSE2 1
+#else
+#define SCAN_SSE2 0
+#endif
+
+AP_DECLARE(const char *) ap_scan_http_line(const char *s, const char *end,
+                                           int c)
+{
+#if SCAN_SSE2
+    const __m128i lf = _mm_set1_epi8(APR_ASCII_LF);
+    const __m128i nul = _mm_setzero_si128();
+    const __m128i cc = _mm_set1_epi8((char)c);
+
+    /* 16 bytes at a time: one compare per byte looked for */
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        int mask = _mm_movemask_epi8(
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                                 _mm_cmpeq_epi8(v, nul)),
+                                    _mm_cmpeq_epi8(v, cc)));
+        if (mask) {
+            return s + __builtin_ctz(mask);
+        }
+        s += 16;
+    }
+#endif
+    while (s < end && *s != APR_ASCII_LF && *s != '\0' && *s != c) {
+        s++;
+    }
+    return s;
+}
+
+AP_DECLARE(apr_size_t) ap_http_headers_end(const char *buf, apr_size_t len)
+{
+    const char *s = buf, *end = buf + len;
+
+    /* s is always at the start of a line here */
+    while (s < end) {
+        if (*s == APR_ASCII_LF) {
+            return s + 1 - buf;
+        }
+        if (*s == APR_ASCII_CR && s + 1 < end && s[1] == APR_ASCII_LF) {
+            return s + 2 - buf;
+        }
+        /* skip past the next LF, and any NUL on the way */
+        do {
+            s = ap_scan_http_line(s, end, APR_ASCII_LF);
+        } while (s < end && *s++ != APR_ASCII_LF);
+    }
+    return 0;
+}
+
+static APR_INLINE int is_lws(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+AP_DECLARE(apr_status_t) ap_parse_http_headers(char *buf, apr_size_t len,
+                                               apr_table_t *headers,
+                                               apr_size_t limit_fieldsize,
+                                               int limit_fields)
+{
+    char *s = buf, *end = buf + len;
+    /* the field being parsed is [name, w), with its value from value on */
+    char *name = NULL, *value = NULL, *w = NULL;
+    int fields = 0;
+
+    while (s < end) {
+        char *eol = (char *)ap_scan_http_line(s, end, APR_ASCII_LF);
+        char *line_end = eol;
+
+        /* a line must end with an LF and not contain any NUL */
+        if (eol == end || *eol != APR_ASCII_LF) {
+            return APR_EINVAL;
+        }
+        if (line_end > s && line_end[-1] == APR_ASCII_CR) {
+            line_end--;
+        }
+        if ((apr_size_t)(eol + 1 - s) > limit_fieldsize) {
+            return APR_ENOSPC;
+        }
+
+        if (name && (line_end == s || !is_lws(*s))) {
+            /* the previous field is complete, strip LWS after its value */
+            while (w > value && is_lws(w[-1])) {
+                w--;
+            }
+            *w = '\0';
+            apr_table_addn(headers, name, value);
+            name = NULL;
+        }
+
+        if (line_end == s) {
+            /* the empty line ends the block */
+            return eol + 1 == end ? APR_SUCCESS : APR_EINVAL;
+        }
+
+        if (is_lws(*s)) {
+            /* a continuation line is appended to its field, as is */
+            if (!name) {
+                return APR_EINVAL;
+            }
+            if ((apr_size_t)(w - name + line_end - s) + 1 >= limit_fieldsize) {
+                return APR_ENOSPC;
+            }
+            memmove(w, s, line_end - s);
+            w += line_end - s;
+        }
+        else {
+            char *colon, *t;
+
+            if (limit_fields && ++fields > limit_fields) {
+                return APR_ENOSPC;
+            }
+            colon = (char *)ap_scan_http_line(s, line_end, ':');
+            if (colon == line_end) {
+                return APR_EINVAL;
+            }
+
+            /* strip LWS after the field-name */
+            for (t = colon; t > s && is_lws(t[-1]); t--)
+                ;
+            *t = '\0';
+
+            name = s;
+            value = colon + 1;
+            while (value < line_end && is_lws(*value)) {
+                value++;
+            }
+            w = line_end;
+        }
+
+        s = eol + 1;
+    }
+
+    /* no empty line */
+    return APR_EINVAL;
+}
+
+/* indexed by ap_header_id_e */
+static const struct {
+    const char *name;
+    apr_size_t len;
+} known_headers[AP_HEADER_KNOWN] = {
+    { "Accept", 6 },
+    { "Accept-Encoding", 15 },
+    { "Accept-Language", 15 },
+    { "Authorization", 13 },
+    { "Cache-Control", 13 },
+    { "Connection", 10 },
+    { "Content-Length", 14 },
+    { "Content-Type", 12 },
+    { "Cookie", 6 },
+    { "Expect", 6 },
+    { "Host", 4 },
+    { "If-Match", 8 },
+    { "If-Modified-Since", 17 },
+    { "If-None-Match", 13 },
+    { "If-Range", 8 },
+    { "If-Unmodified-Since", 19 },
+    { "Pragma", 6 },
+    { "Range", 5 },
+    { "Referer", 7 },
+    { "Transfer-Encoding", 17 },
+    { "User-Agent", 10 },
+};
+
+/*
+ * At most one well known field has a given length and character at a
+ * given position, so the candidate is picked by a switch and the name
+ * compared only once.
+ */
+AP_DECLARE(int) ap_header_id(const char *name, apr_size_t len)
+{
+    int id;
+
+    switch (len) {
+    case 4:
+        id = AP_HEADER_HOST;
+        break;
+    case 5:
+        id = AP_HEADER_RANGE;
+        break;
+    case 6:
+        switch (apr_tolower(name[0])) {
+        case 'a':
+            id = AP_HEADER_ACCEPT;
+            break;
+        case 'c':
+            id = AP_HEADER_COOKIE;
+            break;
+        case 'e':
+            id = AP_HEADER_EXPECT;
+            break;
+        case 'p':
+            id = AP_HEADER_PRAGMA;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 7:
+        id = AP_HEADER_REFERER;
+        break;
+    case 8:
+        /* If-Match, If-Range */
+        switch (apr_tolower(name[3])) {
+        case 'm':
+            id = AP_HEADER_IF_MATCH;
+            break;
+        case 'r':
+            id = AP_HEADER_IF_RANGE;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 10:
+        switch (apr_tolower(name[0])) {
+        case 'c':
+            id = AP_HEADER_CONNECTION;
+            break;
+        case 'u':
+            id = AP_HEADER_USER_AGENT;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 12:
+        id = AP_HEADER_CONTENT_TYPE;
+        break;
+    case 13:
+        switch (apr_tolower(name[0])) {
+        case 'a':
+            id = AP_HEADER_AUTHORIZATION;
+            break;
+        case 'c':
+            id = AP_HEADER_CACHE_CONTROL;
+            break;
+        case 'i':
+            id = AP_HEADER_IF_NONE_MATCH;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 14:
+        id = AP_HEADER_CONTENT_LENGTH;
+        break;
+    case 15:
+        /* Accept-Encoding, Accept-Language */
+        switch (apr_tolower(name[7])) {
+        case 'e':
+            id = AP_HEADER_ACCEPT_ENCODING;
+            break;
+        case 'l':
+            id = AP_HEADER_ACCEPT_LANGUAGE;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 17:
+        switch (apr_tolower(name[0])) {
+        case 'i':
+            id = AP_HEADER_IF_MODIFIED_SINCE;
+            break;
+        case 't':
+            id = AP_HEADER_TRANSFER_ENCODING;
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 19:
+        id = AP_HEADER_IF_UNMODIFIED_SINCE;
+        break;
+    default:
+        return -1;
+    }
+
+    if (strncasecmp(known_headers[id].name, name, len)) {
+        return -1;
+    }
+    return id;
+}
+
+AP_DECLARE(const char *) ap_header_name(ap_header_id_e id)
+{
+    return known_headers[id].name;
+}
@@ -973,7 +973,7 @@ static void check_serverpath(request_rec *r)
 AP_DECLARE(void) ap_update_vhost_from_headers(request_rec *r)
 {
     /* must set this for HTTP/1.1 support */
-    if (r->hostname || (r->hostname = apr_table_get(r->headers_in, "Host"))) {
+    if (r->hostname || (r->hostname = ap_get_header_in(r, AP_HEADER_HOST))) {
         fix_hostname(r);
         if (r->status != HTTP_OK)
             return;
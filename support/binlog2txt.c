@@ -0,0 +1,366 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * binlog2txt: turn the binary access logs written with mod_log_binary
+ * back into text, in the Combined log format:
+ *
+ *   %h %l %u %t "%r" %>s %b "%{Referer}i" "%{User-Agent}i"
+ *
+ * with the virtual host in front (-v) and the time taken to serve the
+ * request in microseconds at the end (-D) if asked for.  The values are
+ * escaped as mod_log_config would have.
+ *
+ * Usage: binlog2txt [-v] [-D] [binary_log] > access_log
+ *
+ * The record format is described in modules/loggers/mod_log_binary.h.
+ */
+
+#include "apr.h"
+#include "apr_lib.h"
+#include "apr_getopt.h"
+#include "apr_strings.h"
+#include "apr_file_io.h"
+#include "apr_time.h"
+
+#if APR_HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "../modules/loggers/mod_log_binary.h"
+
+#define READ_BUF_SIZE  128*1024
+#define WRITE_BUF_SIZE 128*1024
+
+/* Larger than any record mod_log_binary writes */
+#define RECORD_MAX     (64 * 1024)
+
+static apr_file_t *errfile;
+static const char *shortname = "binlog2txt";
+
+/*
+ * usage info
+ */
+#define NL APR_EOL_STR
+static void usage(void)
+{
+    apr_file_printf(errfile,
+    "%s -- Convert binary Apache access logs to text."                      NL
+    "Usage: %s [-v] [-D] [LOGFILE]"                                          NL
+                                                                             NL
+    "Reads LOGFILE, or the standard input, and writes the entries in the"   NL
+    "Combined log format to the standard output."                           NL
+                                                                             NL
+    "Options:"                                                               NL
+    "  -v   Start each entry with the virtual host (%%v)."                   NL
+                                                                             NL
+    "  -D   End each entry with the time taken in microseconds (%%D)."       NL,
+    shortname, shortname);
+    exit(1);
+}
+#undef NL
+
+static apr_uint16_t get16(const unsigned char *p)
+{
+    return (apr_uint16_t)((p[0] << 8) | p[1]);
+}
+
+static apr_uint32_t get32(const unsigned char *p)
+{
+    return ((apr_uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static apr_uint64_t get64(const unsigned char *p)
+{
+    return ((apr_uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+/* Write a string as ap_escape_logitem() would, "-" if missing */
+static void put_escaped(apr_file_t *out, const unsigned char *s,
+                        apr_size_t len)
+{
+    static const char c2x_table[] = "0123456789abcdef";
+    const unsigned char *end = s + len;
+
+    if (!s) {
+        apr_file_putc('-', out);
+        return;
+    }
+    for (; s < end; ++s) {
+        if (apr_isprint(*s) && *s != '"' && *s != '\\') {
+            apr_file_putc(*s, out);
+            continue;
+        }
+        apr_file_putc('\\', out);
+        switch (*s) {
+        case '\b':
+            apr_file_putc('b', out);
+            break;
+        case '\n':
+            apr_file_putc('n', out);
+            break;
+        case '\r':
+            apr_file_putc('r', out);
+            break;
+        case '\t':
+            apr_file_putc('t', out);
+            break;
+        case '\v':
+            apr_file_putc('v', out);
+            break;
+        case '\\':
+        case '"':
+            apr_file_putc(*s, out);
+            break;
+        default:
+            apr_file_putc('x', out);
+            apr_file_putc(c2x_table[*s >> 4], out);
+            apr_file_putc(c2x_table[*s & 0xf], out);
+        }
+    }
+}
+
+/* As %t, in the server's time zone; the last second is kept */
+static const char *clf_time(apr_time_t t, apr_int32_t gmtoff)
+{
+    static char timestr[32];
+    static apr_time_t last_sec = -1;
+    static apr_int32_t last_gmtoff;
+    apr_time_exp_t xt;
+    int timz = gmtoff;
+    char sign = '+';
+
+    if (apr_time_sec(t) == last_sec && gmtoff == last_gmtoff) {
+        return timestr;
+    }
+    apr_time_exp_tz(&xt, t, gmtoff);
+    if (timz < 0) {
+        timz = -timz;
+        sign = '-';
+    }
+    apr_snprintf(timestr, sizeof(timestr),
+                 "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                 xt.tm_mday, apr_month_snames[xt.tm_mon],
+                 xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                 sign, timz / (60*60), (timz % (60*60)) / 60);
+    last_sec = apr_time_sec(t);
+    last_gmtoff = gmtoff;
+    return timestr;
+}
+
+/* Write one record as text, 0 if it is malformed */
+static int convert(apr_file_t *out, const unsigned char *rec,
+                   apr_size_t len, int with_vhost, int with_duration)
+{
+    const unsigned char *str[BINLOG_NSTRINGS];
+    apr_size_t strl[BINLOG_NSTRINGS];
+    const unsigned char *p, *end = rec + len;
+    apr_uint64_t request_time, duration, bytes_sent;
+    apr_int32_t gmtoff;
+    int flags, status, nstrings, i;
+
+    if (len < BINLOG_HEADER_SIZE || rec[4] != BINLOG_VERSION) {
+        return 0;
+    }
+    flags = rec[5];
+    status = get16(rec + 6);
+    request_time = get64(rec + 8);
+    duration = get64(rec + 16);
+    bytes_sent = get64(rec + 24);
+    gmtoff = (apr_int32_t)get32(rec + 32);
+    nstrings = get16(rec + 36);
+
+    for (i = 0; i < BINLOG_NSTRINGS; i++) {
+        str[i] = NULL;
+        strl[i] = 0;
+    }
+    p = rec + BINLOG_HEADER_SIZE;
+    for (i = 0; i < nstrings; i++) {
+        apr_size_t n;
+
+        if (end - p < 2) {
+            return 0;
+        }
+        n = get16(p);
+        p += 2;
+        if (n == BINLOG_NO_STRING) {
+            continue;
+        }
+        if ((apr_size_t)(end - p) < n) {
+            return 0;
+        }
+        if (i < BINLOG_NSTRINGS) {
+            str[i] = p;
+            strl[i] = n;
+        }
+        p += n;
+    }
+
+#define PUT(i) put_escaped(out, str[i], strl[i])
+    if (with_vhost) {
+        PUT(BINLOG_S_VHOST);
+        apr_file_putc(' ', out);
+    }
+    PUT(BINLOG_S_REMOTE_HOST);
+    apr_file_putc(' ', out);
+    PUT(BINLOG_S_REMOTE_LOGNAME);
+    apr_file_putc(' ', out);
+    if (str[BINLOG_S_REMOTE_USER] && !strl[BINLOG_S_REMOTE_USER]) {
+        apr_file_puts("\"\"", out);
+    }
+    else {
+        PUT(BINLOG_S_REMOTE_USER);
+    }
+    apr_file_printf(out, " %s \"", clf_time((apr_time_t)request_time, gmtoff));
+    PUT(BINLOG_S_REQUEST_LINE);
+    apr_file_puts("\" ", out);
+    if (status) {
+        apr_file_printf(out, "%d ", status);
+    }
+    else {
+        apr_file_puts("- ", out);
+    }
+    if ((flags & BINLOG_F_BODY) && bytes_sent) {
+        apr_file_printf(out, "%" APR_UINT64_T_FMT " \"", bytes_sent);
+    }
+    else {
+        apr_file_puts("- \"", out);
+    }
+    PUT(BINLOG_S_REFERER);
+    apr_file_puts("\" \"", out);
+    PUT(BINLOG_S_USER_AGENT);
+    apr_file_putc('"', out);
+    if (with_duration) {
+        apr_file_printf(out, " %" APR_UINT64_T_FMT, duration);
+    }
+    apr_file_putc('\n', out);
+#undef PUT
+
+    return 1;
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_file_t *outfile;
+    apr_file_t *infile;
+    apr_getopt_t *o;
+    apr_pool_t *pool;
+    apr_status_t status;
+    const char *arg;
+    char *inbuffer;
+    char *outbuffer;
+    unsigned char *rec;
+    apr_off_t offset = 0;
+    int with_vhost = 0, with_duration = 0;
+
+    if (apr_app_initialize(&argc, &argv, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    atexit(apr_terminate);
+
+    if (argc) {
+        shortname = apr_filepath_name_get(argv[0]);
+    }
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    apr_file_open_stderr(&errfile, pool);
+    apr_getopt_init(&o, pool, argc, argv);
+
+    while (1) {
+        char opt;
+        status = apr_getopt(o, "vD", &opt, &arg);
+        if (status == APR_EOF) {
+            break;
+        }
+        else if (status != APR_SUCCESS) {
+            usage();
+        }
+        else {
+            switch (opt) {
+            case 'v':
+                with_vhost = 1;
+                break;
+            case 'D':
+                with_duration = 1;
+                break;
+            } /* switch */
+        } /* else */
+    } /* while */
+
+    if (o->ind < argc - 1) {
+        usage();
+    }
+    else if (o->ind == argc - 1) {
+        status = apr_file_open(&infile, argv[o->ind],
+                               APR_FOPEN_READ | APR_FOPEN_BINARY,
+                               APR_OS_DEFAULT, pool);
+        if (status != APR_SUCCESS) {
+            apr_file_printf(errfile, "%s: could not open %s: %pm" APR_EOL_STR,
+                            shortname, argv[o->ind], &status);
+            return 1;
+        }
+    }
+    else {
+        apr_file_open_stdin(&infile, pool);
+    }
+    apr_file_open_stdout(&outfile, pool);
+
+    if (   (outbuffer = apr_palloc(pool, WRITE_BUF_SIZE)) == NULL
+        || (inbuffer  = apr_palloc(pool, READ_BUF_SIZE))  == NULL
+        || (rec       = apr_palloc(pool, RECORD_MAX))     == NULL) {
+        return 1;
+    }
+    apr_file_buffer_set(infile, inbuffer, READ_BUF_SIZE);
+    apr_file_buffer_set(outfile, outbuffer, WRITE_BUF_SIZE);
+
+    for (;;) {
+        apr_size_t len = 4;
+
+        status = apr_file_read_full(infile, rec, len, &len);
+        if (status == APR_EOF && len == 0) {
+            break;
+        }
+        if (status == APR_SUCCESS) {
+            len = get32(rec);
+            if (len < BINLOG_HEADER_SIZE || len > RECORD_MAX) {
+                status = APR_EINVAL;
+            }
+            else {
+                status = apr_file_read_full(infile, rec + 4, len - 4, NULL);
+            }
+        }
+        if (status == APR_SUCCESS
+            && !convert(outfile, rec, len, with_vhost, with_duration)) {
+            status = APR_EINVAL;
+        }
+        if (status != APR_SUCCESS) {
+            apr_file_flush(outfile);
+            apr_file_printf(errfile,
+                            "%s: bad or truncated record at offset %"
+                            APR_OFF_T_FMT APR_EOL_STR, shortname, offset);
+            return 1;
+        }
+        offset += len;
+    }
+
+    apr_file_flush(outfile);
+    return 0;
+}
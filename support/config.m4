@@ -2,6 +2,7 @@ htpasswd_LTFLAGS=""
 htdigest_LTFLAGS=""
 rotatelogs_LTFLAGS=""
 logresolve_LTFLAGS=""
+binlog2txt_LTFLAGS=""
 htdbm_LTFLAGS=""
 ab_LTFLAGS=""
 checkgid_LTFLAGS=""
@@ -16,6 +17,7 @@ if test "$enableval" = "yes" ; then
   APR_ADDTO(htdigest_LTFLAGS, [-static])
   APR_ADDTO(rotatelogs_LTFLAGS, [-static])
   APR_ADDTO(logresolve_LTFLAGS, [-static])
+  APR_ADDTO(binlog2txt_LTFLAGS, [-static])
   APR_ADDTO(htdbm_LTFLAGS, [-static])
   APR_ADDTO(ab_LTFLAGS, [-static])
   APR_ADDTO(checkgid_LTFLAGS, [-static])
@@ -62,6 +64,15 @@ fi
 ])
 APACHE_SUBST(logresolve_LTFLAGS)
 
+AC_ARG_ENABLE(static-binlog2txt,APACHE_HELP_STRING(--enable-static-binlog2txt,Build a statically linked version of binlog2txt),[
+if test "$enableval" = "yes" ; then
+  APR_ADDTO(binlog2txt_LTFLAGS, [-static])
+else
+  APR_REMOVEFROM(binlog2txt_LTFLAGS, [-static])
+fi
+])
+APACHE_SUBST(binlog2txt_LTFLAGS)
+
 AC_ARG_ENABLE(static-htdbm,APACHE_HELP_STRING(--enable-static-htdbm,Build a statically linked version of htdbm),[
 if test "$enableval" = "yes" ; then
   APR_ADDTO(htdbm_LTFLAGS, [-static])
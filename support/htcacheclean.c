@@ -30,6 +30,7 @@
 #include "apr_pools.h"
 #include "apr_hash.h"
 #include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
 #include "apr_signal.h"
 #include "apr_getopt.h"
 #include "apr_md5.h"
@@ -68,6 +69,13 @@
 #define KBYTE         1024
 #define MBYTE         1048576
 #define GBYTE         1073741824
+#define MAX_THREADS   64        /* threads walking the cache with -J */
+#define SAMPLE_SIZE   64        /* entries sampled for eviction with -J */
+#define SAMPLE_PROBES 16        /* random walks per sample */
+#define SAMPLE_PER_DIR 8        /* entries sampled per directory */
+#define SAMPLE_DEPTH  32        /* maximum directory depth */
+#define JOURNAL_TRUNCATE 1048576 /* bytes read before truncating the journal */
+#define FULLSCAN_INTERVAL (apr_time_from_sec(86400)) /* walk the cache daily */
 
 #define DIRINFO (APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_TYPE|APR_FINFO_LINK)
 
@@ -260,6 +268,27 @@ static apr_size_t round_up(apr_size_t val, apr_off_t round) {
     return val;
 }
 
+/*
+ * Whether the body of an entity has a .data file of its own: always in the
+ * old format, and in the new one once it was revalidated.  fd is just past
+ * the disk_cache_info_t.
+ */
+static int has_data_file(apr_file_t *fd, apr_uint32_t format,
+                         const disk_cache_info_t *disk_info)
+{
+    disk_cache_index_t disk_index;
+
+    if (!disk_info->has_body) {
+        return 0;
+    }
+    if (format == DISK_FORMAT_VERSION_6) {
+        return 1;
+    }
+    return apr_file_read_full(fd, &disk_index, sizeof(disk_index), NULL)
+               == APR_SUCCESS
+           && (disk_index.flags & CACHE_DISK_BODY_IN_DATA);
+}
+
 /*
  * delete parent directories
  */
@@ -414,6 +443,8 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
     char *url;
     apr_uint32_t format;
     disk_cache_info_t disk_info;
+    disk_cache_index_t disk_index;
+    int data_file;
 
     apr_pool_create(&p, pool);
 
@@ -446,15 +477,27 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                     len = sizeof(format);
                     if (apr_file_read_full(fd, &format, len, &len)
                             == APR_SUCCESS) {
-                        if (format == DISK_FORMAT_VERSION) {
+                        if (format == DISK_FORMAT_VERSION
+                                || format == DISK_FORMAT_VERSION_6) {
                             apr_off_t offset = 0;
 
                             apr_file_seek(fd, APR_SET, &offset);
 
                             len = sizeof(disk_cache_info_t);
+                            memset(&disk_index, 0, sizeof(disk_index));
 
                             if (apr_file_read_full(fd, &disk_info, len, &len)
-                                    == APR_SUCCESS) {
+                                    == APR_SUCCESS
+                                    && (format == DISK_FORMAT_VERSION_6
+                                        || apr_file_read_full(fd, &disk_index,
+                                                sizeof(disk_index), NULL)
+                                            == APR_SUCCESS)) {
+                                /* the body has its own file in the old format,
+                                 * and in the new one once revalidated */
+                                data_file = disk_info.has_body
+                                        && (format == DISK_FORMAT_VERSION_6
+                                            || (disk_index.flags
+                                                & CACHE_DISK_BODY_IN_DATA));
                                 len = disk_info.name_len;
                                 url = apr_palloc(p, len + 1);
                                 url[len] = 0;
@@ -470,7 +513,7 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                                 &hinfo, APR_FINFO_SIZE, fd)) {
                                             /* ignore the file */
                                         }
-                                        else if (disk_info.has_body && APR_SUCCESS
+                                        else if (data_file && APR_SUCCESS
                                                 != apr_stat(
                                                         &dinfo,
                                                         apr_pstrcat(
@@ -489,7 +532,7 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                                         p)) {
                                             /* ignore the file */
                                         }
-                                        else if (disk_info.has_body && (dinfo.device
+                                        else if (data_file && (dinfo.device
                                                 != disk_info.device
                                                 || dinfo.inode
                                                         != disk_info.inode)) {
@@ -508,10 +551,11 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                                     " %" APR_TIME_T_FMT
                                                     " %d %d\n",
                                                     url,
-                                                    round_up((apr_size_t)hinfo.size, round),
+                                                    round_up((apr_size_t)(hinfo.size
+                                                            - (data_file ? 0 : disk_index.body_len)), round),
                                                     round_up(
-                                                            disk_info.has_body ? (apr_size_t)dinfo.size
-                                                                    : 0, round),
+                                                            format == DISK_FORMAT_VERSION_6 ? (apr_size_t)dinfo.size
+                                                                    : (apr_size_t)disk_index.body_len, round),
                                                     disk_info.status,
                                                     disk_info.entity_version,
                                                     disk_info.date,
@@ -526,7 +570,7 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                         apr_finfo_t dinfo;
 
                                         /* stat the data file */
-                                        if (disk_info.has_body && APR_SUCCESS
+                                        if (data_file && APR_SUCCESS
                                                 != apr_stat(
                                                         &dinfo,
                                                         apr_pstrcat(
@@ -545,7 +589,7 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                                         p)) {
                                             /* ignore the file */
                                         }
-                                        else if (disk_info.has_body && (dinfo.device
+                                        else if (data_file && (dinfo.device
                                                 != disk_info.device
                                                 || dinfo.inode
                                                         != disk_info.inode)) {
@@ -763,7 +807,8 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                 len = sizeof(format);
                 if (apr_file_read_full(fd, &format, len,
                                        &len) == APR_SUCCESS) {
-                    if (format == DISK_FORMAT_VERSION) {
+                    if (format == DISK_FORMAT_VERSION
+                        || format == DISK_FORMAT_VERSION_6) {
                         apr_off_t offset = 0;
 
                         apr_file_seek(fd, APR_SET, &offset);
@@ -772,6 +817,8 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
 
                         if (apr_file_read_full(fd, &disk_info, len,
                                                &len) == APR_SUCCESS) {
+                            int data = has_data_file(fd, format, &disk_info);
+
                             apr_file_close(fd);
                             e = apr_palloc(pool, sizeof(ENTRY));
                             APR_RING_INSERT_TAIL(&root, e, _entry, link);
@@ -782,7 +829,15 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             e->hsize = d->hsize;
                             e->dsize = d->dsize;
                             e->basename = apr_pstrdup(pool, d->basename);
-                            if (!disk_info.has_body) {
+                            /* the header file holds the body in the new
+                             * format unless it was revalidated, the data
+                             * file is left over from an entry in the old one
+                             */
+                            if (format == DISK_FORMAT_VERSION && !data) {
+                                e->dtime = d->htime;
+                                e->dsize = 0;
+                            }
+                            if (!data) {
                                 delete_file(path, apr_pstrcat(p, path, "/",
                                         d->basename, CACHE_DATA_SUFFIX, NULL),
                                         nodes, p);
@@ -879,7 +934,8 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             break;
                         }
                     }
-                    else if (format == DISK_FORMAT_VERSION) {
+                    else if (format == DISK_FORMAT_VERSION
+                             || format == DISK_FORMAT_VERSION_6) {
                         apr_off_t offset = 0;
 
                         apr_file_seek(fd, APR_SET, &offset);
@@ -898,6 +954,10 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             e->hsize = d->hsize;
                             e->dsize = d->dsize;
                             e->basename = apr_pstrdup(pool, d->basename);
+                            /* the body is in the header file */
+                            if (format == DISK_FORMAT_VERSION) {
+                                e->dtime = d->htime;
+                            }
                             break;
                         }
                         else {
@@ -1076,6 +1136,744 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
     }
 }
 
+/*
+ * Incremental mode (-J): the size of the cache is kept in a state file
+ * next to the journal written by mod_cache_disk (CacheJournal), and
+ * updated from the records appended since the previous run, so that the
+ * cache is only walked when the state is missing or too old.  Entries are
+ * evicted from a bounded sample of the cache, taken by random walks down
+ * the directory tree, instead of from the list of all of them.
+ */
+typedef struct _jstate {
+    apr_uint32_t format;  /* CACHE_JOURNAL_VERSION */
+    apr_off_t round;      /* amount the sizes are rounded up to */
+    apr_off_t offset;     /* journal records read so far */
+    apr_time_t scanned;   /* time of the last full scan */
+    apr_off_t sum;        /* size of the cache */
+    apr_off_t nodes;      /* inodes in use */
+    apr_off_t entries;    /* header files */
+} JSTATE;
+
+typedef struct _sample {
+    apr_time_t expire;        /* cache entry exiration time */
+    apr_time_t response_time; /* cache entry time of last response to client */
+    apr_time_t htime;         /* headers file modification time */
+    apr_time_t dtime;         /* body modification time */
+    apr_off_t hsize;          /* headers file size */
+    apr_off_t dsize;          /* body file size, 0 if in the headers file */
+    char basename[256];       /* fileset base name */
+} SAMPLE;
+
+typedef struct _scan {
+    apr_off_t round;             /* amount to round sizes up to */
+    apr_array_header_t *dirs;    /* top level directories to walk */
+    int next;                    /* next directory to walk */
+    apr_off_t sum;               /* totals of the directories walked */
+    apr_off_t nodes;
+    apr_off_t entries;
+    int failed;                  /* a directory could not be walked */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;   /* protects the above */
+#endif
+} SCAN;
+
+/*
+ * add up the sizes of the files below a directory
+ */
+static int scan_dir(const char *path, apr_off_t round, apr_off_t *sum,
+        apr_off_t *nodes, apr_off_t *entries, apr_pool_t *pool)
+{
+    apr_dir_t *dir;
+    apr_finfo_t info;
+    apr_status_t status;
+    apr_pool_t *p;
+    const char *ext, *nextpath;
+    int rv = 0;
+
+    apr_pool_create(&p, pool);
+
+    if (apr_dir_open(&dir, path, p) != APR_SUCCESS) {
+        apr_pool_destroy(p);
+        return 1;
+    }
+
+    while (!interrupted) {
+        status = apr_dir_read(&info, APR_FINFO_TYPE | APR_FINFO_SIZE, dir);
+        if (status != APR_SUCCESS && status != APR_INCOMPLETE) {
+            break;
+        }
+        if (!strcmp(info.name, ".") || !strcmp(info.name, "..")) {
+            continue;
+        }
+        (*nodes)++;
+
+        nextpath = apr_pstrcat(p, path, "/", info.name, NULL);
+        if (!(info.valid & APR_FINFO_TYPE) || !(info.valid & APR_FINFO_SIZE)) {
+            /* the file may be gone already, that's fine */
+            if (apr_stat(&info, nextpath, APR_FINFO_TYPE | APR_FINFO_SIZE
+                         | APR_FINFO_LINK, p) != APR_SUCCESS) {
+                continue;
+            }
+        }
+
+        if (info.filetype == APR_DIR) {
+            if (scan_dir(nextpath, round, sum, nodes, entries, p)) {
+                rv = 1;
+                break;
+            }
+        }
+        else if (info.filetype == APR_REG) {
+            *sum += round_up((apr_size_t)info.size, round);
+            ext = strchr(info.name, '.');
+            if (ext && !strcasecmp(ext, CACHE_HEADER_SUFFIX)) {
+                (*entries)++;
+            }
+        }
+    }
+
+    apr_dir_close(dir);
+    apr_pool_destroy(p);
+
+    if (benice) {
+        apr_sleep(NICE_DELAY);
+    }
+
+    return rv || interrupted;
+}
+
+/*
+ * walk the top level directories handed out by the scan, in a thread of
+ * its own or not
+ */
+static void scan_dirs(SCAN *scan, apr_pool_t *pool)
+{
+    apr_off_t sum, nodes, entries;
+    const char *dir;
+    int failed;
+
+    while (!interrupted) {
+#if APR_HAS_THREADS
+        if (scan->mutex) {
+            apr_thread_mutex_lock(scan->mutex);
+        }
+#endif
+        dir = NULL;
+        if (scan->next < scan->dirs->nelts && !scan->failed) {
+            dir = APR_ARRAY_IDX(scan->dirs, scan->next++, const char *);
+        }
+#if APR_HAS_THREADS
+        if (scan->mutex) {
+            apr_thread_mutex_unlock(scan->mutex);
+        }
+#endif
+        if (!dir) {
+            break;
+        }
+
+        sum = nodes = entries = 0;
+        failed = scan_dir(dir, scan->round, &sum, &nodes, &entries, pool);
+
+#if APR_HAS_THREADS
+        if (scan->mutex) {
+            apr_thread_mutex_lock(scan->mutex);
+        }
+#endif
+        scan->sum += sum;
+        scan->nodes += nodes;
+        scan->entries += entries;
+        scan->failed |= failed;
+#if APR_HAS_THREADS
+        if (scan->mutex) {
+            apr_thread_mutex_unlock(scan->mutex);
+        }
+#endif
+    }
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC scan_thread(apr_thread_t *thd, void *data)
+{
+    apr_pool_t *p = apr_thread_pool_get(thd);
+
+    scan_dirs(data, p);
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+#endif
+
+/*
+ * add up the size of the whole cache, with the top level directories
+ * walked by the given number of threads
+ */
+static int scan_sizes(char *path, apr_pool_t *pool, int threads,
+        apr_off_t round, JSTATE *state)
+{
+    apr_dir_t *dir;
+    apr_finfo_t info;
+    apr_status_t status;
+    SCAN scan;
+    const char *ext, *nextpath;
+
+    memset(&scan, 0, sizeof(scan));
+    scan.round = round;
+    scan.dirs = apr_array_make(pool, 64, sizeof(const char *));
+
+    if (apr_dir_open(&dir, path, pool) != APR_SUCCESS) {
+        return 1;
+    }
+
+    while (!interrupted) {
+        status = apr_dir_read(&info, APR_FINFO_TYPE | APR_FINFO_SIZE, dir);
+        if (status != APR_SUCCESS && status != APR_INCOMPLETE) {
+            break;
+        }
+        if (!strcmp(info.name, ".") || !strcmp(info.name, "..")) {
+            continue;
+        }
+        scan.nodes++;
+
+        nextpath = apr_pstrcat(pool, path, "/", info.name, NULL);
+        if (!(info.valid & APR_FINFO_TYPE) || !(info.valid & APR_FINFO_SIZE)) {
+            if (apr_stat(&info, nextpath, APR_FINFO_TYPE | APR_FINFO_SIZE
+                         | APR_FINFO_LINK, pool) != APR_SUCCESS) {
+                continue;
+            }
+        }
+
+        if (info.filetype == APR_DIR) {
+            APR_ARRAY_PUSH(scan.dirs, const char *) = nextpath;
+        }
+        else if (info.filetype == APR_REG) {
+            scan.sum += round_up((apr_size_t)info.size, round);
+            ext = strchr(info.name, '.');
+            if (ext && !strcasecmp(ext, CACHE_HEADER_SUFFIX)) {
+                scan.entries++;
+            }
+        }
+    }
+
+    apr_dir_close(dir);
+
+    if (threads > scan.dirs->nelts) {
+        threads = scan.dirs->nelts;
+    }
+
+#if APR_HAS_THREADS
+    if (threads > 1 && !interrupted) {
+        apr_thread_t **thds;
+        apr_threadattr_t *attr;
+        apr_allocator_t *allocator;
+        apr_pool_t *p;
+        int i, started = 0;
+
+        apr_thread_mutex_create(&scan.mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+        apr_threadattr_create(&attr, pool);
+        thds = apr_pcalloc(pool, threads * sizeof(apr_thread_t *));
+
+        for (i = 0; i < threads; i++) {
+            /* each thread allocates from an allocator of its own */
+            apr_allocator_create(&allocator);
+            apr_pool_create_ex(&p, pool, NULL, allocator);
+            apr_allocator_owner_set(allocator, p);
+
+            if (apr_thread_create(&thds[i], attr, scan_thread, &scan, p)
+                    != APR_SUCCESS) {
+                break;
+            }
+            started++;
+        }
+
+        /* no thread at all, walk from here */
+        if (!started) {
+            scan_dirs(&scan, pool);
+        }
+
+        for (i = 0; i < started; i++) {
+            apr_thread_join(&status, thds[i]);
+        }
+    }
+    else
+#endif
+    {
+        scan_dirs(&scan, pool);
+    }
+
+    if (scan.failed || interrupted) {
+        return 1;
+    }
+
+    state->sum = scan.sum;
+    state->nodes = scan.nodes;
+    state->entries = scan.entries;
+    state->scanned = apr_time_now();
+
+    return 0;
+}
+
+/*
+ * read the state left by the previous run, if any
+ */
+static int read_state(const char *name, JSTATE *state, apr_pool_t *pool)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+
+    if (apr_file_open(&fd, name, APR_FOPEN_READ | APR_FOPEN_BINARY,
+                      APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+        return 1;
+    }
+    status = apr_file_read_full(fd, state, sizeof(*state), NULL);
+    apr_file_close(fd);
+
+    return status != APR_SUCCESS || state->format != CACHE_JOURNAL_VERSION;
+}
+
+/*
+ * save the state for the next run, replacing the previous one at once
+ */
+static int write_state(const char *name, JSTATE *state, apr_pool_t *pool)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+    const char *tmp = apr_pstrcat(pool, name, ".tmp", NULL);
+    char errmsg[120];
+
+    status = apr_file_open(&fd, tmp, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+                           | APR_FOPEN_TRUNCATE | APR_FOPEN_BINARY,
+                           APR_OS_DEFAULT, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(fd, state, sizeof(*state), NULL);
+        if (status == APR_SUCCESS) {
+            status = apr_file_close(fd);
+        }
+        else {
+            apr_file_close(fd);
+        }
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(tmp, name, pool);
+    }
+    if (status != APR_SUCCESS) {
+        if (errfile) {
+            apr_file_printf(errfile, "Could not write the state file %s: %s"
+                            APR_EOL_STR, name,
+                            apr_strerror(status, errmsg, sizeof errmsg));
+        }
+        apr_file_remove(tmp, pool);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * apply the journal records appended since the previous run
+ */
+static int read_journal(apr_file_t *fd, JSTATE *state, apr_off_t round)
+{
+    disk_cache_journal_t rec;
+    apr_finfo_t finfo;
+    apr_off_t offset, size;
+    apr_size_t len;
+    int i, files;
+
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) != APR_SUCCESS) {
+        return 1;
+    }
+    size = finfo.size;
+
+    /* truncated behind our back, the totals are lost */
+    if (size < state->offset) {
+        return 1;
+    }
+
+    offset = state->offset;
+    if (apr_file_seek(fd, APR_SET, &offset) != APR_SUCCESS) {
+        return 1;
+    }
+
+    /* a record being written is left for the next run */
+    while (!interrupted && state->offset + (apr_off_t)sizeof(rec) <= size) {
+        len = sizeof(rec);
+        if (apr_file_read_full(fd, &rec, len, &len) != APR_SUCCESS) {
+            break;
+        }
+        if (rec.format != CACHE_JOURNAL_VERSION) {
+            return 1;
+        }
+
+        files = 0;
+        for (i = 0; i < CACHE_JOURNAL_FILES; i++) {
+            if (rec.added[i] >= 0) {
+                state->sum += round_up((apr_size_t)rec.added[i], round);
+                files++;
+            }
+            if (rec.removed[i] >= 0) {
+                state->sum -= round_up((apr_size_t)rec.removed[i], round);
+                files--;
+            }
+        }
+        state->nodes += files;
+
+        /* the headers of an entity and of the variants of a URL */
+        if (rec.type == CACHE_JOURNAL_STORE) {
+            if (rec.added[0] >= 0 && rec.removed[0] < 0) {
+                state->entries++;
+            }
+            if (rec.added[2] >= 0 && rec.removed[2] < 0) {
+                state->entries++;
+            }
+        }
+        else if (rec.type == CACHE_JOURNAL_REMOVE) {
+            if (rec.removed[0] >= 0) {
+                state->entries--;
+            }
+        }
+
+        state->offset += sizeof(rec);
+    }
+
+    return 0;
+}
+
+/*
+ * add an entity of the given directory to the sample, unless it is
+ * already there
+ */
+static void sample_entry(const char *path, const char *dir, const char *name,
+        SAMPLE *sample, int *nsample, apr_pool_t *p)
+{
+    apr_file_t *fd;
+    apr_finfo_t hinfo, dinfo;
+    apr_uint32_t format;
+    apr_size_t len;
+    apr_off_t offset = 0;
+    disk_cache_info_t disk_info;
+    SAMPLE *s;
+    const char *ext = strchr(name, '.');
+    char *basename;
+    int i, data;
+
+    basename = apr_pstrndup(p, name, ext - name);
+    if (dir[baselen]) {
+        basename = apr_pstrcat(p, dir + baselen + 1, "/", basename, NULL);
+    }
+    if (strlen(basename) >= sizeof(s->basename)) {
+        return;
+    }
+    for (i = 0; i < *nsample; i++) {
+        if (!strcmp(sample[i].basename, basename)) {
+            return;
+        }
+    }
+
+    if (apr_file_open(&fd, apr_pstrcat(p, dir, "/", name, NULL),
+                      APR_FOPEN_READ | APR_FOPEN_BINARY, APR_OS_DEFAULT, p)
+            != APR_SUCCESS) {
+        return;
+    }
+
+    /* only entities, the headers listing the Vary of a URL go with it */
+    len = sizeof(format);
+    if (apr_file_read_full(fd, &format, len, &len) != APR_SUCCESS
+        || (format != DISK_FORMAT_VERSION && format != DISK_FORMAT_VERSION_6)
+        || apr_file_seek(fd, APR_SET, &offset) != APR_SUCCESS
+        || apr_file_read_full(fd, &disk_info, sizeof(disk_info), NULL)
+            != APR_SUCCESS
+        || apr_file_info_get(&hinfo, APR_FINFO_MTIME | APR_FINFO_SIZE, fd)
+            != APR_SUCCESS) {
+        apr_file_close(fd);
+        return;
+    }
+    data = has_data_file(fd, format, &disk_info);
+    apr_file_close(fd);
+
+    s = &sample[*nsample];
+    s->expire = disk_info.expire;
+    s->response_time = disk_info.response_time;
+    s->htime = hinfo.mtime;
+    s->hsize = hinfo.size;
+    s->dtime = hinfo.mtime;
+    s->dsize = 0;
+    if (data) {
+        if (apr_stat(&dinfo, apr_pstrcat(p, path, "/", basename,
+                                         CACHE_DATA_SUFFIX, NULL),
+                     APR_FINFO_MTIME | APR_FINFO_SIZE, p) != APR_SUCCESS) {
+            return;
+        }
+        s->dtime = dinfo.mtime;
+        s->dsize = dinfo.size;
+    }
+    apr_cpystrn(s->basename, basename, sizeof(s->basename));
+    (*nsample)++;
+}
+
+/*
+ * a random number, xorshift
+ */
+static apr_uint32_t sample_random(apr_uint32_t *seed)
+{
+    apr_uint32_t x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+/*
+ * walk down from the root to a random directory holding header files, and
+ * add some of them to the sample
+ */
+static void sample_probe(char *path, SAMPLE *sample, int *nsample,
+        apr_uint32_t *seed, apr_pool_t *pool)
+{
+    apr_dir_t *dir;
+    apr_finfo_t info;
+    apr_status_t status;
+    apr_pool_t *p;
+    apr_array_header_t *names;
+    const char *cur = path, *name, *ext;
+    int depth, i, start, found;
+
+    apr_pool_create(&p, pool);
+    names = apr_array_make(p, 64, sizeof(const char *));
+
+    for (depth = 0; depth < SAMPLE_DEPTH && !interrupted; depth++) {
+        apr_array_clear(names);
+
+        if (apr_dir_open(&dir, cur, p) != APR_SUCCESS) {
+            break;
+        }
+        while (1) {
+            status = apr_dir_read(&info, APR_FINFO_NAME, dir);
+            if (status != APR_SUCCESS && status != APR_INCOMPLETE) {
+                break;
+            }
+            if (!strcmp(info.name, ".") || !strcmp(info.name, "..")) {
+                continue;
+            }
+            ext = strchr(info.name, '.');
+            /* the directories and the header files, not the others */
+            if (!ext || !strcasecmp(ext, CACHE_HEADER_SUFFIX)
+                || !strcasecmp(ext, CACHE_HEADER_SUFFIX CACHE_VDIR_SUFFIX)) {
+                if (!ext && !strncasecmp(info.name, AP_TEMPFILE_BASE,
+                                         AP_TEMPFILE_BASELEN)) {
+                    continue;
+                }
+                APR_ARRAY_PUSH(names, const char *) = apr_pstrdup(p,
+                                                                  info.name);
+            }
+        }
+        apr_dir_close(dir);
+
+        if (!names->nelts) {
+            break;
+        }
+
+        /* pick one, a directory to go down to or the headers to sample */
+        start = sample_random(seed) % names->nelts;
+        name = APR_ARRAY_IDX(names, start, const char *);
+        ext = strchr(name, '.');
+        if (!ext || strcasecmp(ext, CACHE_HEADER_SUFFIX)) {
+            cur = apr_pstrcat(p, cur, "/", name, NULL);
+            continue;
+        }
+
+        for (i = 0, found = 0; i < names->nelts && found < SAMPLE_PER_DIR
+                               && *nsample < SAMPLE_SIZE; i++) {
+            name = APR_ARRAY_IDX(names, (start + i) % names->nelts,
+                                 const char *);
+            ext = strchr(name, '.');
+            if (ext && !strcasecmp(ext, CACHE_HEADER_SUFFIX)) {
+                sample_entry(path, cur, name, sample, nsample, p);
+                found++;
+            }
+        }
+        break;
+    }
+
+    apr_pool_destroy(p);
+}
+
+/*
+ * the entries from the future first, then the expired ones, then the
+ * oldest ones
+ */
+static int sample_class(const SAMPLE *s)
+{
+    if (s->response_time > now || s->htime > now || s->dtime > now) {
+        return 0;
+    }
+    if (s->expire != APR_DATE_BAD && s->expire < now) {
+        return 1;
+    }
+    return 2;
+}
+
+static int sample_cmp(const void *a, const void *b)
+{
+    const SAMPLE *sa = a, *sb = b;
+    int ca = sample_class(sa), cb = sample_class(sb);
+
+    if (ca != cb) {
+        return ca - cb;
+    }
+    return sa->dtime < sb->dtime ? -1 : sa->dtime > sb->dtime;
+}
+
+/*
+ * evict entries from samples of the cache until it fits the limits
+ */
+static void purge_sampled(char *path, apr_pool_t *pool, apr_off_t max,
+        apr_off_t inodes, apr_off_t round, JSTATE *state)
+{
+    SAMPLE sample[SAMPLE_SIZE];
+    SAMPLE *s;
+    struct stats st;
+    apr_uint32_t seed;
+    int nsample = 0, evict, probes, i;
+
+    memset(&st, 0, sizeof(st));
+    st.sum = st.total = state->sum;
+    st.nodes = st.ntotal = state->nodes;
+    st.entries = st.etotal = state->entries;
+    st.max = max;
+    st.inodes = inodes;
+
+    seed = (apr_uint32_t)(now ^ (now >> 32)) | 1;
+
+    while (!((!st.max || st.sum <= st.max)
+             && (!st.inodes || st.nodes <= st.inodes)) && !interrupted) {
+
+        /* top up the sample */
+        for (probes = 0; probes < SAMPLE_PROBES && nsample < SAMPLE_SIZE
+                         && !interrupted; probes++) {
+            sample_probe(path, sample, &nsample, &seed, pool);
+        }
+
+        /* nothing to evict, the totals must be wrong */
+        if (!nsample) {
+            state->scanned = 0;
+            break;
+        }
+
+        qsort(sample, nsample, sizeof(SAMPLE), sample_cmp);
+
+        /* evict the first quarter, keep the rest for the next round */
+        evict = nsample / 4;
+        if (!evict) {
+            evict = 1;
+        }
+        for (i = 0; i < evict && !interrupted
+                    && !((!st.max || st.sum <= st.max)
+                         && (!st.inodes || st.nodes <= st.inodes)); i++) {
+            s = &sample[i];
+            delete_entry(path, s->basename, &st.nodes, pool);
+            st.sum -= round_up((apr_size_t)s->hsize, round);
+            st.sum -= round_up((apr_size_t)s->dsize, round);
+            st.entries--;
+            switch (sample_class(s)) {
+            case 0:
+                st.dfuture++;
+                break;
+            case 1:
+                st.dexpired++;
+                break;
+            default:
+                st.dfresh++;
+                break;
+            }
+        }
+        memmove(sample, sample + i, (nsample - i) * sizeof(SAMPLE));
+        nsample -= i;
+    }
+
+    state->sum = st.sum;
+    state->nodes = st.nodes;
+    state->entries = st.entries;
+
+    if (!interrupted) {
+        printstats(path, &st);
+    }
+}
+
+/*
+ * one run in incremental mode
+ */
+static int process_journal(char *path, apr_pool_t *pool, const char *journal,
+        int threads, apr_off_t max, apr_off_t inodes, apr_off_t round)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+    apr_finfo_t finfo;
+    JSTATE state;
+    const char *statefile = apr_pstrcat(pool, journal, ".state", NULL);
+    char errmsg[120];
+    int scan, readonly = 0;
+
+    status = apr_file_open(&fd, journal, APR_FOPEN_READ | APR_FOPEN_WRITE
+                           | APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    /* not ours to truncate, read it all the same */
+    if (APR_STATUS_IS_EACCES(status)) {
+        readonly = 1;
+        status = apr_file_open(&fd, journal, APR_FOPEN_READ
+                               | APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    }
+    if (status != APR_SUCCESS) {
+        if (errfile) {
+            apr_file_printf(errfile, "Could not open the journal %s: %s"
+                            APR_EOL_STR, journal,
+                            apr_strerror(status, errmsg, sizeof errmsg));
+        }
+        return 1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    scan = read_state(statefile, &state, pool)
+           || state.round != round
+           || now - state.scanned > FULLSCAN_INTERVAL
+           || read_journal(fd, &state, round);
+
+    if (scan && !interrupted) {
+        /* the records appended from now on are applied next time */
+        if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) != APR_SUCCESS) {
+            apr_file_close(fd);
+            return 1;
+        }
+        memset(&state, 0, sizeof(state));
+        state.format = CACHE_JOURNAL_VERSION;
+        state.round = round;
+        state.offset = finfo.size;
+        if (scan_sizes(path, pool, threads, round, &state)) {
+            apr_file_close(fd);
+            return 1;
+        }
+    }
+
+    if (interrupted) {
+        apr_file_close(fd);
+        return 1;
+    }
+
+    purge_sampled(path, pool, max, inodes, round, &state);
+
+    /* start the journal over once read, unless it grew meanwhile */
+    if (!dryrun && !readonly && state.offset >= JOURNAL_TRUNCATE
+        && apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) == APR_SUCCESS
+        && finfo.size == state.offset
+        && apr_file_trunc(fd, 0) == APR_SUCCESS) {
+        state.offset = 0;
+    }
+    apr_file_close(fd);
+
+    if (interrupted || dryrun) {
+        return interrupted;
+    }
+
+    return write_state(statefile, &state, pool);
+}
+
 static apr_status_t remove_directory(apr_pool_t *pool, const char *dir)
 {
     apr_status_t rv;
@@ -1282,6 +2080,8 @@ static void usage(const char *error)
     "%s -- program for cleaning the disk cache."                             NL
     "Usage: %s [-Dvtrn] -pPATH [-lLIMIT|-LLIMIT] [-PPIDFILE]"                NL
     "       %s [-nti] -dINTERVAL -pPATH [-lLIMIT|-LLIMIT] [-PPIDFILE]"       NL
+    "       %s [-nt] [-Dv|-dINTERVAL] -JJOURNAL [-TTHREADS] -pPATH"          NL
+    "          [-lLIMIT|-LLIMIT] [-PPIDFILE]"                                NL
     "       %s [-Dvt] -pPATH URL ..."                                        NL
                                                                              NL
     "Options:"                                                               NL
@@ -1324,6 +2124,15 @@ static void usage(const char *error)
     "       the disk cache. This option is only possible together with the"  NL
     "       -d option."                                                      NL
                                                                              NL
+    "  -J   Run incrementally, keeping track of the size of the cache with"  NL
+    "       the JOURNAL written by mod_cache_disk (CacheJournal), and"       NL
+    "       evicting entries sampled from the cache. The cache is walked"    NL
+    "       in full the first time, and then once a day. This option is"     NL
+    "       mutually exclusive with the -r and -i options."                  NL
+                                                                             NL
+    "  -T   Specify THREADS as the number of threads walking the cache in"   NL
+    "       full with -J, 1 by default."                                     NL
+                                                                             NL
     "  -a   List the URLs currently stored in the cache. Variants of the"    NL
     "       same URL will be listed once for each variant."                  NL
                                                                              NL
@@ -1341,6 +2150,7 @@ static void usage(const char *error)
     shortname,
     shortname,
     shortname,
+    shortname,
     shortname
     );
 
@@ -1392,7 +2202,8 @@ int main(int argc, const char * const argv[])
     int retries, isdaemon, limit_found, inodes_found, intelligent, dowork;
     char opt;
     const char *arg;
-    char *proxypath, *path, *pidfilename;
+    char *proxypath, *path, *pidfilename, *journal, *cwd;
+    int threads;
     char errmsg[1024];
 
     interrupted = 0;
@@ -1412,6 +2223,8 @@ int main(int argc, const char * const argv[])
     previous = 0; /* avoid compiler warning */
     proxypath = NULL;
     pidfilename = NULL;
+    journal = NULL;
+    threads = 0;
 
     if (apr_app_initialize(&argc, &argv, NULL) != APR_SUCCESS) {
         return 1;
@@ -1431,10 +2244,14 @@ int main(int argc, const char * const argv[])
     apr_signal(SIGINT, setterm);
     apr_signal(SIGTERM, setterm);
 
+    if (apr_filepath_get(&cwd, 0, pool) != APR_SUCCESS) {
+        cwd = NULL;
+    }
+
     apr_getopt_init(&o, pool, argc, argv);
 
     while (1) {
-        status = apr_getopt(o, "iDnvrtd:l:L:p:P:R:aA", &opt, &arg);
+        status = apr_getopt(o, "iDnvrtd:l:L:p:P:R:J:T:aA", &opt, &arg);
         if (status == APR_EOF) {
             break;
         }
@@ -1591,6 +2408,30 @@ int main(int argc, const char * const argv[])
                 pidfilename = apr_pstrdup(pool, arg);
                 break;
 
+            case 'J':
+                if (journal) {
+                    usage_repeated_arg(pool, opt);
+                }
+                /* relative to where we were started from, not to -p */
+                if (apr_filepath_merge(&journal, cwd, arg,
+                                       APR_FILEPATH_NOTRELATIVE, pool)
+                        != APR_SUCCESS) {
+                    usage(apr_psprintf(pool, "Invalid journal path: %s",
+                                       arg));
+                }
+                break;
+
+            case 'T':
+                if (threads) {
+                    usage_repeated_arg(pool, opt);
+                }
+                threads = atoi(arg);
+                if (threads < 1 || threads > MAX_THREADS) {
+                    usage(apr_psprintf(pool, "Invalid number of threads: %s"
+                                             APR_EOL_STR APR_EOL_STR, arg));
+                }
+                break;
+
             case 'R':
                 if (round) {
                     usage_repeated_arg(pool, opt);
@@ -1671,6 +2512,14 @@ int main(int argc, const char * const argv[])
          usage("Option -i cannot be used without -d");
     }
 
+    if (journal && (realclean || intelligent || listurls)) {
+         usage("Option -J cannot be used with -r, -i, -a or -A");
+    }
+
+    if (threads && !journal) {
+         usage("Option -T cannot be used without -J");
+    }
+
     if (!proxypath) {
          usage("Option -p must be specified");
     }
@@ -1765,7 +2614,16 @@ int main(int argc, const char * const argv[])
             break;
         }
 
-        if (dowork && !interrupted) {
+        if (journal && !interrupted) {
+            if (process_journal(path, instance, journal, threads ? threads : 1,
+                                max, inodes, round)
+                && !isdaemon && !interrupted) {
+                apr_file_printf(errfile, "An error occurred, cache cleaning "
+                                         "aborted." APR_EOL_STR);
+                return 1;
+            }
+        }
+        else if (dowork && !interrupted) {
             apr_off_t nodes = 0;
             if (!process_dir(path, instance, &nodes) && !interrupted) {
                 purge(path, instance, max, inodes, nodes, round);
@@ -0,0 +1,547 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-cache-disk.c measures how fast mod_cache_disk recalls the headers
+ * of a cached entity, from the open of its header file to the response
+ * and request header tables:
+ *
+ *   - in format 6, as open_entity() and recall_headers() used to: the
+ *     info and the name read, then the headers read line by line with
+ *     apr_file_gets() and split on ':', and the .data file opened and
+ *     stat()ed to match its inode
+ *   - in format 7 (DISK_FORMAT_VERSION): the info and the index read,
+ *     then the name and the header block read at once and split in place,
+ *     the body being in the same file
+ *
+ * The two entity files are written in the directory given, with the same
+ * headers and a 16KB body, and read back in a loop, so they come from the
+ * page cache.
+ *
+ * It then measures what revalidating an entity in format 7 costs, for
+ * bodies of 16KB to 16MB, from the new header file written to its rename
+ * into place:
+ *
+ *   - copy: the body copied from the old header file to the new one, as
+ *     commit_entity() does where hard links are not supported
+ *   - link: the .data file made a hard link to the old header file, which
+ *     keeps the body (CACHE_DISK_BODY_IN_DATA)
+ *
+ * usage: time-cache-disk [iterations [directory]]
+ *        default: 100000 iterations in /tmp, a hundredth of them for the
+ *        revalidations
+ *
+ * After running configure, compile with something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix -I../modules/cache \
+ *       `apr-1-config --includes --cppflags` -o time-cache-disk \
+ *       time-cache-disk.c `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_file_io.h"
+#include "apr_lib.h"
+#include "apr_pools.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#include "httpd.h"
+#include "cache_common.h"
+#include "cache_disk_common.h"
+
+#define BODY_SIZE 16384
+
+static const char *name = "http://www.example.com:80/images/logo.png?";
+
+static const char *resp_hdrs[][2] = {
+    { "Date", "Mon, 11 Jun 2012 16:30:45 GMT" },
+    { "Server", "Apache/2.5.0-dev (Unix)" },
+    { "Last-Modified", "Thu, 07 Jun 2012 09:12:33 GMT" },
+    { "ETag", "\"2a3f-4c1dfc1e6e240\"" },
+    { "Accept-Ranges", "bytes" },
+    { "Cache-Control", "max-age=86400, public" },
+    { "Expires", "Tue, 12 Jun 2012 16:30:45 GMT" },
+    { "Vary", "Accept-Encoding" },
+    { "Content-Type", "image/png" },
+};
+
+static const char *req_hdrs[][2] = {
+    { "Host", "www.example.com" },
+    { "User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:12.0) "
+                    "Gecko/20100101 Firefox/12.0" },
+    { "Accept", "image/png,image/*;q=0.8,*/*;q=0.5" },
+    { "Accept-Language", "en-us,en;q=0.5" },
+    { "Accept-Encoding", "gzip, deflate" },
+};
+
+#define NRESP (sizeof(resp_hdrs) / sizeof(resp_hdrs[0]))
+#define NREQ  (sizeof(req_hdrs) / sizeof(req_hdrs[0]))
+
+static void check(apr_status_t rv, const char *what)
+{
+    if (rv != APR_SUCCESS) {
+        char buf[120];
+        fprintf(stderr, "%s: %s\n", what, apr_strerror(rv, buf, sizeof(buf)));
+        exit(1);
+    }
+}
+
+static void write_files(const char *hfile, const char *dfile, int format,
+                        apr_off_t body_len, apr_pool_t *p)
+{
+    static char body[BODY_SIZE], zeros[CACHE_DISK_BODY_ALIGN];
+    apr_off_t remaining;
+    disk_cache_info_t info;
+    disk_cache_index_t index;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_size_t i, len = 0;
+    char *block, *b;
+
+    memset(&info, 0, sizeof(info));
+    memset(&index, 0, sizeof(index));
+    info.format = format;
+    info.status = 200;
+    info.name_len = strlen(name);
+    info.has_body = 1;
+
+    if (format == DISK_FORMAT_VERSION_6) {
+        check(apr_file_open(&fd, dfile, APR_WRITE | APR_CREATE | APR_TRUNCATE
+                            | APR_BINARY, APR_OS_DEFAULT, p), dfile);
+        check(apr_file_write_full(fd, body, sizeof(body), NULL), dfile);
+        check(apr_file_info_get(&finfo, APR_FINFO_IDENT, fd), dfile);
+        info.device = finfo.device;
+        info.inode = finfo.inode;
+        apr_file_close(fd);
+    }
+
+    check(apr_file_open(&fd, hfile, APR_WRITE | APR_CREATE | APR_TRUNCATE
+                        | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, p), hfile);
+
+    if (format == DISK_FORMAT_VERSION_6) {
+        check(apr_file_write_full(fd, &info, sizeof(info), NULL), hfile);
+        check(apr_file_write_full(fd, name, info.name_len, NULL), hfile);
+        for (i = 0; i < NRESP; i++) {
+            apr_file_printf(fd, "%s: %s" CRLF, resp_hdrs[i][0], resp_hdrs[i][1]);
+        }
+        apr_file_puts(CRLF, fd);
+        for (i = 0; i < NREQ; i++) {
+            apr_file_printf(fd, "%s: %s" CRLF, req_hdrs[i][0], req_hdrs[i][1]);
+        }
+        apr_file_puts(CRLF, fd);
+        check(apr_file_close(fd), hfile);
+        return;
+    }
+
+    for (i = 0; i < NRESP; i++) {
+        len += strlen(resp_hdrs[i][0]) + strlen(resp_hdrs[i][1]) + 2;
+    }
+    for (i = 0; i < NREQ; i++) {
+        len += strlen(req_hdrs[i][0]) + strlen(req_hdrs[i][1]) + 2;
+    }
+    b = block = apr_palloc(p, len);
+    for (i = 0; i < NRESP; i++) {
+        b = apr_cpystrn(b, resp_hdrs[i][0], len) + 1;
+        b = apr_cpystrn(b, resp_hdrs[i][1], len) + 1;
+    }
+    for (i = 0; i < NREQ; i++) {
+        b = apr_cpystrn(b, req_hdrs[i][0], len) + 1;
+        b = apr_cpystrn(b, req_hdrs[i][1], len) + 1;
+    }
+
+    index.hdrs_len = len;
+    index.nhdrs_out = NRESP;
+    index.nhdrs_in = NREQ;
+    len += sizeof(info) + sizeof(index) + info.name_len;
+    index.body_offset = APR_ALIGN(len, CACHE_DISK_BODY_ALIGN);
+    index.body_len = body_len;
+
+    check(apr_file_write_full(fd, &info, sizeof(info), NULL), hfile);
+    check(apr_file_write_full(fd, &index, sizeof(index), NULL), hfile);
+    check(apr_file_write_full(fd, name, info.name_len, NULL), hfile);
+    check(apr_file_write_full(fd, block, index.hdrs_len, NULL), hfile);
+    check(apr_file_write_full(fd, zeros, index.body_offset - len, NULL), hfile);
+    for (remaining = body_len; remaining > 0; remaining -= sizeof(body)) {
+        check(apr_file_write_full(fd, body, remaining > BODY_SIZE ? BODY_SIZE
+                                  : (apr_size_t)remaining, NULL), hfile);
+    }
+    check(apr_file_close(fd), hfile);
+}
+
+/* read_table() of mod_cache_disk.c, without the EBCDIC and logging bits */
+static apr_status_t read_table(apr_table_t *table, apr_file_t *file)
+{
+    char w[MAX_STRING_LEN];
+    char *l;
+    int p;
+    apr_status_t rv;
+
+    while (1) {
+        rv = apr_file_gets(w, MAX_STRING_LEN - 1, file);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+
+        p = strlen(w);
+        if (p > 0 && w[p - 1] == '\n') {
+            if (p > 1 && w[p - 2] == CR) {
+                w[p - 2] = '\0';
+            }
+            else {
+                w[p - 1] = '\0';
+            }
+        }
+
+        if (w[0] == '\0') {
+            break;
+        }
+
+        if (!(l = strchr(w, ':'))) {
+            return APR_EGENERAL;
+        }
+
+        *l++ = '\0';
+        while (*l && apr_isspace(*l)) {
+            ++l;
+        }
+
+        apr_table_add(table, w, l);
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t recall_v6(const char *hfile, const char *dfile,
+                              apr_pool_t *p)
+{
+    disk_cache_info_t info;
+    apr_file_t *fd, *dfd;
+    apr_finfo_t finfo;
+    apr_table_t *resp, *req;
+    apr_status_t rv;
+    char *url;
+
+    rv = apr_file_open(&fd, hfile, APR_READ | APR_BINARY | APR_BUFFERED,
+                       0, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(fd, &info, sizeof(info), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        url = apr_palloc(p, info.name_len + 1);
+        rv = apr_file_read_full(fd, url, info.name_len, NULL);
+        url[info.name_len] = '\0';
+    }
+    if (rv == APR_SUCCESS && strcmp(url, name)) {
+        rv = APR_EGENERAL;
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_open(&dfd, dfile, APR_READ | APR_BINARY, 0, p);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_SIZE | APR_FINFO_IDENT, dfd);
+    }
+    if (rv == APR_SUCCESS && (finfo.inode != info.inode
+                              || finfo.device != info.device)) {
+        rv = APR_EGENERAL;
+    }
+    if (rv == APR_SUCCESS) {
+        resp = apr_table_make(p, 20);
+        req = apr_table_make(p, 20);
+        rv = read_table(resp, fd);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = read_table(req, fd);
+    }
+    return rv;
+}
+
+/* read_table_block() of mod_cache_disk.c */
+static apr_status_t read_table_block(apr_table_t *table, apr_uint32_t n,
+                                     char **block, char *end)
+{
+    char *key, *val, *p = *block;
+
+    while (n--) {
+        key = p;
+        p = memchr(p, '\0', end - p);
+        if (!p) {
+            return APR_EGENERAL;
+        }
+        val = ++p;
+        p = memchr(p, '\0', end - p);
+        if (!p) {
+            return APR_EGENERAL;
+        }
+        ++p;
+
+        apr_table_addn(table, key, val);
+    }
+
+    *block = p;
+    return APR_SUCCESS;
+}
+
+static apr_status_t recall_v7(const char *hfile, const char *dfile,
+                              apr_pool_t *p)
+{
+    disk_cache_info_t info;
+    disk_cache_index_t index;
+    apr_file_t *fd;
+    apr_table_t *resp, *req;
+    apr_status_t rv;
+    apr_size_t len;
+    char *buf, *block;
+
+    rv = apr_file_open(&fd, hfile, APR_READ | APR_BINARY | APR_BUFFERED,
+                       0, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(fd, &info, sizeof(info), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(fd, &index, sizeof(index), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        len = info.name_len + index.hdrs_len;
+        buf = apr_palloc(p, len);
+        rv = apr_file_read_full(fd, buf, len, NULL);
+    }
+    if (rv == APR_SUCCESS && (info.name_len != strlen(name)
+                              || memcmp(buf, name, info.name_len))) {
+        rv = APR_EGENERAL;
+    }
+    if (rv == APR_SUCCESS) {
+        block = buf + info.name_len;
+        resp = apr_table_make(p, index.nhdrs_out);
+        req = apr_table_make(p, index.nhdrs_in);
+        rv = read_table_block(resp, index.nhdrs_out, &block, buf + len);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = read_table_block(req, index.nhdrs_in, &block, buf + len);
+    }
+    return rv;
+}
+
+/*
+ * The new header file of a revalidated entity, written from the old one,
+ * without the body: the info, the index, the name and the header block.
+ */
+static apr_status_t revalidate_headers(const char *hfile, const char *tfile,
+                                       apr_file_t **fd, apr_file_t **tfd,
+                                       disk_cache_index_t *index,
+                                       apr_pool_t *p)
+{
+    disk_cache_info_t info;
+    apr_status_t rv;
+    apr_size_t len;
+    char *buf;
+
+    rv = apr_file_open(fd, hfile, APR_READ | APR_BINARY, 0, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(*fd, &info, sizeof(info), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(*fd, index, sizeof(*index), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        len = info.name_len + index->hdrs_len;
+        buf = apr_palloc(p, len);
+        rv = apr_file_read_full(*fd, buf, len, NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_open(tfd, tfile, APR_WRITE | APR_CREATE | APR_TRUNCATE
+                           | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, p);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(*tfd, &info, sizeof(info), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(*tfd, index, sizeof(*index), NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(*tfd, buf, len, NULL);
+    }
+    return rv;
+}
+
+/* copy_body() of mod_cache_disk.c */
+static apr_status_t revalidate_copy(const char *hfile, const char *dfile,
+                                    apr_pool_t *p)
+{
+    static char zeros[CACHE_DISK_BODY_ALIGN];
+    char buf[AP_IOBUFSIZE];
+    const char *tfile = apr_pstrcat(p, hfile, ".tmp", NULL);
+    disk_cache_index_t index;
+    apr_file_t *fd, *tfd;
+    apr_off_t offset, remaining;
+    apr_status_t rv;
+    apr_size_t len;
+
+    rv = revalidate_headers(hfile, tfile, &fd, &tfd, &index, p);
+    if (rv == APR_SUCCESS) {
+        offset = 0;
+        rv = apr_file_seek(tfd, APR_CUR, &offset);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(tfd, zeros,
+                                 (apr_size_t)(index.body_offset - offset),
+                                 NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        offset = index.body_offset;
+        rv = apr_file_seek(fd, APR_SET, &offset);
+    }
+    for (remaining = index.body_len; rv == APR_SUCCESS && remaining > 0;
+         remaining -= len) {
+        len = remaining > (apr_off_t)sizeof(buf) ? sizeof(buf)
+                                                  : (apr_size_t)remaining;
+        rv = apr_file_read_full(fd, buf, len, &len);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_write_full(tfd, buf, len, NULL);
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_close(tfd);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_rename(tfile, hfile, p);
+    }
+    return rv;
+}
+
+/* keep_body() of mod_cache_disk.c */
+static apr_status_t revalidate_link(const char *hfile, const char *dfile,
+                                    apr_pool_t *p)
+{
+    const char *tfile = apr_pstrcat(p, hfile, ".tmp", NULL);
+    disk_cache_index_t index;
+    apr_file_t *fd, *tfd;
+    apr_status_t rv;
+
+    rv = revalidate_headers(hfile, tfile, &fd, &tfd, &index, p);
+    if (rv == APR_SUCCESS) {
+        apr_file_remove(dfile, p);
+        rv = apr_file_link(hfile, dfile);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_close(tfd);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_rename(tfile, hfile, p);
+    }
+    return rv;
+}
+
+static void run(const char *what,
+                apr_status_t (*recall)(const char *, const char *,
+                                       apr_pool_t *),
+                const char *hfile, const char *dfile, int iterations,
+                apr_pool_t *p)
+{
+    apr_time_t start, elapsed;
+    int i;
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        check(recall(hfile, dfile, p), what);
+        apr_pool_clear(p);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-10s %8.1f ns/recall %6.2f M recalls/s\n", what,
+           elapsed * 1000.0 / iterations,
+           elapsed ? (double)iterations / elapsed : 0.0);
+}
+
+static void run_revalidate(const char *hfile, const char *dfile,
+                           int iterations, apr_pool_t *p)
+{
+    static const apr_off_t sizes[] = { 16384, 1048576, 16777216 };
+    apr_time_t start, copied, linked;
+    apr_size_t s;
+    int i;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        write_files(hfile, NULL, DISK_FORMAT_VERSION, sizes[s], p);
+        start = apr_time_now();
+        for (i = 0; i < iterations; i++) {
+            check(revalidate_copy(hfile, dfile, p), "copy");
+            apr_pool_clear(p);
+        }
+        copied = apr_time_now() - start;
+
+        start = apr_time_now();
+        for (i = 0; i < iterations; i++) {
+            check(revalidate_link(hfile, dfile, p), "link");
+            apr_pool_clear(p);
+        }
+        linked = apr_time_now() - start;
+
+        printf("%8" APR_OFF_T_FMT " bytes: copy %10.1f us, link %8.1f us "
+               "per revalidation\n", sizes[s],
+               (double)copied / iterations, (double)linked / iterations);
+    }
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *p, *rp;
+    const char *dir = "/tmp";
+    const char *h6, *d6, *h7, *d7;
+    int iterations = 100000;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        dir = argv[2];
+    }
+    if (iterations < 1 || argc > 3) {
+        fprintf(stderr, "usage: %s [iterations [directory]]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+    apr_pool_create(&rp, p);
+
+    h6 = apr_pstrcat(p, dir, "/time-cache-disk-6" CACHE_HEADER_SUFFIX, NULL);
+    d6 = apr_pstrcat(p, dir, "/time-cache-disk-6" CACHE_DATA_SUFFIX, NULL);
+    h7 = apr_pstrcat(p, dir, "/time-cache-disk-7" CACHE_HEADER_SUFFIX, NULL);
+    d7 = apr_pstrcat(p, dir, "/time-cache-disk-7" CACHE_DATA_SUFFIX, NULL);
+
+    write_files(h6, d6, DISK_FORMAT_VERSION_6, BODY_SIZE, p);
+    write_files(h7, NULL, DISK_FORMAT_VERSION, BODY_SIZE, p);
+
+    run("format 6", recall_v6, h6, d6, iterations, rp);
+    run("format 7", recall_v7, h7, NULL, iterations, rp);
+
+    run_revalidate(h7, d7, iterations > 100 ? iterations / 100 : 1, rp);
+
+    apr_file_remove(h6, p);
+    apr_file_remove(d6, p);
+    apr_file_remove(h7, p);
+    apr_file_remove(d7, p);
+
+    apr_pool_destroy(p);
+    return 0;
+}
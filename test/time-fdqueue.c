@@ -0,0 +1,247 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-fdqueue.c measures how fast the listener of the event MPM can hand
+ * sockets over to its worker threads (server/mpm/event/fdqueue.c):
+ *
+ *   - the main thread plays the listener: it reserves an idle worker with
+ *     ap_queue_info_wait_for_idler() and queues a dummy socket
+ *   - the worker threads go idle, pop the socket and do a little work
+ *
+ * This is done once with the per-worker deques and once with the single
+ * mutex protected FIFO they replaced, for each number of worker threads.
+ *
+ * usage: time-fdqueue [items [work [threads...]]]
+ *        defaults: 1000000 items, 100 iterations of work per item,
+ *                  1 8 32 128 threads
+ *
+ * After running configure, compile with something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix -I../server/mpm/event \
+ *       `apr-1-config --includes --cppflags` -o time-fdqueue \
+ *       time-fdqueue.c ../server/mpm/event/fdqueue.c \
+ *       `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_thread_proc.h"
+#include "apr_time.h"
+
+#include "fdqueue.h"
+
+/* The structure replaced by the deques: one FIFO behind one mutex */
+typedef struct old_queue_t {
+    fd_queue_elem_t *data;
+    unsigned int nelts;
+    unsigned int bounds;
+    unsigned int in;
+    unsigned int out;
+    apr_thread_mutex_t *one_big_mutex;
+    apr_thread_cond_t *not_empty;
+    int terminated;
+} old_queue_t;
+
+static void old_queue_init(old_queue_t *queue, int capacity, apr_pool_t *p)
+{
+    apr_thread_mutex_create(&queue->one_big_mutex, APR_THREAD_MUTEX_DEFAULT,
+                            p);
+    apr_thread_cond_create(&queue->not_empty, p);
+    queue->data = apr_pcalloc(p, capacity * sizeof(fd_queue_elem_t));
+    queue->bounds = capacity;
+    queue->nelts = queue->in = queue->out = 0;
+    queue->terminated = 0;
+}
+
+static void old_queue_push(old_queue_t *queue, apr_socket_t *sd)
+{
+    apr_thread_mutex_lock(queue->one_big_mutex);
+    queue->data[queue->in].sd = sd;
+    if (++queue->in >= queue->bounds)
+        queue->in -= queue->bounds;
+    queue->nelts++;
+    apr_thread_cond_signal(queue->not_empty);
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+}
+
+static apr_status_t old_queue_pop(old_queue_t *queue, apr_socket_t **sd)
+{
+    apr_thread_mutex_lock(queue->one_big_mutex);
+    if (queue->nelts == 0) {
+        if (!queue->terminated) {
+            apr_thread_cond_wait(queue->not_empty, queue->one_big_mutex);
+        }
+        if (queue->nelts == 0) {
+            apr_thread_mutex_unlock(queue->one_big_mutex);
+            return queue->terminated ? APR_EOF : APR_EINTR;
+        }
+    }
+    *sd = queue->data[queue->out].sd;
+    if (++queue->out >= queue->bounds)
+        queue->out -= queue->bounds;
+    queue->nelts--;
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+    return APR_SUCCESS;
+}
+
+static void old_queue_term(old_queue_t *queue)
+{
+    apr_thread_mutex_lock(queue->one_big_mutex);
+    queue->terminated = 1;
+    apr_thread_cond_broadcast(queue->not_empty);
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+}
+
+static fd_queue_info_t *queue_info;
+static fd_queue_t queue;
+static old_queue_t old_queue;
+static int use_old;
+static int work;
+static volatile apr_uint32_t sink;
+
+static void * APR_THREAD_FUNC worker_thread(apr_thread_t *thd, void *data)
+{
+    int slot = (int)(apr_uintptr_t)data;
+    apr_uint32_t acc = 0;
+
+    for (;;) {
+        apr_socket_t *sd;
+        event_conn_state_t *ecs;
+        apr_pool_t *p;
+        timer_event_t *te;
+        apr_status_t rv;
+        int i;
+
+        ap_queue_info_set_idle(queue_info, NULL);
+        do {
+            if (use_old) {
+                rv = old_queue_pop(&old_queue, &sd);
+            }
+            else {
+                rv = ap_queue_pop_something(&queue, slot, &sd, &ecs, &p, &te);
+            }
+        } while (APR_STATUS_IS_EINTR(rv));
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+
+        /* pretend to serve the connection */
+        for (i = 0; i < work; i++) {
+            acc = acc * 31 + (apr_uint32_t)(apr_uintptr_t)sd;
+        }
+    }
+
+    sink += acc;
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void run(const char *what, int old, int nthreads, int items)
+{
+    apr_pool_t *p;
+    apr_thread_t **threads;
+    apr_status_t rv;
+    apr_time_t start, elapsed;
+    int blocked = 0;
+    int i;
+
+    apr_pool_create(&p, NULL);
+    use_old = old;
+    ap_queue_info_create(&queue_info, p, nthreads, -1);
+    if (old) {
+        old_queue_init(&old_queue, nthreads, p);
+    }
+    else {
+        ap_queue_init(&queue, nthreads, nthreads, p);
+    }
+
+    threads = apr_palloc(p, nthreads * sizeof(apr_thread_t *));
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_create(&threads[i], NULL, worker_thread,
+                          (void *)(apr_uintptr_t)i, p);
+    }
+
+    start = apr_time_now();
+    for (i = 0; i < items; i++) {
+        apr_socket_t *sd = (apr_socket_t *)(apr_uintptr_t)(i + 1);
+        int had_to_block = 0;
+
+        ap_queue_info_wait_for_idler(queue_info, &had_to_block);
+        blocked += had_to_block;
+        if (old) {
+            old_queue_push(&old_queue, sd);
+        }
+        else {
+            ap_queue_push(&queue, sd, NULL, NULL);
+        }
+    }
+    if (old) {
+        old_queue_term(&old_queue);
+    }
+    else {
+        ap_queue_term(&queue);
+    }
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_join(&rv, threads[i]);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-22s %4d threads %9d items %8.1f ms %8.1f ns/item"
+           " %6.2f%% blocked\n", what, nthreads, items, elapsed / 1000.0,
+           elapsed * 1000.0 / items, blocked * 100.0 / items);
+
+    apr_pool_destroy(p);
+}
+
+int main(int argc, const char * const argv[])
+{
+    static const int default_threads[] = { 1, 8, 32, 128 };
+    int items = 1000000;
+    int i, n;
+
+    work = 100;
+    if (argc > 1) {
+        items = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        work = atoi(argv[2]);
+    }
+    if (items < 1 || work < 0) {
+        fprintf(stderr, "usage: %s [items [work [threads...]]]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+
+    n = argc > 3 ? argc - 3 : sizeof(default_threads) / sizeof(int);
+    for (i = 0; i < n; i++) {
+        int nthreads = argc > 3 ? atoi(argv[i + 3]) : default_threads[i];
+
+        if (nthreads < 1) {
+            fprintf(stderr, "invalid number of threads: %s\n", argv[i + 3]);
+            exit(1);
+        }
+        run("single FIFO", 1, nthreads, items);
+        run("work-stealing deques", 0, nthreads, items);
+    }
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-filter-chain.c measures how fast the filters of a SetOutputFilter
+ * line are added to a request (server/util_filter.c), for a stack of six
+ * filters:
+ *
+ *   - by name, as core_insert_filter() used to: the list split with
+ *     ap_getword(), each name looked up in the filter trie, each filter
+ *     allocated on its own
+ *   - from an ap_filter_chain_t made once at configuration time, with
+ *     ap_add_filter_chain()
+ *
+ * Each request starts with the connection's CORE filter and the HTTP
+ * protocol filters, as after ap_read_request().
+ *
+ * usage: time-filter-chain [iterations]
+ *        default: 1000000 iterations
+ *
+ * After running configure, compile with something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix \
+ *       `apr-1-config --includes --cppflags` \
+ *       `apu-1-config --includes` -o time-filter-chain \
+ *       time-filter-chain.c ../server/util_filter.c \
+ *       `apu-1-config --link-ld --libs` `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_hooks.h"
+#include "apr_lib.h"
+#include "apr_pools.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include "httpd.h"
+#include "http_log.h"
+#include "util_filter.h"
+
+#define FILTERS "INCLUDES;SUBSTITUTE;SED;xml2enc;proxy-html;DEFLATE"
+
+/* What util_filter.c needs from the rest of httpd */
+
+AP_DECLARE(void) ap_log_cerror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status,
+                                const conn_rec *c, const char *fmt, ...)
+{
+    fprintf(stderr, "unexpected error logged at %s:%d\n", file, line);
+    exit(1);
+}
+
+AP_DECLARE(void) ap_log_rerror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status,
+                                const request_rec *r, const char *fmt, ...)
+{
+    fprintf(stderr, "unexpected error logged at %s:%d\n", file, line);
+    exit(1);
+}
+
+AP_DECLARE(void) ap_str_tolower(char *str)
+{
+    while (*str) {
+        *str = apr_tolower(*str);
+        ++str;
+    }
+}
+
+/* ap_getword() from server/util.c */
+static char *getword(apr_pool_t *atrans, const char **line, char stop)
+{
+    const char *pos = *line;
+    int len;
+    char *res;
+
+    while ((*pos != stop) && *pos) {
+        ++pos;
+    }
+
+    len = pos - *line;
+    res = apr_pstrmemdup(atrans, *line, len);
+
+    if (stop) {
+        while (*pos == stop) {
+            ++pos;
+        }
+    }
+    *line = pos;
+
+    return res;
+}
+
+static apr_status_t dummy_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    return APR_SUCCESS;
+}
+
+/* about what a server with the usual modules has registered */
+static const struct {
+    const char *name;
+    ap_filter_type ftype;
+} registered[] = {
+    { "BYTERANGE", AP_FTYPE_PROTOCOL },
+    { "CACHE_OUT", AP_FTYPE_CONTENT_SET },
+    { "CACHE_SAVE", AP_FTYPE_CONTENT_SET },
+    { "CHUNK", AP_FTYPE_TRANSCODE },
+    { "CONTENT_LENGTH", AP_FTYPE_PROTOCOL },
+    { "CORE", AP_FTYPE_NETWORK },
+    { "DEFLATE", AP_FTYPE_CONTENT_SET },
+    { "HTTP_HEADER", AP_FTYPE_PROTOCOL },
+    { "HTTP_OUTERROR", AP_FTYPE_PROTOCOL },
+    { "INCLUDES", AP_FTYPE_RESOURCE },
+    { "INFLATE", AP_FTYPE_RESOURCE },
+    { "OLD_WRITE", AP_FTYPE_RESOURCE },
+    { "proxy-html", AP_FTYPE_RESOURCE },
+    { "SED", AP_FTYPE_RESOURCE },
+    { "SSL/TLS Filter", AP_FTYPE_CONNECTION },
+    { "SUBREQ_CORE", AP_FTYPE_CONTENT_SET },
+    { "SUBSTITUTE", AP_FTYPE_RESOURCE },
+    { "UP_TO_DATE", AP_FTYPE_PROTOCOL },
+    { "xml2enc", AP_FTYPE_RESOURCE },
+};
+
+static void run(const char *what, const ap_filter_chain_t *chain,
+                conn_rec *c, ap_filter_t *core, int iterations)
+{
+    apr_pool_t *p;
+    apr_time_t start, elapsed;
+    int i, n = 0;
+
+    apr_pool_create(&p, c->pool);
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        request_rec r;
+        ap_filter_t *f;
+
+        memset(&r, 0, sizeof(r));
+        r.pool = p;
+        r.connection = c;
+        c->output_filters = core;
+        r.proto_output_filters = r.output_filters = c->output_filters;
+        ap_add_output_filter("HTTP_HEADER", NULL, &r, c);
+        ap_add_output_filter("CONTENT_LENGTH", NULL, &r, c);
+        ap_add_output_filter("BYTERANGE", NULL, &r, c);
+
+        if (chain) {
+            ap_add_filter_chain(chain, &r);
+        }
+        else {
+            const char *filter, *filters = FILTERS;
+
+            while (*filters && (filter = getword(r.pool, &filters, ';'))) {
+                ap_add_output_filter(filter, NULL, &r, c);
+            }
+        }
+
+        for (n = 0, f = r.output_filters; f; f = f->next) {
+            n++;
+        }
+        apr_pool_clear(p);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-10s %2d filters %8.1f ns/request\n", what, n,
+           elapsed * 1000.0 / iterations);
+
+    apr_pool_destroy(p);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *p;
+    conn_rec c;
+    ap_filter_chain_t *chain;
+    ap_filter_t *core;
+    int iterations = 1000000;
+    int i;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+    apr_hook_global_pool = p;
+
+    for (i = 0; i < sizeof(registered) / sizeof(registered[0]); i++) {
+        ap_register_output_filter(registered[i].name, dummy_filter, NULL,
+                                  registered[i].ftype);
+    }
+    chain = ap_filter_chain_make(p, FILTERS, 0);
+
+    memset(&c, 0, sizeof(c));
+    c.pool = p;
+    core = ap_add_output_filter("CORE", NULL, NULL, &c);
+
+    run("by name", NULL, &c, core, iterations);
+    run("chain", chain, &c, core, iterations);
+
+    apr_pool_destroy(p);
+    return 0;
+}
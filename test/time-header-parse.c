@@ -0,0 +1,252 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-header-parse.c measures how fast request header fields are split
+ * into r->headers_in, for a few realistic browser request heads:
+ *
+ *   - line by line, as ap_get_mime_headers_core() does: each line copied
+ *     into its own pool buffer, checked for NULs, then searched for ':'
+ *   - with ap_parse_http_headers() (server/util_scan.c), as the fast path
+ *     of ap_read_request() does: the block copied once, then split in place
+ *
+ * Only the parsing is timed, not the input filters: reading line by line
+ * also costs one AP_MODE_GETLINE call through the filter chain per line.
+ *
+ * usage: time-header-parse [iterations]
+ *        default: 200000 iterations per request head
+ *
+ * After running configure, compile with something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix \
+ *       `apr-1-config --includes --cppflags` -o time-header-parse \
+ *       time-header-parse.c ../server/util_scan.c \
+ *       `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#include "httpd.h"
+#include "http_protocol.h"
+
+#define LIMIT_FIELDSIZE DEFAULT_LIMIT_REQUEST_FIELDSIZE
+#define LIMIT_FIELDS    DEFAULT_LIMIT_REQUEST_FIELDS
+#define MIN_LINE_ALLOC  80
+
+/* the header fields, without the request line */
+static const struct {
+    const char *what;
+    const char *head;
+} heads[] = {
+    { "curl",
+      "Host: www.example.com\r\n"
+      "User-Agent: curl/7.24.0 (x86_64-pc-linux-gnu) libcurl/7.24.0\r\n"
+      "Accept: */*\r\n"
+      "\r\n" },
+    { "firefox",
+      "Host: www.example.com\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:12.0) "
+      "Gecko/20100101 Firefox/12.0\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "*/*;q=0.8\r\n"
+      "Accept-Language: en-us,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate\r\n"
+      "Connection: keep-alive\r\n"
+      "Referer: http://www.example.com/index.html\r\n"
+      "If-Modified-Since: Tue, 10 Apr 2012 08:13:12 GMT\r\n"
+      "If-None-Match: \"2a0c3e-1b6f-4bd4e25ea6a00\"\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "\r\n" },
+    { "chrome with cookies",
+      "Host: www.example.com\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64) AppleWebKit/536.5 "
+      "(KHTML, like Gecko) Chrome/19.0.1084.46 Safari/536.5\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "*/*;q=0.8\r\n"
+      "Referer: http://www.example.com/search?q=apache+httpd&ie=UTF-8\r\n"
+      "Accept-Encoding: gzip,deflate,sdch\r\n"
+      "Accept-Language: en-US,en;q=0.8\r\n"
+      "Accept-Charset: ISO-8859-1,utf-8;q=0.7,*;q=0.3\r\n"
+      "Cookie: __utma=12798129.1234567890.1336000000.1336000000."
+      "1336000000.1; __utmb=12798129.1.10.1336000000; __utmc=12798129; "
+      "__utmz=12798129.1336000000.1.1.utmcsr=(direct)|utmccn=(direct)|"
+      "utmcmd=(none); session=8f14e45fceea167a5a36dedd4bea2543; "
+      "prefs=lang%3Den%26tz%3DEurope%252FBerlin%26theme%3Dlight\r\n"
+      "\r\n" },
+};
+
+/* ap_get_mime_headers_core(), minus the reading and the error reports */
+static int parse_line_by_line(const char *head, apr_table_t *t, apr_pool_t *p)
+{
+    const char *s = head;
+    char *last_field = NULL, *field, *value, *tmp_field;
+    apr_size_t last_len = 0, alloc_len = 0, len;
+    int fields_read = 0;
+
+    for (;;) {
+        const char *eol = strchr(s, '\n');
+        int folded = 0;
+
+        /* ap_rgetline_core(): copy the line, strip CRLF, check for NULs */
+        len = eol + 1 - s;
+        field = apr_palloc(p, len < MIN_LINE_ALLOC ? MIN_LINE_ALLOC : len);
+        memcpy(field, s, len);
+        len--;
+        if (len && field[len - 1] == '\r') {
+            len--;
+        }
+        field[len] = '\0';
+        if (strlen(field) < len) {
+            return 0;
+        }
+        s = eol + 1;
+
+        if (last_field != NULL) {
+            if ((len > 0) && ((*field == '\t') || *field == ' ')) {
+                apr_size_t fold_len = last_len + len + 1;
+
+                if (fold_len >= LIMIT_FIELDSIZE) {
+                    return 0;
+                }
+                if (fold_len > alloc_len) {
+                    char *fold_buf;
+                    alloc_len += alloc_len;
+                    if (fold_len > alloc_len) {
+                        alloc_len = fold_len;
+                    }
+                    fold_buf = apr_palloc(p, alloc_len);
+                    memcpy(fold_buf, last_field, last_len);
+                    last_field = fold_buf;
+                }
+                memcpy(last_field + last_len, field, len + 1);
+                last_len += len;
+                folded = 1;
+            }
+            else {
+                if (++fields_read > LIMIT_FIELDS) {
+                    return 0;
+                }
+                if (!(value = strchr(last_field, ':'))) {
+                    return 0;
+                }
+                tmp_field = value - 1;
+                *value++ = '\0';
+                while (*value == ' ' || *value == '\t') {
+                    ++value;
+                }
+                while (tmp_field > last_field
+                       && (*tmp_field == ' ' || *tmp_field == '\t')) {
+                    *tmp_field-- = '\0';
+                }
+                tmp_field = last_field + last_len - 1;
+                while (tmp_field > value
+                       && (*tmp_field == ' ' || *tmp_field == '\t')) {
+                    *tmp_field-- = '\0';
+                }
+                apr_table_addn(t, last_field, value);
+                alloc_len = 0;
+            }
+        }
+
+        if (len == 0) {
+            break;
+        }
+        if (!folded) {
+            last_field = field;
+            last_len = len;
+        }
+    }
+    return 1;
+}
+
+static int parse_in_place(const char *head, apr_size_t len, apr_table_t *t,
+                          apr_pool_t *p)
+{
+    /* the copy done by apr_brigade_pflatten() */
+    char *buf = apr_pmemdup(p, head, len);
+    apr_size_t head_len = ap_http_headers_end(buf, len);
+
+    return head_len && ap_parse_http_headers(buf, head_len, t,
+                                             LIMIT_FIELDSIZE,
+                                             LIMIT_FIELDS) == APR_SUCCESS;
+}
+
+static void run(const char *what, const char *head, int in_place,
+                int iterations, apr_pool_t *p)
+{
+    apr_size_t len = strlen(head);
+    apr_time_t start, elapsed;
+    int i, nfields = 0;
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        apr_table_t *t = apr_table_make(p, 25);
+        int ok = in_place ? parse_in_place(head, len, t, p)
+                          : parse_line_by_line(head, t, p);
+
+        if (!ok) {
+            fprintf(stderr, "%s: failed to parse\n", what);
+            exit(1);
+        }
+        apr_table_compress(t, APR_OVERLAP_TABLES_MERGE);
+        nfields = apr_table_elts(t)->nelts;
+        apr_pool_clear(p);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-20s %-13s %3d fields %8.1f ns/head %6.2f M fields/s\n",
+           what, in_place ? "in place" : "line by line", nfields,
+           elapsed * 1000.0 / iterations,
+           elapsed ? (double)nfields * iterations / elapsed : 0.0);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *p;
+    int iterations = 200000;
+    int i;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+
+    for (i = 0; i < sizeof(heads) / sizeof(heads[0]); i++) {
+        run(heads[i].what, heads[i].head, 0, iterations, p);
+        run(heads[i].what, heads[i].head, 1, iterations, p);
+    }
+
+    apr_pool_destroy(p);
+    return 0;
+}
@@ -0,0 +1,348 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-log-format.c measures how many access log entries per second
+ * mod_log_config can write for the Combined format:
+ *
+ *   - item by item, as config_log_transaction() used to: each item
+ *     formatted and escaped into its own pool string, then all of them
+ *     copied into one more pool buffer by the log writer
+ *   - with the program compiled from the format
+ *     (modules/loggers/log_program.c), which writes the entry straight
+ *     into a buffer on the stack
+ *
+ * The entries are not written anywhere, only formatted.  ap_get_header_in()
+ * is stubbed with apr_table_get(), so both sides search r->headers_in.
+ *
+ * usage: time-log-format [iterations]
+ *        default: 1000000 iterations
+ *
+ * After running configure and make (for server/test_char.h), compile with
+ * something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix -I../server \
+ *       -I../modules/loggers `apr-1-config --includes --cppflags` \
+ *       -o time-log-format time-log-format.c \
+ *       ../modules/loggers/log_program.c ../server/util_time.c \
+ *       ../server/util_scan.c `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#include "httpd.h"
+#include "http_core.h"
+#include "http_protocol.h"
+#include "test_char.h"
+
+#include "log_program.h"
+
+#define TEST_CHAR(c, f)        (test_char_table[(unsigned char)(c)] & (f))
+
+/* "%h %l %u %t \"%r\" %>s %b \"%{Referer}i\" \"%{User-Agent}i\"" */
+
+/* What log_program.c needs from the rest of httpd */
+
+AP_DECLARE(const char *) ap_get_remote_host(conn_rec *conn, void *dir_config,
+                                            int type, int *str_is_ip)
+{
+    return conn->client_ip;
+}
+
+AP_DECLARE(const char *) ap_get_header_in(request_rec *r, ap_header_id_e id)
+{
+    return apr_table_get(r->headers_in, ap_header_name(id));
+}
+
+/* ap_escape_logitem() from server/util.c */
+static char *escape_logitem(apr_pool_t *p, const char *str)
+{
+    static const char c2x_table[] = "0123456789abcdef";
+    char *ret;
+    unsigned char *d;
+    const unsigned char *s;
+    apr_size_t length, escapes = 0;
+
+    if (!str) {
+        return NULL;
+    }
+
+    s = (const unsigned char *)str;
+    for (; *s; ++s) {
+        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
+            ++escapes;
+        }
+    }
+    length = s - (const unsigned char *)str + 1;
+    if (!escapes) {
+        return apr_pmemdup(p, str, length);
+    }
+
+    ret = apr_palloc(p, length + 3 * escapes);
+    d = (unsigned char *)ret;
+    s = (const unsigned char *)str;
+    for (; *s; ++s) {
+        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
+            *d++ = '\\';
+            switch (*s) {
+            case '\b':
+                *d++ = 'b';
+                break;
+            case '\n':
+                *d++ = 'n';
+                break;
+            case '\r':
+                *d++ = 'r';
+                break;
+            case '\t':
+                *d++ = 't';
+                break;
+            case '\v':
+                *d++ = 'v';
+                break;
+            case '\\':
+            case '"':
+                *d++ = *s;
+                break;
+            default:
+                *d++ = 'x';
+                *d++ = c2x_table[*s >> 4];
+                *d++ = c2x_table[*s & 0xf];
+            }
+        }
+        else {
+            *d++ = *s;
+        }
+    }
+    *d = '\0';
+    return ret;
+}
+
+/* The item functions of mod_log_config.c used by the Combined format */
+
+typedef const char *item_fn(request_rec *r, char *a);
+
+static const char *constant_item(request_rec *r, char *a)
+{
+    return a;
+}
+
+static const char *log_remote_host(request_rec *r, char *a)
+{
+    return escape_logitem(r->pool, ap_get_remote_host(r->connection,
+                                                      r->per_dir_config,
+                                                      REMOTE_NAME, NULL));
+}
+
+static const char *log_remote_logname(request_rec *r, char *a)
+{
+    /* no IdentityCheck */
+    return escape_logitem(r->pool, NULL);
+}
+
+static const char *log_remote_user(request_rec *r, char *a)
+{
+    return r->user ? escape_logitem(r->pool, r->user) : "-";
+}
+
+static const char *log_request_time(request_rec *r, char *a)
+{
+    char *buf = apr_palloc(r->pool, LOG_CLF_TIME_SIZE);
+
+    log_clf_time(buf, r->request_time);
+    return buf;
+}
+
+static const char *log_request_line(request_rec *r, char *a)
+{
+    return escape_logitem(r->pool, r->the_request);
+}
+
+static const char *log_status(request_rec *r, char *a)
+{
+    return r->status <= 0 ? "-" : apr_itoa(r->pool, r->status);
+}
+
+static const char *clf_log_bytes_sent(request_rec *r, char *a)
+{
+    if (!r->sent_bodyct || !r->bytes_sent) {
+        return "-";
+    }
+    return apr_off_t_toa(r->pool, r->bytes_sent);
+}
+
+static const char *log_header_in(request_rec *r, char *a)
+{
+    return escape_logitem(r->pool, apr_table_get(r->headers_in, a));
+}
+
+static const struct {
+    item_fn *func;
+    char *arg;
+    log_op_e op;
+} combined[] = {
+    { log_remote_host, "", LOG_OP_REMOTE_HOST },
+    { constant_item, " ", LOG_OP_CONST },
+    { log_remote_logname, "", LOG_OP_ITEM },
+    { constant_item, " ", LOG_OP_CONST },
+    { log_remote_user, "", LOG_OP_ITEM },
+    { constant_item, " ", LOG_OP_CONST },
+    { log_request_time, "", LOG_OP_TIME_CLF },
+    { constant_item, " \"", LOG_OP_CONST },
+    { log_request_line, "", LOG_OP_REQUEST_LINE },
+    { constant_item, "\" ", LOG_OP_CONST },
+    { log_status, "", LOG_OP_STATUS },
+    { constant_item, " ", LOG_OP_CONST },
+    { clf_log_bytes_sent, "", LOG_OP_BYTES_CLF },
+    { constant_item, " \"", LOG_OP_CONST },
+    { log_header_in, "Referer", LOG_OP_HEADER_IN },
+    { constant_item, "\" \"", LOG_OP_CONST },
+    { log_header_in, "User-Agent", LOG_OP_HEADER_IN },
+    { constant_item, "\"\n", LOG_OP_CONST },
+};
+
+#define NITEMS (sizeof(combined) / sizeof(combined[0]))
+
+static const char *run_item(request_rec *r, request_rec *orig, void *item)
+{
+    int i = (int)(apr_size_t)item;
+    const char *cp = combined[i].func(r, combined[i].arg);
+
+    return cp ? cp : "-";
+}
+
+static apr_time_t end_time(request_rec *r)
+{
+    return r->request_time;
+}
+
+/* config_log_transaction() and ap_default_log_writer() as they were */
+static apr_size_t format_by_item(request_rec *r, char **line)
+{
+    const char *strs[NITEMS];
+    int strl[NITEMS];
+    apr_size_t len = 0;
+    char *s;
+    int i;
+
+    for (i = 0; i < NITEMS; i++) {
+        strs[i] = combined[i].func(r, combined[i].arg);
+        if (!strs[i]) {
+            strs[i] = "-";
+        }
+    }
+    for (i = 0; i < NITEMS; i++) {
+        len += strl[i] = strlen(strs[i]);
+    }
+
+    *line = s = apr_palloc(r->pool, len + 1);
+    for (i = 0; i < NITEMS; i++) {
+        memcpy(s, strs[i], strl[i]);
+        s += strl[i];
+    }
+    return len;
+}
+
+static void run(const char *what, const log_program *prog, request_rec *r,
+                int iterations, apr_pool_t *p)
+{
+    char buf[HUGE_STRING_LEN], *line = NULL;
+    apr_size_t len = 0;
+    apr_time_t start, elapsed;
+    int i;
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        r->pool = p;
+        if (prog) {
+            len = log_program_run(prog, r, r, run_item, end_time,
+                                  buf, sizeof(buf), &line);
+        }
+        else {
+            len = format_by_item(r, &line);
+        }
+        apr_pool_clear(p);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-10s %4" APR_SIZE_T_FMT " bytes/line %8.1f ns/line "
+           "%6.2f M lines/s\n", what, len, elapsed * 1000.0 / iterations,
+           elapsed ? (double)iterations / elapsed : 0.0);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *p, *rp;
+    conn_rec c;
+    request_rec r;
+    log_program *prog;
+    int iterations = 1000000;
+    int i;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+    apr_pool_create(&rp, p);
+
+    prog = log_program_make(p, NITEMS);
+    for (i = 0; i < NITEMS; i++) {
+        log_program_add(prog, combined[i].op, 0, combined[i].arg,
+                        (void *)(apr_size_t)i);
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.client_ip = "192.0.2.17";
+    memset(&r, 0, sizeof(r));
+    r.connection = &c;
+    r.request_time = apr_time_now();
+    r.the_request = "GET /images/logo.png?v=20120611 HTTP/1.1";
+    r.status = HTTP_OK;
+    r.sent_bodyct = 1;
+    r.bytes_sent = 13724;
+    r.headers_in = apr_table_make(p, 10);
+    apr_table_setn(r.headers_in, "Host", "www.example.com");
+    apr_table_setn(r.headers_in, "User-Agent",
+                   "Mozilla/5.0 (X11; Linux x86_64; rv:12.0) "
+                   "Gecko/20100101 Firefox/12.0");
+    apr_table_setn(r.headers_in, "Accept", "image/png,image/*;q=0.8,*/*;q=0.5");
+    apr_table_setn(r.headers_in, "Accept-Language", "en-us,en;q=0.5");
+    apr_table_setn(r.headers_in, "Accept-Encoding", "gzip, deflate");
+    apr_table_setn(r.headers_in, "Connection", "keep-alive");
+    apr_table_setn(r.headers_in, "Referer", "http://www.example.com/");
+
+    run("by item", NULL, &r, iterations, rp);
+    run("program", prog, &r, iterations, rp);
+
+    apr_pool_destroy(p);
+    return 0;
+}
@@ -0,0 +1,236 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * time-timer-heap.c measures the cost of the event MPM's timed callback
+ * bookkeeping (server/mpm/event/timer_heap.c) with a large number of
+ * pending timers:
+ *
+ *   - inserting timers until <pending> of them are queued
+ *   - the same from <threads> threads concurrently
+ *   - expiring all of them again, as the listener thread does
+ *   - for comparison, inserting into the sorted ring the event MPM
+ *     used before, with <pending> timers already queued
+ *
+ * usage: time-timer-heap [pending [threads [shards]]]
+ *        defaults: 100000 pending timers, 8 threads, 8 shards
+ *
+ * After running configure, compile with something like:
+ *
+ *   gcc -O2 -Wall -I../include -I../os/unix -I../server/mpm/event \
+ *       `apr-1-config --includes --cppflags` -o time-timer-heap \
+ *       time-timer-heap.c ../server/mpm/event/timer_heap.c \
+ *       `apr-1-config --link-ld --libs`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_ring.h"
+#include "apr_thread_proc.h"
+#include "apr_time.h"
+
+#include "timer_heap.h"
+
+/* SPREAD is the interval over which the expiration times are distributed */
+#define SPREAD apr_time_from_sec(60)
+/* inserts into the old sorted ring are O(n), keep that part short */
+#define RING_INSERTS 1000
+
+/*
+ * Dummy a bunch of stuff just to get a compile
+ */
+AP_DECLARE(void *) ap_malloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL) {
+        abort();
+    }
+    return p;
+}
+
+AP_DECLARE(void *) ap_realloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+    if (p == NULL) {
+        abort();
+    }
+    return p;
+}
+
+static timer_heap_t *th;
+static int per_thread;
+static apr_uint32_t seed_base;
+
+static void dummy_cb(void *baton)
+{
+}
+
+static void release_cb(timer_event_t *te)
+{
+    ap_timer_heap_release(th, te);
+}
+
+/* a small LCG is good enough here and keeps rand() out of the loops */
+static apr_time_t next_when(apr_uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (apr_time_t)(*seed % (apr_uint32_t)SPREAD);
+}
+
+static void report(const char *what, int n, apr_time_t elapsed)
+{
+    printf("%-40s %9d ops %8.1f ms %8.1f ns/op\n", what, n,
+           elapsed / 1000.0, n ? elapsed * 1000.0 / n : 0.0);
+}
+
+static void * APR_THREAD_FUNC insert_thread(apr_thread_t *thd, void *data)
+{
+    apr_uint32_t seed = seed_base + (apr_uint32_t)(apr_uintptr_t)data;
+    int i;
+
+    for (i = 0; i < per_thread; i++) {
+        ap_timer_heap_insert(th, next_when(&seed), dummy_cb, NULL);
+    }
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+/* The structure replaced by timer_heap.c: one ring sorted by 'when' */
+APR_RING_HEAD(timer_ring_t, timer_event_t);
+
+static void ring_insert(struct timer_ring_t *ring, timer_event_t *te)
+{
+    timer_event_t *ep;
+
+    for (ep = APR_RING_FIRST(ring);
+         ep != APR_RING_SENTINEL(ring, timer_event_t, link);
+         ep = APR_RING_NEXT(ep, link)) {
+        if (ep->when > te->when) {
+            APR_RING_INSERT_BEFORE(ep, te, link);
+            return;
+        }
+    }
+    APR_RING_INSERT_TAIL(ring, te, timer_event_t, link);
+}
+
+static void time_ring(int pending)
+{
+    struct timer_ring_t ring;
+    timer_event_t *te = ap_malloc((pending + RING_INSERTS) * sizeof(*te));
+    apr_uint32_t seed = seed_base;
+    apr_time_t start;
+    int i;
+
+    APR_RING_INIT(&ring, timer_event_t, link);
+    for (i = 0; i < pending; i++) {
+        /* build it already sorted, we're not timing this part */
+        te[i].when = (apr_time_t)i * SPREAD / pending;
+        APR_RING_INSERT_TAIL(&ring, &te[i], timer_event_t, link);
+    }
+
+    start = apr_time_now();
+    for (i = pending; i < pending + RING_INSERTS; i++) {
+        te[i].when = next_when(&seed);
+        ring_insert(&ring, &te[i]);
+    }
+    report("sorted ring: insert", RING_INSERTS, apr_time_now() - start);
+
+    free(te);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *p;
+    apr_thread_t **threads;
+    apr_status_t rv;
+    apr_time_t start;
+    apr_uint32_t seed;
+    int pending = 100000, nthreads = 8, nshards = 8;
+    int i, n;
+
+    if (argc > 1) {
+        pending = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nthreads = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        nshards = atoi(argv[3]);
+    }
+    if (pending < 1 || nthreads < 1 || nshards < 1) {
+        fprintf(stderr, "usage: %s [pending [threads [shards]]]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+    seed_base = (apr_uint32_t)apr_time_now();
+
+    rv = ap_timer_heap_create(&th, nshards, p);
+    if (rv != APR_SUCCESS) {
+        fprintf(stderr, "ap_timer_heap_create failed: %d\n", rv);
+        exit(1);
+    }
+    printf("%d pending timers, %d threads, %d shards\n\n",
+           pending, nthreads, nshards);
+
+    /* 1. single threaded fill */
+    seed = seed_base;
+    start = apr_time_now();
+    for (i = 0; i < pending; i++) {
+        ap_timer_heap_insert(th, next_when(&seed), dummy_cb, NULL);
+    }
+    report("timer heap: insert (1 thread)", pending, apr_time_now() - start);
+
+    /* 2. expire everything, entries go back to the free lists */
+    start = apr_time_now();
+    n = ap_timer_heap_expire(th, SPREAD, release_cb);
+    report("timer heap: expire", n, apr_time_now() - start);
+
+    /* 3. concurrent fill, reusing the free lists */
+    per_thread = pending / nthreads;
+    threads = ap_malloc(nthreads * sizeof(apr_thread_t *));
+    start = apr_time_now();
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_create(&threads[i], NULL, insert_thread,
+                          (void *)(apr_uintptr_t)i, p);
+    }
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_join(&rv, threads[i]);
+    }
+    report("timer heap: insert (all threads)", per_thread * nthreads,
+           apr_time_now() - start);
+
+    /* 4. steady state: expire the earliest tenth, then put them back */
+    start = apr_time_now();
+    n = ap_timer_heap_expire(th, SPREAD / 10, release_cb);
+    for (i = 0; i < n; i++) {
+        ap_timer_heap_insert(th, next_when(&seed), dummy_cb, NULL);
+    }
+    report("timer heap: expire + re-insert", n, apr_time_now() - start);
+    ap_timer_heap_expire(th, SPREAD, release_cb);
+
+    /* 5. the old sorted ring */
+    time_ring(pending);
+
+    free(threads);
+    apr_pool_destroy(p);
+    return 0;
+}